@@ -8,7 +8,13 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <numeric>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace std {
 namespace experimental {
@@ -20,7 +26,11 @@ inline namespace v1 {
 #include "reduce.inl"
 #include "transform.inl"
 #include "transform_reduce.inl"
+#include "compact.inl"
+#include "search.inl"
 #include "sort.inl"
+#include "merge.inl"
+#include "select.inl"
 #include "stablesort.inl"
 
 namespace details {
@@ -233,41 +243,26 @@ bool lexicographical_compare_impl(InputIt1 first1, InputIt1 last1,
   return std::lexicographical_compare(first1, last1, first2, last2, comp);
 }
 
-//
-// Transition function: check Lo first, if Lo is = then pick Hi
-//
-//                  Hi address
-//                  <    =    >
-//               +--------------------
-//             < |  <    <    <
-//               +--------------------
-// Lo address  = |  <    =    >
-//               +--------------------
-//             > |  >    >    >
-//               +--------------------
-//
-//   0: <
-//   1: =
-//   2: >
-//
-//
+// elements neither of which goes before the other
+template<class Compare>
+struct lexicographical_equivalent {
+  Compare comp;
+  template<class T1, class T2>
+  bool operator()(const T1& a, const T2& b) const __CPU__ __HC__ {
+    return !comp(a, b) && !comp(b, a);
+  }
+};
 
-// Note: 1. the comparison needs both operator== and operator< (or a functor),
-//       both of them should be [[hc]]
+// parallel::lexicographical_compare: the first elements which are not
+// equivalent decide, found with the early exit parallel mismatch
 template<class InputIt1, class InputIt2, class Compare>
 bool lexicographical_compare_impl(InputIt1 first1, InputIt1 last1,
                                   InputIt2 first2, InputIt2 last2,
                                   Compare comp,
                                   std::random_access_iterator_tag) {
-  unsigned n1 = std::distance(first1, last1);
-  unsigned n2 = std::distance(first2, last2);
-  unsigned N = std::min(n1, n2);
-
-  // An empty range is lexicographically less than any non-empty range.
-  // Two empty ranges are lexicographically equal.
-  if (N == 0) {
-    return n1 < n2;
-  }
+  const size_t n1 = static_cast<size_t>(std::distance(first1, last1));
+  const size_t n2 = static_cast<size_t>(std::distance(first2, last2));
+  const size_t N = std::min(n1, n2);
 
   // call to std::lexicographical_compare when small data size
   if (N <= details::PARALLELIZE_THRESHOLD) {
@@ -275,19 +270,13 @@ bool lexicographical_compare_impl(InputIt1 first1, InputIt1 last1,
              std::input_iterator_tag{});
   }
 
-  typedef typename std::iterator_traits<InputIt1>::value_type _Tp;
-
-  auto first1_ = n1 <= n2 ? first1 : first2;
-  auto last1_  = n1 <= n2 ?  last1 :  last2;
-  auto first2_ = n1 <= n2 ? first2 : first1;
-
-  // transform_reduce assumes two vectors are the same size,
-  // use the smaller one as the first vector
-  std::vector<int> tmp(N);
-  transform(first1_, last1_, first2_, std::begin(tmp), [comp](const _Tp& a, const _Tp& b) { return comp(a, b) ? 0 : a == b ? 1 : 2;});
-  auto ans = details::reduce_lexi(tmp);
-
-  return ans == 1 ? n1 < n2 : ans == 0;
+  auto m = mismatch_impl(first1, first1 + N, first2, lexicographical_equivalent<Compare>{comp},
+                         std::random_access_iterator_tag{});
+  if (m.first == first1 + N) {
+    // an empty or shorter range is less
+    return n1 < n2;
+  }
+  return comp(*m.first, *m.second);
 }
 
 template<typename InputIt1, typename InputIt2, typename BinaryPredicate>
@@ -309,8 +298,9 @@ bool equal_impl(InputIt1 first1, InputIt1 last1,
     return equal_impl(first1, last1, first2, p, std::input_iterator_tag{});
   }
 
-  return transform_reduce(first1, last1, first2, true,
-                          std::logical_and<bool>(), p);
+  // stops at the first difference
+  return mismatch_impl(first1, last1, first2, p,
+                       std::random_access_iterator_tag{}).first == last1;
 }
 
 
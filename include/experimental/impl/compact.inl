@@ -0,0 +1,537 @@
+#pragma once
+
+namespace details {
+
+#define COMPACT_TILE_SIZE       256
+#define COMPACT_MAX_TILES       1024
+#define HOST_COMPACT_GRAIN      (1 << 16)
+
+// Exclusive scan of size counts (at most COMPACT_TILE_SIZE * COMPACT_TILE_SIZE
+// or so, one per tile of another kernel), in one tile.
+inline void scan_counts_hsa(const hc::array_view<unsigned>& counts, unsigned size) {
+  kernel_launch(COMPACT_TILE_SIZE, [counts, size](hc::tiled_index<1> t_idx) [[hc]] {
+    tile_static unsigned sums[COMPACT_TILE_SIZE];
+    const unsigned l = t_idx.local[0];
+    const unsigned per = (size + COMPACT_TILE_SIZE - 1) / COMPACT_TILE_SIZE;
+    const unsigned begin = l * per < size ? l * per : size;
+    const unsigned end = begin + per < size ? begin + per : size;
+    unsigned sum = 0;
+    for (unsigned i = begin; i < end; ++i) {
+      sum += counts[i];
+    }
+    sums[l] = sum;
+    t_idx.barrier.wait();
+    for (unsigned offset = 1; offset < COMPACT_TILE_SIZE; offset *= 2) {
+      const unsigned other = l >= offset ? sums[l - offset] : 0;
+      t_idx.barrier.wait();
+      sums[l] += other;
+      t_idx.barrier.wait();
+    }
+    sum = sums[l] - sum;
+    for (unsigned i = begin; i < end; ++i) {
+      const unsigned count = counts[i];
+      counts[i] = sum;
+      sum += count;
+    }
+  }, COMPACT_TILE_SIZE);
+}
+
+
+// Flags of the compaction: whether element i of in is kept.
+
+// pred(in[i]), or its negation
+template<typename Predicate, bool Negate>
+struct compact_pred_flag {
+  Predicate pred;
+  template<typename Container>
+  bool operator()(const Container& in, unsigned i) const __CPU__ __HC__ {
+    return pred(in[i]) != Negate;
+  }
+};
+
+// in[i] != value
+template<typename T>
+struct compact_value_flag {
+  T value;
+  template<typename Container>
+  bool operator()(const Container& in, unsigned i) const __CPU__ __HC__ {
+    return !(in[i] == value);
+  }
+};
+
+// first element of a group of equivalent consecutive elements
+template<typename BinaryPredicate>
+struct compact_unique_flag {
+  BinaryPredicate pred;
+  template<typename Container>
+  bool operator()(const Container& in, unsigned i) const __CPU__ __HC__ {
+    return (i == 0) || !pred(in[i - 1], in[i]);
+  }
+};
+
+
+// Stream compaction on the accelerator, in two steps.
+//
+// compact_count_hsa splits [0, N) in contiguous ranges, one per tile, counts
+// the elements kept in each range and scans the counts: offsets[tile] is the
+// number of elements kept before the range of the tile.  Returns the number
+// of elements kept.
+//
+// compact_scatter_hsa then writes the kept elements, in order, to
+// outTrue[0, count) and, with WithFalse, the others, in order, to
+// outFalse[falseBase, falseBase + N - count).  Each range is processed
+// COMPACT_TILE_SIZE elements at a time, in order.
+struct compact_ranges {
+  unsigned numTiles;
+  unsigned rangeSize;
+
+  explicit compact_ranges(unsigned N) {
+    const unsigned chunks = (N + COMPACT_TILE_SIZE - 1) / COMPACT_TILE_SIZE;
+    numTiles = std::max(1u, std::min<unsigned>(chunks, COMPACT_MAX_TILES));
+    rangeSize = (chunks + numTiles - 1) / numTiles * COMPACT_TILE_SIZE;
+  }
+};
+
+template<typename Container, typename Flag>
+unsigned compact_count_hsa(const Container& in, unsigned N, const Flag& flag,
+                           const compact_ranges& ranges,
+                           const hc::array_view<unsigned>& offsets) {
+  const unsigned numTiles = ranges.numTiles;
+  const unsigned rangeSize = ranges.rangeSize;
+  kernel_launch(numTiles * COMPACT_TILE_SIZE,
+                [in, N, flag, numTiles, rangeSize, offsets](hc::tiled_index<1> t_idx) [[hc]] {
+    tile_static unsigned count;
+    const unsigned l = t_idx.local[0];
+    const unsigned begin = t_idx.tile[0] * rangeSize;
+    const unsigned end = begin + rangeSize < N ? begin + rangeSize : N;
+    if (l == 0) {
+      count = 0;
+    }
+    // one more count, 0, gets the total
+    if ((t_idx.tile[0] == 0) && (l == 1)) {
+      offsets[numTiles] = 0;
+    }
+    t_idx.barrier.wait();
+    unsigned kept = 0;
+    for (unsigned i = begin + l; i < end; i += COMPACT_TILE_SIZE) {
+      kept += flag(in, i) ? 1 : 0;
+    }
+    if (kept) {
+      hc::atomic_fetch_add(&count, kept);
+    }
+    t_idx.barrier.wait();
+    if (l == 0) {
+      offsets[t_idx.tile[0]] = count;
+    }
+  }, COMPACT_TILE_SIZE);
+
+  scan_counts_hsa(offsets, numTiles + 1);
+  offsets.synchronize();
+  return offsets[numTiles];
+}
+
+template<bool WithFalse, typename Container, typename Flag, typename TTrue, typename TFalse>
+void compact_scatter_hsa(const Container& in, unsigned N, const Flag& flag,
+                         const compact_ranges& ranges,
+                         const hc::array_view<unsigned>& offsets,
+                         const hc::array_view<TTrue>& outTrue,
+                         const hc::array_view<TFalse>& outFalse, unsigned falseBase) {
+  const unsigned rangeSize = ranges.rangeSize;
+  kernel_launch(ranges.numTiles * COMPACT_TILE_SIZE,
+                [in, N, flag, rangeSize, offsets, outTrue, outFalse, falseBase]
+                (hc::tiled_index<1> t_idx) [[hc]] {
+    tile_static unsigned ranks[COMPACT_TILE_SIZE];
+    tile_static unsigned base;
+    const unsigned l = t_idx.local[0];
+    const unsigned begin = t_idx.tile[0] * rangeSize;
+    const unsigned end = begin + rangeSize < N ? begin + rangeSize : N;
+    if (l == 0) {
+      base = offsets[t_idx.tile[0]];
+    }
+    for (unsigned chunk = begin; chunk < end; chunk += COMPACT_TILE_SIZE) {
+      const unsigned i = chunk + l;
+      const bool kept = (i < end) && flag(in, i);
+      ranks[l] = kept ? 1 : 0;
+      t_idx.barrier.wait();
+      for (unsigned offset = 1; offset < COMPACT_TILE_SIZE; offset *= 2) {
+        const unsigned other = l >= offset ? ranks[l - offset] : 0;
+        t_idx.barrier.wait();
+        ranks[l] += other;
+        t_idx.barrier.wait();
+      }
+      // kept elements before i
+      const unsigned before = base + ranks[l] - (kept ? 1 : 0);
+      if (kept) {
+        outTrue[before] = in[i];
+      } else if (WithFalse && (i < end)) {
+        outFalse[falseBase + i - before] = in[i];
+      }
+      t_idx.barrier.wait();
+      if (l == 0) {
+        base += ranks[COMPACT_TILE_SIZE - 1];
+      }
+      t_idx.barrier.wait();
+    }
+  }, COMPACT_TILE_SIZE);
+}
+
+
+// Stream compaction on the host: each thread flags its range and counts the
+// kept elements, then writes its range where the counts of the threads
+// before it say.  The kept elements go in order to outTrue, and with
+// WithFalse, the others in order to outFalse (or after the kept elements in
+// outTrue with falseAfterTrue).  Returns the number of elements kept.
+template<bool WithFalse, typename TIn, typename TTrue, typename TFalse, typename Flag>
+size_t compact_host(const TIn* in, size_t N, const Flag& flag,
+                    TTrue* outTrue, TFalse* outFalse, bool falseAfterTrue) {
+  const unsigned threads = host_thread_count(N, HOST_COMPACT_GRAIN);
+  const size_t rangeSize = (N + threads - 1) / threads;
+  std::vector<unsigned char> flags(N);
+  std::vector<size_t> offsets(threads + 1, 0);
+  host_launch(threads, [&](unsigned t) {
+    const size_t end = std::min(N, (t + 1) * rangeSize);
+    size_t kept = 0;
+    for (size_t i = t * rangeSize; i < end; ++i) {
+      flags[i] = flag(in, static_cast<unsigned>(i));
+      kept += flags[i];
+    }
+    offsets[t + 1] = kept;
+  });
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  const size_t count = offsets[threads];
+
+  host_launch(threads, [&](unsigned t) {
+    const size_t begin = t * rangeSize;
+    const size_t end = std::min(N, begin + rangeSize);
+    size_t kept = offsets[t];
+    size_t other = begin - offsets[t];
+    for (size_t i = begin; i < end; ++i) {
+      if (flags[i]) {
+        outTrue[kept++] = in[i];
+      } else if (WithFalse && falseAfterTrue) {
+        outTrue[count + other++] = in[i];
+      } else if (WithFalse) {
+        outFalse[other++] = in[i];
+      }
+    }
+  });
+  return count;
+}
+
+// Compaction of [first, first + N) to d_first, and the elements not kept to
+// d_false with WithFalse.  Returns the number of elements kept.
+template<bool WithFalse, typename TIn, typename TTrue, typename TFalse, typename Flag>
+size_t compact_copy(const TIn* first, size_t N, const Flag& flag, TTrue* d_first, TFalse* d_false) {
+  if (!use_hsa()) {
+    return compact_host<WithFalse>(first, N, flag, d_first, d_false, false);
+  }
+
+  const unsigned n = static_cast<unsigned>(N);
+  hc::array_view<const TIn> in_(hc::extent<1>(n), first);
+  compact_ranges ranges(n);
+  hc::array_view<unsigned> offsets((hc::extent<1>(ranges.numTiles + 1)));
+  const unsigned count = compact_count_hsa(in_, n, flag, ranges, offsets);
+
+  // the outputs only have room for their elements
+  hc::array_view<TTrue> outTrue = count
+                                ? hc::array_view<TTrue>(hc::extent<1>(count), d_first)
+                                : hc::array_view<TTrue>(hc::extent<1>(1));
+  hc::array_view<TFalse> outFalse = (WithFalse && count < n)
+                                  ? hc::array_view<TFalse>(hc::extent<1>(n - count), d_false)
+                                  : hc::array_view<TFalse>(hc::extent<1>(1));
+  outTrue.discard_data();
+  outFalse.discard_data();
+  compact_scatter_hsa<WithFalse>(in_, n, flag, ranges, offsets, outTrue, outFalse, 0);
+  if (count) {
+    outTrue.synchronize();
+  }
+  if (WithFalse && count < n) {
+    outFalse.synchronize();
+  }
+  return count;
+}
+
+// In place compaction of [first, first + N): the kept elements move to the
+// front, in order, and with WithFalse the others follow them, in order.
+// Returns the number of elements kept.
+template<bool WithFalse, typename T, typename Flag>
+size_t compact_in_place(T* first, size_t N, const Flag& flag) {
+  if (!use_hsa()) {
+    std::vector<T> tmp(N);
+    const size_t count = compact_host<WithFalse>(first, N, flag, tmp.data(), tmp.data(), true);
+    const size_t moved = WithFalse ? N : count;
+    const unsigned threads = host_thread_count(moved, HOST_COMPACT_GRAIN);
+    host_launch(threads, [&](unsigned t) {
+      const size_t begin = std::min(moved, moved * t / threads);
+      const size_t end = std::min(moved, moved * (t + 1) / threads);
+      std::move(tmp.begin() + begin, tmp.begin() + end, first + begin);
+    });
+    return count;
+  }
+
+  const unsigned n = static_cast<unsigned>(N);
+  hc::array_view<T> in_(hc::extent<1>(n), first);
+  compact_ranges ranges(n);
+  hc::array_view<unsigned> offsets((hc::extent<1>(ranges.numTiles + 1)));
+  const unsigned count = compact_count_hsa(in_, n, flag, ranges, offsets);
+  if (count == n) {
+    return count;
+  }
+
+  hc::array_view<T> tmp((hc::extent<1>(n)));
+  compact_scatter_hsa<WithFalse>(in_, n, flag, ranges, offsets, tmp, tmp, count);
+  const unsigned moved = WithFalse ? n : count;
+  if (moved) {
+    kernel_launch(moved, [in_, tmp](hc::index<1> idx) [[hc]] {
+      in_[idx] = tmp[idx];
+    });
+  }
+  in_.synchronize();
+  return count;
+}
+
+
+// copy_if
+// std::copy_if forwarder
+template<typename InputIterator, typename OutputIterator, typename Predicate>
+OutputIterator copy_if_impl(InputIterator first, InputIterator last,
+                            OutputIterator d_first, Predicate pred,
+                            std::input_iterator_tag) {
+  return std::copy_if(first, last, d_first, pred);
+}
+
+// parallel::copy_if
+template<typename InputIterator, typename OutputIterator, typename Predicate>
+OutputIterator copy_if_impl(InputIterator first, InputIterator last,
+                            OutputIterator d_first, Predicate pred,
+                            std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return copy_if_impl(first, last, d_first, pred, std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  auto d_first_ = utils::get_pointer(d_first);
+  return d_first + compact_copy<false>(first_, N, compact_pred_flag<Predicate, false>{pred},
+                                       d_first_, d_first_);
+}
+
+// remove_copy_if
+// std::remove_copy_if forwarder
+template<typename InputIterator, typename OutputIterator, typename Predicate>
+OutputIterator remove_copy_if_impl(InputIterator first, InputIterator last,
+                                   OutputIterator d_first, Predicate pred,
+                                   std::input_iterator_tag) {
+  return std::remove_copy_if(first, last, d_first, pred);
+}
+
+// parallel::remove_copy_if
+template<typename InputIterator, typename OutputIterator, typename Predicate>
+OutputIterator remove_copy_if_impl(InputIterator first, InputIterator last,
+                                   OutputIterator d_first, Predicate pred,
+                                   std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return remove_copy_if_impl(first, last, d_first, pred, std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  auto d_first_ = utils::get_pointer(d_first);
+  return d_first + compact_copy<false>(first_, N, compact_pred_flag<Predicate, true>{pred},
+                                       d_first_, d_first_);
+}
+
+// remove_copy
+// std::remove_copy forwarder
+template<typename InputIterator, typename OutputIterator, typename T>
+OutputIterator remove_copy_impl(InputIterator first, InputIterator last,
+                                OutputIterator d_first, const T& value,
+                                std::input_iterator_tag) {
+  return std::remove_copy(first, last, d_first, value);
+}
+
+// parallel::remove_copy
+template<typename InputIterator, typename OutputIterator, typename T>
+OutputIterator remove_copy_impl(InputIterator first, InputIterator last,
+                                OutputIterator d_first, const T& value,
+                                std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return remove_copy_impl(first, last, d_first, value, std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  auto d_first_ = utils::get_pointer(d_first);
+  return d_first + compact_copy<false>(first_, N, compact_value_flag<T>{value},
+                                       d_first_, d_first_);
+}
+
+// remove_if
+// std::remove_if forwarder
+template<typename ForwardIterator, typename Predicate>
+ForwardIterator remove_if_impl(ForwardIterator first, ForwardIterator last,
+                               Predicate pred,
+                               std::input_iterator_tag) {
+  return std::remove_if(first, last, pred);
+}
+
+// parallel::remove_if
+template<typename ForwardIterator, typename Predicate>
+ForwardIterator remove_if_impl(ForwardIterator first, ForwardIterator last,
+                               Predicate pred,
+                               std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return remove_if_impl(first, last, pred, std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  return first + compact_in_place<false>(first_, N, compact_pred_flag<Predicate, true>{pred});
+}
+
+// remove
+// std::remove forwarder
+template<typename ForwardIterator, typename T>
+ForwardIterator remove_impl(ForwardIterator first, ForwardIterator last,
+                            const T& value,
+                            std::input_iterator_tag) {
+  return std::remove(first, last, value);
+}
+
+// parallel::remove
+template<typename ForwardIterator, typename T>
+ForwardIterator remove_impl(ForwardIterator first, ForwardIterator last,
+                            const T& value,
+                            std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return remove_impl(first, last, value, std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  return first + compact_in_place<false>(first_, N, compact_value_flag<T>{value});
+}
+
+// unique
+// std::unique forwarder
+template<typename ForwardIterator, typename BinaryPredicate>
+ForwardIterator unique_impl(ForwardIterator first, ForwardIterator last,
+                            BinaryPredicate p,
+                            std::input_iterator_tag) {
+  return std::unique(first, last, p);
+}
+
+// parallel::unique
+template<typename ForwardIterator, typename BinaryPredicate>
+ForwardIterator unique_impl(ForwardIterator first, ForwardIterator last,
+                            BinaryPredicate p,
+                            std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return unique_impl(first, last, p, std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  return first + compact_in_place<false>(first_, N, compact_unique_flag<BinaryPredicate>{p});
+}
+
+// unique_copy
+// std::unique_copy forwarder
+template<typename InputIterator, typename OutputIterator, typename BinaryPredicate>
+OutputIterator unique_copy_impl(InputIterator first, InputIterator last,
+                                OutputIterator d_first, BinaryPredicate p,
+                                std::input_iterator_tag) {
+  return std::unique_copy(first, last, d_first, p);
+}
+
+// parallel::unique_copy
+template<typename InputIterator, typename OutputIterator, typename BinaryPredicate>
+OutputIterator unique_copy_impl(InputIterator first, InputIterator last,
+                                OutputIterator d_first, BinaryPredicate p,
+                                std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return unique_copy_impl(first, last, d_first, p, std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  auto d_first_ = utils::get_pointer(d_first);
+  return d_first + compact_copy<false>(first_, N, compact_unique_flag<BinaryPredicate>{p},
+                                       d_first_, d_first_);
+}
+
+// partition_copy
+// std::partition_copy forwarder
+template<typename InputIterator, typename OutputIterator1, typename OutputIterator2,
+         typename Predicate>
+std::pair<OutputIterator1, OutputIterator2>
+partition_copy_impl(InputIterator first, InputIterator last,
+                    OutputIterator1 d_first_true, OutputIterator2 d_first_false,
+                    Predicate pred,
+                    std::input_iterator_tag) {
+  return std::partition_copy(first, last, d_first_true, d_first_false, pred);
+}
+
+// parallel::partition_copy
+template<typename InputIterator, typename OutputIterator1, typename OutputIterator2,
+         typename Predicate>
+std::pair<OutputIterator1, OutputIterator2>
+partition_copy_impl(InputIterator first, InputIterator last,
+                    OutputIterator1 d_first_true, OutputIterator2 d_first_false,
+                    Predicate pred,
+                    std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return partition_copy_impl(first, last, d_first_true, d_first_false, pred,
+                               std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  auto d_true_ = utils::get_pointer(d_first_true);
+  auto d_false_ = utils::get_pointer(d_first_false);
+  const size_t count = compact_copy<true>(first_, N, compact_pred_flag<Predicate, false>{pred},
+                                          d_true_, d_false_);
+  return std::make_pair(d_first_true + count, d_first_false + (N - count));
+}
+
+// stable_partition, and partition which is stable too
+// std::stable_partition forwarder
+template<typename BidirIterator, typename Predicate>
+BidirIterator stable_partition_impl(BidirIterator first, BidirIterator last,
+                                    Predicate pred,
+                                    std::input_iterator_tag) {
+  return std::stable_partition(first, last, pred);
+}
+
+// parallel::stable_partition
+template<typename BidirIterator, typename Predicate>
+BidirIterator stable_partition_impl(BidirIterator first, BidirIterator last,
+                                    Predicate pred,
+                                    std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return stable_partition_impl(first, last, pred, std::input_iterator_tag{});
+  }
+
+  auto first_ = utils::get_pointer(first);
+  return first + compact_in_place<true>(first_, N, compact_pred_flag<Predicate, false>{pred});
+}
+
+// partition
+// std::partition forwarder
+template<typename ForwardIterator, typename Predicate>
+ForwardIterator partition_impl(ForwardIterator first, ForwardIterator last,
+                               Predicate pred,
+                               std::input_iterator_tag) {
+  return std::partition(first, last, pred);
+}
+
+// parallel::partition
+template<typename ForwardIterator, typename Predicate>
+ForwardIterator partition_impl(ForwardIterator first, ForwardIterator last,
+                               Predicate pred,
+                               std::random_access_iterator_tag tag) {
+  return stable_partition_impl(first, last, pred, tag);
+}
+
+} // namespace details
@@ -12,4 +12,54 @@ inline void kernel_launch(int N, Kernel k, int tile = 0) {
     }
 }
 
+// Fences ordering the global memory accesses of a work-item with those of the
+// other tiles of a kernel: release before an atomic publishes data written
+// before it, acquire after an atomic showed that data to be ready.
+// hc::global_memory_fence is tile scoped (and not implemented); these are
+// system scoped, so they cover all the tiles of the device.
+inline void release_fence() __CPU__ __HC__ {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+inline void acquire_fence() __CPU__ __HC__ {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+// true when the kernels run on an HSA accelerator.  Otherwise the algorithms
+// which have one use their host implementation (CPU backend).
+inline bool use_hsa() {
+    return hc::accelerator().is_hsa_accelerator();
+}
+
+// number of host threads to process N elements, each thread gets at least
+// grain elements
+inline unsigned host_thread_count(size_t N, size_t grain) {
+    size_t count = std::max(1u, std::thread::hardware_concurrency());
+    count = std::min(count, N / std::max(grain, size_t(1)));
+    return count ? static_cast<unsigned>(count) : 1;
+}
+
+// joins the threads it holds when it goes out of scope, so that they are
+// not destroyed joinable when the calling thread throws
+struct host_threads {
+    std::vector<std::thread> threads;
+
+    ~host_threads() {
+        for (auto& th : threads) {
+            th.join();
+        }
+    }
+};
+
+// host invocation: f(t) for t in [0, count), f(0) runs on the calling thread.
+// An exception thrown by f(0) is rethrown once the other threads are done.
+template<typename Function>
+inline void host_launch(unsigned count, Function f) {
+    host_threads guard;
+    for (unsigned t = 1; t < count; ++t) {
+        guard.threads.emplace_back(f, t);
+    }
+    f(0);
+}
+
 } // namespace details
@@ -0,0 +1,419 @@
+#pragma once
+
+namespace details {
+
+#define SET_PATH_ITEMS          32
+#define HOST_MERGE_GRAIN        (1 << 16)
+
+// Elements of a merge walk kept by a set operation: those only in a, those
+// only in b, and those in both (the one of a)
+#define SET_KEEP_A              1
+#define SET_KEEP_B              2
+#define SET_KEEP_BOTH           4
+
+// Write the elements [diag, diagEnd) of the merge of a[0, n1) and b[0, n2)
+// to dst[diag, diagEnd).  The elements of a go before the equal elements of
+// b.
+template<typename A, typename B, typename Out, typename Compare>
+inline void merge_copy(const A& a, unsigned n1, const B& b, unsigned n2, const Out& dst,
+                       unsigned diag, unsigned diagEnd, const Compare& comp) __CPU__ __HC__ {
+  unsigned i = merge_path(a, 0, n1, b, 0, n2, diag, comp);
+  unsigned j = diag - i;
+  for (unsigned k = diag; k < diagEnd; ++k) {
+    if ((j >= n2) || ((i < n1) && !comp(b[j], a[i]))) {
+      dst[k] = a[i++];
+    } else {
+      dst[k] = b[j++];
+    }
+  }
+}
+
+// Merge of a[0, n1) and b[0, n2) to dst: every work-item, or host thread,
+// writes an equal slice of the output from where the merge path crosses it.
+template<typename TA, typename TB, typename TOut, typename Compare>
+void merge_two(const TA* a, unsigned n1, const TB* b, unsigned n2, TOut* dst,
+               const Compare& comp) {
+  const unsigned N = n1 + n2;
+  if (!use_hsa()) {
+    const unsigned threads = host_thread_count(N, HOST_MERGE_GRAIN);
+    host_launch(threads, [&](unsigned t) {
+      merge_copy(a, n1, b, n2, dst,
+                 static_cast<unsigned>(uint64_t(N) * t / threads),
+                 static_cast<unsigned>(uint64_t(N) * (t + 1) / threads), comp);
+    });
+    return;
+  }
+
+  hc::array_view<const TA> av(hc::extent<1>(n1), a);
+  hc::array_view<const TB> bv(hc::extent<1>(n2), b);
+  hc::array_view<TOut> dv(hc::extent<1>(N), dst);
+  dv.discard_data();
+  const unsigned items = (N + MERGE_PATH_ITEMS - 1) / MERGE_PATH_ITEMS;
+  kernel_launch(items, [av, n1, bv, n2, dv, N, comp](hc::index<1> idx) [[hc]] {
+    const unsigned diag = idx[0] * MERGE_PATH_ITEMS;
+    const unsigned diagEnd = diag + MERGE_PATH_ITEMS < N ? diag + MERGE_PATH_ITEMS : N;
+    merge_copy(av, n1, bv, n2, dv, diag, diagEnd, comp);
+  });
+  dv.synchronize();
+}
+
+// Merge of the runs data[0, mid) and data[mid, N) in place, through a
+// temporary.
+template<typename T, typename Compare>
+void merge_in_place(T* data, unsigned mid, unsigned N, const Compare& comp) {
+  if (!use_hsa()) {
+    std::vector<T> tmp(N);
+    T* tmp_ = tmp.data();
+    const unsigned threads = host_thread_count(N, HOST_MERGE_GRAIN);
+    host_launch(threads, [&](unsigned t) {
+      const unsigned diag = static_cast<unsigned>(uint64_t(N) * t / threads);
+      const unsigned diagEnd = static_cast<unsigned>(uint64_t(N) * (t + 1) / threads);
+      merge_path_copy<false>(data, tmp_, data, tmp_, 0, mid, mid, N,
+                             diag, diagEnd, diag, comp);
+    });
+    host_launch(threads, [&](unsigned t) {
+      const unsigned begin = static_cast<unsigned>(uint64_t(N) * t / threads);
+      const unsigned end = static_cast<unsigned>(uint64_t(N) * (t + 1) / threads);
+      std::move(tmp_ + begin, tmp_ + end, data + begin);
+    });
+    return;
+  }
+
+  hc::array_view<T> dv(hc::extent<1>(N), data);
+  hc::array_view<T> tmp((hc::extent<1>(N)));
+  const unsigned items = (N + MERGE_PATH_ITEMS - 1) / MERGE_PATH_ITEMS;
+  kernel_launch(items, [dv, tmp, mid, N, comp](hc::index<1> idx) [[hc]] {
+    const unsigned diag = idx[0] * MERGE_PATH_ITEMS;
+    const unsigned diagEnd = diag + MERGE_PATH_ITEMS < N ? diag + MERGE_PATH_ITEMS : N;
+    merge_path_copy<false>(dv, tmp, dv, tmp, 0, mid, mid, N, diag, diagEnd, diag, comp);
+  });
+  kernel_launch(N, [dv, tmp](hc::index<1> idx) [[hc]] {
+    dv[idx] = tmp[idx];
+  });
+  dv.synchronize();
+}
+
+
+// Start (i, j) of the slice of a set operation at diagonal diag of the merge
+// of a[0, n1) and b[0, n2): the merge path, moved back to the first elements
+// equivalent to the next element of the merge.  The elements which match
+// each other stay in the same slice, and the walk of the slice starts as the
+// sequential walk would reach it.  A long run of equivalent elements makes a
+// long slice.
+template<typename A, typename B, typename Compare>
+inline void set_split(const A& a, unsigned n1, const B& b, unsigned n2, unsigned diag,
+                      const Compare& comp, unsigned& i, unsigned& j) __CPU__ __HC__ {
+  i = merge_path(a, 0, n1, b, 0, n2, diag, comp);
+  j = diag - i;
+  if ((i < n1) && ((j >= n2) || !comp(b[j], a[i]))) {
+    const unsigned iStart = sort_bound(a, 0, i, a[i], comp, false);
+    j = sort_bound(b, 0, j, a[i], comp, false);
+    i = iStart;
+  } else if (j < n2) {
+    i = sort_bound(a, 0, i, b[j], comp, false);
+    j = sort_bound(b, 0, j, b[j], comp, false);
+  }
+}
+
+template<bool Write>
+struct set_emit {
+  template<typename Out, typename T>
+  static void emit(const Out& dst, unsigned k, const T& v) __CPU__ __HC__ {
+    dst[k] = v;
+  }
+};
+
+template<>
+struct set_emit<false> {
+  template<typename Out, typename T>
+  static void emit(const Out&, unsigned, const T&) __CPU__ __HC__ {}
+};
+
+// Sequential walk of a slice of a set operation: returns the number of
+// elements kept, and with Write, writes them to dst from out.
+template<int Keep, bool Write, typename A, typename B, typename Out, typename Compare>
+inline unsigned set_walk(const A& a, unsigned i, unsigned iEnd,
+                         const B& b, unsigned j, unsigned jEnd,
+                         const Out& dst, unsigned out, const Compare& comp) __CPU__ __HC__ {
+  unsigned count = 0;
+  while ((i < iEnd) || (j < jEnd)) {
+    if ((j >= jEnd) || ((i < iEnd) && comp(a[i], b[j]))) {
+      if (Keep & SET_KEEP_A) {
+        set_emit<Write>::emit(dst, out + count++, a[i]);
+      }
+      ++i;
+    } else if ((i >= iEnd) || comp(b[j], a[i])) {
+      if (Keep & SET_KEEP_B) {
+        set_emit<Write>::emit(dst, out + count++, b[j]);
+      }
+      ++j;
+    } else {
+      if (Keep & SET_KEEP_BOTH) {
+        set_emit<Write>::emit(dst, out + count++, a[i]);
+      }
+      ++i;
+      ++j;
+    }
+  }
+  return count;
+}
+
+// Set operation on a[0, n1) and b[0, n2), in two passes over equal slices of
+// the merge: the first counts the elements every slice keeps, the counts are
+// scanned, then with Write the second writes every slice where its count
+// says.  Returns the number of elements kept.
+template<int Keep, bool Write, typename TA, typename TB, typename TOut, typename Compare>
+size_t set_operation(const TA* a, unsigned n1, const TB* b, unsigned n2, TOut* dst,
+                     const Compare& comp) {
+  const unsigned N = n1 + n2;
+  // the accelerator needs both ranges
+  if (!use_hsa() || (n1 == 0) || (n2 == 0)) {
+    const unsigned threads = host_thread_count(N, HOST_MERGE_GRAIN);
+    std::vector<unsigned> splitA(threads + 1, 0), splitB(threads + 1, 0);
+    std::vector<size_t> offsets(threads + 1, 0);
+    host_launch(threads, [&](unsigned t) {
+      unsigned i, j;
+      set_split(a, n1, b, n2, static_cast<unsigned>(uint64_t(N) * t / threads), comp, i, j);
+      set_split(a, n1, b, n2, static_cast<unsigned>(uint64_t(N) * (t + 1) / threads), comp,
+                splitA[t + 1], splitB[t + 1]);
+      offsets[t + 1] = set_walk<Keep, false>(a, i, splitA[t + 1], b, j, splitB[t + 1],
+                                             dst, 0, comp);
+    });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    if (Write) {
+      host_launch(threads, [&](unsigned t) {
+        TOut* out = dst + offsets[t];
+        set_walk<Keep, Write>(a, splitA[t], splitA[t + 1], b, splitB[t], splitB[t + 1],
+                              out, 0, comp);
+      });
+    }
+    return offsets[threads];
+  }
+
+  hc::array_view<const TA> av(hc::extent<1>(n1), a);
+  hc::array_view<const TB> bv(hc::extent<1>(n2), b);
+  const unsigned slices = (N + SET_PATH_ITEMS - 1) / SET_PATH_ITEMS;
+  hc::array_view<unsigned> offsets((hc::extent<1>(slices + 1)));
+  kernel_launch(slices, [av, n1, bv, n2, N, offsets, slices, comp](hc::index<1> idx) [[hc]] {
+    const unsigned k = idx[0];
+    const unsigned diagEnd = (k + 1) * SET_PATH_ITEMS < N ? (k + 1) * SET_PATH_ITEMS : N;
+    unsigned i, j, iEnd, jEnd;
+    set_split(av, n1, bv, n2, k * SET_PATH_ITEMS, comp, i, j);
+    set_split(av, n1, bv, n2, diagEnd, comp, iEnd, jEnd);
+    offsets[k] = set_walk<Keep, false>(av, i, iEnd, bv, j, jEnd, offsets, 0, comp);
+    // one more count, 0, gets the total
+    if (k == 0) {
+      offsets[slices] = 0;
+    }
+  });
+  scan_counts_hsa(offsets, slices + 1);
+  offsets.synchronize();
+  const unsigned count = offsets[slices];
+  if (!Write || (count == 0)) {
+    return count;
+  }
+
+  hc::array_view<TOut> dv(hc::extent<1>(count), dst);
+  dv.discard_data();
+  kernel_launch(slices, [av, n1, bv, n2, N, offsets, dv, comp](hc::index<1> idx) [[hc]] {
+    const unsigned k = idx[0];
+    const unsigned diagEnd = (k + 1) * SET_PATH_ITEMS < N ? (k + 1) * SET_PATH_ITEMS : N;
+    unsigned i, j, iEnd, jEnd;
+    set_split(av, n1, bv, n2, k * SET_PATH_ITEMS, comp, i, j);
+    set_split(av, n1, bv, n2, diagEnd, comp, iEnd, jEnd);
+    set_walk<Keep, Write>(av, i, iEnd, bv, j, jEnd, dv, offsets[k], comp);
+  });
+  dv.synchronize();
+  return count;
+}
+
+
+// merge
+// std::merge forwarder
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt merge_impl(InputIt1 first1, InputIt1 last1,
+                    InputIt2 first2, InputIt2 last2,
+                    OutputIt d_first, Compare comp,
+                    std::input_iterator_tag) {
+  return std::merge(first1, last1, first2, last2, d_first, comp);
+}
+
+// parallel::merge
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt merge_impl(InputIt1 first1, InputIt1 last1,
+                    InputIt2 first2, InputIt2 last2,
+                    OutputIt d_first, Compare comp,
+                    std::random_access_iterator_tag) {
+  const size_t n1 = static_cast<size_t>(std::distance(first1, last1));
+  const size_t n2 = static_cast<size_t>(std::distance(first2, last2));
+  if ((n1 + n2 <= details::PARALLELIZE_THRESHOLD) || (n1 == 0) || (n2 == 0)) {
+    return merge_impl(first1, last1, first2, last2, d_first, comp,
+                      std::input_iterator_tag{});
+  }
+
+  merge_two(utils::get_pointer(first1), static_cast<unsigned>(n1),
+            utils::get_pointer(first2), static_cast<unsigned>(n2),
+            utils::get_pointer(d_first), comp);
+  return d_first + (n1 + n2);
+}
+
+// inplace_merge
+// std::inplace_merge forwarder
+template<typename BidirIt, typename Compare>
+void inplace_merge_impl(BidirIt first, BidirIt middle, BidirIt last,
+                        Compare comp,
+                        std::input_iterator_tag) {
+  std::inplace_merge(first, middle, last, comp);
+}
+
+// parallel::inplace_merge
+template<typename BidirIt, typename Compare>
+void inplace_merge_impl(BidirIt first, BidirIt middle, BidirIt last,
+                        Compare comp,
+                        std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  const size_t mid = static_cast<size_t>(std::distance(first, middle));
+  if ((N <= details::PARALLELIZE_THRESHOLD) || (mid == 0) || (mid == N)) {
+    return inplace_merge_impl(first, middle, last, comp, std::input_iterator_tag{});
+  }
+
+  merge_in_place(utils::get_pointer(first), static_cast<unsigned>(mid),
+                 static_cast<unsigned>(N), comp);
+}
+
+// set_union, set_intersection, set_difference and set_symmetric_difference,
+// on random access iterators
+template<int Keep, typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_operation_impl(InputIt1 first1, InputIt1 last1,
+                            InputIt2 first2, InputIt2 last2,
+                            OutputIt d_first, Compare comp) {
+  const size_t n1 = static_cast<size_t>(std::distance(first1, last1));
+  const size_t n2 = static_cast<size_t>(std::distance(first2, last2));
+  return d_first + set_operation<Keep, true>(utils::get_pointer(first1), static_cast<unsigned>(n1),
+                                             utils::get_pointer(first2), static_cast<unsigned>(n2),
+                                             utils::get_pointer(d_first), comp);
+}
+
+// set_union
+// std::set_union forwarder
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_union_impl(InputIt1 first1, InputIt1 last1,
+                        InputIt2 first2, InputIt2 last2,
+                        OutputIt d_first, Compare comp,
+                        std::input_iterator_tag) {
+  return std::set_union(first1, last1, first2, last2, d_first, comp);
+}
+
+// parallel::set_union
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_union_impl(InputIt1 first1, InputIt1 last1,
+                        InputIt2 first2, InputIt2 last2,
+                        OutputIt d_first, Compare comp,
+                        std::random_access_iterator_tag) {
+  if (std::distance(first1, last1) + std::distance(first2, last2) <= details::PARALLELIZE_THRESHOLD) {
+    return set_union_impl(first1, last1, first2, last2, d_first, comp,
+                          std::input_iterator_tag{});
+  }
+  return set_operation_impl<SET_KEEP_A | SET_KEEP_B | SET_KEEP_BOTH>(first1, last1, first2, last2,
+                                                                     d_first, comp);
+}
+
+// set_intersection
+// std::set_intersection forwarder
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_intersection_impl(InputIt1 first1, InputIt1 last1,
+                               InputIt2 first2, InputIt2 last2,
+                               OutputIt d_first, Compare comp,
+                               std::input_iterator_tag) {
+  return std::set_intersection(first1, last1, first2, last2, d_first, comp);
+}
+
+// parallel::set_intersection
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_intersection_impl(InputIt1 first1, InputIt1 last1,
+                               InputIt2 first2, InputIt2 last2,
+                               OutputIt d_first, Compare comp,
+                               std::random_access_iterator_tag) {
+  if (std::distance(first1, last1) + std::distance(first2, last2) <= details::PARALLELIZE_THRESHOLD) {
+    return set_intersection_impl(first1, last1, first2, last2, d_first, comp,
+                                 std::input_iterator_tag{});
+  }
+  return set_operation_impl<SET_KEEP_BOTH>(first1, last1, first2, last2, d_first, comp);
+}
+
+// set_difference
+// std::set_difference forwarder
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_difference_impl(InputIt1 first1, InputIt1 last1,
+                             InputIt2 first2, InputIt2 last2,
+                             OutputIt d_first, Compare comp,
+                             std::input_iterator_tag) {
+  return std::set_difference(first1, last1, first2, last2, d_first, comp);
+}
+
+// parallel::set_difference
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_difference_impl(InputIt1 first1, InputIt1 last1,
+                             InputIt2 first2, InputIt2 last2,
+                             OutputIt d_first, Compare comp,
+                             std::random_access_iterator_tag) {
+  if (std::distance(first1, last1) + std::distance(first2, last2) <= details::PARALLELIZE_THRESHOLD) {
+    return set_difference_impl(first1, last1, first2, last2, d_first, comp,
+                               std::input_iterator_tag{});
+  }
+  return set_operation_impl<SET_KEEP_A>(first1, last1, first2, last2, d_first, comp);
+}
+
+// set_symmetric_difference
+// std::set_symmetric_difference forwarder
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_symmetric_difference_impl(InputIt1 first1, InputIt1 last1,
+                                       InputIt2 first2, InputIt2 last2,
+                                       OutputIt d_first, Compare comp,
+                                       std::input_iterator_tag) {
+  return std::set_symmetric_difference(first1, last1, first2, last2, d_first, comp);
+}
+
+// parallel::set_symmetric_difference
+template<typename InputIt1, typename InputIt2, typename OutputIt, typename Compare>
+OutputIt set_symmetric_difference_impl(InputIt1 first1, InputIt1 last1,
+                                       InputIt2 first2, InputIt2 last2,
+                                       OutputIt d_first, Compare comp,
+                                       std::random_access_iterator_tag) {
+  if (std::distance(first1, last1) + std::distance(first2, last2) <= details::PARALLELIZE_THRESHOLD) {
+    return set_symmetric_difference_impl(first1, last1, first2, last2, d_first, comp,
+                                         std::input_iterator_tag{});
+  }
+  return set_operation_impl<SET_KEEP_A | SET_KEEP_B>(first1, last1, first2, last2, d_first, comp);
+}
+
+// includes
+// std::includes forwarder
+template<typename InputIt1, typename InputIt2, typename Compare>
+bool includes_impl(InputIt1 first1, InputIt1 last1,
+                   InputIt2 first2, InputIt2 last2,
+                   Compare comp,
+                   std::input_iterator_tag) {
+  return std::includes(first1, last1, first2, last2, comp);
+}
+
+// parallel::includes: no element is only in the second range
+template<typename InputIt1, typename InputIt2, typename Compare>
+bool includes_impl(InputIt1 first1, InputIt1 last1,
+                   InputIt2 first2, InputIt2 last2,
+                   Compare comp,
+                   std::random_access_iterator_tag) {
+  const size_t n1 = static_cast<size_t>(std::distance(first1, last1));
+  const size_t n2 = static_cast<size_t>(std::distance(first2, last2));
+  if ((n1 + n2 <= details::PARALLELIZE_THRESHOLD) || (n2 > n1)) {
+    return includes_impl(first1, last1, first2, last2, comp, std::input_iterator_tag{});
+  }
+
+  // nothing is written
+  typedef typename std::iterator_traits<InputIt1>::value_type _Tp;
+  return set_operation<SET_KEEP_B, false>(utils::get_pointer(first1), static_cast<unsigned>(n1),
+                                          utils::get_pointer(first2), static_cast<unsigned>(n2),
+                                          static_cast<_Tp*>(nullptr), comp) == 0;
+}
+
+} // namespace details
@@ -13,96 +13,133 @@ T reduce_impl(InputIterator first, InputIterator last,
   return std::accumulate(first, last, init, binary_op);
 }
 
-#define REDUCE_WAVEFRONT_SIZE 512
-#define _REDUCE_STEP(_LENGTH, _IDX, _W) \
-if ((_IDX < _W) && ((_IDX + _W) < _LENGTH)) {\
-	T mine = scratch[_IDX]; \
-	T other = scratch[_IDX + _W]; \
-	scratch[_IDX] = binary_op(mine, other); \
-}\
+#define REDUCE_TILE_SIZE        256
+#define REDUCE_TILES_PER_CU     8
+#define HOST_REDUCE_GRAIN       (1 << 15)
+
+// the elements themselves, for reduce and the scans
+struct reduce_identity {
+  template<typename U>
+  const U& operator()(const U& x) const __CPU__ __HC__ {
+    return x;
+  }
+};
+
+// Tree reduction of scratch[0, count) in a tile, to scratch[0]
+template<typename T, typename BinaryOperation>
+inline void reduce_tile(T* scratch, unsigned count, const BinaryOperation& binary_op,
+                        const hc::tiled_index<1>& t_idx) __HC__ {
+  const unsigned l = t_idx.local[0];
+  for (unsigned w = REDUCE_TILE_SIZE / 2; w > 0; w /= 2) {
+    if ((l < w) && (l + w < count)) {
+      scratch[l] = binary_op(scratch[l], scratch[l + w]);
+    }
     t_idx.barrier.wait();
+  }
+}
 
-int reduce_lexi(std::vector<int>& v) {
-
-    const int N = static_cast<int>(v.size());
-    auto binary_op = [](const int& a, const int& b) { return a == 1 ? b : a; };
-    // call to std::accumulate when small data size
-    if (N <= details::PARALLELIZE_THRESHOLD) {
-        return reduce_impl(std::begin(v), std::end(v), 1, binary_op, std::input_iterator_tag{});
+// Reduction on the accelerator, in one kernel.  The number of tiles follows
+// the compute units of the device: each tile reduces a contiguous range, one
+// element per work-item at a time, and writes its partial result; the last
+// tile to finish, which takes the last ticket, reduces the partial results
+// and init.
+template<typename T, typename TIn, typename UnaryOperation, typename BinaryOperation>
+T reduce_hsa(const TIn* first, unsigned N, T init,
+             const UnaryOperation& unary_op, const BinaryOperation& binary_op) {
+  const unsigned chunks = (N + REDUCE_TILE_SIZE - 1) / REDUCE_TILE_SIZE;
+  const unsigned cus = std::max(1u, hc::accelerator().get_cu_count());
+  const unsigned maxTiles = std::max(1u, std::min(chunks, cus * REDUCE_TILES_PER_CU));
+  const unsigned rangeSize = (chunks + maxTiles - 1) / maxTiles * REDUCE_TILE_SIZE;
+  // no tile is left without elements
+  const unsigned numTiles = (N + rangeSize - 1) / rangeSize;
+
+  hc::array_view<const TIn> in_(hc::extent<1>(N), first);
+  hc::array_view<T> partials((hc::extent<1>(numTiles)));
+  unsigned ticket = 0;
+  hc::array_view<unsigned> tickets(hc::extent<1>(1), &ticket);
+  std::vector<T> r(1, init);
+  hc::array_view<T> result(hc::extent<1>(1), r);
+  kernel_launch(numTiles * REDUCE_TILE_SIZE,
+                [in_, N, rangeSize, numTiles, partials, tickets, result, unary_op, binary_op]
+                (hc::tiled_index<1> t_idx) [[hc]] {
+    tile_static T scratch[REDUCE_TILE_SIZE];
+    tile_static bool last;
+    const unsigned l = t_idx.local[0];
+    const unsigned begin = t_idx.tile[0] * rangeSize;
+    const unsigned end = begin + rangeSize < N ? begin + rangeSize : N;
+    const unsigned count = end - begin < REDUCE_TILE_SIZE ? end - begin : REDUCE_TILE_SIZE;
+    if (l < count) {
+      T accumulator = unary_op(in_[begin + l]);
+      for (unsigned i = begin + l + REDUCE_TILE_SIZE; i < end; i += REDUCE_TILE_SIZE) {
+        accumulator = binary_op(accumulator, unary_op(in_[i]));
+      }
+      scratch[l] = accumulator;
     }
+    t_idx.barrier.wait();
+    reduce_tile(scratch, count, binary_op, t_idx);
 
-    int max_ComputeUnits = 32;
-    int numTiles = max_ComputeUnits*32;
-    int length = (REDUCE_WAVEFRONT_SIZE*numTiles);
-    length = N < length ? N : length;
-    unsigned int residual = length % REDUCE_WAVEFRONT_SIZE;
-    length = residual ? (length + REDUCE_WAVEFRONT_SIZE - residual): length ;
-    numTiles = static_cast< int >((N/REDUCE_WAVEFRONT_SIZE)>= numTiles?(numTiles):
-                                  (std::ceil( static_cast< float >( N ) / REDUCE_WAVEFRONT_SIZE) ));
-
-    std::vector<int> r(numTiles);
-    hc::array_view<int> result(numTiles, r);
-    hc::array_view<const int> first_(N, v);
-    result.discard_data();
-    kernel_launch(length,
-                  [ first_, N, length, result, binary_op ]
-                  ( hc::tiled_index<1> t_idx ) [[hc]]
-                  {
-                  using T = int;
-                  int gx = t_idx.global[0];
-                  int gloId = gx;
-                  tile_static int scratch[REDUCE_WAVEFRONT_SIZE];
-                  //  Initialize local data store
-                  unsigned int tileIndex = t_idx.local[0];
-
-                  int accumulator;
-                  if (gloId < N)
-                  {
-                  accumulator = first_[gx];
-                  gx += length;
-                  }
-
-
-                  // Loop sequentially over chunks of input vector, reducing an arbitrary size input
-                  // length into a length related to the number of workgroups
-                  while (gx < N)
-                  {
-                      T element = first_[gx];
-                      accumulator = binary_op(accumulator, element);
-                      gx += length;
-                  }
-
-                  scratch[tileIndex] = accumulator;
-                  t_idx.barrier.wait();
-
-                  unsigned int tail = N - (t_idx.tile[0] * REDUCE_WAVEFRONT_SIZE);
-
-                  _REDUCE_STEP(tail, tileIndex, 1);
-                  _REDUCE_STEP(tail, tileIndex, 2);
-                  _REDUCE_STEP(tail, tileIndex, 4);
-                  _REDUCE_STEP(tail, tileIndex, 8);
-                  _REDUCE_STEP(tail, tileIndex, 16);
-                  _REDUCE_STEP(tail, tileIndex, 32);
-                  _REDUCE_STEP(tail, tileIndex, 64);
-                  _REDUCE_STEP(tail, tileIndex, 128);
-                  _REDUCE_STEP(tail, tileIndex, 256);
-
+    if (l == 0) {
+      partials[t_idx.tile[0]] = scratch[0];
+      release_fence();
+      last = hc::atomic_fetch_add(&tickets[0], 1u) == numTiles - 1;
+    }
+    t_idx.barrier.wait();
+    if (!last) {
+      return;
+    }
 
-                  //  Abort threads that are passed the end of the input vector
-                  if (gloId >= N)
-                      return;
+    // the partial results of all the tiles are written
+    acquire_fence();
+    const unsigned total = numTiles < REDUCE_TILE_SIZE ? numTiles : REDUCE_TILE_SIZE;
+    if (l < total) {
+      T accumulator = partials[l];
+      for (unsigned i = l + REDUCE_TILE_SIZE; i < numTiles; i += REDUCE_TILE_SIZE) {
+        accumulator = binary_op(accumulator, partials[i]);
+      }
+      scratch[l] = accumulator;
+    }
+    t_idx.barrier.wait();
+    reduce_tile(scratch, total, binary_op, t_idx);
+    if (l == 0) {
+      result[0] = binary_op(result[0], scratch[0]);
+    }
+  }, REDUCE_TILE_SIZE);
 
-                  //  Write only the single reduced value for the entire workgroup
-                  if (tileIndex == 0)
-                  {
-                      result[t_idx.tile[ 0 ]] = scratch[0];
-                  }
+  result.synchronize();
+  return r[0];
+}
 
-                  }, REDUCE_WAVEFRONT_SIZE);
+// Reduction on the host: each thread reduces a contiguous range to its own
+// partial result, with no barrier, and the caller reduces init and the
+// partial results in order.
+template<typename T, typename TIn, typename UnaryOperation, typename BinaryOperation>
+T reduce_host(const TIn* first, size_t N, T init,
+              const UnaryOperation& unary_op, const BinaryOperation& binary_op) {
+  const unsigned threads = host_thread_count(N, HOST_REDUCE_GRAIN);
+  std::vector<T> partials(threads, init);
+  host_launch(threads, [&](unsigned t) {
+    const size_t begin = N * t / threads;
+    const size_t end = N * (t + 1) / threads;
+    T accumulator = unary_op(first[begin]);
+    for (size_t i = begin + 1; i < end; ++i) {
+      accumulator = binary_op(accumulator, unary_op(first[i]));
+    }
+    partials[t] = accumulator;
+  });
+  for (const T& partial : partials) {
+    init = binary_op(init, partial);
+  }
+  return init;
+}
 
-    result.synchronize();
-    auto ans = std::accumulate(std::begin(r), std::end(r), 1, binary_op);
-    return ans;
+// GENERALIZED_SUM(binary_op, init, unary_op(first[0]), ..., unary_op(first[N - 1]))
+template<typename T, typename TIn, typename UnaryOperation, typename BinaryOperation>
+T reduce_dispatch(const TIn* first, size_t N, T init,
+                  const UnaryOperation& unary_op, const BinaryOperation& binary_op) {
+  if (use_hsa()) {
+    return reduce_hsa(first, static_cast<unsigned>(N), init, unary_op, binary_op);
+  }
+  return reduce_host(first, N, init, unary_op, binary_op);
 }
 
 template<class RandomAccessIterator, class T, class BinaryOperation>
@@ -111,85 +148,13 @@ T reduce_impl(RandomAccessIterator first, RandomAccessIterator last,
               BinaryOperation binary_op,
               std::random_access_iterator_tag) {
 
-    const int N = static_cast<int>(std::distance(first, last));
+    const size_t N = static_cast<size_t>(std::distance(first, last));
     // call to std::accumulate when small data size
     if (N <= details::PARALLELIZE_THRESHOLD) {
         return reduce_impl(first, last, init, binary_op, std::input_iterator_tag{});
     }
 
-    int max_ComputeUnits = 32;
-    int numTiles = max_ComputeUnits*32;
-    int length = (REDUCE_WAVEFRONT_SIZE*numTiles);
-    length = N < length ? N : length;
-    unsigned int residual = length % REDUCE_WAVEFRONT_SIZE;
-    length = residual ? (length + REDUCE_WAVEFRONT_SIZE - residual): length ;
-    numTiles = static_cast< int >((N/REDUCE_WAVEFRONT_SIZE)>= numTiles?(numTiles):
-                                  (std::ceil( static_cast< float >( N ) / REDUCE_WAVEFRONT_SIZE) ));
-
-    auto f_ = utils::get_pointer(first);
-    using _Ty = typename std::iterator_traits<RandomAccessIterator>::value_type;
-    std::vector<T> r(numTiles);
-    hc::array_view<T> result(hc::extent<1>(numTiles), r);
-    hc::array_view<const _Ty> first_(hc::extent<1>(N), f_);
-    result.discard_data();
-    kernel_launch(length,
-                  [ first_, N, length, result, binary_op ]
-                  ( hc::tiled_index<1> t_idx ) [[hc]]
-                  {
-                  int gx = t_idx.global[0];
-                  int gloId = gx;
-                  tile_static T scratch[REDUCE_WAVEFRONT_SIZE];
-                  //  Initialize local data store
-                  unsigned int tileIndex = t_idx.local[0];
-
-                  T accumulator;
-                  if (gloId < N)
-                  {
-                  accumulator = first_[gx];
-                  gx += length;
-                  }
-
-
-                  // Loop sequentially over chunks of input vector, reducing an arbitrary size input
-                  // length into a length related to the number of workgroups
-                  while (gx < N)
-                  {
-                      T element = first_[gx];
-                      accumulator = binary_op(accumulator, element);
-                      gx += length;
-                  }
-
-                  scratch[tileIndex] = accumulator;
-                  t_idx.barrier.wait();
-
-                  unsigned int tail = N - (t_idx.tile[0] * REDUCE_WAVEFRONT_SIZE);
-
-                  _REDUCE_STEP(tail, tileIndex, 256);
-                  _REDUCE_STEP(tail, tileIndex, 128);
-                  _REDUCE_STEP(tail, tileIndex, 64);
-                  _REDUCE_STEP(tail, tileIndex, 32);
-                  _REDUCE_STEP(tail, tileIndex, 16);
-                  _REDUCE_STEP(tail, tileIndex, 8);
-                  _REDUCE_STEP(tail, tileIndex, 4);
-                  _REDUCE_STEP(tail, tileIndex, 2);
-                  _REDUCE_STEP(tail, tileIndex, 1);
-
-
-                  //  Abort threads that are passed the end of the input vector
-                  if (gloId >= N)
-                      return;
-
-                  //  Write only the single reduced value for the entire workgroup
-                  if (tileIndex == 0)
-                  {
-                      result[t_idx.tile[ 0 ]] = scratch[0];
-                  }
-
-                  }, REDUCE_WAVEFRONT_SIZE);
-
-    result.synchronize();
-    auto ans = std::accumulate(std::begin(r), std::end(r), init, binary_op);
-    return ans;
+    return reduce_dispatch(utils::get_pointer(first), N, init, reduce_identity(), binary_op);
 }
 } // namespace details
 
@@ -9,9 +9,223 @@
 
 namespace details {
 
-#define SCAN_KERNELWAVES 2
-#define SCAN_WAVESIZE 128
-#define SCAN_TILE_MAX 65535
+#define SCAN_TILE_SIZE          256
+#define SCAN_ITEMS              4
+#define SCAN_TILE_MAX           65535
+#define HOST_SCAN_GRAIN         (1 << 16)
+
+// Status of a tile of the single pass scan: its sum is published, or the sum
+// of all the elements up to its end
+#define SCAN_FLAG_AGGREGATE     1u
+#define SCAN_FLAG_PREFIX        2u
+
+// Single pass scan on the accelerator: chained scan with decoupled look-back.
+//
+// Tiles take SCAN_TILE_SIZE * SCAN_ITEMS elements at a time, in the order of
+// a ticket, so that every tile before a tile's own has been started.  A tile
+// scans its elements (each work-item SCAN_ITEMS consecutive ones, then the
+// sums of the work-items), publishes its sum, and looks back at the tiles
+// before it: it combines their sums until one of them has published the sum
+// of all the elements up to its end, then publishes its own.  The elements
+// are read and written once, in one kernel.
+//
+// The inclusive scan leaves init out, the exclusive scan starts from it.
+template<typename TIn, typename TOut, typename UnaryOperation, typename BinaryOperation>
+void scan_hsa(const TIn* in, TOut* out, unsigned N, const TOut& init, bool inclusive,
+              const UnaryOperation& unary_op, const BinaryOperation& binary_op) {
+  const unsigned tileItems = SCAN_TILE_SIZE * SCAN_ITEMS;
+  const unsigned numTiles = (N + tileItems - 1) / tileItems;
+  const unsigned launched = std::min<unsigned>(numTiles, SCAN_TILE_MAX);
+
+  hc::array_view<const TIn> in_(hc::extent<1>(N), in);
+  hc::array_view<TOut> out_(hc::extent<1>(N), out);
+  if (static_cast<const void*>(in) != static_cast<const void*>(out)) {
+    out_.discard_data();
+  }
+  // the status of each tile, then the ticket
+  std::vector<unsigned> status(numTiles + 1, 0);
+  hc::array_view<unsigned> flags(hc::extent<1>(numTiles + 1), status);
+  hc::array_view<TOut> aggregates((hc::extent<1>(numTiles)));
+  hc::array_view<TOut> prefixes((hc::extent<1>(numTiles)));
+
+  kernel_launch(launched * SCAN_TILE_SIZE,
+                [in_, out_, N, numTiles, tileItems, flags, aggregates, prefixes,
+                 init, inclusive, unary_op, binary_op]
+                (hc::tiled_index<1> t_idx) [[hc]] {
+    tile_static TOut items[SCAN_TILE_SIZE * SCAN_ITEMS];
+    tile_static TOut sums[SCAN_TILE_SIZE];
+    tile_static TOut prefix;
+    tile_static bool hasPrefix;
+    tile_static unsigned ticket;
+    const unsigned l = t_idx.local[0];
+
+    for (;;) {
+      if (l == 0) {
+        ticket = hc::atomic_fetch_add(&flags[numTiles], 1u);
+      }
+      t_idx.barrier.wait();
+      const unsigned tile = ticket;
+      if (tile >= numTiles) {
+        return;
+      }
+      const unsigned base = tile * tileItems;
+      const unsigned size = N - base < tileItems ? N - base : tileItems;
+
+      for (unsigned k = l; k < size; k += SCAN_TILE_SIZE) {
+        items[k] = unary_op(in_[base + k]);
+      }
+      t_idx.barrier.wait();
+
+      // the sums of the work-items, then their inclusive scan
+      const unsigned begin = l * SCAN_ITEMS;
+      const unsigned end = begin + SCAN_ITEMS < size ? begin + SCAN_ITEMS : size;
+      const unsigned count = (size + SCAN_ITEMS - 1) / SCAN_ITEMS;
+      if (begin < end) {
+        TOut sum = items[begin];
+        for (unsigned k = begin + 1; k < end; ++k) {
+          sum = binary_op(sum, items[k]);
+        }
+        sums[l] = sum;
+      }
+      t_idx.barrier.wait();
+      for (unsigned offset = 1; offset < count; offset *= 2) {
+        const bool add = (l >= offset) && (l < count);
+        TOut other;
+        if (add) {
+          other = sums[l - offset];
+        }
+        t_idx.barrier.wait();
+        if (add) {
+          sums[l] = binary_op(other, sums[l]);
+        }
+        t_idx.barrier.wait();
+      }
+
+      if (l == 0) {
+        const TOut aggregate = sums[count - 1];
+        TOut inclusivePrefix;
+        if (tile == 0) {
+          prefix = init;
+          hasPrefix = !inclusive;
+          inclusivePrefix = inclusive ? aggregate : binary_op(init, aggregate);
+        } else {
+          aggregates[tile] = aggregate;
+          release_fence();
+          hc::atomic_exchange(&flags[tile], SCAN_FLAG_AGGREGATE);
+
+          // look back, the sum of tiles [j, tile) in running
+          TOut running;
+          for (unsigned j = tile - 1; ; --j) {
+            unsigned flag;
+            do {
+              flag = hc::atomic_fetch_add(&flags[j], 0u);
+            } while (flag == 0);
+            acquire_fence();
+            const TOut value = flag == SCAN_FLAG_PREFIX ? prefixes[j] : aggregates[j];
+            running = j + 1 == tile ? value : binary_op(value, running);
+            if (flag == SCAN_FLAG_PREFIX) {
+              break;
+            }
+          }
+          prefix = running;
+          hasPrefix = true;
+          inclusivePrefix = binary_op(running, aggregate);
+        }
+        prefixes[tile] = inclusivePrefix;
+        release_fence();
+        hc::atomic_exchange(&flags[tile], SCAN_FLAG_PREFIX);
+      }
+      t_idx.barrier.wait();
+
+      if (begin < end) {
+        // the sum of the elements before those of the work-item
+        bool has = hasPrefix;
+        TOut carry = prefix;
+        if (l > 0) {
+          carry = has ? binary_op(carry, sums[l - 1]) : sums[l - 1];
+          has = true;
+        }
+        for (unsigned k = begin; k < end; ++k) {
+          const TOut value = items[k];
+          if (inclusive) {
+            carry = has ? binary_op(carry, value) : value;
+            has = true;
+            items[k] = carry;
+          } else {
+            items[k] = carry;
+            carry = binary_op(carry, value);
+          }
+        }
+      }
+      t_idx.barrier.wait();
+      for (unsigned k = l; k < size; k += SCAN_TILE_SIZE) {
+        out_[base + k] = items[k];
+      }
+      // the tile_static memory is reused for the next tile
+      t_idx.barrier.wait();
+    }
+  }, SCAN_TILE_SIZE);
+
+  out_.synchronize();
+}
+
+// Two pass blocked scan on the host: each thread sums its block, the caller
+// scans the sums of the blocks, then each thread scans its block from the sum
+// of the blocks before it.  No tile barriers, and in place scans work.
+template<typename TIn, typename TOut, typename UnaryOperation, typename BinaryOperation>
+void scan_host(const TIn* in, TOut* out, size_t N, const TOut& init, bool inclusive,
+               const UnaryOperation& unary_op, const BinaryOperation& binary_op) {
+  const unsigned threads = host_thread_count(N, HOST_SCAN_GRAIN);
+  std::vector<TOut> carries(threads, init);
+  if (threads > 1) {
+    // the sum of block t in carries[t + 1], the last one is not needed
+    host_launch(threads - 1, [&](unsigned t) {
+      const size_t begin = N * t / threads;
+      const size_t end = N * (t + 1) / threads;
+      TOut sum = unary_op(in[begin]);
+      for (size_t i = begin + 1; i < end; ++i) {
+        sum = binary_op(sum, unary_op(in[i]));
+      }
+      carries[t + 1] = sum;
+    });
+    for (unsigned t = 1; t < threads; ++t) {
+      carries[t] = (t == 1) && inclusive ? carries[t] : binary_op(carries[t - 1], carries[t]);
+    }
+  }
+
+  host_launch(threads, [&](unsigned t) {
+    const size_t begin = N * t / threads;
+    const size_t end = N * (t + 1) / threads;
+    bool has = (t > 0) || !inclusive;
+    TOut carry = carries[t];
+    for (size_t i = begin; i < end; ++i) {
+      const TOut value = unary_op(in[i]);
+      if (inclusive) {
+        carry = has ? binary_op(carry, value) : value;
+        has = true;
+        out[i] = carry;
+      } else {
+        out[i] = carry;
+        carry = binary_op(carry, value);
+      }
+    }
+  });
+}
+
+// Scan of unary_op(in[0]), ..., unary_op(in[N - 1]) to out: inclusive,
+// without init, or exclusive, from init
+template<typename TIn, typename TOut, typename UnaryOperation, typename BinaryOperation>
+void scan_dispatch(const TIn* in, TOut* out, size_t N, const TOut& init, bool inclusive,
+                   const UnaryOperation& unary_op, const BinaryOperation& binary_op) {
+  if (N == 0) {
+    return;
+  }
+  if (use_hsa()) {
+    scan_hsa(in, out, static_cast<unsigned>(N), init, inclusive, unary_op, binary_op);
+  } else {
+    scan_host(in, out, N, init, inclusive, unary_op, binary_op);
+  }
+}
 
 template<
     typename InputIterator,
@@ -26,294 +240,12 @@ void scan_impl(
     const BinaryFunction& binary_op,
     const bool& inclusive = true )
 {
-    /**********************************************************************************
-     * Type Names - used in KernelTemplateSpecializer
-     *********************************************************************************/
-    typedef typename std::iterator_traits< InputIterator >::value_type iType;
     typedef typename std::iterator_traits< OutputIterator >::value_type oType;
 
-    int exclusive = inclusive ? 0 : 1;
-
-    int numElements = static_cast< int >( std::distance( first, last ) );
-    const unsigned int kernel0_WgSize = SCAN_WAVESIZE*SCAN_KERNELWAVES;
-    const unsigned int kernel1_WgSize = SCAN_WAVESIZE*SCAN_KERNELWAVES ;
-    const unsigned int kernel2_WgSize = SCAN_WAVESIZE*SCAN_KERNELWAVES;
-
-    //  Ceiling function to bump the size of input to the next whole wavefront size
-    unsigned int sizeInputBuff = numElements;
-    unsigned int modWgSize = (sizeInputBuff & ((kernel0_WgSize)-1));
-    if( modWgSize )
-    {
-        sizeInputBuff &= ~modWgSize;
-        sizeInputBuff += (kernel0_WgSize);
-    }
-    // tiles number
-    int numWorkGroupsK0 = static_cast< int >( sizeInputBuff / (kernel0_WgSize) );
-    //  Ceiling function to bump the size of the sum array to the next whole wavefront size
-    unsigned int sizeScanBuff = numWorkGroupsK0;
-    modWgSize = (sizeScanBuff & ((kernel0_WgSize)-1));
-    if( modWgSize )
-    {
-        sizeScanBuff &= ~modWgSize;
-        sizeScanBuff += (kernel0_WgSize);
-    }
-
-    hc::array_view<iType> preSumArray((hc::extent<1>(sizeScanBuff)));
-
-    /**********************************************************************************
-     *  Kernel 0
-     *********************************************************************************/
-  //	Loop to calculate the inclusive scan of each individual tile, and output the block sums of every tile
-  //	This loop is inherently parallel; every tile is independant with potentially many wavefronts
-
-	const unsigned int tile_limit = SCAN_TILE_MAX;
-	const unsigned int max_ext = (tile_limit*kernel0_WgSize);
-	unsigned int	   tempBuffsize = (sizeInputBuff); 
-	unsigned int	   iteration = (tempBuffsize-1)/max_ext; 
-
-    auto f_ = utils::get_pointer(first);
-    hc::array_view<iType> first_(hc::extent<1>(numElements), f_);
-    for(unsigned int i=0; i<=iteration; i++)
-	{
-	    unsigned int extent_sz =  (tempBuffsize > max_ext) ? max_ext : tempBuffsize; 
-		unsigned int index = i*(tile_limit*kernel0_WgSize);
-		unsigned int tile_index = i*tile_limit;
-
-        auto kernel =
-            [first_, init, numElements, preSumArray,
-            exclusive, index, tile_index, kernel0_WgSize, binary_op]
-                ( hc::tiled_index< 1 > t_idx ) [[hc]]
-                {
-                    unsigned int gloId = t_idx.global[ 0 ] + index;
-                    unsigned int groId = t_idx.tile[ 0 ] + tile_index;
-                    unsigned int locId = t_idx.local[ 0 ];
-                    int wgSize = kernel0_WgSize;
-                    tile_static iType lds[ SCAN_WAVESIZE*SCAN_KERNELWAVES ];
-
-                    int input_offset = (groId*wgSize)+locId;
-                    // if exclusive, load gloId=0 w/ identity, and all others shifted-1
-                    if(input_offset < numElements)
-                        lds[locId] = first_[input_offset];
-                    if(input_offset+(wgSize/2) < numElements)
-                        lds[locId+(wgSize/2)] = first_[ input_offset+(wgSize/2)];
-
-                    // Exclusive case
-                    if(exclusive && gloId == 0)
-                    {
-                        iType start_val = first_[0];
-                        lds[locId] = binary_op(init, start_val);
-                    }
-                    unsigned int  offset = 1;
-                    //  Computes a scan within a workgroup with two data per element
-
-                    for (unsigned int start = wgSize>>1; start > 0; start >>= 1) 
-                    {
-                        t_idx.barrier.wait();
-                        if (locId < start)
-                        {
-                            unsigned int temp1 = offset*(2*locId+1)-1;
-                            unsigned int temp2 = offset*(2*locId+2)-1;
-                            iType y = lds[temp2];
-                            iType y1 =lds[temp1];
-
-                            lds[temp2] = binary_op(y, y1);
-                        }
-                        offset *= 2;
-                    }
-                    t_idx.barrier.wait();
-                    if (locId == 0)
-                    {
-                        preSumArray[ groId  ] = lds[wgSize -1];
-                    }
-                };
-
-        details::kernel_launch(extent_sz, kernel, kernel0_WgSize);
-        tempBuffsize = tempBuffsize - max_ext;
-	}
-
-    /**********************************************************************************
-     *  Kernel 1
-     *********************************************************************************/
-
-    int workPerThread = static_cast< int >( sizeScanBuff / kernel1_WgSize );
-    workPerThread = workPerThread ? workPerThread : 1;
-
-    auto kernel1 =
-        [preSumArray, numWorkGroupsK0,
-        workPerThread, binary_op, kernel1_WgSize]
-            ( hc::tiled_index< 1 > t_idx ) [[hc]]
-            {
-                unsigned int gloId = t_idx.global[ 0 ];
-                int locId = t_idx.local[ 0 ];
-                int wgSize = kernel1_WgSize;
-                int mapId  = gloId * workPerThread;
-
-                tile_static iType lds[ SCAN_WAVESIZE*SCAN_KERNELWAVES ];
-
-                // do offset of zero manually
-                int offset;
-                iType workSum;
-                if (mapId < numWorkGroupsK0)
-                {
-                    // accumulate zeroth value manually
-                    offset = 0;
-                    workSum = preSumArray[mapId+offset];
-                    //  Serial accumulation
-                    for( offset = offset+1; offset < workPerThread; offset += 1 )
-                    {
-                        if (mapId+offset<numWorkGroupsK0)
-                        {
-                            iType y = preSumArray[mapId+offset];
-                            workSum = binary_op( workSum, y );
-                        }
-                    }
-                }
-                t_idx.barrier.wait();
-                iType scanSum = workSum;
-                offset = 1;
-                // load LDS with register sums
-                lds[ locId ] = workSum;
-
-                // scan in lds
-                for( offset = offset*1; offset < wgSize; offset *= 2 )
-                {
-                    t_idx.barrier.wait();
-                    if (mapId < numWorkGroupsK0)
-                    {
-                        if (locId >= offset)
-                        {
-                            iType y = lds[ locId - offset ];
-                            scanSum = binary_op( scanSum, y );
-                        }
-                    }
-                    t_idx.barrier.wait();
-                    lds[ locId ] = scanSum;
-                } // for offset
-                t_idx.barrier.wait();
-                workSum = preSumArray[mapId];
-                if(locId > 0){
-                    iType y = lds[locId-1];
-                    workSum = binary_op(workSum, y);
-                    preSumArray[ mapId] = workSum;
-                }
-
-                // write final scan from pre-scan and lds scan
-                for( offset = 1; offset < workPerThread; offset += 1 )
-                {
-                    t_idx.barrier.wait_with_global_memory_fence();
-                    if (mapId+offset < numWorkGroupsK0 && locId > 0)
-                    {
-                        iType y  = preSumArray[ mapId + offset ] ;
-                        iType y1 = binary_op(y, workSum);
-                        preSumArray[ mapId + offset ] = y1;
-                        workSum = y1;
-
-                    } // thread in bounds
-                    else if(mapId+offset < numWorkGroupsK0 ){
-                        iType y  = preSumArray[ mapId + offset ] ;
-                        preSumArray[ mapId + offset ] = binary_op(y, workSum);
-                        workSum = preSumArray[ mapId + offset ];
-                    }
-
-                } // for
-            };
-
-    details::kernel_launch(kernel1_WgSize, kernel1, kernel1_WgSize);
-
-    /**********************************************************************************
-     *  Kernel 2
-     *********************************************************************************/
-	tempBuffsize = (sizeInputBuff); 
-	iteration = (tempBuffsize-1)/max_ext; 
-    auto re_ = utils::get_pointer(result);
-    hc::array_view<oType> re(hc::extent<1>(numElements), re_);
-    re.discard_data();
-
-    for(unsigned int a=0; a<=iteration ; a++)
-    {
-        unsigned int extent_sz =  (tempBuffsize > max_ext) ? max_ext : tempBuffsize; 
-        unsigned int index = a*(tile_limit*kernel2_WgSize);
-        unsigned int tile_index = a*tile_limit;
-
-        auto kernel =
-            [ first_, re, preSumArray, numElements, binary_op,
-            init, exclusive, index, tile_index, kernel2_WgSize]
-                ( hc::tiled_index< 1 > t_idx ) [[hc]]
-                {
-                    int gloId = t_idx.global[ 0 ] + index;
-                    unsigned int groId = t_idx.tile[ 0 ] + tile_index;
-                    int locId = t_idx.local[ 0 ];
-                    int wgSize = kernel2_WgSize;
-
-                    tile_static iType lds[ SCAN_WAVESIZE*SCAN_KERNELWAVES ];
-                    // if exclusive, load gloId=0 w/ identity, and all others shifted-1
-                    iType val;
-
-                    if (gloId < numElements){
-                        if (exclusive)
-                        {
-                            if (gloId > 0)
-                            { // thread>0
-                                val = first_[gloId-1];
-                                lds[ locId ] = val;
-                            }
-                            else
-                            { // thread=0
-                                val = init;
-                                lds[ locId ] = val;
-                            }
-                        }
-                        else
-                        {
-                            val = first_[gloId];
-                            lds[ locId ] = val;
-                        }
-                    }
-
-                    iType scanResult = lds[locId];
-                    iType postBlockSum, newResult;
-                    // accumulate prefix
-                    iType y, y1, sum;
-                    if(locId == 0 && gloId < numElements)
-                    {
-                        if(groId > 0) {
-                            postBlockSum = preSumArray[ groId-1 ];
-                            if (!exclusive)
-                                newResult = binary_op( scanResult, postBlockSum );
-                            else 
-                                newResult =  postBlockSum;
-                        }
-                        else {
-                            newResult = scanResult;
-                        }
-                        lds[ locId ] = newResult;
-                    } 
-                    //  Computes a scan within a workgroup
-                    sum = lds[ locId ];
-
-                    for( int offset = 1; offset < wgSize; offset *= 2 )
-                    {
-                        t_idx.barrier.wait();
-                        if (locId >= offset)
-                        {
-                            iType y = lds[ locId - offset ];
-                            sum = binary_op( sum, y );
-                        }
-                        t_idx.barrier.wait();
-                        lds[ locId ] = sum;
-                    }
-                    t_idx.barrier.wait();
-                    //  Abort threads that are passed the end of the input vector
-                    if (gloId >= numElements) return; 
-
-                    re[ gloId ] = sum;
-
-                };
-
-        details::kernel_launch(extent_sz, kernel, kernel2_WgSize);
-        tempBuffsize = tempBuffsize - max_ext;
-    }
-}   //end of inclusive_scan_enqueue( )
+    const size_t N = static_cast<size_t>(std::distance(first, last));
+    const oType init_ = init;
+    scan_dispatch(utils::get_pointer(first), utils::get_pointer(result), N, init_, inclusive,
+                  reduce_identity(), binary_op);
+}
 
 } // namespace details
-
@@ -0,0 +1,422 @@
+#pragma once
+
+namespace details {
+
+#define SEARCH_TILE_SIZE        256
+#define SEARCH_MAX_TILES        1024
+#define SEARCH_PROBE_SIZE       4096
+#define HOST_SEARCH_GRAIN       (1 << 14)
+
+// Matches of the searches: whether the search stops at position i.
+
+// in[i] == value
+template<typename Container, typename T>
+struct find_match {
+  Container in;
+  T value;
+  bool operator()(size_t i) const __CPU__ __HC__ {
+    return in[i] == value;
+  }
+};
+
+// pred(in[i]), or its negation
+template<typename Container, typename Predicate, bool Negate>
+struct find_if_match {
+  Container in;
+  Predicate pred;
+  bool operator()(size_t i) const __CPU__ __HC__ {
+    return pred(in[i]) != Negate;
+  }
+};
+
+// !p(in1[i], in2[i])
+template<typename Container1, typename Container2, typename BinaryPredicate>
+struct mismatch_match {
+  Container1 in1;
+  Container2 in2;
+  BinaryPredicate p;
+  bool operator()(size_t i) const __CPU__ __HC__ {
+    return !p(in1[i], in2[i]);
+  }
+};
+
+// p(in[i], in[i + 1])
+template<typename Container, typename BinaryPredicate>
+struct adjacent_find_match {
+  Container in;
+  BinaryPredicate p;
+  bool operator()(size_t i) const __CPU__ __HC__ {
+    return p(in[i], in[i + 1]);
+  }
+};
+
+// p(in[i], s[j]) for some j
+template<typename Container, typename Set, typename BinaryPredicate>
+struct find_first_of_match {
+  Container in;
+  Set s;
+  size_t M;
+  BinaryPredicate p;
+  bool operator()(size_t i) const __CPU__ __HC__ {
+    for (size_t j = 0; j < M; ++j) {
+      if (p(in[i], s[j])) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+// p(in[i + j], s[j]) for all j
+template<typename Container, typename Pattern, typename BinaryPredicate>
+struct search_match {
+  Container in;
+  Pattern s;
+  size_t M;
+  BinaryPredicate p;
+  bool operator()(size_t i) const __CPU__ __HC__ {
+    for (size_t j = 0; j < M; ++j) {
+      if (!p(in[i + j], s[j])) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// p(in[i + j], value) for all j < count.  Only the first element of a run
+// looks ahead: a run which starts earlier is as long and matches first, so
+// the work stays linear.
+template<typename Container, typename T, typename BinaryPredicate>
+struct search_n_match {
+  Container in;
+  size_t count;
+  T value;
+  BinaryPredicate p;
+  bool operator()(size_t i) const __CPU__ __HC__ {
+    if ((i > 0) && p(in[i - 1], value)) {
+      return false;
+    }
+    for (size_t j = 0; j < count; ++j) {
+      if (!p(in[i + j], value)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+
+// Blocked searches of the lowest i in [begin, N) with match(i), or N.  The
+// blocks are handed out in increasing order and the best index so far is
+// shared: a worker stops as soon as a match before its next block is known.
+
+template<typename Match>
+size_t search_hsa(size_t begin, size_t N, const Match& match) {
+  const unsigned b = static_cast<unsigned>(begin);
+  const unsigned n = static_cast<unsigned>(N);
+  const unsigned chunks = (n - b + SEARCH_TILE_SIZE - 1) / SEARCH_TILE_SIZE;
+  const unsigned numTiles = std::min<unsigned>(chunks, SEARCH_MAX_TILES);
+  hc::array_view<unsigned> best((hc::extent<1>(1)));
+  best[0] = n;
+
+  kernel_launch(numTiles * SEARCH_TILE_SIZE,
+                [b, n, numTiles, match, best](hc::tiled_index<1> t_idx) [[hc]] {
+    tile_static unsigned found;
+    const unsigned l = t_idx.local[0];
+    for (unsigned chunk = b + t_idx.tile[0] * SEARCH_TILE_SIZE; chunk < n;
+         chunk += numTiles * SEARCH_TILE_SIZE) {
+      if (l == 0) {
+        found = hc::atomic_fetch_add(&best[0], 0u);
+      }
+      t_idx.barrier.wait();
+      // the same for the whole tile
+      if (found <= chunk) {
+        break;
+      }
+      t_idx.barrier.wait();
+      const unsigned i = chunk + l;
+      if ((i < n) && match(i)) {
+        hc::atomic_fetch_min(&best[0], i);
+      }
+    }
+  }, SEARCH_TILE_SIZE);
+
+  best.synchronize();
+  return best[0];
+}
+
+template<typename Match>
+size_t search_host(size_t begin, size_t N, const Match& match) {
+  const unsigned threads = host_thread_count(N - begin, HOST_SEARCH_GRAIN);
+  std::atomic<size_t> best(N);
+  host_launch(threads, [&](unsigned t) {
+    for (size_t block = begin + t * size_t(HOST_SEARCH_GRAIN); block < N;
+         block += threads * size_t(HOST_SEARCH_GRAIN)) {
+      if (best.load(std::memory_order_relaxed) <= block) {
+        return;
+      }
+      const size_t end = std::min(N, block + HOST_SEARCH_GRAIN);
+      for (size_t i = block; i < end; ++i) {
+        if (match(i)) {
+          size_t current = best.load();
+          while ((i < current) && !best.compare_exchange_weak(current, i)) {}
+          return;
+        }
+      }
+    }
+  });
+  return best.load();
+}
+
+// The lowest i in [0, N) with match(i), or N.  The first block is searched on
+// the calling thread, so early hits launch nothing; makeDeviceMatch() builds
+// the matcher over array_views only when the rest goes to the accelerator.
+template<typename HostMatch, typename MakeDeviceMatch>
+size_t search_first(size_t N, const HostMatch& match, MakeDeviceMatch makeDeviceMatch) {
+  const size_t probe = std::min(N, size_t(SEARCH_PROBE_SIZE));
+  for (size_t i = 0; i < probe; ++i) {
+    if (match(i)) {
+      return i;
+    }
+  }
+  if (probe == N) {
+    return N;
+  }
+  return use_hsa() ? search_hsa(probe, N, makeDeviceMatch())
+                   : search_host(probe, N, match);
+}
+
+
+// find
+// std::find forwarder
+template<typename InputIterator, typename T>
+InputIterator find_impl(InputIterator first, InputIterator last,
+                        const T& value,
+                        std::input_iterator_tag) {
+  return std::find(first, last, value);
+}
+
+// parallel::find
+template<typename InputIterator, typename T>
+InputIterator find_impl(InputIterator first, InputIterator last,
+                        const T& value,
+                        std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return find_impl(first, last, value, std::input_iterator_tag{});
+  }
+
+  typedef typename std::iterator_traits<InputIterator>::value_type _Tp;
+  const _Tp* first_ = utils::get_pointer(first);
+  typedef find_match<const _Tp*, T> HostMatch;
+  typedef find_match<hc::array_view<const _Tp>, T> DeviceMatch;
+  return first + search_first(N, HostMatch{first_, value}, [&]() {
+    return DeviceMatch{hc::array_view<const _Tp>(hc::extent<1>(N), first_), value};
+  });
+}
+
+// find_if, and find_if_not with Negate
+// std::find_if and std::find_if_not forwarder
+template<bool Negate, typename InputIterator, typename Predicate>
+InputIterator find_if_impl(InputIterator first, InputIterator last,
+                           Predicate pred,
+                           std::input_iterator_tag) {
+  return Negate ? std::find_if_not(first, last, pred)
+                : std::find_if(first, last, pred);
+}
+
+// parallel::find_if and parallel::find_if_not
+template<bool Negate, typename InputIterator, typename Predicate>
+InputIterator find_if_impl(InputIterator first, InputIterator last,
+                           Predicate pred,
+                           std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return find_if_impl<Negate>(first, last, pred, std::input_iterator_tag{});
+  }
+
+  typedef typename std::iterator_traits<InputIterator>::value_type _Tp;
+  const _Tp* first_ = utils::get_pointer(first);
+  typedef find_if_match<const _Tp*, Predicate, Negate> HostMatch;
+  typedef find_if_match<hc::array_view<const _Tp>, Predicate, Negate> DeviceMatch;
+  return first + search_first(N, HostMatch{first_, pred}, [&]() {
+    return DeviceMatch{hc::array_view<const _Tp>(hc::extent<1>(N), first_), pred};
+  });
+}
+
+// mismatch
+// std::mismatch forwarder
+template<typename InputIt1, typename InputIt2, typename BinaryPredicate>
+std::pair<InputIt1, InputIt2>
+mismatch_impl(InputIt1 first1, InputIt1 last1,
+              InputIt2 first2,
+              BinaryPredicate p,
+              std::input_iterator_tag) {
+  return std::mismatch(first1, last1, first2, p);
+}
+
+// parallel::mismatch
+template<typename InputIt1, typename InputIt2, typename BinaryPredicate>
+std::pair<InputIt1, InputIt2>
+mismatch_impl(InputIt1 first1, InputIt1 last1,
+              InputIt2 first2,
+              BinaryPredicate p,
+              std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first1, last1));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return mismatch_impl(first1, last1, first2, p, std::input_iterator_tag{});
+  }
+
+  typedef typename std::iterator_traits<InputIt1>::value_type _Tp1;
+  typedef typename std::iterator_traits<InputIt2>::value_type _Tp2;
+  const _Tp1* first1_ = utils::get_pointer(first1);
+  const _Tp2* first2_ = utils::get_pointer(first2);
+  typedef mismatch_match<const _Tp1*, const _Tp2*, BinaryPredicate> HostMatch;
+  typedef mismatch_match<hc::array_view<const _Tp1>, hc::array_view<const _Tp2>,
+                         BinaryPredicate> DeviceMatch;
+  const size_t i = search_first(N, HostMatch{first1_, first2_, p}, [&]() {
+    return DeviceMatch{hc::array_view<const _Tp1>(hc::extent<1>(N), first1_),
+                       hc::array_view<const _Tp2>(hc::extent<1>(N), first2_), p};
+  });
+  return std::make_pair(first1 + i, first2 + i);
+}
+
+// adjacent_find
+// std::adjacent_find forwarder
+template<typename ForwardIterator, typename BinaryPredicate>
+ForwardIterator adjacent_find_impl(ForwardIterator first, ForwardIterator last,
+                                   BinaryPredicate p,
+                                   std::input_iterator_tag) {
+  return std::adjacent_find(first, last, p);
+}
+
+// parallel::adjacent_find
+template<typename ForwardIterator, typename BinaryPredicate>
+ForwardIterator adjacent_find_impl(ForwardIterator first, ForwardIterator last,
+                                   BinaryPredicate p,
+                                   std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if (N <= details::PARALLELIZE_THRESHOLD) {
+    return adjacent_find_impl(first, last, p, std::input_iterator_tag{});
+  }
+
+  typedef typename std::iterator_traits<ForwardIterator>::value_type _Tp;
+  const _Tp* first_ = utils::get_pointer(first);
+  // positions [0, N - 1), each compared with the next element
+  typedef adjacent_find_match<const _Tp*, BinaryPredicate> HostMatch;
+  typedef adjacent_find_match<hc::array_view<const _Tp>, BinaryPredicate> DeviceMatch;
+  const size_t i = search_first(N - 1, HostMatch{first_, p}, [&]() {
+    return DeviceMatch{hc::array_view<const _Tp>(hc::extent<1>(N), first_), p};
+  });
+  return (i == N - 1) ? last : first + i;
+}
+
+// find_first_of
+// std::find_first_of forwarder
+template<typename InputIterator, typename ForwardIterator, typename BinaryPredicate>
+InputIterator find_first_of_impl(InputIterator first, InputIterator last,
+                                 ForwardIterator s_first, ForwardIterator s_last,
+                                 BinaryPredicate p,
+                                 std::input_iterator_tag) {
+  return std::find_first_of(first, last, s_first, s_last, p);
+}
+
+// parallel::find_first_of
+template<typename InputIterator, typename ForwardIterator, typename BinaryPredicate>
+InputIterator find_first_of_impl(InputIterator first, InputIterator last,
+                                 ForwardIterator s_first, ForwardIterator s_last,
+                                 BinaryPredicate p,
+                                 std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  const size_t M = static_cast<size_t>(std::distance(s_first, s_last));
+  if ((N <= details::PARALLELIZE_THRESHOLD) || (M == 0)) {
+    return find_first_of_impl(first, last, s_first, s_last, p, std::input_iterator_tag{});
+  }
+
+  typedef typename std::iterator_traits<InputIterator>::value_type _Tp;
+  typedef typename std::iterator_traits<ForwardIterator>::value_type _Ts;
+  const _Tp* first_ = utils::get_pointer(first);
+  const _Ts* s_first_ = utils::get_pointer(s_first);
+  typedef find_first_of_match<const _Tp*, const _Ts*, BinaryPredicate> HostMatch;
+  typedef find_first_of_match<hc::array_view<const _Tp>, hc::array_view<const _Ts>,
+                              BinaryPredicate> DeviceMatch;
+  return first + search_first(N, HostMatch{first_, s_first_, M, p}, [&]() {
+    return DeviceMatch{hc::array_view<const _Tp>(hc::extent<1>(N), first_),
+                       hc::array_view<const _Ts>(hc::extent<1>(M), s_first_), M, p};
+  });
+}
+
+// search
+// std::search forwarder
+template<typename ForwardIt1, typename ForwardIt2, typename BinaryPredicate>
+ForwardIt1 search_impl(ForwardIt1 first, ForwardIt1 last,
+                       ForwardIt2 s_first, ForwardIt2 s_last,
+                       BinaryPredicate p,
+                       std::input_iterator_tag) {
+  return std::search(first, last, s_first, s_last, p);
+}
+
+// parallel::search
+template<typename ForwardIt1, typename ForwardIt2, typename BinaryPredicate>
+ForwardIt1 search_impl(ForwardIt1 first, ForwardIt1 last,
+                       ForwardIt2 s_first, ForwardIt2 s_last,
+                       BinaryPredicate p,
+                       std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  const size_t M = static_cast<size_t>(std::distance(s_first, s_last));
+  if ((M == 0) || (M > N) || (N - M < details::PARALLELIZE_THRESHOLD)) {
+    return search_impl(first, last, s_first, s_last, p, std::input_iterator_tag{});
+  }
+
+  typedef typename std::iterator_traits<ForwardIt1>::value_type _Tp;
+  typedef typename std::iterator_traits<ForwardIt2>::value_type _Ts;
+  const _Tp* first_ = utils::get_pointer(first);
+  const _Ts* s_first_ = utils::get_pointer(s_first);
+  typedef search_match<const _Tp*, const _Ts*, BinaryPredicate> HostMatch;
+  typedef search_match<hc::array_view<const _Tp>, hc::array_view<const _Ts>,
+                       BinaryPredicate> DeviceMatch;
+  // the positions where the whole pattern fits
+  const size_t positions = N - M + 1;
+  const size_t i = search_first(positions, HostMatch{first_, s_first_, M, p}, [&]() {
+    return DeviceMatch{hc::array_view<const _Tp>(hc::extent<1>(N), first_),
+                       hc::array_view<const _Ts>(hc::extent<1>(M), s_first_), M, p};
+  });
+  return (i == positions) ? last : first + i;
+}
+
+// search_n
+// std::search_n forwarder
+template<typename ForwardIterator, typename Size, typename T, typename BinaryPredicate>
+ForwardIterator search_n_impl(ForwardIterator first, ForwardIterator last,
+                              Size count, const T& value,
+                              BinaryPredicate p,
+                              std::input_iterator_tag) {
+  return std::search_n(first, last, count, value, p);
+}
+
+// parallel::search_n
+template<typename ForwardIterator, typename Size, typename T, typename BinaryPredicate>
+ForwardIterator search_n_impl(ForwardIterator first, ForwardIterator last,
+                              Size count, const T& value,
+                              BinaryPredicate p,
+                              std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if ((count <= Size()) || (static_cast<size_t>(count) > N) ||
+      (N - static_cast<size_t>(count) < details::PARALLELIZE_THRESHOLD)) {
+    return search_n_impl(first, last, count, value, p, std::input_iterator_tag{});
+  }
+
+  typedef typename std::iterator_traits<ForwardIterator>::value_type _Tp;
+  const _Tp* first_ = utils::get_pointer(first);
+  const size_t M = static_cast<size_t>(count);
+  const size_t positions = N - M + 1;
+  typedef search_n_match<const _Tp*, T, BinaryPredicate> HostMatch;
+  typedef search_n_match<hc::array_view<const _Tp>, T, BinaryPredicate> DeviceMatch;
+  const size_t i = search_first(positions, HostMatch{first_, M, value, p}, [&]() {
+    return DeviceMatch{hc::array_view<const _Tp>(hc::extent<1>(N), first_), M, value, p};
+  });
+  return (i == positions) ? last : first + i;
+}
+
+} // namespace details
@@ -0,0 +1,282 @@
+#pragma once
+
+namespace details {
+
+#define SELECT_SAMPLE_SIZE      8192
+#define SELECT_SEQ_SIZE         (1 << 15)
+#define HOST_SELECT_GRAIN       (1 << 16)
+
+// top_k only gathers candidates when the range has at least that many
+// elements per element kept, and selects in a copy of the range otherwise
+#define SELECT_TOP_K_RATIO      64
+
+// whether in[i] goes before the splitter, or with Upper, does not go after it
+template<typename T, typename Compare, bool Upper>
+struct select_flag {
+  T splitter;
+  Compare comp;
+  template<typename Container>
+  bool operator()(const Container& in, unsigned i) const __CPU__ __HC__ {
+    return Upper ? !comp(splitter, in[i]) : comp(in[i], splitter);
+  }
+};
+
+// Sorted sample of data[0, N), one element at a scrambled position in each of
+// SELECT_SAMPLE_SIZE equal strides, so that periodic inputs are not sampled
+// at the same phase every time
+template<typename T, typename Compare>
+std::vector<T> select_sample(const T* data, size_t N, const Compare& comp) {
+  const size_t s = std::min<size_t>(N, SELECT_SAMPLE_SIZE);
+  std::vector<T> sample;
+  sample.reserve(s);
+  for (size_t i = 0; i < s; ++i) {
+    const size_t begin = i * N / s;
+    const size_t stride = (i + 1) * N / s - begin;
+    sample.push_back(data[begin + (i * 2654435761u) % stride]);
+  }
+  std::sort(sample.begin(), sample.end(), comp);
+  return sample;
+}
+
+// How far from its expected rank in a sorted sample of size s the element of
+// rank `rank` can fall, with a good margin
+inline size_t select_margin(size_t rank, size_t s) {
+  const size_t spread = std::min(rank, s - rank);
+  return 4 * static_cast<size_t>(std::sqrt(double(spread))) + 4;
+}
+
+// Rearranges data[0, N) the way std::nth_element does around nth.  Each round
+// picks two splitters from a sample of the part of the range left, so that
+// the element nth most likely falls between them, moves the elements before
+// the lower splitter to the front and the ones after the upper splitter to the
+// back with the parallel stable partition, and goes on with the part which
+// holds nth.  A splitter near an end of the sample is not needed, and the
+// elements kept for a small nth are then found in one pass.
+template<typename T, typename Compare>
+void select_nth(T* data, size_t N, size_t nth, const Compare& comp) {
+  size_t lo = 0;
+  size_t hi = N;
+  while (hi - lo > SELECT_SEQ_SIZE) {
+    const size_t n = hi - lo;
+    const std::vector<T> sample = select_sample(data + lo, n, comp);
+    const size_t s = sample.size();
+    const size_t rank = (nth - lo) * s / n;
+    const size_t margin = select_margin(rank, s);
+    const bool lowerSplit = rank > margin;
+    const bool upperSplit = rank + margin < s - 1;
+
+    if (lowerSplit) {
+      const T& lower = sample[rank - margin];
+      const size_t before = compact_in_place<true>(data + lo, n,
+                                                   select_flag<T, Compare, false>{lower, comp});
+      if (nth < lo + before) {
+        hi = lo + before;
+        continue;
+      }
+      lo += before;
+    }
+    if (upperSplit) {
+      const T& upper = sample[rank + margin];
+      const size_t between = compact_in_place<true>(data + lo, hi - lo,
+                                                    select_flag<T, Compare, true>{upper, comp});
+      if (nth >= lo + between) {
+        lo += between;
+        continue;
+      }
+      hi = lo + between;
+    }
+
+    // every element left is equivalent to the splitters
+    if (lowerSplit && upperSplit && !comp(sample[rank - margin], sample[rank + margin])) {
+      return;
+    }
+    // no element moved out: the sequential selection finishes
+    if (hi - lo == n) {
+      break;
+    }
+  }
+  std::nth_element(data + lo, data + nth, data + hi, comp);
+}
+
+// Candidates for the k first elements of data[0, N) in the order of comp, at
+// least k of them and including those k, gathered on the host.  Each thread
+// appends the elements before the worst of those it keeps to a buffer of 2k
+// elements, and when it is full keeps the k first with std::nth_element.
+template<typename T, typename Compare>
+void top_k_candidates_host(const T* data, size_t N, size_t k, const Compare& comp,
+                           std::vector<T>& candidates) {
+  const unsigned threads = host_thread_count(N, HOST_SELECT_GRAIN);
+  std::vector<std::vector<T>> kept(threads);
+  host_launch(threads, [&](unsigned t) {
+    const size_t begin = N * t / threads;
+    const size_t end = N * (t + 1) / threads;
+    std::vector<T>& buffer = kept[t];
+    buffer.reserve(2 * k);
+    bool trimmed = false;
+    for (size_t i = begin; i < end; ++i) {
+      // after a trim, buffer[k - 1] is the worst element kept
+      if (!trimmed || comp(data[i], buffer[k - 1])) {
+        buffer.push_back(data[i]);
+        if (buffer.size() == 2 * k) {
+          std::nth_element(buffer.begin(), buffer.begin() + (k - 1), buffer.end(), comp);
+          buffer.erase(buffer.begin() + k, buffer.end());
+          trimmed = true;
+        }
+      }
+    }
+  });
+  for (const std::vector<T>& buffer : kept) {
+    candidates.insert(candidates.end(), buffer.begin(), buffer.end());
+  }
+}
+
+// Candidates for the k first elements of data[0, N) in the order of comp, on
+// the accelerator: the elements which do not go after a threshold picked from
+// a sample, in one compaction.  Leaves candidates empty when the threshold
+// turns out too tight.
+template<typename T, typename Compare>
+void top_k_candidates_hsa(const T* data, size_t N, size_t k, const Compare& comp,
+                          std::vector<T>& candidates) {
+  const std::vector<T> sample = select_sample(data, N, comp);
+  const size_t s = sample.size();
+  const size_t rank = k * s / N;
+  const size_t margin = select_margin(rank, s);
+  if (rank + margin >= s) {
+    return;
+  }
+
+  const unsigned n = static_cast<unsigned>(N);
+  const select_flag<T, Compare, true> flag{sample[rank + margin], comp};
+  hc::array_view<const T> in_(hc::extent<1>(n), data);
+  compact_ranges ranges(n);
+  hc::array_view<unsigned> offsets((hc::extent<1>(ranges.numTiles + 1)));
+  const unsigned count = compact_count_hsa(in_, n, flag, ranges, offsets);
+  if (count < k) {
+    return;
+  }
+
+  candidates.assign(count, sample[rank + margin]);
+  hc::array_view<T> out(hc::extent<1>(count), candidates.data());
+  out.discard_data();
+  compact_scatter_hsa<false>(in_, n, flag, ranges, offsets, out, out, 0);
+  out.synchronize();
+}
+
+
+// nth_element
+// std::nth_element forwarder
+template<typename RandomIt, typename Compare>
+void nth_element_impl(RandomIt first, RandomIt nth, RandomIt last,
+                      Compare comp,
+                      std::input_iterator_tag) {
+  std::nth_element(first, nth, last, comp);
+}
+
+// parallel::nth_element
+template<typename RandomIt, typename Compare>
+void nth_element_impl(RandomIt first, RandomIt nth, RandomIt last,
+                      Compare comp,
+                      std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  const size_t k = static_cast<size_t>(std::distance(first, nth));
+  if ((N <= details::PARALLELIZE_THRESHOLD) || (k >= N)) {
+    return nth_element_impl(first, nth, last, comp, std::input_iterator_tag{});
+  }
+
+  select_nth(utils::get_pointer(first), N, k, comp);
+}
+
+// partial_sort
+// std::partial_sort forwarder
+template<typename RandomIt, typename Compare>
+void partial_sort_impl(RandomIt first, RandomIt middle, RandomIt last,
+                       Compare comp,
+                       std::input_iterator_tag) {
+  std::partial_sort(first, middle, last, comp);
+}
+
+// parallel::partial_sort: selection of the first elements, then the parallel
+// sort of those only
+template<typename RandomIt, typename Compare>
+void partial_sort_impl(RandomIt first, RandomIt middle, RandomIt last,
+                       Compare comp,
+                       std::random_access_iterator_tag) {
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  const size_t k = static_cast<size_t>(std::distance(first, middle));
+  if ((N <= details::PARALLELIZE_THRESHOLD) || (k == 0)) {
+    return partial_sort_impl(first, middle, last, comp, std::input_iterator_tag{});
+  }
+
+  if (k < N) {
+    select_nth(utils::get_pointer(first), N, k - 1, comp);
+  }
+  sort_impl(first, middle, comp, std::random_access_iterator_tag{});
+}
+
+// top_k
+// std::partial_sort_copy forwarder
+template<typename InputIt, typename RandomIt, typename Compare>
+RandomIt top_k_impl(InputIt first, InputIt last,
+                    RandomIt d_first, size_t k,
+                    Compare comp,
+                    std::input_iterator_tag) {
+  return std::partial_sort_copy(first, last, d_first, d_first + k, comp);
+}
+
+// parallel::top_k: the k first elements are selected among candidates
+// gathered in one pass when k is small, or in a copy of the whole range,
+// then sorted
+template<typename InputIt, typename RandomIt, typename Compare>
+RandomIt top_k_impl(InputIt first, InputIt last,
+                    RandomIt d_first, size_t k,
+                    Compare comp,
+                    std::random_access_iterator_tag) {
+  typedef typename std::iterator_traits<InputIt>::value_type T;
+  const size_t N = static_cast<size_t>(std::distance(first, last));
+  if ((N <= details::PARALLELIZE_THRESHOLD) || (k == 0)) {
+    return top_k_impl(first, last, d_first, k, comp, std::input_iterator_tag{});
+  }
+
+  const size_t m = std::min(k, N);
+  auto first_ = utils::get_pointer(first);
+  std::vector<T> candidates;
+  if (m * SELECT_TOP_K_RATIO <= N) {
+    if (use_hsa()) {
+      top_k_candidates_hsa(first_, N, m, comp, candidates);
+    } else {
+      top_k_candidates_host(first_, N, m, comp, candidates);
+    }
+  }
+  if (candidates.empty()) {
+    candidates.assign(first_, first_ + N);
+  }
+
+  if (candidates.size() > m) {
+    select_nth(candidates.data(), candidates.size(), m - 1, comp);
+  }
+  std::copy(candidates.begin(), candidates.begin() + m, d_first);
+  sort_impl(d_first, d_first + m, comp, std::random_access_iterator_tag{});
+  return d_first + m;
+}
+
+// partial_sort_copy
+// std::partial_sort_copy forwarder
+template<typename InputIt, typename RandomIt, typename Compare>
+RandomIt partial_sort_copy_impl(InputIt first, InputIt last,
+                                RandomIt d_first, RandomIt d_last,
+                                Compare comp,
+                                std::input_iterator_tag) {
+  return std::partial_sort_copy(first, last, d_first, d_last, comp);
+}
+
+// parallel::partial_sort_copy
+template<typename InputIt, typename RandomIt, typename Compare>
+RandomIt partial_sort_copy_impl(InputIt first, InputIt last,
+                                RandomIt d_first, RandomIt d_last,
+                                Compare comp,
+                                std::random_access_iterator_tag tag) {
+  return top_k_impl(first, last, d_first, static_cast<size_t>(std::distance(d_first, d_last)),
+                    comp, tag);
+}
+
+} // namespace details
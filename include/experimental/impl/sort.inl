@@ -2,899 +2,602 @@
 
 namespace details {
 
-// FIXME sort algorithm implementation breaks Clang 4.0 as of now
-#if 0
-
-#define WG_SIZE                 256
-#define BITONIC_SORT_WGSIZE     64
-#define RADICES                 16
-#define ELEMENTS_PER_WORK_ITEM  4
-#define BITS_PER_PASS			4
-#define NUM_BUCKET				(1<<BITS_PER_PASS)
-
-
-#define AtomInc(x) hc::atomic_fetch_inc(&(x))
-#define AtomAdd(x, value) hc::atomic_fetch_add(&(x), value)
-#define USE_2LEVEL_REDUCE 
-#define _max(a,b)    (((a) > (b)) ? (a) : (b))
-#define _min(a,b)    (((a) < (b)) ? (a) : (b))
-#define SET_HISTOGRAM(setIdx, key) ldsSortData[(setIdx)*NUM_BUCKET+key]
-
-struct uint_4
-{
-    uint_4() [[hc]] : x(0), y(0), z(0), w(0) {}
-    uint_4(unsigned int x, unsigned int y, unsigned int z, unsigned int w) [[hc]]
-        : x(x), y(y), z(z), w(w) {}
-    unsigned int x, y, z, w;
-    uint_4 operator+=(const uint_4& other) [[hc]] {
-        x += other.x;
-        y += other.y;
-        z += other.z;
-        w += other.w;
-        return *this;
+#define SORT_TILE_SIZE          256
+#define RADIX_BITS              4
+#define RADIX_BUCKETS           (1 << RADIX_BITS)
+#define RADIX_MAX_TILES         1024
+#define HOST_RADIX_BITS         8
+#define HOST_RADIX_BUCKETS      (1 << HOST_RADIX_BITS)
+#define HOST_SORT_GRAIN         (1 << 16)
+#define MERGE_PATH_ITEMS        8
+
+// Keys of the radix sort: the bits of a value, mapped so that the unsigned
+// order of the keys is the order of the values.
+template<typename T, typename = void>
+struct radix_traits {
+  static const bool enabled = false;
+};
+
+// integers: the sign bit of the signed types is flipped
+template<typename T>
+struct radix_traits<T, typename std::enable_if<std::is_integral<T>::value &&
+                                               !std::is_same<T, bool>::value>::type> {
+  static const bool enabled = true;
+  static const int bits = sizeof(T) * 8;
+  typedef typename std::conditional<(sizeof(T) <= 4), uint32_t, uint64_t>::type key_type;
+
+  static key_type to_key(const T& v) __CPU__ __HC__ {
+    key_type k = static_cast<key_type>(static_cast<typename std::make_unsigned<T>::type>(v));
+    if (std::is_signed<T>::value) {
+      k ^= key_type(1) << (bits - 1);
     }
-    uint_4 operator-=(const uint_4& other) [[hc]] {
-        x -= other.x;
-        y -= other.y;
-        z -= other.z;
-        w -= other.w;
-        return *this;
+    return k;
+  }
+};
+
+// IEEE 754: negative values have all their bits flipped, the others their
+// sign bit.  -0 is mapped to the key of +0, as they compare equal.
+template<>
+struct radix_traits<float> {
+  static const bool enabled = true;
+  static const int bits = 32;
+  typedef uint32_t key_type;
+
+  static key_type to_key(const float& v) __CPU__ __HC__ {
+    union { float f; uint32_t u; } b;
+    b.f = v;
+    if (v == 0.0f) {
+      b.u = 0;
     }
+    return (b.u & 0x80000000u) ? ~b.u : (b.u | 0x80000000u);
+  }
 };
-uint_4 operator+(const uint_4& a, const uint_4& b) [[hc]]
-{
-    uint_4 ret(a);
-    ret += b;
-    return ret;
-}
-uint_4 operator-(const uint_4& a, const uint_4& b) [[hc]]
-{
-    uint_4 ret(a);
-    ret -= b;
-    return ret;
-}
-#define make_uint4 uint_4
 
-static inline uint_4 SELECT_UINT4(uint_4 &a,uint_4 &b,uint_4  &condition )  [[hc]]
-{
-	uint_4 res;
-	res.x = (condition.x )? b.x : a.x;
-	res.y = (condition.y )? b.y : a.y;
-	res.z = (condition.z )? b.z : a.z;
-	res.w = (condition.w )? b.w : a.w;
-	return res;
+template<>
+struct radix_traits<double> {
+  static const bool enabled = true;
+  static const int bits = 64;
+  typedef uint64_t key_type;
+
+  static key_type to_key(const double& v) __CPU__ __HC__ {
+    union { double f; uint64_t u; } b;
+    b.f = v;
+    if (v == 0.0) {
+      b.u = 0;
+    }
+    const uint64_t sign = uint64_t(1) << 63;
+    return (b.u & sign) ? ~b.u : (b.u | sign);
+  }
+};
 
+// Order of the radix sort for a comparator: 1 ascending, -1 descending, 0
+// when the comparator is not known to order the keys (merge sort)
+template<typename T, typename Compare>
+struct radix_order {
+  static const int value = 0;
+};
+
+template<typename T>
+struct radix_order<T, std::less<T>> {
+  static const int value = radix_traits<T>::enabled ? 1 : 0;
+};
+
+template<typename T>
+struct radix_order<T, std::greater<T>> {
+  static const int value = radix_traits<T>::enabled ? -1 : 0;
+};
+
+// digit of v for the pass starting at bit shift, descending orders use the
+// complement of the key
+template<typename T, int Order, int Bits>
+inline unsigned radix_digit(const T& v, int shift) __CPU__ __HC__ {
+  typename radix_traits<T>::key_type k = radix_traits<T>::to_key(v);
+  if (Order < 0) {
+    k = ~k;
+  }
+  return static_cast<unsigned>(k >> shift) & ((1u << Bits) - 1);
 }
-static unsigned int scanLocalMemAndTotal(unsigned int val, unsigned int* lmem, unsigned int *totalSum, int exclusive, hc::tiled_index< 1 > t_idx) [[hc]]
-{
-	// Set first half of local memory to zero to make room for scanning
-	int l_id = t_idx.local[ 0 ];
-	int l_size = WG_SIZE;
-	lmem[l_id] = 0;
-
-	l_id += l_size;
-	lmem[l_id] = val;
-	t_idx.barrier.wait();
-
-	unsigned int t;
-	for (int i = 1; i < l_size; i *= 2)
-	{
-		t = lmem[l_id -  i]; 
-		t_idx.barrier.wait();
-		lmem[l_id] += t;     
-		t_idx.barrier.wait();
-	}
-	*totalSum = lmem[l_size*2 - 1];
-	return lmem[l_id-exclusive];
-}
-static unsigned int prefixScanVectorEx( uint_4* data ) [[hc]]
-{
-	unsigned int sum = 0;
-	unsigned int tmp = data[0].x;
-	data[0].x = sum;
-	sum += tmp;
-	tmp = data[0].y;
-	data[0].y = sum;
-	sum += tmp;
-	tmp = data[0].z;
-	data[0].z = sum;
-	sum += tmp;
-	tmp = data[0].w;
-	data[0].w = sum;
-	sum += tmp;
-	return sum;
+
+// number of elements of data in [left, right) ordered before v, or not after
+// v when upper is set
+template<typename T, typename Container, typename Compare>
+inline unsigned sort_bound(const Container& data, unsigned left, unsigned right,
+                           const T& v, const Compare& comp, bool upper) __CPU__ __HC__ {
+  const unsigned begin = left;
+  while (left < right) {
+    const unsigned mid = left + (right - left) / 2;
+    if (upper ? !comp(v, data[mid]) : comp(data[mid], v)) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  return left - begin;
 }
-static uint_4 localPrefixSum256V( uint_4 pData, unsigned int lIdx, unsigned int* totalSum, unsigned int* sorterSharedMemory, hc::tiled_index< 1 > t_idx ) [[hc]]
-{
-	unsigned int s4 = prefixScanVectorEx( &pData );
-	unsigned int rank = scanLocalMemAndTotal( s4, sorterSharedMemory, totalSum,  1, t_idx);
-	return pData + make_uint4( rank, rank, rank, rank );
+
+// Merge path: number of elements of the run [aBegin, aEnd) of a among the
+// first diag elements of its merge with the run [bBegin, bEnd) of b.  The
+// elements of the first run go before the equal elements of the second one.
+template<typename ContainerA, typename ContainerB, typename Compare>
+inline unsigned merge_path(const ContainerA& a, unsigned aBegin, unsigned aEnd,
+                           const ContainerB& b, unsigned bBegin, unsigned bEnd,
+                           unsigned diag, const Compare& comp) __CPU__ __HC__ {
+  const unsigned bCount = bEnd - bBegin;
+  unsigned low = diag > bCount ? diag - bCount : 0;
+  unsigned high = diag < aEnd - aBegin ? diag : aEnd - aBegin;
+  while (low < high) {
+    const unsigned mid = low + (high - low) / 2;
+    if (comp(b[bBegin + diag - mid - 1], a[aBegin + mid])) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
 }
-static void sort4BitsKeyValueAscending(unsigned int sortData[4],  const int startBit, int lIdx,  unsigned int* ldsSortData,  bool Asc_sort, hc::tiled_index< 1 > t_idx) [[hc]]
-{
-	for(int bitIdx=0; bitIdx<BITS_PER_PASS; bitIdx++)
-	{
-		unsigned int mask = (1<<bitIdx);
-		uint_4 prefixSum;
-		uint_4 cmpResult( (sortData[0]>>startBit) & mask, (sortData[1]>>startBit) & mask, (sortData[2]>>startBit) & mask, (sortData[3]>>startBit) & mask );
-		uint_4 temp;
-
-		if(!Asc_sort)
-		{
-			temp.x = (cmpResult.x != mask);
-			temp.y = (cmpResult.y != mask);
-			temp.z = (cmpResult.z != mask);
-			temp.w = (cmpResult.w != mask);
-		}
-		else
-		{
-			temp.x = (cmpResult.x != 0);
-			temp.y = (cmpResult.y != 0);
-			temp.z = (cmpResult.z != 0);
-			temp.w = (cmpResult.w != 0);
-		}
-                    uint_4 arg1 = make_uint4(1,1,1,1);
-                    uint_4 arg2 = make_uint4(0,0,0,0);
-		prefixSum = SELECT_UINT4( arg1, arg2, temp );//(cmpResult != make_uint4(mask,mask,mask,mask)));
-
-		unsigned int total = 0;
-		prefixSum = localPrefixSum256V( prefixSum, lIdx, &total, ldsSortData, t_idx);
-		{
-			uint_4 localAddr(lIdx*4+0,lIdx*4+1,lIdx*4+2,lIdx*4+3);
-			uint_4 dstAddr = localAddr - prefixSum + make_uint4( total, total, total, total );
-			if(!Asc_sort)
-			{
-				temp.x = (cmpResult.x != mask);
-				temp.y = (cmpResult.y != mask);
-				temp.z = (cmpResult.z != mask);
-				temp.w = (cmpResult.w != mask);
-				}
-			else
-			{
-				temp.x = (cmpResult.x != 0);
-				temp.y = (cmpResult.y != 0);
-				temp.z = (cmpResult.z != 0);
-				temp.w = (cmpResult.w != 0);
-			}
-			dstAddr = SELECT_UINT4( prefixSum, dstAddr, temp);
-
-			t_idx.barrier.wait();
-    
-			ldsSortData[dstAddr.x] = sortData[0];
-			ldsSortData[dstAddr.y] = sortData[1];
-			ldsSortData[dstAddr.z] = sortData[2];
-			ldsSortData[dstAddr.w] = sortData[3];
-
-			t_idx.barrier.wait();
-
-			sortData[0] = ldsSortData[localAddr.x];
-			sortData[1] = ldsSortData[localAddr.y];
-			sortData[2] = ldsSortData[localAddr.z];
-			sortData[3] = ldsSortData[localAddr.w];
-
-			t_idx.barrier.wait();
-		}
-	}
+
+// both runs in data
+template<typename Container, typename Compare>
+inline unsigned merge_path(const Container& data, unsigned aBegin, unsigned aEnd,
+                           unsigned bBegin, unsigned bEnd, unsigned diag,
+                           const Compare& comp) __CPU__ __HC__ {
+  return merge_path(data, aBegin, aEnd, data, bBegin, bEnd, diag, comp);
 }
 
-static void sort4BitsSignedKeyValueAscending(unsigned int sortData[4],  const int startBit, int lIdx,  unsigned int* ldsSortData, bool Asc_sort, hc::tiled_index< 1 > t_idx) [[hc]]
-{
-	unsigned int signedints[4];
-    signedints[0] = ( ( ( (sortData[0] >> startBit) & 0x7 ) ^ 0x7 ) & 0x7 ) | ((sortData[0] >> startBit) & (1<<3));
-    signedints[1] = ( ( ( (sortData[1] >> startBit) & 0x7 ) ^ 0x7 ) & 0x7 ) | ((sortData[1] >> startBit) & (1<<3));
-    signedints[2] = ( ( ( (sortData[2] >> startBit) & 0x7 ) ^ 0x7 ) & 0x7 ) | ((sortData[2] >> startBit) & (1<<3));
-    signedints[3] = ( ( ( (sortData[3] >> startBit) & 0x7 ) ^ 0x7 ) & 0x7 ) | ((sortData[3] >> startBit) & (1<<3));
-
-
-
-	for(int bitIdx=0; bitIdx<BITS_PER_PASS; bitIdx++)
-	{
-		unsigned int mask = (1<<bitIdx);
-		uint_4 prefixSum;
-		uint_4 cmpResult( signedints[0] & mask, signedints[1] & mask, signedints[2] & mask, signedints[3] & mask );
-		uint_4 temp;
-
-		if(!Asc_sort)
-		{
-			temp.x = (cmpResult.x != 0);
-			temp.y = (cmpResult.y != 0);
-			temp.z = (cmpResult.z != 0);
-			temp.w = (cmpResult.w != 0);
-		}
-		else
-		{
-			temp.x = (cmpResult.x != mask);
-			temp.y = (cmpResult.y != mask);
-			temp.z = (cmpResult.z != mask);
-			temp.w = (cmpResult.w != mask);
-		}
-                    uint_4 arg1 = make_uint4(1,1,1,1);
-                    uint_4 arg2 = make_uint4(0,0,0,0);
-		prefixSum = SELECT_UINT4( arg1, arg2, temp );//(cmpResult != make_uint4(mask,mask,mask,mask)));
-
-		unsigned int total = 0;
-		prefixSum = localPrefixSum256V( prefixSum, lIdx, &total, ldsSortData, t_idx);
-		{
-			uint_4 localAddr(lIdx*4+0,lIdx*4+1,lIdx*4+2,lIdx*4+3);
-			uint_4 dstAddr = localAddr - prefixSum + make_uint4( total, total, total, total );
-			if(!Asc_sort)
-			{
-				temp.x = (cmpResult.x != 0);
-				temp.y = (cmpResult.y != 0);
-				temp.z = (cmpResult.z != 0);
-				temp.w = (cmpResult.w != 0);
-				}
-			else
-			{
-				temp.x = (cmpResult.x != mask);
-				temp.y = (cmpResult.y != mask);
-				temp.z = (cmpResult.z != mask);
-				temp.w = (cmpResult.w != mask);
-			}
-			dstAddr = SELECT_UINT4( prefixSum, dstAddr, temp);
-
-			t_idx.barrier.wait();
-    
-			ldsSortData[dstAddr.x] = sortData[0];
-			ldsSortData[dstAddr.y] = sortData[1];
-			ldsSortData[dstAddr.z] = sortData[2];
-			ldsSortData[dstAddr.w] = sortData[3];
-
-			t_idx.barrier.wait();
-
-			sortData[0] = ldsSortData[localAddr.x];
-			sortData[1] = ldsSortData[localAddr.y];
-			sortData[2] = ldsSortData[localAddr.z];
-			sortData[3] = ldsSortData[localAddr.w];
-
-			t_idx.barrier.wait();
-
-			ldsSortData[dstAddr.x] = signedints[0];
-			ldsSortData[dstAddr.y] = signedints[1];
-			ldsSortData[dstAddr.z] = signedints[2];
-			ldsSortData[dstAddr.w] = signedints[3];
-
-			t_idx.barrier.wait();
-			signedints[0] = ldsSortData[localAddr.x];
-			signedints[1] = ldsSortData[localAddr.y];
-			signedints[2] = ldsSortData[localAddr.z];
-			signedints[3] = ldsSortData[localAddr.w];
-			t_idx.barrier.wait();
-		}
-	}
+// Write the elements [diag, diagEnd) of the merge of the runs [aBegin, aEnd)
+// and [bBegin, bEnd) of src to dst, from out.  The values, if any, follow
+// their keys.
+template<bool HasValues, typename KeyIn, typename KeyOut, typename ValueIn,
+         typename ValueOut, typename Compare>
+inline void merge_path_copy(const KeyIn& src, const KeyOut& dst,
+                            const ValueIn& srcValues, const ValueOut& dstValues,
+                            unsigned aBegin, unsigned aEnd, unsigned bBegin, unsigned bEnd,
+                            unsigned diag, unsigned diagEnd, unsigned out,
+                            const Compare& comp) __CPU__ __HC__ {
+  unsigned i = aBegin + merge_path(src, aBegin, aEnd, bBegin, bEnd, diag, comp);
+  unsigned j = bBegin + diag - (i - aBegin);
+  for (unsigned k = diag; k < diagEnd; ++k, ++out) {
+    const bool fromA = (j >= bEnd) || ((i < aEnd) && !comp(src[j], src[i]));
+    const unsigned from = fromA ? i++ : j++;
+    dst[out] = src[from];
+    if (HasValues) {
+      dstValues[out] = srcValues[from];
+    }
+  }
 }
 
 
-static unsigned int scanlMemPrivData( unsigned int val,  unsigned int* lmem, int exclusive, 
-                            hc::tiled_index< 1 > t_idx) restrict (amp)
-{
-	// Set first half of local memory to zero to make room for scanning
-	unsigned int lIdx = t_idx.local[ 0 ];
-	unsigned int wgSize = WG_SIZE;
-	lmem[lIdx] = 0;
-
-	lIdx += wgSize;
-	lmem[lIdx] = val;
-	t_idx.barrier.wait();
-
-	// Now, perform Kogge-Stone scan
-	 unsigned int t;
-	for (unsigned int i = 1; i < wgSize; i *= 2)
-	{
-		t = lmem[lIdx -  i]; 
-		t_idx.barrier.wait();
-		lmem[lIdx] += t;     
-		t_idx.barrier.wait();
-	}
-	return lmem[lIdx-exclusive];
+// LSD radix sort on the accelerator, RADIX_BITS per pass.
+//
+// The input is split in numTiles contiguous ranges.  Each pass counts the
+// digits of every range, scans the counts (digit major) to get where the
+// elements of a digit and range go, then each range is scattered in order,
+// SORT_TILE_SIZE elements at a time, which keeps the pass stable.  The
+// passes where all the elements have the same digit are skipped.
+// With HasValues, values is permuted like data.
+template<typename T, int Order, typename V, bool HasValues>
+void radix_sort_hsa(hc::array_view<T>& data, hc::array_view<V>& values, unsigned N) {
+  typedef radix_traits<T> traits;
+  const int passes = traits::bits / RADIX_BITS;
+  const unsigned chunks = (N + SORT_TILE_SIZE - 1) / SORT_TILE_SIZE;
+  const unsigned numTiles = std::min<unsigned>(chunks, RADIX_MAX_TILES);
+  const unsigned rangeSize = (chunks + numTiles - 1) / numTiles * SORT_TILE_SIZE;
+  const unsigned histSize = numTiles * RADIX_BUCKETS;
+
+  // digits of all the passes in one go, to find the trivial ones
+  std::vector<unsigned> counts(passes * RADIX_BUCKETS, 0);
+  hc::array_view<unsigned> counts_(hc::extent<1>(passes * RADIX_BUCKETS), counts);
+  kernel_launch(numTiles * SORT_TILE_SIZE,
+                [data, counts_, N, rangeSize, passes](hc::tiled_index<1> t_idx) [[hc]] {
+    tile_static unsigned local[64 / RADIX_BITS * RADIX_BUCKETS];
+    const unsigned l = t_idx.local[0];
+    const unsigned begin = t_idx.tile[0] * rangeSize;
+    const unsigned end = begin + rangeSize < N ? begin + rangeSize : N;
+    for (int i = l; i < passes * RADIX_BUCKETS; i += SORT_TILE_SIZE) {
+      local[i] = 0;
+    }
+    t_idx.barrier.wait();
+    for (unsigned i = begin + l; i < end; i += SORT_TILE_SIZE) {
+      const T v = data[i];
+      for (int p = 0; p < passes; ++p) {
+        hc::atomic_fetch_add(&local[p * RADIX_BUCKETS + radix_digit<T, Order, RADIX_BITS>(v, p * RADIX_BITS)], 1u);
+      }
+    }
+    t_idx.barrier.wait();
+    for (int i = l; i < passes * RADIX_BUCKETS; i += SORT_TILE_SIZE) {
+      if (local[i]) {
+        hc::atomic_fetch_add(&counts_[i], local[i]);
+      }
+    }
+  }, SORT_TILE_SIZE);
+  counts_.synchronize();
+
+  hc::array_view<T> tmp((hc::extent<1>(N)));
+  hc::array_view<V> tmpValues((hc::extent<1>(HasValues ? N : 1)));
+  hc::array_view<unsigned> hist((hc::extent<1>(histSize)));
+  hc::array_view<T> src = data, dst = tmp;
+  hc::array_view<V> srcValues = values, dstValues = tmpValues;
+  bool inData = true;
+  for (int p = 0; p < passes; ++p) {
+    const int shift = p * RADIX_BITS;
+    bool trivial = false;
+    for (int d = 0; d < RADIX_BUCKETS; ++d) {
+      trivial |= (counts[p * RADIX_BUCKETS + d] == N);
+    }
+    if (trivial) {
+      continue;
+    }
+
+    // digits of each range
+    kernel_launch(numTiles * SORT_TILE_SIZE,
+                  [src, hist, N, rangeSize, numTiles, shift](hc::tiled_index<1> t_idx) [[hc]] {
+      tile_static unsigned local[RADIX_BUCKETS];
+      const unsigned l = t_idx.local[0];
+      const unsigned tile = t_idx.tile[0];
+      const unsigned begin = tile * rangeSize;
+      const unsigned end = begin + rangeSize < N ? begin + rangeSize : N;
+      if (l < RADIX_BUCKETS) {
+        local[l] = 0;
+      }
+      t_idx.barrier.wait();
+      for (unsigned i = begin + l; i < end; i += SORT_TILE_SIZE) {
+        hc::atomic_fetch_add(&local[radix_digit<T, Order, RADIX_BITS>(src[i], shift)], 1u);
+      }
+      t_idx.barrier.wait();
+      if (l < RADIX_BUCKETS) {
+        hist[l * numTiles + tile] = local[l];
+      }
+    }, SORT_TILE_SIZE);
+
+    scan_counts_hsa(hist, histSize);
+
+    // scatter, the rank of an element within its digit comes from a scan of
+    // 16-bit counters, four digits per 64-bit word
+    kernel_launch(numTiles * SORT_TILE_SIZE,
+                  [src, dst, srcValues, dstValues, hist, N, rangeSize, numTiles, shift]
+                  (hc::tiled_index<1> t_idx) [[hc]] {
+      tile_static uint64_t ranks[RADIX_BUCKETS / 4][SORT_TILE_SIZE];
+      tile_static unsigned base[RADIX_BUCKETS];
+      const unsigned l = t_idx.local[0];
+      const unsigned tile = t_idx.tile[0];
+      const unsigned begin = tile * rangeSize;
+      const unsigned end = begin + rangeSize < N ? begin + rangeSize : N;
+      if (l < RADIX_BUCKETS) {
+        base[l] = hist[l * numTiles + tile];
+      }
+      for (unsigned chunk = begin; chunk < end; chunk += SORT_TILE_SIZE) {
+        const unsigned i = chunk + l;
+        const bool valid = i < end;
+        const T v = src[valid ? i : chunk];
+        const unsigned d = radix_digit<T, Order, RADIX_BITS>(v, shift);
+        for (int w = 0; w < RADIX_BUCKETS / 4; ++w) {
+          ranks[w][l] = (valid && (d / 4 == unsigned(w))) ? (uint64_t(1) << (16 * (d % 4))) : 0;
+        }
+        t_idx.barrier.wait();
+        for (unsigned offset = 1; offset < SORT_TILE_SIZE; offset *= 2) {
+          uint64_t other[RADIX_BUCKETS / 4];
+          for (int w = 0; w < RADIX_BUCKETS / 4; ++w) {
+            other[w] = l >= offset ? ranks[w][l - offset] : 0;
+          }
+          t_idx.barrier.wait();
+          for (int w = 0; w < RADIX_BUCKETS / 4; ++w) {
+            ranks[w][l] += other[w];
+          }
+          t_idx.barrier.wait();
+        }
+        if (valid) {
+          const unsigned rank = static_cast<unsigned>(ranks[d / 4][l] >> (16 * (d % 4))) & 0xffff;
+          dst[base[d] + rank - 1] = v;
+          if (HasValues) {
+            dstValues[base[d] + rank - 1] = srcValues[i];
+          }
+        }
+        t_idx.barrier.wait();
+        if (l < RADIX_BUCKETS) {
+          base[l] += static_cast<unsigned>(ranks[l / 4][SORT_TILE_SIZE - 1] >> (16 * (l % 4))) & 0xffff;
+        }
+        t_idx.barrier.wait();
+      }
+    }, SORT_TILE_SIZE);
+
+    std::swap(src, dst);
+    std::swap(srcValues, dstValues);
+    inData = !inData;
+  }
+
+  if (!inData) {
+    kernel_launch(N, [src, data, srcValues, values](hc::index<1> idx) [[hc]] {
+      data[idx] = src[idx];
+      if (HasValues) {
+        values[idx] = srcValues[idx];
+      }
+    });
+  }
+  data.synchronize();
+  if (HasValues) {
+    values.synchronize();
+  }
 }
 
-typedef struct _b3ConstData
-{
-   int m_n;
-   int m_nWGs;
-   int m_startBit;
-   int m_nBlocksPerWG;
-} b3ConstData;
-
-template<typename InputIt, typename Compare>
-void sort_enqueue_int_uint(InputIt &first, InputIt &last, Compare comp, bool int_flag)
-{
-  
-	typedef typename std::iterator_traits< InputIt >::value_type Values;
-    const int RADIX = 4;
-    int orig_szElements = static_cast<int>(std::distance(first, last));
-	const unsigned int localSize  = WG_SIZE;
-
-	unsigned int szElements = (unsigned int)orig_szElements;
-    unsigned int modWgSize = (szElements & ((localSize)-1));
-    if( modWgSize )
-    {
-        szElements &= ~modWgSize;
-        szElements += (localSize);
+// Merge sort on the accelerator.  Each tile sorts SORT_TILE_SIZE elements in
+// tile_static memory: an element finds its place in the merged run from its
+// rank in the other run.  Then runs are merged pairwise along merge paths,
+// MERGE_PATH_ITEMS elements per work-item.  The elements of the left run go
+// before the equal elements of the right run, so the sort is stable.
+// With HasValues, values is permuted like data.
+template<typename T, typename Compare, typename V, bool HasValues>
+void merge_sort_hsa(hc::array_view<T>& data, hc::array_view<V>& values, unsigned N,
+                    const Compare& comp) {
+  const unsigned chunks = (N + SORT_TILE_SIZE - 1) / SORT_TILE_SIZE;
+  kernel_launch(chunks * SORT_TILE_SIZE, [data, values, N, comp](hc::tiled_index<1> t_idx) [[hc]] {
+    tile_static T buffer[2][SORT_TILE_SIZE];
+    tile_static V valueBuffer[HasValues ? 2 : 1][HasValues ? SORT_TILE_SIZE : 1];
+    const unsigned l = t_idx.local[0];
+    const unsigned begin = t_idx.tile[0] * SORT_TILE_SIZE;
+    const unsigned count = N - begin < SORT_TILE_SIZE ? N - begin : SORT_TILE_SIZE;
+    if (l < count) {
+      buffer[0][l] = data[begin + l];
+      if (HasValues) {
+        valueBuffer[0][l] = values[begin + l];
+      }
+    }
+    t_idx.barrier.wait();
+    int in = 0;
+    for (unsigned width = 1; width < SORT_TILE_SIZE; width *= 2) {
+      if (l < count) {
+        const T v = buffer[in][l];
+        const unsigned start = l / (2 * width) * (2 * width);
+        const bool left = (l - start) < width;
+        const unsigned mid = start + width < count ? start + width : count;
+        const unsigned end = start + 2 * width < count ? start + 2 * width : count;
+        const unsigned pos = left ? l + sort_bound(buffer[in], mid, end, v, comp, false)
+                                  : start + (l - mid) + sort_bound(buffer[in], start, mid, v, comp, true);
+        buffer[1 - in][pos] = v;
+        if (HasValues) {
+          valueBuffer[1 - in][pos] = valueBuffer[in][l];
+        }
+      }
+      in = 1 - in;
+      t_idx.barrier.wait();
+    }
+    if (l < count) {
+      data[begin + l] = buffer[in][l];
+      if (HasValues) {
+        values[begin + l] = valueBuffer[in][l];
+      }
+    }
+  }, SORT_TILE_SIZE);
+
+  if (N <= SORT_TILE_SIZE) {
+    data.synchronize();
+    if (HasValues) {
+      values.synchronize();
     }
-	unsigned int numGroups = (szElements/localSize)>= 32?(32*8):(szElements/localSize);
-
-    hc::array_view<Values> dvSwapInputValues((hc::extent<1>(orig_szElements)));
-    hc::array_view<int> dvHistogramBins(hc::extent<1>(numGroups * RADICES));
-
-	bool Asc_sort = 0;
-	if(comp(2,3))
-       Asc_sort = 1;
-	int swap = 0;
-    unsigned int blockSize = (int)(ELEMENTS_PER_WORK_ITEM*localSize);
-    unsigned int nBlocks = (int)(orig_szElements + blockSize-1)/(blockSize);
-    b3ConstData cdata;
-	cdata.m_n = (int)orig_szElements;
-	cdata.m_nWGs = (int)numGroups;
-	cdata.m_nBlocksPerWG = (int)(nBlocks + numGroups - 1)/numGroups;
-    if(nBlocks < numGroups)
-    {
-		cdata.m_nBlocksPerWG = 1;
-		numGroups = nBlocks;
-        cdata.m_nWGs = numGroups;
-	}
-
-	int bits;
-    auto f_ = utils::get_pointer(first);
-    hc::array_view<Values> first_(hc::extent<1>(orig_szElements), f_);
-	for(bits = 0; bits < (sizeof(Values) * 8); bits += RADIX)
-    {
-          cdata.m_startBit = bits;
-		  kernel_launch( numGroups * localSize, 
-				[
-					first_,
-					dvSwapInputValues,
-					dvHistogramBins,
-					cdata,
-					swap,
-					Asc_sort,
-					int_flag,
-                    numGroups
-				] ( hc::tiled_index< 1 > t_idx ) [[hc]]
-		  {
-			tile_static unsigned int lmem[WG_SIZE*RADICES];
-			unsigned int gIdx = t_idx.global[ 0 ];
-			unsigned int lIdx = t_idx.local[ 0 ];
-			unsigned int wgIdx = t_idx.tile[ 0 ];
-			unsigned int localSize = t_idx.tile_dim[ 0 ];
-
-			const int shift = cdata.m_startBit;
-			const int dataAlignment = 1024;
-			const int n = cdata.m_n;
-			const int w_n = n + dataAlignment-(n%dataAlignment);
-			const int nWGs = cdata.m_nWGs;
-			const int nBlocksPerWG = cdata.m_nBlocksPerWG;
-
-			for(int i=0; i<RADICES; i++)
-			{
-				lmem[i*localSize+ lIdx] = 0;
-			}
-			t_idx.barrier.wait();
-			const int blockSize = ELEMENTS_PER_WORK_ITEM*localSize;
-			int nBlocks = (w_n)/blockSize - nBlocksPerWG*wgIdx;
-			int addr = blockSize*nBlocksPerWG*wgIdx + lIdx;
-			unsigned int local_key;
-			for(int iblock=0; iblock<_min(nBlocksPerWG, nBlocks); iblock++)
-			{
-				for(int i=0; i<ELEMENTS_PER_WORK_ITEM; i++, addr+=localSize )
-				{
-					if( (addr) < n)
-					{
-						if(int_flag && (shift >= sizeof(Values) * 7))
-						{
-							 if(swap == 0)
-								local_key = (first_[addr] >> shift);
-							 else
-								local_key = (dvSwapInputValues[addr] >> shift);
-				             unsigned int signBit   = local_key & (1<<3);
-							 if(!Asc_sort)
-									local_key = 0xF - (( ( ( local_key & 0x7 ) ^ 0x7 ) & 0x7 ) | signBit);
-							 else
-									local_key = 0xF - (( ( ( local_key & 0x7 ) ^ 0x7 ) & 0x7 ) | signBit);
-						}
-						else
-						{
-							if(swap == 0)
-								local_key = (first_[addr] >> shift) & 0xFU;
-							else
-								local_key = (dvSwapInputValues[addr] >> shift) & 0xFU;
-						}
-						if(!Asc_sort)
-							lmem[(RADICES - local_key -1)*localSize+ lIdx]++;   
-						else
-							lmem[local_key*localSize+ lIdx]++;
-					}
-				}
-			}
-			t_idx.barrier.wait();
-			if( lIdx < RADICES )
-			{
-				unsigned int sum = 0;
-				for(unsigned int i=0; i<localSize; i++)
-				{
-					sum += lmem[lIdx*localSize+ i];
-				}
-				dvHistogramBins[lIdx * numGroups + wgIdx] = sum;
-			}
-		}, localSize);
-
-	
-		kernel_launch( numGroups * localSize, 
-				[
-					dvHistogramBins,
-					numGroups
-				] ( hc::tiled_index< 1 > t_idx ) [[hc]]
-		  {
-
-			unsigned int lIdx = t_idx.local[ 0 ];
-			unsigned int llIdx = lIdx;
-			unsigned int wgSize = t_idx.tile_dim[ 0 ];
-
-			tile_static unsigned int lmem[WG_SIZE*8];
-			tile_static int s_seed; 
-			s_seed = 0;
-			t_idx.barrier.wait();
-    
-			bool last_thread = (lIdx < numGroups && (lIdx+1) == numGroups) ? 1 : 0;
-			for (int d = 0; d < 16; d++)
-			{
-				unsigned int val = 0;
-				if (lIdx < numGroups)
-					val = dvHistogramBins[(numGroups * d) + lIdx];
-				unsigned int res =  scanlMemPrivData(val, lmem,1, t_idx);
-				if (lIdx < numGroups)
-					dvHistogramBins[(numGroups * d) + lIdx] = res + s_seed;
-				if (last_thread) 
-					s_seed += res + val;
-				t_idx.barrier.wait();
-			}
-
-		}, localSize);
-		if((bits >= sizeof(Values) * 7) && int_flag)
-			break;
-		kernel_launch( localSize, 
-				[
-					first_,
-					dvSwapInputValues,
-					dvHistogramBins,
-					cdata,
-					swap,
-					Asc_sort
-				] ( hc::tiled_index< 1 > t_idx ) [[hc]]
-		  {
-
-			tile_static unsigned int ldsSortData[WG_SIZE*ELEMENTS_PER_WORK_ITEM+16];
-			tile_static unsigned int localHistogramToCarry[NUM_BUCKET];
-			tile_static unsigned int localHistogram[NUM_BUCKET*2];
-
-			unsigned int gIdx = t_idx.global[ 0 ];
-			unsigned int lIdx = t_idx.local[ 0 ];
-			unsigned int wgIdx = t_idx.tile[ 0 ];
-			unsigned int localSize = t_idx.tile_dim[ 0 ];
-
-			const int dataAlignment = 1024;
-			const int n = cdata.m_n;
-			const int w_n = n + dataAlignment-(n%dataAlignment);
-
-			const int nWGs = cdata.m_nWGs;
-			const int startBit = cdata.m_startBit;
-			const int nBlocksPerWG = cdata.m_nBlocksPerWG;
-
-			if( lIdx < (NUM_BUCKET) )
-			{
-				if(!Asc_sort)
-					localHistogramToCarry[lIdx] = dvHistogramBins[(NUM_BUCKET - lIdx -1)*nWGs + wgIdx]; 
-				else
-					localHistogramToCarry[lIdx] = dvHistogramBins[lIdx*nWGs + wgIdx];
-			}
-
-			t_idx.barrier.wait();
-			const int blockSize = ELEMENTS_PER_WORK_ITEM*WG_SIZE;
-			int nBlocks = w_n/blockSize - nBlocksPerWG*wgIdx;
-			int addr = blockSize*nBlocksPerWG*wgIdx + ELEMENTS_PER_WORK_ITEM*lIdx;
-			for(int iblock=0; iblock<_min(nBlocksPerWG, nBlocks); iblock++, addr+=blockSize)
-			{
-				unsigned int myHistogram = 0;
-				unsigned int sortData[ELEMENTS_PER_WORK_ITEM];
-				for(int i=0; i<ELEMENTS_PER_WORK_ITEM; i++)
-				{
-					if(!Asc_sort)
-					{
-						if(swap == 0)
-						{
-							sortData[i] = ( addr+i < n )? first_[ addr+i ] : 0x0;
-						}
-						else
-						{
-							sortData[i] = ( addr+i < n )? dvSwapInputValues[ addr+i ] : 0x0;
-						}
-					}
-					else
-					{
-						if(swap == 0)
-						{
-							sortData[i] = ( addr+i < n )? first_[ addr+i ] : 0xffffffff;
-						}
-						else
-						{
-							sortData[i] = ( addr+i < n )? dvSwapInputValues[ addr+i ] : 0xffffffff;
-						}
-					}
-				}
-				sort4BitsKeyValueAscending(sortData, startBit, lIdx, ldsSortData, Asc_sort, t_idx);
-
-				unsigned int keys[ELEMENTS_PER_WORK_ITEM];
-				for(int i=0; i<ELEMENTS_PER_WORK_ITEM; i++)
-					keys[i] = (sortData[i]>>startBit) & 0xf;
-				
-				{	
-					unsigned int setIdx = lIdx/16;
-					if( lIdx < NUM_BUCKET )
-					{
-						localHistogram[lIdx] = 0;
-					}
-					ldsSortData[lIdx] = 0;
-					t_idx.barrier.wait();
-					
-					for(int i=0; i<ELEMENTS_PER_WORK_ITEM; i++)
-					{
-						if( addr+i < n )
-						{
-							if(!Asc_sort)
-								AtomInc( SET_HISTOGRAM( setIdx, (NUM_BUCKET - keys[i] - 1) ) );
-							else
-								AtomInc( SET_HISTOGRAM( setIdx, keys[i] ) );
-						}
-					}
-					t_idx.barrier.wait();
-					unsigned int hIdx = NUM_BUCKET+lIdx;
-					if( lIdx < NUM_BUCKET )
-					{
-						unsigned int sum = 0;
-						for(int i=0; i<WG_SIZE/16; i++)
-						{
-							sum += SET_HISTOGRAM( i, lIdx );
-						}
-						myHistogram = sum;
-						localHistogram[hIdx] = sum;
-					}
-					t_idx.barrier.wait();
-					if( lIdx < NUM_BUCKET )
-					{
-						localHistogram[hIdx] = localHistogram[hIdx-1];//may cause race condition
-					}
-					t_idx.barrier.wait();
-					unsigned int u0, u1, u2;
-					if( lIdx < NUM_BUCKET )
-					{
-						u0 = localHistogram[hIdx-3];
-						u1 = localHistogram[hIdx-2];
-						u2 = localHistogram[hIdx-1];
-					}
-					t_idx.barrier.wait();
-					if( lIdx < NUM_BUCKET )
-						localHistogram[hIdx] += u0 + u1 + u2;
-					t_idx.barrier.wait();
-					if( lIdx < NUM_BUCKET )
-					{
-						u0 = localHistogram[hIdx-12];
-						u1 = localHistogram[hIdx-8];
-						u2 = localHistogram[hIdx-4];
-					}
-					t_idx.barrier.wait();
-					if( lIdx < NUM_BUCKET )
-						localHistogram[hIdx] += u0 + u1 + u2;
-					t_idx.barrier.wait();
-				}
-				{
-					for(int ie=0; ie<ELEMENTS_PER_WORK_ITEM; ie++)
-					{
-						int dataIdx = ELEMENTS_PER_WORK_ITEM*lIdx+ie;
-						int binIdx;
-						int groupOffset;
-						if(!Asc_sort)
-						{
-							binIdx = NUM_BUCKET - keys[ie] - 1;
-							groupOffset = localHistogramToCarry[NUM_BUCKET - binIdx -1];
-						}
-						else
-						{
-							binIdx = keys[ie];
-							groupOffset = localHistogramToCarry[binIdx];
-						}
-						int myIdx = dataIdx - localHistogram[NUM_BUCKET+binIdx];
-						if( addr+ie < n )
-						{
-							if ((groupOffset + myIdx)<n)
-							{
-								if(swap == 0)
-								{
-									dvSwapInputValues[ groupOffset + myIdx ] =  sortData[ie]; 
-								}
-								else
-								{
-									first_[ groupOffset + myIdx ] = sortData[ie];
-								}
-							}
-						}
-					}
-				}
-				t_idx.barrier.wait();
-				if( lIdx < NUM_BUCKET )
-				{
-					if(!Asc_sort)
-						localHistogramToCarry[NUM_BUCKET - lIdx -1] += myHistogram;
-					else
-						localHistogramToCarry[lIdx] += myHistogram;
-				}
-				t_idx.barrier.wait();
-			}
-		 }, localSize);
-		 swap = swap? 0: 1;
-	}
-	if(int_flag)
-	{
-		cdata.m_startBit = bits;
-		kernel_launch( numGroups * localSize, 
-				[
-					first_,
-					dvSwapInputValues,
-					dvHistogramBins,
-					cdata,
-					swap,
-					Asc_sort
-				] ( hc::tiled_index< 1 > t_idx ) [[hc]]
-		  {
-
-			tile_static unsigned int ldsSortData[WG_SIZE*ELEMENTS_PER_WORK_ITEM+WG_SIZE];
-			tile_static unsigned int localHistogramToCarry[NUM_BUCKET];
-			tile_static unsigned int localHistogram[NUM_BUCKET*2];
-
-			unsigned int gIdx = t_idx.global[ 0 ];
-			unsigned int lIdx = t_idx.local[ 0 ];
-			unsigned int wgIdx = t_idx.tile[ 0 ];
-			unsigned int localSize = t_idx.tile_dim[0];
-
-			const int dataAlignment = 1024;
-			const int n = cdata.m_n;
-			const int w_n = n + dataAlignment-(n%dataAlignment);
-
-			const int nWGs = cdata.m_nWGs;
-			const int startBit = cdata.m_startBit;
-			const int nBlocksPerWG = cdata.m_nBlocksPerWG;
-
-			if( lIdx < (NUM_BUCKET) )
-			{
-				if(!Asc_sort)
-					localHistogramToCarry[lIdx] = dvHistogramBins[lIdx*nWGs + wgIdx];
-				else
-					localHistogramToCarry[lIdx] = dvHistogramBins[lIdx*nWGs + wgIdx];
-			}
-
-			t_idx.barrier.wait();
-			const int blockSize = ELEMENTS_PER_WORK_ITEM*WG_SIZE;
-			int nBlocks = w_n/blockSize - nBlocksPerWG*wgIdx;
-			int addr = blockSize*nBlocksPerWG*wgIdx + ELEMENTS_PER_WORK_ITEM*lIdx;
-
-			for(int iblock=0; iblock<_min(nBlocksPerWG, nBlocks); iblock++, addr+=blockSize)
-			{
-				unsigned int myHistogram = 0;
-				unsigned int sortData[ELEMENTS_PER_WORK_ITEM];
-				for(int i=0; i<ELEMENTS_PER_WORK_ITEM; i++)
-				{
-					if(!Asc_sort)
-					{
-						sortData[i] = ( addr+i < n )? dvSwapInputValues[ addr+i ] : 0x80000000;
-					}
-					else
-					{
-						sortData[i] = ( addr+i < n )? dvSwapInputValues[ addr+i ] : 0x7fffffff;
-					}
-				}
-				sort4BitsSignedKeyValueAscending(sortData, startBit, lIdx, ldsSortData, Asc_sort, t_idx);
-
-				unsigned int keys[ELEMENTS_PER_WORK_ITEM];
-				for(int i=0; i<ELEMENTS_PER_WORK_ITEM; i++)
-					keys[i] = 0xF - (( ( ( (sortData[i] >> startBit) & 0x7 ) ^ 0x7 ) & 0x7 ) | ((sortData[i] >> startBit) & (1<<3)) );
-				
-				{	
-					unsigned int setIdx = lIdx/16;
-					if( lIdx < NUM_BUCKET )
-					{
-						localHistogram[lIdx] = 0;
-					}
-					ldsSortData[lIdx] = 0;
-					t_idx.barrier.wait();
-					
-					for(int i=0; i<ELEMENTS_PER_WORK_ITEM; i++)
-					{
-						if( addr+i < n )
-						{
-							if(!Asc_sort)
-								AtomInc( SET_HISTOGRAM( setIdx, (NUM_BUCKET - keys[i] - 1) ) );
-							else
-								AtomInc( SET_HISTOGRAM( setIdx, keys[i] ) );
-						}
-					}
-					t_idx.barrier.wait();
-					unsigned int hIdx = NUM_BUCKET+lIdx;
-					if( lIdx < NUM_BUCKET )
-					{
-						unsigned int sum = 0;
-						for(int i=0; i<WG_SIZE/16; i++)
-						{
-							sum += SET_HISTOGRAM( i, lIdx );
-						}
-						myHistogram = sum;
-						localHistogram[hIdx] = sum;
-					}
-					t_idx.barrier.wait();
-					if( lIdx < NUM_BUCKET )
-					{
-						localHistogram[hIdx] = localHistogram[hIdx-1];
-					}
-					t_idx.barrier.wait();
-					unsigned int u0, u1, u2;
-					if( lIdx < NUM_BUCKET )
-					{
-						u0 = localHistogram[hIdx-3];
-						u1 = localHistogram[hIdx-2];
-						u2 = localHistogram[hIdx-1];
-					}
-					t_idx.barrier.wait();
-					if( lIdx < NUM_BUCKET )
-						localHistogram[hIdx] += u0 + u1 + u2;
-					t_idx.barrier.wait();
-					if( lIdx < NUM_BUCKET )
-					{
-						u0 = localHistogram[hIdx-12];
-						u1 = localHistogram[hIdx-8];
-						u2 = localHistogram[hIdx-4];
-					}
-					t_idx.barrier.wait();
-					if( lIdx < NUM_BUCKET )
-						localHistogram[hIdx] += u0 + u1 + u2;
-					t_idx.barrier.wait();
-				}
-				{
-					for(int ie=0; ie<ELEMENTS_PER_WORK_ITEM; ie++)
-					{
-						int dataIdx = ELEMENTS_PER_WORK_ITEM*lIdx+ie;
-						int binIdx;
-						int groupOffset;
-						if(!Asc_sort)
-						{
-							binIdx = 0xF - keys[ie];
-							groupOffset = localHistogramToCarry[binIdx];
-						}
-						else
-						{
-							binIdx = keys[ie];
-							groupOffset = localHistogramToCarry[binIdx];
-						}
-						int myIdx = dataIdx - localHistogram[NUM_BUCKET+binIdx];
-						if( addr+ie < n )
-						{
-							if ((groupOffset + myIdx)<n)
-							{
-									first_[ groupOffset + myIdx ] = sortData[ie];
-							}
-						}
-					}
-				}
-				t_idx.barrier.wait();
-				if( lIdx < NUM_BUCKET )
-				{
-					localHistogramToCarry[lIdx] += myHistogram;
-				}
-				t_idx.barrier.wait();
-			}
-		 }, localSize);
-	}
     return;
-}
+  }
 
+  hc::array_view<T> tmp((hc::extent<1>(N)));
+  hc::array_view<V> tmpValues((hc::extent<1>(HasValues ? N : 1)));
+  hc::array_view<T> src = data, dst = tmp;
+  hc::array_view<V> srcValues = values, dstValues = tmpValues;
+  bool inData = true;
+  // the runs are multiples of MERGE_PATH_ITEMS, a work-item stays in a pair
+  const unsigned items = (N + MERGE_PATH_ITEMS - 1) / MERGE_PATH_ITEMS;
+  for (unsigned width = SORT_TILE_SIZE; width < N; width *= 2) {
+    kernel_launch(items, [src, dst, srcValues, dstValues, N, width, comp](hc::index<1> idx) [[hc]] {
+      const unsigned out = idx[0] * MERGE_PATH_ITEMS;
+      const unsigned start = out / (2 * width) * (2 * width);
+      const unsigned mid = N - start > width ? start + width : N;
+      const unsigned end = N - start > 2 * width ? start + 2 * width : N;
+      const unsigned last = N - out > MERGE_PATH_ITEMS ? out + MERGE_PATH_ITEMS : N;
+      merge_path_copy<HasValues>(src, dst, srcValues, dstValues, start, mid, mid, end,
+                                 out - start, last - start, out, comp);
+    });
+    std::swap(src, dst);
+    std::swap(srcValues, dstValues);
+    inData = !inData;
+  }
 
-template<typename InputIt, typename Compare>
-typename std::enable_if<
-std::is_same<
-typename std::iterator_traits<InputIt >::value_type,
-         unsigned int >::value>::type
-sort_dispatch(InputIt first, InputIt last, Compare comp)
-{
-    sort_enqueue_int_uint(first, last, comp, 0);
-}
- 
-template<typename InputIt, typename Compare>
-typename std::enable_if<std::is_same<typename std::iterator_traits<InputIt>::value_type, int>::value>::type
-sort_dispatch(InputIt first, InputIt last, Compare comp)
-{
-    sort_enqueue_int_uint(first, last, comp, 1);
+  if (!inData) {
+    kernel_launch(N, [src, data, srcValues, values](hc::index<1> idx) [[hc]] {
+      data[idx] = src[idx];
+      if (HasValues) {
+        values[idx] = srcValues[idx];
+      }
+    });
+  }
+  data.synchronize();
+  if (HasValues) {
+    values.synchronize();
+  }
 }
 
+// LSD radix sort on the host, HOST_RADIX_BITS per pass: each thread counts
+// the digits of its range, then scatters it where the counts of all the
+// threads (digit major) say.  With HasValues, values is permuted like data.
+template<typename T, int Order, typename V, bool HasValues>
+void radix_sort_host(T* data, V* values, unsigned N) {
+  typedef radix_traits<T> traits;
+  const int passes = traits::bits / HOST_RADIX_BITS;
+  const unsigned threads = host_thread_count(N, HOST_SORT_GRAIN);
+  const unsigned rangeSize = (N + threads - 1) / threads;
+  std::vector<T> tmp(N);
+  std::vector<V> tmpValues(HasValues ? N : 0);
+  std::vector<unsigned> hist(threads * HOST_RADIX_BUCKETS);
+  T* src = data;
+  T* dst = tmp.data();
+  V* srcValues = values;
+  V* dstValues = tmpValues.data();
+  for (int p = 0; p < passes; ++p) {
+    const int shift = p * HOST_RADIX_BITS;
+    host_launch(threads, [&](unsigned t) {
+      unsigned* h = &hist[t * HOST_RADIX_BUCKETS];
+      std::fill(h, h + HOST_RADIX_BUCKETS, 0);
+      const unsigned end = std::min(N, (t + 1) * rangeSize);
+      for (unsigned i = t * rangeSize; i < end; ++i) {
+        h[radix_digit<T, Order, HOST_RADIX_BITS>(src[i], shift)]++;
+      }
+    });
+
+    // offsets, digit major, and skip the pass when all the digits are equal
+    bool trivial = false;
+    unsigned sum = 0;
+    for (int d = 0; d < HOST_RADIX_BUCKETS; ++d) {
+      unsigned total = 0;
+      for (unsigned t = 0; t < threads; ++t) {
+        const unsigned count = hist[t * HOST_RADIX_BUCKETS + d];
+        hist[t * HOST_RADIX_BUCKETS + d] = sum;
+        sum += count;
+        total += count;
+      }
+      trivial |= (total == N);
+    }
+    if (trivial) {
+      continue;
+    }
 
-template<typename InputIt, typename Compare>
-typename std::enable_if<
-    !(std::is_same< typename std::iterator_traits<InputIt >::value_type, unsigned int >::value
-   || std::is_same< typename std::iterator_traits<InputIt >::value_type,          int >::value
-    )
-    >::type
-sort_dispatch(const InputIt& first, const InputIt& last, const Compare& comp)
-{
-    typedef typename std::iterator_traits< InputIt >::value_type T;
-    size_t szElements = static_cast< size_t >( std::distance( first, last ) );
-
-    size_t wgSize  = BITONIC_SORT_WGSIZE;
-    if((szElements/2) < BITONIC_SORT_WGSIZE)
-        wgSize = (int)szElements/2;
-    unsigned int stage, passOfStage, numStages = 0;
-    for(size_t temp = szElements; temp > 1; temp >>= 1)
-        ++numStages;
-
-    auto f_ = utils::get_pointer(first);
-    hc::array_view<T> first_(hc::extent<1>(szElements), f_);
-    for(stage = 0; stage < numStages; ++stage)
-    {
-        for(passOfStage = 0; passOfStage < stage + 1; ++passOfStage) {
-            auto ker = [first_, szElements, comp, stage, passOfStage]
-                (hc::tiled_index<1> tidx) [[hc]]
-            {
-                int threadId = tidx.global[0];
-                int pairDistance = 1 << (stage - passOfStage);
-                int blockWidth = 2 * pairDistance;
-                int leftId = (threadId & (pairDistance - 1))
-                    + (threadId >> (stage - passOfStage) ) * blockWidth;
-
-
-                int rightId = leftId + pairDistance;
-                T leftElement = first_[leftId];
-                T rightElement = first_[rightId];
-                unsigned int sameDirectionBlockWidth = threadId >> stage;
-                unsigned int sameDirection = sameDirectionBlockWidth & 0x1;
-
-
-                int temp    = sameDirection?rightId:temp;
-                rightId = sameDirection?leftId:rightId;
-                leftId  = sameDirection?temp:leftId;
-
-                bool compareResult = comp(leftElement, rightElement);
-
-
-                T greater = compareResult?rightElement:leftElement;
-                T lesser  = compareResult?leftElement:rightElement;
-                first_[leftId] = lesser;
-                first_[rightId] = greater;
-            };
-            kernel_launch(szElements / 2, ker, wgSize);
+    host_launch(threads, [&](unsigned t) {
+      unsigned* offset = &hist[t * HOST_RADIX_BUCKETS];
+      const unsigned end = std::min(N, (t + 1) * rangeSize);
+      for (unsigned i = t * rangeSize; i < end; ++i) {
+        const unsigned pos = offset[radix_digit<T, Order, HOST_RADIX_BITS>(src[i], shift)]++;
+        dst[pos] = src[i];
+        if (HasValues) {
+          dstValues[pos] = srcValues[i];
         }
+      }
+    });
+    std::swap(src, dst);
+    std::swap(srcValues, dstValues);
+  }
+  if (src != data) {
+    std::copy(src, src + N, data);
+    if (HasValues) {
+      std::copy(srcValues, srcValues + N, values);
+    }
+  }
+}
+
+// Merge sort on the host: each thread sorts a range, then the ranges are
+// merged pairwise.  The output of every round is split evenly between the
+// threads along the merge paths, so all the threads merge until the end.
+// With HasValues, values is permuted like data: the ranges are sorted
+// through an index.
+template<typename T, typename Compare, typename V, bool HasValues, bool Stable>
+void merge_sort_host(T* data, V* values, unsigned N, const Compare& comp) {
+  const unsigned threads = host_thread_count(N, HOST_SORT_GRAIN);
+  const unsigned rangeSize = (N + threads - 1) / threads;
+  std::vector<T> tmp(N);
+  std::vector<V> tmpValues(HasValues ? N : 0);
+  host_launch(threads, [&](unsigned t) {
+    const unsigned begin = std::min(N, t * rangeSize);
+    const unsigned end = std::min(N, begin + rangeSize);
+    if (!HasValues) {
+      if (Stable) {
+        std::stable_sort(data + begin, data + end, comp);
+      } else {
+        std::sort(data + begin, data + end, comp);
+      }
+      return;
+    }
+    std::vector<unsigned> index(end - begin);
+    std::iota(index.begin(), index.end(), begin);
+    std::stable_sort(index.begin(), index.end(), [&](unsigned a, unsigned b) {
+      return comp(data[a], data[b]);
+    });
+    for (unsigned i = begin; i < end; ++i) {
+      tmp[i] = data[index[i - begin]];
+      tmpValues[i] = values[index[i - begin]];
+    }
+    std::copy(tmp.begin() + begin, tmp.begin() + end, data + begin);
+    std::copy(tmpValues.begin() + begin, tmpValues.begin() + end, values + begin);
+  });
+  if (threads == 1) {
+    return;
+  }
+
+  T* src = data;
+  T* dst = tmp.data();
+  V* srcValues = values;
+  V* dstValues = tmpValues.data();
+  for (unsigned width = rangeSize; width < N; width *= 2) {
+    host_launch(threads, [&](unsigned t) {
+      const unsigned first = static_cast<unsigned>(uint64_t(N) * t / threads);
+      const unsigned last = static_cast<unsigned>(uint64_t(N) * (t + 1) / threads);
+      for (unsigned out = first; out < last; ) {
+        const unsigned start = out / (2 * width) * (2 * width);
+        const unsigned mid = std::min(N, start + width);
+        const unsigned end = std::min(N, start + 2 * width);
+        const unsigned stop = std::min(last, end);
+        merge_path_copy<HasValues>(src, dst, srcValues, dstValues, start, mid, mid, end,
+                                   out - start, stop - start, out, comp);
+        out = stop;
+      }
+    });
+    std::swap(src, dst);
+    std::swap(srcValues, dstValues);
+  }
+  if (src != data) {
+    std::copy(src, src + N, data);
+    if (HasValues) {
+      std::copy(srcValues, srcValues + N, values);
     }
+  }
 }
-#endif
- 
+
+// Sort N keys, and the values along with them when HasValues.  The radix
+// sorts and the merge sorts on the accelerator are always stable.
+template<typename T, typename Compare, typename V, bool HasValues, bool Stable,
+         int Order = radix_order<T, Compare>::value>
+struct sort_dispatch {
+  static void sort(T* keys, V* values, unsigned N, const Compare& comp) {
+    if (use_hsa()) {
+      hc::array_view<T> keys_(hc::extent<1>(N), keys);
+      hc::array_view<V> values_ = HasValues ? hc::array_view<V>(hc::extent<1>(N), values)
+                                            : hc::array_view<V>(hc::extent<1>(1));
+      radix_sort_hsa<T, Order, V, HasValues>(keys_, values_, N);
+    } else {
+      radix_sort_host<T, Order, V, HasValues>(keys, values, N);
+    }
+  }
+};
+
+template<typename T, typename Compare, typename V, bool HasValues, bool Stable>
+struct sort_dispatch<T, Compare, V, HasValues, Stable, 0> {
+  static void sort(T* keys, V* values, unsigned N, const Compare& comp) {
+    if (use_hsa()) {
+      hc::array_view<T> keys_(hc::extent<1>(N), keys);
+      hc::array_view<V> values_ = HasValues ? hc::array_view<V>(hc::extent<1>(N), values)
+                                            : hc::array_view<V>(hc::extent<1>(1));
+      merge_sort_hsa<T, Compare, V, HasValues>(keys_, values_, N, comp);
+    } else {
+      merge_sort_host<T, Compare, V, HasValues, Stable>(keys, values, N, comp);
+    }
+  }
+};
+
 template<class InputIt, class Compare>
 void sort_impl(InputIt first, InputIt last, Compare comp, std::input_iterator_tag) {
     std::sort(first, last, comp);
 }
- 
 
+
+// parallel::sort: radix sort for the arithmetic types compared with
+// std::less or std::greater, merge sort otherwise
 template<class InputIt, class Compare>
 void sort_impl(InputIt first, InputIt last, Compare comp,
                std::random_access_iterator_tag) {
+  typedef typename std::iterator_traits<InputIt>::value_type T;
   unsigned N = std::distance(first, last);
-  if (N == 0)
-      return;
 
-  // FIXME sort algorithm implementation breaks Clang 4.0 as of now
-#if 0
   // call to std::sort when small data size
   if (N <= details::PARALLELIZE_THRESHOLD) {
       std::sort(first, last, comp);
+      return;
   }
-  sort_dispatch(first, last, comp);
-#endif
 
-  std::sort(first, last, comp);
+  auto first_ = utils::get_pointer(first);
+  sort_dispatch<T, Compare, unsigned char, false, false>::sort(first_, nullptr, N, comp);
 }
 
 
@@ -4,16 +4,6 @@
  */
 #pragma once
 
-#define _T_REDUCE_WAVEFRONT_SIZE 512
-
-#define _T_REDUCE_STEP(_LENGTH, _IDX, _W) \
-    if ((_IDX < _W) && ((_IDX + _W) < _LENGTH)) {\
-      T mine = scratch[_IDX];\
-      T other = scratch[_IDX + _W];\
-      scratch[_IDX] = binary_op(mine, other); \
-    }\
-    t_idx.barrier.wait();
-
 /**
  *
  * Return: GENERALIZED_SUM(binary_op, init, unary_op(*first), ..., unary_op(*(first + (last - first) - * 1))).
@@ -41,75 +31,7 @@ T transform_reduce(InputIterator first, InputIterator last,
     return std::accumulate(first, last, init, new_op);
   }
 
-  int max_ComputeUnits = 32;
-  int numTiles = max_ComputeUnits*32;
-  int length = (_T_REDUCE_WAVEFRONT_SIZE * numTiles);
-  length = N < length ? N : length;
-  unsigned int residual = length % _T_REDUCE_WAVEFRONT_SIZE;
-  length = residual ? (length + _T_REDUCE_WAVEFRONT_SIZE - residual): length ;
-  numTiles = static_cast< int >((N/_T_REDUCE_WAVEFRONT_SIZE)>= numTiles?(numTiles):
-                                (std::ceil( static_cast< float >( N ) / _T_REDUCE_WAVEFRONT_SIZE) ));
-
-  std::unique_ptr<T[]> r(new T[numTiles]);
-  auto f_ = utils::get_pointer(first);
-  hc::array_view<T> result(hc::extent<1>(numTiles), r.get());
-  hc::array_view<_Tp> first_(hc::extent<1>(N), f_);
-  result.discard_data();
-  auto transform_op = unary_op;
-  details::kernel_launch(length, [first_, N, length, transform_op, result, binary_op] (hc::tiled_index<1> t_idx) [[hc]]
-                {
-                int gx = t_idx.global[0];
-                int gloId = gx;
-                tile_static T scratch[_T_REDUCE_WAVEFRONT_SIZE];
-                //  Initialize local data store
-                unsigned int tileIndex = t_idx.local[0];
-
-                T accumulator;
-                if (gloId < N)
-                {
-                accumulator = transform_op(first_[gx]);
-                gx += length;
-                }
-
-
-                // Loop sequentially over chunks of input vector, reducing an arbitrary size input
-                // length into a length related to the number of workgroups
-                while (gx < N)
-                {
-                T element = transform_op(first_[gx]);
-                accumulator = binary_op(accumulator, element);
-                gx += length;
-                }
-
-                scratch[tileIndex] = accumulator;
-                t_idx.barrier.wait();
-
-                unsigned int tail = N - (t_idx.tile[0] * _T_REDUCE_WAVEFRONT_SIZE);
-
-                _T_REDUCE_STEP(tail, tileIndex, 256);
-                _T_REDUCE_STEP(tail, tileIndex, 128);
-                _T_REDUCE_STEP(tail, tileIndex, 64);
-                _T_REDUCE_STEP(tail, tileIndex, 32);
-                _T_REDUCE_STEP(tail, tileIndex, 16);
-                _T_REDUCE_STEP(tail, tileIndex, 8);
-                _T_REDUCE_STEP(tail, tileIndex, 4);
-                _T_REDUCE_STEP(tail, tileIndex, 2);
-                _T_REDUCE_STEP(tail, tileIndex, 1);
-
-
-                //  Abort threads that are passed the end of the input vector
-                if (gloId >= N)
-                    return;
-
-                //  Write only the single reduced value for the entire workgroup
-                if (tileIndex == 0)
-                {
-                    result[t_idx.tile[ 0 ]] = scratch[0];
-                }
-                }, _T_REDUCE_WAVEFRONT_SIZE);
-  result.synchronize();
-  auto ans = std::accumulate(r.get(), r.get() + numTiles, init, binary_op);
-  return ans;
+  return details::reduce_dispatch(utils::get_pointer(first), N, init, unary_op, binary_op);
 }
 
 template<typename ExecutionPolicy,
@@ -19,6 +19,21 @@ template<class It>
 using isRandomAccessIt = std::is_base_of<std::random_access_iterator_tag,
                                          tag<It>>;
 
+template<class... Its>
+struct areRandomAccessIt : std::true_type {};
+
+template<class It, class... Its>
+struct areRandomAccessIt<It, Its...>
+  : std::integral_constant<bool, isRandomAccessIt<It>::value &&
+                                 areRandomAccessIt<Its...>::value> {};
+
+// random access tag when all the iterators are, for algorithms reading and
+// writing through more than one iterator
+template<class... Its>
+using commonTag = typename std::conditional<areRandomAccessIt<Its...>::value,
+                                            std::random_access_iterator_tag,
+                                            std::input_iterator_tag>::type;
+
 template<class ExecutionPolicy>
 using isExecutionPolicy =
         is_execution_policy<typename std::decay<ExecutionPolicy>::type>;
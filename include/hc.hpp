@@ -54,6 +54,7 @@ using namespace Kalmar::CLAMP;
 class accelerator;
 class accelerator_view;
 class completion_future;
+class command_graph;
 template <int N> class extent;
 template <int N> class tiled_extent;
 template <typename T, int N> class array_view;
@@ -103,6 +104,33 @@ inline uint64_t get_tick_frequency() {
     return Kalmar::getContext()->getSystemTickFrequency();
 }
 
+/**
+ * Unpin the host memory in [ptr, ptr + size) which copies between unpinned
+ * host memory and device memory keep pinned for reuse.
+ *
+ * Must be called before host memory used by such copies is unmapped or
+ * returned to the operating system. am_free and am_memtracker_remove do it for
+ * the range they release. The size of the cache is controlled by the
+ * HCC_PINNED_CACHE_SIZE environment variable, in MB; the cache is disabled
+ * by default.
+ */
+inline void invalidate_host_pin_cache(void* ptr, size_t size) {
+    Kalmar::getContext()->invalidateHostPinCache(ptr, size);
+}
+
+/**
+ * Get statistics of the cache of pinned host memory used by copies between
+ * unpinned host memory and device memory.
+ *
+ * @param[out] hits Number of copies which found their host memory pinned.
+ * @param[out] misses Number of copies which had to pin their host memory.
+ * @param[out] evictions Number of ranges unpinned to stay in the budget.
+ * @param[out] pinned_bytes Size of the host memory pinned by the cache.
+ */
+inline void get_host_pin_cache_stats(uint64_t* hits, uint64_t* misses, uint64_t* evictions, size_t* pinned_bytes) {
+    Kalmar::getContext()->getHostPinCacheStats(hits, misses, evictions, pinned_bytes);
+}
+
 #define GET_SYMBOL_ADDRESS(acc, symbol) \
     acc.get_symbol_address( #symbol );
 
@@ -155,6 +183,12 @@ public:
      */
     execute_order get_execute_order() const { return pQueue->get_execute_order(); }
 
+    /**
+     * Returns the number of hardware queues this accelerator_view dispatches
+     * its kernels to. See accelerator::create_view().
+     */
+    unsigned int get_hardware_queue_count() const { return pQueue->getHardwareQueueCount(); }
+
     /**
      * Returns a boolean value indicating whether the accelerator view when
      * passed to a parallel_for_each would result in automatic selection of an
@@ -236,6 +270,75 @@ public:
      */
     void flush() { pQueue->flush(); }
 
+    /**
+     * Opens a batch of kernel dispatches on this accelerator_view.
+     *
+     * Kernels launched on this accelerator_view until the matching end_batch()
+     * are written into the command queue but are not made visible to the
+     * device yet. end_batch() then publishes all of them with a single write
+     * index update and a single doorbell ring. Only the last packet of a
+     * published batch carries a completion signal; the completion_future of
+     * every kernel in the batch becomes ready when the whole batch completes.
+     *
+     * Batches are intended for issuing many small kernels back-to-back. Batches
+     * may be nested, in which case only the outermost end_batch() publishes.
+     * The packets recorded so far are also published by flush(), wait(),
+     * enqueueing a marker or a copy, or waiting on the completion_future of a
+     * kernel in the batch.
+     *
+     * On accelerators which do not support batching, this member function has
+     * no effect.
+     */
+    void begin_batch() { pQueue->beginBatch(); }
+
+    /**
+     * Closes the batch opened by the matching begin_batch() and publishes the
+     * kernels recorded in it to the device.
+     */
+    void end_batch() { pQueue->endBatch(); }
+
+    /**
+     * Starts recording commands issued to this accelerator_view into a
+     * command_graph, instead of executing them.
+     *
+     * Kernel launches (parallel_for_each), copy_async() and markers are
+     * recorded. Their completion_future objects are ready immediately and do
+     * not represent any execution. Other commands, such as synchronous copies,
+     * are executed as usual and are not part of the graph. Contents of
+     * array_view objects are synchronized when a kernel is recorded, not when
+     * the graph is replayed.
+     *
+     * @throw runtime_exception if this accelerator_view does not support
+     *        capture, or is already capturing.
+     */
+    void begin_capture();
+
+    /**
+     * Stops recording commands started by begin_capture().
+     *
+     * @return The recorded command_graph, which can be replayed any number of
+     *         times with replay().
+     */
+    command_graph end_capture();
+
+    /**
+     * Returns true if this accelerator_view is recording commands.
+     */
+    bool is_capturing() const { return pQueue->isCapturing(); }
+
+    /**
+     * Submits all the commands recorded in graph to this accelerator_view.
+     * Kernel arguments, dispatch packets and copy descriptors are prepared
+     * when the graph is captured, so replaying a graph is cheaper than issuing
+     * the same commands again.
+     *
+     * @param[in] graph A command_graph captured on an accelerator_view of the
+     *                  same accelerator.
+     * @return A completion_future which becomes ready once all the commands in
+     *         the graph have completed.
+     */
+    completion_future replay(const command_graph& graph);
+
     /**
      * This command inserts a marker event into the accelerator_view's command
      * queue. This marker is returned as a completion_future object. When all
@@ -314,7 +417,16 @@ public:
      * The copy command will be implicitly ordered with respect to commands previously equeued to this accelerator_view:
      * - If the queue execute_order is execute_in_order (the default), then the copy will execute after all previously sent commands finish execution.
      * - If the queue execute_order is execute_any_order, then the copy will start after all previously send commands start but can execute in any order.
+     * - If the queue execute_order is execute_out_of_order, then the copy will only wait for previously sent commands which write src, or read or write dst.
+     *
+     * Src or dst may be host memory which is not pinned or otherwise known to the runtime (e.g. allocated with malloc).
+     * Such copies are performed by a runtime thread through the staging buffers of the device instead of
+     * the DMA engines directly, the calling thread still does not wait for them.
+     * The host memory must remain valid until the copy completes.
      *
+     * Src and dst may be in the memory of two different devices.  The copy is then done by the DMA engine of a
+     * device which can access the memory of the other one (see accelerator::get_is_peer), or else staged through
+     * host buffers in chunks, the copies of the chunks to the host overlapping with the copies to dst.
      */
     completion_future copy_async(const void *src, void *dst, size_t size_bytes);
 
@@ -328,6 +440,7 @@ public:
      * The copy command will be implicitly ordered with respect to commands previously enqueued to this accelerator_view:
      * - If the queue execute_order is execute_in_order (the default), then the copy will execute after all previously sent commands finish execution.
      * - If the queue execute_order is execute_any_order, then the copy will start after all previously send commands start but can execute in any order.
+     * - If the queue execute_order is execute_out_of_order, then the copy will only wait for previously sent commands which write src, or read or write dst.
      *   The copyAcc determines where the copy is executed and does not affect the ordering.
      *
      * The copy_async_ext flavor allows caller to provide additional information about each pointer, which can improve performance by eliminating replicated lookups,
@@ -743,12 +856,29 @@ public:
      * Creates and returns a new accelerator view on the accelerator with the
      * supplied queuing mode.
      *
+     * @param[in] order The execution order of the accelerator_view to be
+     *                  created. With execute_out_of_order, kernels and
+     *                  asynchronous copies only wait for the older commands
+     *                  which access the same buffers (arrays and array_views
+     *                  captured by kernels, src and dst of copy_async), so
+     *                  independent commands may overlap. Buffers are matched
+     *                  by their base address; other dependencies have to be
+     *                  expressed with markers.
      * @param[in] qmode The queuing mode of the accelerator_view to be created.
      *                  See "Queuing Mode". The default value would be
      *                  queueing_mdoe_automatic if not specified.
-     */
-    accelerator_view create_view(execute_order order = execute_in_order, queuing_mode mode = queuing_mode_automatic) {
-        auto pQueue = pDev->createQueue(order);
+     * @param[in] hardware_queue_count The number of hardware queues kernels
+     *                  are spread over, at most 4. Kernels which only use
+     *                  arrays and array_views and do not depend on each
+     *                  other may run concurrently on different hardware
+     *                  queues; the execution order is still honored for
+     *                  dependent commands. Kernels which also capture raw
+     *                  pointers, or 64 bit values, and other commands wait
+     *                  for all the hardware queues. The default value is 1.
+     */
+    accelerator_view create_view(execute_order order = execute_in_order, queuing_mode mode = queuing_mode_automatic,
+                                 unsigned int hardware_queue_count = 1) {
+        auto pQueue = pDev->createQueue(order, hardware_queue_count);
         pQueue->set_mode(mode);
         return pQueue;
     }
@@ -1054,7 +1184,7 @@ public:
      * object which does not refer to any asynchronous operation. Default
      * constructed completion_future objects have valid() == false
      */
-    completion_future() : __amp_future(), __thread_then(nullptr), __asyncOp(nullptr) {};
+    completion_future() : __amp_future(), __asyncOp(nullptr) {};
 
     /**
      * Copy constructor. Constructs a new completion_future object that referes
@@ -1064,7 +1194,7 @@ public:
      *                  initialize this.
      */
     completion_future(const completion_future& other)
-        : __amp_future(other.__amp_future), __thread_then(other.__thread_then), __asyncOp(other.__asyncOp) {}
+        : __amp_future(other.__amp_future), __asyncOp(other.__asyncOp) {}
 
     /**
      * Move constructor. Move constructs a new completion_future object that
@@ -1076,7 +1206,7 @@ public:
      *                  completion_future
      */
     completion_future(completion_future&& other)
-        : __amp_future(std::move(other.__amp_future)), __thread_then(other.__thread_then), __asyncOp(other.__asyncOp) {}
+        : __amp_future(std::move(other.__amp_future)), __asyncOp(std::move(other.__asyncOp)) {}
 
     /**
      * Copy assignment. Copy assigns the contents of other to this. This method
@@ -1089,7 +1219,6 @@ public:
     completion_future& operator=(const completion_future& _Other) {
         if (this != &_Other) {
            __amp_future = _Other.__amp_future;
-           __thread_then = _Other.__thread_then;
            __asyncOp = _Other.__asyncOp;
         }
         return (*this);
@@ -1107,8 +1236,7 @@ public:
     completion_future& operator=(completion_future&& _Other) {
         if (this != &_Other) {
             __amp_future = std::move(_Other.__amp_future);
-            __thread_then = _Other.__thread_then;
-           __asyncOp = _Other.__asyncOp;
+            __asyncOp = std::move(_Other.__asyncOp);
         }
         return (*this);
     }
@@ -1187,23 +1315,48 @@ public:
      * executed upon completion of the asynchronous operation associated with
      * this completion_future object. The completion callback func should have
      * an operator() that is valid when invoked with non arguments, i.e., "func()".
+     *
+     * func is copied and invoked on a runtime worker thread; no thread is
+     * created per call. then() may be called any number of times on the same
+     * completion_future.
+     *
+     * @return A completion_future which becomes ready after func returns, so
+     *         continuations can be chained. If func throws, the exception is
+     *         rethrown by get() on the returned object. If this
+     *         completion_future is not valid, func is never invoked and an
+     *         invalid completion_future is returned.
      */
-    // FIXME: notice we removed const from the signature here
-    //        the original signature in the specification should be
-    //        template<typename functor>
-    //        void then(const functor& func) const;
     template<typename functor>
-    void then(const functor & func) {
+    completion_future then(const functor & func) const {
 #if __KALMAR_ACCELERATOR__ != 1
-      // could only assign once
-      if (__thread_then == nullptr) {
-        // spawn a new thread to wait on the future and then execute the callback functor
-        __thread_then = new std::thread([&]() __CPU__ {
-          this->wait();
-          if(this->valid())
-            func();
+      if (!this->valid()) {
+        return completion_future();
+      }
+
+      auto next = std::make_shared<Kalmar::KalmarContinuationOp>();
+      // keep the antecedent alive until the continuation has run
+      std::shared_ptr<Kalmar::KalmarAsyncOp> antecedent = __asyncOp;
+      std::function<void()> callback = [func, next, antecedent]() __CPU__ {
+        try {
+          func();
+          next->complete();
+        } catch (...) {
+          next->complete(std::current_exception());
+        }
+      };
+
+      if (__asyncOp != nullptr) {
+        __asyncOp->addCompletionCallback(std::move(callback));
+      } else {
+        std::shared_future<void> fut = __amp_future;
+        Kalmar::KalmarCallbackPool::getInstance().enqueue([fut, callback]() __CPU__ {
+          fut.wait();
+          callback();
         });
       }
+      return completion_future(std::static_pointer_cast<Kalmar::KalmarAsyncOp>(next));
+#else
+      return completion_future();
 #endif
     }
 
@@ -1280,12 +1433,6 @@ public:
     }
 
     ~completion_future() {
-      if (__thread_then != nullptr) {
-        __thread_then->join();
-      }
-      delete __thread_then;
-      __thread_then = nullptr;
-      
       if (__asyncOp != nullptr) {
         __asyncOp = nullptr;
       }
@@ -1299,13 +1446,12 @@ public:
 
 private:
     std::shared_future<void> __amp_future;
-    std::thread* __thread_then = nullptr;
     std::shared_ptr<Kalmar::KalmarAsyncOp> __asyncOp;
 
     completion_future(std::shared_ptr<Kalmar::KalmarAsyncOp> event) : __amp_future(*(event->getFuture())), __asyncOp(event) {}
 
     completion_future(const std::shared_future<void> &__future)
-        : __amp_future(__future), __thread_then(nullptr), __asyncOp(nullptr) {}
+        : __amp_future(__future), __asyncOp(nullptr) {}
 
     friend class Kalmar::HSAQueue;
     
@@ -1368,6 +1514,59 @@ private:
 
     // accelerator_view
     friend class accelerator_view;
+
+    // kernels launched on the host while capturing a command_graph
+    template <typename Kernel, typename Domain> friend
+        completion_future capture_cpu_task(const std::shared_ptr<Kalmar::KalmarQueue>&, Kernel const&, Domain const&);
+};
+
+// ------------------------------------------------------------------------
+// command_graph
+// ------------------------------------------------------------------------
+
+/**
+ * A sequence of commands recorded on an accelerator_view between
+ * accelerator_view::begin_capture() and accelerator_view::end_capture(),
+ * which can be replayed with accelerator_view::replay().
+ */
+class command_graph {
+public:
+    /**
+     * Default constructor. Constructs an empty command_graph, with
+     * valid() == false.
+     */
+    command_graph() : pGraph(nullptr) {}
+
+    /**
+     * Returns true if this command_graph holds recorded commands.
+     */
+    bool valid() const { return pGraph != nullptr; }
+
+    /**
+     * Returns the number of commands recorded in this command_graph.
+     */
+    size_t get_node_count() const { return pGraph ? pGraph->getNodeCount() : 0; }
+
+    /**
+     * Replaces the pointer from by the pointer to in the arguments of every
+     * recorded kernel and in every recorded copy, so the same graph can be
+     * replayed on other buffers. If the graph is being replayed, this waits
+     * for the replay to complete first.
+     *
+     * @param[in] from Pointer used when the graph was captured.
+     * @param[in] to Pointer to be used by subsequent replays.
+     * @return The number of locations patched.
+     */
+    size_t patch_pointer(const void* from, const void* to) {
+        return pGraph ? pGraph->patchPointer(from, to) : 0;
+    }
+
+private:
+    std::shared_ptr<Kalmar::KalmarGraph> pGraph;
+
+    command_graph(const std::shared_ptr<Kalmar::KalmarGraph>& graph) : pGraph(graph) {}
+
+    friend class accelerator_view;
 };
 
 // ------------------------------------------------------------------------
@@ -1382,6 +1581,29 @@ accelerator_view::create_marker() const {
     return completion_future(pQueue->EnqueueMarker());
 }
 
+inline void accelerator_view::begin_capture() {
+    if (pQueue->isCapturing()) {
+        throw runtime_exception("accelerator_view is already capturing commands", E_FAIL);
+    }
+    if (!pQueue->beginCapture()) {
+        throw runtime_exception("command graph capture is not supported on this accelerator_view", E_FAIL);
+    }
+}
+
+inline command_graph accelerator_view::end_capture() {
+    return command_graph(pQueue->endCapture());
+}
+
+inline completion_future accelerator_view::replay(const command_graph& graph) {
+    if (!graph.valid()) {
+        return completion_future();
+    }
+    if (pQueue->isCapturing()) {
+        throw runtime_exception("can not replay a command graph while capturing commands", E_FAIL);
+    }
+    return completion_future(graph.pGraph->replay(pQueue.get()));
+}
+
 inline unsigned int accelerator_view::get_version() const { return get_accelerator().get_version(); }
 
 inline completion_future accelerator_view::create_blocking_marker(completion_future& dependent_future) const {
@@ -3815,10 +4037,29 @@ void partitioned_task_tile_3D(Kernel const& f, tiled_extent<3> const& ext, int p
     delete [] tidx;
 }
 
+// Record a CPU kernel launch into the command graph being captured on pQueue.
+// The functor is copied into the graph, so the pointers it captures can be
+// patched with command_graph::patch_pointer(). As for the other recorded
+// commands, the completion_future returned is already ready.
+template <typename Kernel, typename Domain>
+completion_future capture_cpu_task(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
+                                   Domain const& compute_domain)
+{
+    std::shared_ptr<Kernel> kernel = std::make_shared<Kernel>(f);
+    std::shared_ptr<Domain> domain = std::make_shared<Domain>(compute_domain);
+    std::shared_ptr<Kalmar::KalmarQueue> queue = pQueue;
+    return completion_future(pQueue->captureHostTask([queue, kernel, domain]() {
+        launch_cpu_task_async(queue, *kernel, *domain);
+    }, kernel.get(), sizeof(Kernel)));
+}
+
 template <typename Kernel, int N>
 completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      extent<N> const& compute_domain)
 {
+    if (pQueue->isCapturing()) {
+        return capture_cpu_task(pQueue, f, compute_domain);
+    }
     Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
     for (int i = 0; i < Kalmar::NTHREAD; ++i)
         obj[i] = std::thread(partitioned_task<Kernel, N>, std::cref(f), std::cref(compute_domain), i);
@@ -3830,6 +4071,9 @@ template <typename Kernel>
 completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<1> const& compute_domain)
 {
+    if (pQueue->isCapturing()) {
+        return capture_cpu_task(pQueue, f, compute_domain);
+    }
     Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
     for (int i = 0; i < Kalmar::NTHREAD; ++i)
         obj[i] = std::thread(partitioned_task_tile_1D<Kernel>,
@@ -3842,6 +4086,9 @@ template <typename Kernel>
 completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<2> const& compute_domain)
 {
+    if (pQueue->isCapturing()) {
+        return capture_cpu_task(pQueue, f, compute_domain);
+    }
     Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
     for (int i = 0; i < Kalmar::NTHREAD; ++i)
         obj[i] = std::thread(partitioned_task_tile_2D<Kernel>,
@@ -3854,6 +4101,9 @@ template <typename Kernel>
 completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<3> const& compute_domain)
 {
+    if (pQueue->isCapturing()) {
+        return capture_cpu_task(pQueue, f, compute_domain);
+    }
     Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
     for (int i = 0; i < Kalmar::NTHREAD; ++i)
         obj[i] = std::thread(partitioned_task_tile_3D<Kernel>,
@@ -11,6 +11,8 @@ typedef int am_status_t;
 // Flags for am_alloc API:
 #define amHostPinned 0x1
 #define amHostCoherent 0x2
+#define amCached 0x4
+#define amNoCache 0x8
 
 
 namespace hc {
@@ -59,6 +61,9 @@ namespace hc {
  *
  * Flags:
  *  amHostPinned : Allocated pinned host memory and map it into the address space of the specified accelerator.
+ *  amCached : Allocate from the allocation cache: blocks freed by am_free are kept and reused by later
+ *             allocations of a similar size.  All the allocations use the cache if HCC_AM_CACHE=1.
+ *  amNoCache : Never allocate from the allocation cache.
  *
  *
  * @return : On success, pointer to the newly allocated memory is returned.
@@ -79,6 +84,38 @@ auto_voidp am_alloc(size_t size, hc::accelerator &acc, unsigned flags);
 am_status_t am_free(void*  ptr);
 
 
+/**
+ * Free a block of memory previously allocated with am_alloc, once the commands already
+ * enqueued to @p av have completed.  This call does not wait for them if the block was allocated
+ * from the allocation cache: the block is reused by later allocations only once they are done.
+ *
+ * @return AM_SUCCESS, or AM_ERROR_MISC if @p ptr is not tracked.
+ * @see am_alloc, am_free
+ */
+am_status_t am_free_async(void* ptr, hc::accelerator_view &av);
+
+
+/**
+ * Counters of the allocation cache used by am_alloc with amCached.
+ */
+struct AmAllocCacheStats {
+    uint64_t hits;          ///< Allocations served from cached blocks.
+    uint64_t misses;        ///< Allocations which allocated new blocks.
+    size_t   inUseBytes;    ///< Size of the blocks allocated and not freed yet.
+    size_t   cachedBytes;   ///< Size of the free blocks kept for later allocations.
+    size_t   pendingBytes;  ///< Size of the blocks freed by am_free_async, waiting for their commands.
+};
+
+void am_alloc_cache_stats(AmAllocCacheStats *stats);
+
+/**
+ * Release the free blocks of the allocation cache until at most @p keepBytes remain.
+ *
+ * @return The number of bytes released.
+ */
+size_t am_alloc_cache_trim(size_t keepBytes = 0);
+
+
 /**
  * Copy @p size bytes of memory from @p src to @ dst.  The memory areas (src+size and dst+size) must not overlap.
  *
@@ -165,8 +202,54 @@ void am_memtracker_print();
 void am_memtracker_sizeinfo(const hc::accelerator &acc, size_t *deviceMemSize, size_t *hostMemSize, size_t *userMemSize);
 
 
+/**
+ * Memory tracked for an accelerator: current and peak size, and number of ranges, of the device
+ * and host memory allocated by AM and of the user memory registered with am_memtracker_add.
+ */
+struct AmMemoryUsage {
+    size_t deviceBytes;
+    size_t deviceCount;
+    size_t devicePeakBytes;
+    size_t hostBytes;
+    size_t hostCount;
+    size_t hostPeakBytes;
+    size_t userBytes;
+    size_t userCount;
+    size_t userPeakBytes;
+};
+
+/**
+ * Return the memory tracked for @p acc.  The totals are maintained as ranges are tracked and
+ * untracked, so this call does not walk the tracker.
+ **/
+void am_memtracker_usage(const hc::accelerator &acc, AmMemoryUsage *usage);
+
+/**
+ * Return the size and number of the ranges tracked for @p acc with @p appId (see am_memtracker_update).
+ **/
+void am_memtracker_app_usage(const hc::accelerator &acc, int appId, size_t *bytes, size_t *count);
+
+/**
+ * Append the memory usage of each accelerator, per appId, and the ranges sampled by the allocation
+ * profiler to @p fileName (stderr if NULL), one JSON object per line.  With @p allRanges, every
+ * tracked range is written too.
+ *
+ * The profiler records the call stack of the ranges of at least HCC_AM_PROFILE_THRESHOLD bytes
+ * (disabled if unset): the ones still tracked are written with their age, to find leaks.
+ *
+ * @return AM_ERROR_MISC if the file can not be opened.
+ **/
+am_status_t am_memtracker_dump(const char *fileName = NULL, bool allRanges = false);
+
+
 void am_memtracker_update_peers(const hc::accelerator &acc, int peerCnt, hsa_agent_s *agents);
 
+/*
+ * Tell whether @p agent was given access to the tracked range containing @p ptr, by am_map_to_peers
+ * or am_memtracker_update_peers.
+ */
+bool am_memtracker_peer_access(const void *ptr, const hsa_agent_s &agent);
+
 /*
  * Map device memory or hsa allocated host memory pointed to by @p ptr to the peers.
  * 
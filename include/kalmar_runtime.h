@@ -34,7 +34,10 @@ enum queuing_mode
 enum execute_order
 {
     execute_in_order,
-    execute_any_order
+    execute_any_order,
+    // commands are only ordered by the dependencies the runtime infers
+    // from the buffers they read and write
+    execute_out_of_order
 };
 
 enum hcCommandKind {
@@ -87,6 +90,58 @@ using namespace Kalmar::enums;
 class KalmarDevice;
 struct rw_info;
 
+/// KalmarCallbackPool
+///
+/// Process-wide pool of worker threads which runs completion callbacks
+/// registered through KalmarAsyncOp::addCompletionCallback. User functors never
+/// run on the thread that observed the completion (e.g. the HSA async signal
+/// handler thread), so a slow continuation can not stall other notifications.
+///
+/// The pool is created on first use and intentionally never destroyed:
+/// completions may still be delivered by runtime threads while static objects
+/// are being torn down at program exit.
+class KalmarCallbackPool {
+public:
+  static KalmarCallbackPool& getInstance() {
+    static KalmarCallbackPool* pool = new KalmarCallbackPool();
+    return *pool;
+  }
+
+  void enqueue(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+  }
+
+private:
+  KalmarCallbackPool() {
+    unsigned int count = std::thread::hardware_concurrency();
+    count = std::max(2u, std::min(count, 4u));
+    for (unsigned int i = 0; i < count; ++i) {
+      std::thread(&KalmarCallbackPool::run, this).detach();
+    }
+  }
+
+  void run() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !tasks.empty(); });
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> tasks;
+};
+
 /// KalmarAsyncOp
 ///
 /// This is an abstraction of all asynchronous operations within Kalmar
@@ -133,6 +188,28 @@ public:
    */
   virtual void setWaitMode(hcWaitMode mode) {}
 
+  /**
+   * Register a callback to be invoked once the async operation completes.
+   * The callback is run on a KalmarCallbackPool worker thread and may be
+   * invoked immediately if the operation has already completed.
+   *
+   * The default implementation parks a pool worker on the future of the
+   * operation. Backends which can be notified of completion should override
+   * it.
+   *
+   * @param callback[in] function to be invoked after completion.
+   */
+  virtual void addCompletionCallback(std::function<void()> callback) {
+    std::shared_future<void>* future = getFuture();
+    std::shared_future<void> fut = future ? *future : std::shared_future<void>();
+    KalmarCallbackPool::getInstance().enqueue([fut, callback] {
+      if (fut.valid()) {
+        fut.wait();
+      }
+      callback();
+    });
+  }
+
   uint64_t getSeqNum () const { return seqNum;};
   void     setSeqNum (uint64_t s) {seqNum = s;};
 
@@ -148,6 +225,184 @@ private:
 
 };
 
+/// KalmarContinuationOp
+///
+/// Async operation completed from the host rather than by a device queue. It
+/// backs the completion_future returned by completion_future::then, so that
+/// continuations can themselves be waited on, chained, or used as marker
+/// dependencies.
+class KalmarContinuationOp : public KalmarAsyncOp {
+public:
+  KalmarContinuationOp()
+      : KalmarAsyncOp(hcCommandInvalid), promise(),
+        future(promise.get_future().share()), ready(false) {}
+
+  std::shared_future<void>* getFuture() override { return &future; }
+
+  bool isReady() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ready;
+  }
+
+  void addCompletionCallback(std::function<void()> callback) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!ready) {
+        callbacks.push_back(std::move(callback));
+        return;
+      }
+    }
+    KalmarCallbackPool::getInstance().enqueue(std::move(callback));
+  }
+
+  /// create an operation which has already completed
+  static std::shared_ptr<KalmarAsyncOp> createCompleted() {
+    std::shared_ptr<KalmarContinuationOp> op = std::make_shared<KalmarContinuationOp>();
+    op->complete();
+    return op;
+  }
+
+  /**
+   * Mark the operation as completed and release the callbacks registered so
+   * far. Each callback is posted to the pool instead of being run inline, so
+   * long chains of continuations do not grow the stack.
+   *
+   * @param error[in] exception to be rethrown by get() on the future, or
+   *                  nullptr if the continuation succeeded.
+   */
+  void complete(std::exception_ptr error = nullptr) {
+    std::vector<std::function<void()>> pending;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (error) {
+        promise.set_exception(error);
+      } else {
+        promise.set_value();
+      }
+      ready = true;
+      pending.swap(callbacks);
+    }
+    for (auto& callback : pending) {
+      KalmarCallbackPool::getInstance().enqueue(std::move(callback));
+    }
+  }
+
+private:
+  std::promise<void> promise;
+  std::shared_future<void> future;
+  std::mutex mutex;
+  bool ready;
+  std::vector<std::function<void()>> callbacks;
+};
+
+class KalmarQueue;
+
+/// KalmarGraph
+/// Sequence of commands recorded while a KalmarQueue is in capture mode.
+/// A graph is replayed onto a queue of the device it was captured on.
+class KalmarGraph {
+public:
+  virtual ~KalmarGraph() {}
+
+  /// number of recorded commands
+  virtual size_t getNodeCount() const = 0;
+
+  /// replace every occurrence of pointer from in the recorded kernel
+  /// arguments and copy descriptors by to
+  /// @return number of locations patched
+  virtual size_t patchPointer(const void* from, const void* to) = 0;
+
+  /// submit the recorded commands to queue
+  /// @return an operation which completes after the last recorded command
+  virtual std::shared_ptr<KalmarAsyncOp> replay(KalmarQueue* queue) = 0;
+
+protected:
+  /// offsets of the pointer-aligned slots of [bytes, bytes + size) holding a
+  /// non-null value, for images whose argument layout is unknown. Computed
+  /// once at capture so that patchPointerAt() only visits these slots.
+  static std::vector<uint32_t> pointerSlots(const void* bytes, size_t size) {
+    std::vector<uint32_t> offsets;
+    const char* p = static_cast<const char*>(bytes);
+    for (size_t offset = 0; offset + sizeof(void*) <= size; offset += alignof(void*)) {
+      const void* value;
+      memcpy(&value, p + offset, sizeof(void*));
+      if (value != nullptr)
+        offsets.push_back(static_cast<uint32_t>(offset));
+    }
+    return offsets;
+  }
+
+  /// patch the pointers of bytes at offsets which are equal to from by to
+  static size_t patchPointerAt(void* bytes, const std::vector<uint32_t>& offsets, const void* from, const void* to) {
+    size_t count = 0;
+    char* p = static_cast<char*>(bytes);
+    for (uint32_t offset : offsets) {
+      if (memcmp(p + offset, &from, sizeof(void*)) == 0) {
+        memcpy(p + offset, &to, sizeof(void*));
+        ++count;
+      }
+    }
+    return count;
+  }
+};
+
+/// KalmarHostGraph
+/// KalmarGraph made of host tasks, run in order when the graph is replayed.
+/// Used by queues which execute their commands on the host.
+class KalmarHostGraph final : public KalmarGraph {
+public:
+  /// record a task; the pointers stored in [patchable, patchable + size)
+  /// are updated by patchPointer()
+  void addTask(std::function<void()> task, void* patchable = nullptr, size_t size = 0) {
+    std::vector<uint32_t> offsets;
+    if (patchable != nullptr)
+      offsets = pointerSlots(patchable, size);
+    nodes.push_back(Node{ std::move(task), patchable, std::move(offsets) });
+  }
+
+  /// record a copy
+  void addCopy(const void* src, void* dst, size_t sizeBytes) {
+    std::shared_ptr<CopyDesc> desc = std::make_shared<CopyDesc>(CopyDesc{ src, dst, sizeBytes });
+    nodes.push_back(Node{ [desc] {
+      if (desc->src != desc->dst)
+        memmove(desc->dst, desc->src, desc->sizeBytes);
+    }, desc.get(), { offsetof(CopyDesc, src), offsetof(CopyDesc, dst) } });
+  }
+
+  size_t getNodeCount() const override { return nodes.size(); }
+
+  size_t patchPointer(const void* from, const void* to) override {
+    size_t count = 0;
+    for (auto& node : nodes) {
+      if (node.patchable != nullptr)
+        count += patchPointerAt(node.patchable, node.offsets, from, to);
+    }
+    return count;
+  }
+
+  std::shared_ptr<KalmarAsyncOp> replay(KalmarQueue* queue) override {
+    for (auto& node : nodes)
+      node.task();
+    return KalmarContinuationOp::createCompleted();
+  }
+
+private:
+  struct CopyDesc {
+    const void* src;
+    void* dst;
+    size_t sizeBytes;
+  };
+
+  struct Node {
+    std::function<void()> task;
+    void* patchable;
+    // offsets of the pointers in patchable
+    std::vector<uint32_t> offsets;
+  };
+
+  std::vector<Node> nodes;
+};
+
 /// KalmarQueue
 /// This is the implementation of accelerator_view
 /// KalamrQueue is responsible for data operations and launch kernel
@@ -203,6 +458,9 @@ public:
 
   execute_order get_execute_order() const { return order; }
 
+  /// get number of hardware queues the commands of the queue are spread over
+  virtual unsigned int getHardwareQueueCount() { return 1; }
+
   /// get number of pending async operations in the queue
   virtual int getPendingAsyncOps() { return 0; }
 
@@ -263,6 +521,31 @@ public:
   /// is called.
   virtual bool set_cu_mask(const std::vector<bool>& cu_mask) { return false; };
 
+  /// open a batch of kernel dispatches; batches may be nested.
+  /// dispatches issued while a batch is open are published to the device
+  /// together by the outermost endBatch(), or earlier by flush() / wait()
+  virtual void beginBatch() {}
+
+  /// close the batch opened by the matching beginBatch()
+  virtual void endBatch() {}
+
+  /// start recording commands into a graph instead of executing them
+  /// @return false if the queue does not support capture
+  virtual bool beginCapture() { return false; }
+
+  /// stop recording commands
+  /// @return the recorded graph
+  virtual std::shared_ptr<KalmarGraph> endCapture() { return nullptr; }
+
+  virtual bool isCapturing() { return false; }
+
+  /// record a host task into the graph being captured. Used by kernels which
+  /// are launched on the host rather than through LaunchKernel*. Returns an
+  /// op which has already completed, as for the other recorded commands.
+  virtual std::shared_ptr<KalmarAsyncOp> captureHostTask(std::function<void()> task, void* patchable, size_t size) {
+    return KalmarContinuationOp::createCompleted();
+  }
+
 private:
   KalmarDevice* pDev;
   queuing_mode mode;
@@ -327,6 +610,11 @@ public:
     /// @key: used to avoid duplicate release
     virtual void release(void* ptr, struct rw_info* key) = 0;
 
+    /// device memory in [ptr, ptr + size) is about to be written by a command
+    /// which does not name the buffers it writes (copies, raw pointers): drop
+    /// the host copies of the buffers created on this device it overlaps
+    virtual void invalidateMapShadows(const void* ptr, size_t size) {}
+
     /// build program
     virtual void BuildProgram(void* size, void* source) {}
 
@@ -340,7 +628,7 @@ public:
     virtual bool check(size_t* size, size_t dim_ext) { return true; }
 
     /// create KalmarQueue from current device
-    virtual std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order) = 0;
+    virtual std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order, unsigned int hwQueueCount = 1) = 0;
     virtual ~KalmarDevice() {}
 
     std::shared_ptr<KalmarQueue> get_default_queue() {
@@ -432,7 +720,7 @@ public:
     bool is_emulated() const override { return true; }
     uint32_t get_version() const override { return 0; }
 
-    std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order) override { return std::shared_ptr<KalmarQueue>(new CPUQueue(this)); }
+    std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order, unsigned int hwQueueCount = 1) override { return std::shared_ptr<KalmarQueue>(new CPUQueue(this)); }
     void* create(size_t count, struct rw_info* /* not used */ ) override { return kalmar_aligned_alloc(0x1000, count); }
     void release(void* ptr, struct rw_info* /* nout used */) override { kalmar_aligned_free(ptr); }
     void* CreateKernel(const char* fun) { return nullptr; }
@@ -503,6 +791,22 @@ public:
 
     /// get tick frequency
     virtual uint64_t getSystemTickFrequency() { return 0L; };
+
+    /// unpin the host memory in [ptr, ptr + size) kept pinned by unpinned copies
+    virtual void invalidateHostPinCache(void* ptr, size_t size) {}
+
+    /// device memory in [ptr, ptr + size) is about to be written without its
+    /// buffer being known, see KalmarDevice::invalidateMapShadows
+    void invalidateMapShadows(const void* ptr, size_t size) {
+        for (auto dev : Devices)
+            dev->invalidateMapShadows(ptr, size);
+    }
+
+    /// get statistics of the cache of host memory pinned by unpinned copies
+    virtual void getHostPinCacheStats(uint64_t* hits, uint64_t* misses, uint64_t* evictions, size_t* pinnedBytes) {
+        *hits = *misses = *evictions = 0;
+        *pinnedBytes = 0;
+    }
 };
 
 KalmarContext *getContext();
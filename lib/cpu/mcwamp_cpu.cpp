@@ -46,6 +46,43 @@ public:
   void unmap(void* device, void* addr, size_t count, size_t offset, bool modify) override {}
 
   void Push(void *kernel, int idx, void* device, bool isConst) override {}
+
+  // commands are executed synchronously, so every op is already completed
+  std::shared_ptr<KalmarAsyncOp> EnqueueMarker() override {
+      if (captureGraph)
+          captureGraph->addTask([] {});
+      return KalmarContinuationOp::createCompleted();
+  }
+
+  std::shared_ptr<KalmarAsyncOp> EnqueueAsyncCopy(const void* src, void* dst, size_t size_bytes) override {
+      if (captureGraph)
+          captureGraph->addCopy(src, dst, size_bytes);
+      else if (src != dst)
+          memmove(dst, src, size_bytes);
+      return KalmarContinuationOp::createCompleted();
+  }
+
+  bool beginCapture() override {
+      captureGraph = std::make_shared<KalmarHostGraph>();
+      return true;
+  }
+
+  std::shared_ptr<KalmarGraph> endCapture() override {
+      std::shared_ptr<KalmarGraph> graph = captureGraph;
+      captureGraph = nullptr;
+      return graph;
+  }
+
+  bool isCapturing() override { return captureGraph != nullptr; }
+
+  std::shared_ptr<KalmarAsyncOp> captureHostTask(std::function<void()> task, void* patchable, size_t size) override {
+      captureGraph->addTask(std::move(task), patchable, size);
+      return KalmarContinuationOp::createCompleted();
+  }
+
+private:
+  // graph being recorded between beginCapture() and endCapture()
+  std::shared_ptr<KalmarHostGraph> captureGraph;
 };
 
 class CPUFallbackDevice final : public KalmarDevice
@@ -68,7 +105,7 @@ public:
     void release(void *device, struct rw_info* /* not used */ ) override { 
         kalmar_aligned_free(device);
     }
-    std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order) override {
+    std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order, unsigned int hwQueueCount = 1) override {
         return std::shared_ptr<KalmarQueue>(new CPUFallbackQueue(this));
     }
 };
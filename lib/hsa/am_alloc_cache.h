@@ -0,0 +1,290 @@
+/*
+Copyright (c) 2015-2016 Advanced Micro Devices, Inc. All rights reserved.
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANNTY OF ANY KIND, EXPRESS OR
+IMPLIED, INNCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANNY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER INN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR INN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef AM_ALLOC_CACHE_H
+#define AM_ALLOC_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+//-------------------------------------------------------------------------------------------------
+// Caching sub-allocator used by am_alloc/am_free.
+// Allocating memory from the runtime (and making it accessible to the devices) is expensive, and
+// applications commonly allocate and free scratch buffers of the same sizes over and over.  Freed
+// blocks are kept in free lists, one per memory pool (key) and size class, and handed out again by
+// the next allocations of the same class.  Size classes are 256 bytes and up, four per power of two,
+// so a block is at most 25% larger than requested.  Blocks larger than _maxCachedBytes are not cached.
+//
+// A block may also be freed asynchronously: it stays pending until the work which may still use it
+// is done (ready() returns true), then joins the free lists.
+//
+// The total size of the free blocks is limited to a budget: blocks freed past the budget go back
+// to the backend.  The memory comes from a Backend, so the cache does not depend on the runtime.
+//
+// AmAllocCache provides thread-safe access via a mutex.  The backend is called without holding it.
+class AmAllocCache {
+public:
+    struct Backend {
+        virtual ~Backend() {}
+        virtual void* Allocate(uint64_t key, size_t sizeBytes) = 0;
+        virtual void Free(uint64_t key, void* ptr) = 0;
+    };
+
+    struct Stats {
+        uint64_t hits;          // allocations served from the free lists
+        uint64_t misses;        // allocations served by the backend
+        size_t   inUseBytes;    // blocks allocated and not freed yet
+        size_t   cachedBytes;   // blocks in the free lists
+        size_t   pendingBytes;  // blocks freed asynchronously, not ready yet
+    };
+
+    static const size_t _minClassBytes = 256;
+    static const size_t _maxCachedBytes = 256*1024*1024;
+
+    AmAllocCache(Backend *backend, size_t budgetBytes) :
+        _backend(backend), _budgetBytes(budgetBytes),
+        _hits(0), _misses(0), _inUseBytes(0), _cachedBytes(0), _pendingBytes(0) {}
+
+    ~AmAllocCache() { Trim(0); }
+
+    static size_t SizeClass(size_t sizeBytes) {
+        if (sizeBytes <= _minClassBytes) {
+            return _minClassBytes;
+        }
+        size_t pow2 = _minClassBytes;
+        while (pow2 * 2 <= sizeBytes) {
+            pow2 *= 2;
+        }
+        const size_t step = pow2 / 4;
+        return (sizeBytes + step - 1) / step * step;
+    }
+
+    // Allocate a block of at least sizeBytes from the pool identified by key.
+    // *fresh (if not NULL) is set when the block comes from the backend.  Returns NULL on failure.
+    void* Allocate(uint64_t key, size_t sizeBytes, bool *fresh = NULL) {
+        const size_t classBytes = SizeClass(sizeBytes);
+        if (fresh) {
+            *fresh = false;
+        }
+        {
+            Victims victims;
+            void* ptr = NULL;
+            {
+                std::lock_guard<std::mutex> l(_lock);
+                ReapPending(&victims);
+                auto list = _freeLists.find(std::make_pair(key, classBytes));
+                if ((list != _freeLists.end()) && !list->second.empty()) {
+                    ptr = list->second.back();
+                    list->second.pop_back();
+                    _cachedBytes -= classBytes;
+                    _inUse[ptr] = Block{key, classBytes};
+                    _inUseBytes += classBytes;
+                    _hits++;
+                }
+            }
+            FreeVictims(victims);
+            if (ptr != NULL) {
+                return ptr;
+            }
+        }
+
+        const bool cacheable = (classBytes <= _maxCachedBytes);
+        void* ptr = _backend->Allocate(key, cacheable ? classBytes : sizeBytes);
+        if (ptr == NULL) {
+            // give the cached memory back and retry once
+            if (Trim(0) == 0) {
+                return NULL;
+            }
+            ptr = _backend->Allocate(key, cacheable ? classBytes : sizeBytes);
+            if (ptr == NULL) {
+                return NULL;
+            }
+        }
+        if (fresh) {
+            *fresh = true;
+        }
+
+        std::lock_guard<std::mutex> l(_lock);
+        _misses++;
+        if (cacheable) {
+            _inUse[ptr] = Block{key, classBytes};
+            _inUseBytes += classBytes;
+        } else {
+            _uncached[ptr] = key;
+        }
+        return ptr;
+    }
+
+    // Free a block returned by Allocate.  Returns false if ptr was not allocated by the cache.
+    bool Free(void* ptr) {
+        return Release(ptr, nullptr, true);
+    }
+
+    // Free a block once ready() returns true.  Returns false if ptr was not allocated by the cache.
+    bool FreeAsync(void* ptr, std::function<bool()> ready) {
+        return Release(ptr, std::move(ready), true);
+    }
+
+    // Give a block back to the backend right away, without caching it.
+    bool Discard(void* ptr) {
+        return Release(ptr, nullptr, false);
+    }
+
+    // Give free blocks back to the backend until at most keepBytes remain cached.
+    // Returns the number of bytes given back.
+    size_t Trim(size_t keepBytes) {
+        Victims victims;
+        size_t trimmed = 0;
+        {
+            std::lock_guard<std::mutex> l(_lock);
+            ReapPending(&victims);
+            for (auto list = _freeLists.begin(); (list != _freeLists.end()) && (_cachedBytes > keepBytes); ++list) {
+                const size_t classBytes = list->first.second;
+                while (!list->second.empty() && (_cachedBytes > keepBytes)) {
+                    victims.push_back(std::make_pair(list->first.first, list->second.back()));
+                    list->second.pop_back();
+                    _cachedBytes -= classBytes;
+                    trimmed += classBytes;
+                }
+            }
+        }
+        FreeVictims(victims);
+        return trimmed;
+    }
+
+    void GetStats(Stats *stats) {
+        Victims victims;
+        {
+            std::lock_guard<std::mutex> l(_lock);
+            ReapPending(&victims);
+            stats->hits = _hits;
+            stats->misses = _misses;
+            stats->inUseBytes = _inUseBytes;
+            stats->cachedBytes = _cachedBytes;
+            stats->pendingBytes = _pendingBytes;
+        }
+        FreeVictims(victims);
+    }
+
+private:
+    // blocks to give back to the backend once _lock is released, with their keys
+    typedef std::vector<std::pair<uint64_t, void*>> Victims;
+
+    struct Block {
+        uint64_t key;
+        size_t   classBytes;
+    };
+
+    struct Pending {
+        void*                   ptr;
+        Block                   block;
+        std::function<bool()>   ready;
+    };
+
+    bool Release(void* ptr, std::function<bool()> ready, bool cache) {
+        uint64_t key;
+        {
+            std::lock_guard<std::mutex> l(_lock);
+            auto it = _inUse.find(ptr);
+            if (it != _inUse.end()) {
+                const Block block = it->second;
+                _inUse.erase(it);
+                _inUseBytes -= block.classBytes;
+                if (cache && ready) {
+                    _pending.push_back(Pending{ptr, block, std::move(ready)});
+                    _pendingBytes += block.classBytes;
+                    return true;
+                }
+                if (cache && (_cachedBytes + block.classBytes <= _budgetBytes)) {
+                    _freeLists[std::make_pair(block.key, block.classBytes)].push_back(ptr);
+                    _cachedBytes += block.classBytes;
+                    return true;
+                }
+                key = block.key;
+            } else {
+                auto u = _uncached.find(ptr);
+                if (u == _uncached.end()) {
+                    return false;
+                }
+                key = u->second;
+                _uncached.erase(u);
+            }
+        }
+        if (ready) {
+            // blocks which are not cached are freed once the work using them is done
+            while (!ready()) {
+                std::this_thread::yield();
+            }
+        }
+        _backend->Free(key, ptr);
+        return true;
+    }
+
+    // Move the pending blocks which are ready to the free lists, or to victims past the budget.
+    // Called with _lock held.
+    void ReapPending(Victims *victims) {
+        for (auto it = _pending.begin(); it != _pending.end(); ) {
+            if (!it->ready()) {
+                ++it;
+                continue;
+            }
+            _pendingBytes -= it->block.classBytes;
+            if (_cachedBytes + it->block.classBytes <= _budgetBytes) {
+                _freeLists[std::make_pair(it->block.key, it->block.classBytes)].push_back(it->ptr);
+                _cachedBytes += it->block.classBytes;
+            } else {
+                victims->push_back(std::make_pair(it->block.key, it->ptr));
+            }
+            it = _pending.erase(it);
+        }
+    }
+
+    void FreeVictims(const Victims &victims) {
+        for (auto &v : victims) {
+            _backend->Free(v.first, v.second);
+        }
+    }
+
+    Backend                                                 *_backend;
+    size_t                                                  _budgetBytes;
+
+    std::map<std::pair<uint64_t, size_t>, std::vector<void*>> _freeLists;     // by key and size class
+    std::unordered_map<void*, Block>                        _inUse;
+    std::unordered_map<void*, uint64_t>                     _uncached;      // too large to be cached
+    std::deque<Pending>                                     _pending;
+
+    uint64_t                                                _hits;
+    uint64_t                                                _misses;
+    size_t                                                  _inUseBytes;
+    size_t                                                  _cachedBytes;
+    size_t                                                  _pendingBytes;
+
+    std::mutex                                              _lock;
+};
+
+#endif
@@ -2,6 +2,12 @@
 #include <hsa/hsa.h>
 #include <hsa/hsa_ext_amd.h>
 
+#include <execinfo.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "am_alloc_cache.h"
+
 #define DB_TRACKER 0
 
 #if DB_TRACKER 
@@ -15,8 +21,16 @@
 //=========================================================================================================
 // Pointer Tracker Structures:
 //=========================================================================================================
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace hc {
 AmPointerInfo & AmPointerInfo::operator= (const AmPointerInfo &other) 
@@ -35,71 +49,299 @@ AmPointerInfo & AmPointerInfo::operator= (const AmPointerInfo &other)
 }
 
 
+std::ostream &operator<<(std::ostream &os, const hc::AmPointerInfo &ap)
+{
+    os << "hostPointer:" << ap._hostPointer << " devicePointer:"<< ap._devicePointer << " sizeBytes:" << ap._sizeBytes
+       << " isInDeviceMem:" << ap._isInDeviceMem  << " isAmManaged:" << ap._isAmManaged 
+       << " appId:" << ap._appId << " appAllocFlags:" << ap._appAllocationFlags;
+    return os;
+}
+
+
 //---
 struct AmMemoryRange {
     const void * _basePointer;
     const void * _endPointer;
     AmMemoryRange(const void *basePointer, size_t sizeBytes) :
         _basePointer(basePointer), _endPointer((const unsigned char*)basePointer + sizeBytes - 1) {};
-};
-
-// Functor to compare ranges:
-struct AmMemoryRangeCompare {
-    // Return true is LHS range is less than RHS - used to order the 
-    bool operator()(const AmMemoryRange &lhs, const AmMemoryRange &rhs) const
-    {
-        return lhs._endPointer < rhs._basePointer;
-    }
 
+    bool contains(const void *pointer) const { return (pointer >= _basePointer) && (pointer <= _endPointer); }
 };
 
 
-std::ostream &operator<<(std::ostream &os, const hc::AmPointerInfo &ap)
-{
-    os << "hostPointer:" << ap._hostPointer << " devicePointer:"<< ap._devicePointer << " sizeBytes:" << ap._sizeBytes
-       << " isInDeviceMem:" << ap._isInDeviceMem  << " isAmManaged:" << ap._isAmManaged 
-       << " appId:" << ap._appId << " appAllocFlags:" << ap._appAllocationFlags;
-    return os;
-}
+// Give a block allocated by am_alloc back to the runtime, bypassing the allocation cache.
+static void amReleaseBlock(void *ptr);
 
 
 //-------------------------------------------------------------------------------------------------
 // This structure tracks information for each pointer.
 // Uses memory-range-based lookups - so pointers that exist anywhere in the range of hostPtr + size 
 // will find the associated AmPointerInfo.
-// The insertions and lookups use a self-balancing binary tree and should support O(logN) lookup speed.
-// The structure is thread-safe - writers obtain a mutex before modifying the tree.  Multiple simulatenous readers are supported.
+//
+// Lookups are far more frequent than insertions (every copy looks up its src and dst pointers), so
+// the ranges are kept in immutable sorted chunks of at most _maxChunkEntries ranges, listed in an
+// immutable index, which readers search without taking a lock (two binary searches, O(logN)).
+// Writers obtain a mutex, copy the one chunk they change and the index, and publish the new index;
+// the replaced chunk and index are freed once no reader can still be using them (read-copy-update).
+// Readers announce themselves in one of several reader slots, picked from the thread id so that
+// threads looking up pointers at the same time rarely share a cache line, and count in one of two
+// counters of the slot, picked by the parity of an epoch: a writer flips the epoch, so that it only
+// waits for the readers which entered before it did.
 class AmPointerTracker {
-typedef std::map<AmMemoryRange, hc::AmPointerInfo, AmMemoryRangeCompare> MapTrackerType;
 public:
+    typedef std::pair<AmMemoryRange, hc::AmPointerInfo> Entry;
+    typedef std::vector<Entry> Chunk;           // sorted by base pointer, never empty
+    typedef std::vector<const Chunk*> Index;    // chunks in address order, ranges do not overlap
+
+    AmPointerTracker() : _index(new Index()), _epoch(0), _sampleThreshold(0) {
+        for (int i = 0; i < _numReaderSlots; i++) {
+            _readers[i].active[0].store(0, std::memory_order_relaxed);
+            _readers[i].active[1].store(0, std::memory_order_relaxed);
+        }
+        // HCC_AM_PROFILE_THRESHOLD: record the call stack of the ranges of at least this many bytes
+        const char *threshold = getenv("HCC_AM_PROFILE_THRESHOLD");
+        if (threshold) {
+            _sampleThreshold = strtoull(threshold, NULL, 0);
+        }
+    }
+    ~AmPointerTracker() {
+        Index *index = _index.load();
+        for (const Chunk *c : *index) {
+            delete c;
+        }
+        delete index;
+    }
 
     void insert(void *pointer, const hc::AmPointerInfo &p);
     int remove(void *pointer);
 
-    MapTrackerType::iterator find(const void *hostPtr) ;
-    
-    MapTrackerType::iterator readerLockBegin() { _mutex.lock(); return _tracker.begin(); } ;
-    MapTrackerType::iterator end() { return _tracker.end(); } ;
-    void readerUnlock() { _mutex.unlock(); };
-
+    // Copy the information of the range containing pointer to *info (if not NULL).
+    // Returns false if pointer is not tracked.
+    bool find(const void *pointer, hc::AmPointerInfo *info);
+    bool update(const void *pointer, int appId, unsigned allocationFlags);
+
+    // Call f for each tracked range, in address order.  Writers wait meanwhile.
+    template <typename F>
+    void forEach(F f) {
+        std::lock_guard<std::mutex> l (_writerMutex);
+        for (const Chunk *c : *_index.load(std::memory_order_relaxed)) {
+            for (const Entry &e : *c) {
+                f(e.first, e.second);
+            }
+        }
+    }
 
     size_t reset (const hc::accelerator &acc);
     void update_peers (const hc::accelerator &acc, int peerCnt, hsa_agent_t *peerAgents) ;
 
+    // Record that agents were given access to the range containing pointer, and tell whether agent was.
+    void allow_access(const void *pointer, int agentCount, const hsa_agent_t *agents);
+    bool has_access(const void *pointer, hsa_agent_t agent);
+
+    // Running totals of the ranges tracked for acc, kept up to date by the writers.
+    void usage(const hc::accelerator &acc, hc::AmMemoryUsage *usage);
+    void app_usage(const hc::accelerator &acc, int appId, size_t *bytes, size_t *count);
+
+    // Write the totals, the sampled ranges and, if allRanges, every range as JSON lines.
+    void dump(FILE *f, bool allRanges);
+
 private:
-    MapTrackerType  _tracker;
-    std::mutex      _mutex;
-    //std::shared_timed_mutex _mut;
+    static const int _numReaderSlots = 64;
+    static const int _maxSampleFrames = 32;
+    static const size_t _maxChunkEntries = 256;
+
+    // device memory allocated by AM, host memory allocated by AM, memory added by the application
+    enum { UsageDevice = 0, UsageHost = 1, UsageUser = 2, UsageKinds = 3 };
+
+    struct Usage {
+        size_t bytes[UsageKinds];
+        size_t count[UsageKinds];
+        size_t peakBytes[UsageKinds];
+        std::map<int, std::pair<size_t, size_t>> apps;     // bytes and count by appId
+    };
+
+    // Call stack of the insertion of a range of at least HCC_AM_PROFILE_THRESHOLD bytes.
+    struct Sample {
+        std::chrono::steady_clock::time_point time;
+        std::vector<void*> stack;
+    };
+
+    static int usageKind(const hc::AmPointerInfo &info) {
+        return info._isAmManaged ? (info._isInDeviceMem ? UsageDevice : UsageHost) : UsageUser;
+    }
+
+    // Add or remove info from the totals.  Called with _writerMutex held.
+    void account(const hc::AmPointerInfo &info, bool add);
+
+    struct alignas(64) ReaderSlot {
+        std::atomic<int> active[2];     // readers of this slot using an index, by epoch parity
+    };
+
+    ReaderSlot &readerSlot() {
+        return _readers[std::hash<std::thread::id>()(std::this_thread::get_id()) % _numReaderSlots];
+    }
+
+    // the chunk of index which may contain pointer: the last one starting at or before it, else the first
+    static size_t chunkOf(const Index &index, const void *pointer);
+
+    // index of the range containing pointer in chunk, or -1
+    static long lookup(const Chunk &chunk, const void *pointer);
+
+    // Replace the published index by index, and free the previous one and the chunks it alone
+    // used (replaced) once the readers are done with them.  Called with _writerMutex held.
+    void publish(Index *index, const std::vector<const Chunk*> &replaced);
+
+    std::atomic<Index*>     _index;
+    std::atomic<unsigned>   _epoch;
+    ReaderSlot              _readers[_numReaderSlots];
+    std::mutex              _writerMutex;
+
+    // protected by _writerMutex
+    std::map<Kalmar::KalmarDevice*, Usage>  _usage;
+    std::map<const void*, Sample>           _samples;   // by base pointer
+    std::map<const void*, std::vector<uint64_t>>  _peerAccess;    // agents given access, by base pointer
+    size_t                                  _sampleThreshold;
 };
 
 
+//---
+void AmPointerTracker::account(const hc::AmPointerInfo &info, bool add)
+{
+    Usage &u = _usage[info._acc.get_dev_ptr()];
+    const int kind = usageKind(info);
+    std::pair<size_t, size_t> &app = u.apps[info._appId];
+    if (add) {
+        u.bytes[kind] += info._sizeBytes;
+        u.count[kind]++;
+        u.peakBytes[kind] = std::max(u.peakBytes[kind], u.bytes[kind]);
+        app.first += info._sizeBytes;
+        app.second++;
+    } else {
+        u.bytes[kind] -= info._sizeBytes;
+        u.count[kind]--;
+        app.first -= info._sizeBytes;
+        app.second--;
+        if (app.second == 0) {
+            u.apps.erase(info._appId);
+        }
+    }
+}
+
+
+//---
+size_t AmPointerTracker::chunkOf(const Index &index, const void *pointer)
+{
+    // first chunk starting after pointer, the one before may contain it
+    auto iter = std::upper_bound(index.begin(), index.end(), pointer,
+                                 [](const void *p, const Chunk *c) { return p < c->front().first._basePointer; });
+    return (iter == index.begin()) ? 0 : (iter - index.begin() - 1);
+}
+
+
+//---
+long AmPointerTracker::lookup(const Chunk &chunk, const void *pointer)
+{
+    // first range starting after pointer, the one before may contain it
+    auto iter = std::upper_bound(chunk.begin(), chunk.end(), pointer,
+                                 [](const void *p, const Entry &e) { return p < e.first._basePointer; });
+    if (iter == chunk.begin()) {
+        return -1;
+    }
+    --iter;
+    return iter->first.contains(pointer) ? (iter - chunk.begin()) : -1;
+}
+
+
+//---
+void AmPointerTracker::publish(Index *index, const std::vector<const Chunk*> &replaced)
+{
+    Index *old = _index.exchange(index);
+
+    // A reader which entered before the exchange may still use the old index; one which enters after
+    // it loads the new one.  Readers entering after a flip of the epoch count in the other counter, so
+    // the wait for the counters of the previous parity is bounded by the readers already in.  A reader
+    // may read the epoch before a flip and enter after it: the second flip waits for it.
+    for (int flip = 0; flip < 2; flip++) {
+        const unsigned parity = _epoch.fetch_add(1) & 1;
+        for (int i = 0; i < _numReaderSlots; i++) {
+            while (_readers[i].active[parity].load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    delete old;
+    for (const Chunk *c : replaced) {
+        delete c;
+    }
+}
+
+
 //---
 void AmPointerTracker::insert (void *pointer, const hc::AmPointerInfo &p)
 {
-    std::lock_guard<std::mutex> l (_mutex);
+    Sample sample;
+    const bool sampled = (_sampleThreshold != 0) && (p._sizeBytes >= _sampleThreshold);
+    if (sampled) {
+        void *frames[_maxSampleFrames];
+        int depth = backtrace(frames, _maxSampleFrames);
+        // skip this function
+        sample.stack.assign(frames + std::min(depth, 1), frames + depth);
+        sample.time = std::chrono::steady_clock::now();
+    }
+
+    std::lock_guard<std::mutex> l (_writerMutex);
 
     mprintf ("insert: %p + %zu\n", pointer, p._sizeBytes);
-    _tracker.insert(std::make_pair(AmMemoryRange(pointer, p._sizeBytes), p));
+    const Index &current = *_index.load(std::memory_order_relaxed);
+    AmMemoryRange range(pointer, p._sizeBytes);
+
+    Chunk *chunk = new Chunk();
+    size_t c = 0;
+    if (!current.empty()) {
+        c = chunkOf(current, pointer);
+        const Chunk &old = *current[c];
+
+        // ranges overlapping a tracked range are ignored: the one before is in this chunk unless
+        // pointer is before all of them, the one after in this chunk or at the start of the next
+        auto pos = std::lower_bound(old.begin(), old.end(), pointer,
+                                    [](const Entry &e, const void *ptr) { return e.first._basePointer < ptr; });
+        const Entry *next = (pos != old.end()) ? &*pos :
+                            (c + 1 < current.size()) ? &current[c + 1]->front() : nullptr;
+        if (((next != nullptr) && (next->first._basePointer <= range._endPointer)) ||
+            ((pos != old.begin()) && ((pos - 1)->first._endPointer >= pointer))) {
+            delete chunk;
+            return;
+        }
+
+        chunk->reserve(old.size() + 1);
+        chunk->insert(chunk->end(), old.begin(), pos);
+        chunk->push_back(std::make_pair(range, p));
+        chunk->insert(chunk->end(), pos, old.end());
+    } else {
+        chunk->push_back(std::make_pair(range, p));
+    }
+
+    Index *index = new Index(current);
+    std::vector<const Chunk*> replaced;
+    if (current.empty()) {
+        index->push_back(chunk);
+    } else {
+        replaced.push_back(current[c]);
+        (*index)[c] = chunk;
+        if (chunk->size() > _maxChunkEntries) {
+            // split in halves
+            Chunk *upper = new Chunk(chunk->begin() + chunk->size() / 2, chunk->end());
+            chunk->erase(chunk->begin() + chunk->size() / 2, chunk->end());
+            index->insert(index->begin() + c + 1, upper);
+        }
+    }
+    publish(index, replaced);
+
+    account(p, true);
+    if (sampled) {
+        _samples[pointer] = std::move(sample);
+    }
 }
 
 
@@ -107,19 +349,86 @@ void AmPointerTracker::insert (void *pointer, const hc::AmPointerInfo &p)
 // Return 1 if removed or 0 if not found.
 int AmPointerTracker::remove (void *pointer)
 {
-    std::lock_guard<std::mutex> l (_mutex);
+    std::lock_guard<std::mutex> l (_writerMutex);
     mprintf ("remove: %p\n", pointer);
-    return _tracker.erase(AmMemoryRange(pointer,1));
+
+    const Index &current = *_index.load(std::memory_order_relaxed);
+    if (current.empty()) {
+        return 0;
+    }
+    const size_t c = chunkOf(current, pointer);
+    const Chunk &old = *current[c];
+    long i = lookup(old, pointer);
+    if (i < 0) {
+        return 0;
+    }
+
+    const Entry removed = old[i];
+    Index *index = new Index(current);
+    if (old.size() == 1) {
+        index->erase(index->begin() + c);
+    } else {
+        Chunk *chunk = new Chunk(old);
+        chunk->erase(chunk->begin() + i);
+        (*index)[c] = chunk;
+    }
+    publish(index, std::vector<const Chunk*>(1, &old));
+
+    account(removed.second, false);
+    _samples.erase(removed.first._basePointer);
+    _peerAccess.erase(removed.first._basePointer);
+    return 1;
 }
 
 
 //---
-AmPointerTracker::MapTrackerType::iterator  AmPointerTracker::find (const void *pointer)
+bool AmPointerTracker::find (const void *pointer, hc::AmPointerInfo *info)
 {
-    std::lock_guard<std::mutex> l (_mutex);
-    auto iter = _tracker.find(AmMemoryRange(pointer,1));
     mprintf ("find: %p\n", pointer);
-    return iter;
+    std::atomic<int> &active = readerSlot().active[_epoch.load() & 1];
+    active.fetch_add(1);
+
+    const Index &index = *_index.load();
+    long i = -1;
+    if (!index.empty()) {
+        const Chunk &chunk = *index[chunkOf(index, pointer)];
+        i = lookup(chunk, pointer);
+        if ((i >= 0) && info) {
+            *info = chunk[i].second;
+        }
+    }
+
+    active.fetch_sub(1, std::memory_order_release);
+    return (i >= 0);
+}
+
+
+//---
+bool AmPointerTracker::update (const void *pointer, int appId, unsigned allocationFlags)
+{
+    std::lock_guard<std::mutex> l (_writerMutex);
+
+    const Index &current = *_index.load(std::memory_order_relaxed);
+    if (current.empty()) {
+        return false;
+    }
+    const size_t c = chunkOf(current, pointer);
+    const Chunk &old = *current[c];
+    long i = lookup(old, pointer);
+    if (i < 0) {
+        return false;
+    }
+
+    Chunk *chunk = new Chunk(old);
+    account((*chunk)[i].second, false);
+    (*chunk)[i].second._appId              = appId;
+    (*chunk)[i].second._appAllocationFlags = allocationFlags;
+    account((*chunk)[i].second, true);
+
+    Index *index = new Index(current);
+    (*index)[c] = chunk;
+    publish(index, std::vector<const Chunk*>(1, &old));
+    return true;
 }
 
 
@@ -128,24 +437,54 @@ AmPointerTracker::MapTrackerType::iterator  AmPointerTracker::find (const void *
 // Returns count of ranges removed.
 size_t AmPointerTracker::reset (const hc::accelerator &acc) 
 {
-    std::lock_guard<std::mutex> l (_mutex);
+    std::lock_guard<std::mutex> l (_writerMutex);
     mprintf ("reset: \n");
 
+    // chunks without a range of acc are kept as they are
+    const Index &current = *_index.load(std::memory_order_relaxed);
+    Index *index = new Index();
+    std::vector<const Chunk*> replaced;
+
     size_t count = 0;
-    // relies on C++11 (erase returns iterator)
-    for (auto iter = _tracker.begin() ; iter != _tracker.end(); ) {
-        if (iter->second._acc == acc) {
-            if (iter->second._isAmManaged) {
-                hsa_amd_memory_pool_free(const_cast<void*> (iter->first._basePointer));
+    std::vector<void*> amManaged;
+    for (const Chunk *old : current) {
+        Chunk *chunk = nullptr;
+        for (auto e = old->begin(); e != old->end(); ++e) {
+            if (e->second._acc == acc) {
+                if (chunk == nullptr) {
+                    chunk = new Chunk(old->begin(), e);
+                }
+                if (e->second._isAmManaged) {
+                    amManaged.push_back(const_cast<void*> (e->first._basePointer));
+                }
+                account(e->second, false);
+                _samples.erase(e->first._basePointer);
+                _peerAccess.erase(e->first._basePointer);
+                count++;
+            } else if (chunk != nullptr) {
+                chunk->push_back(*e);
             }
-            count++;
+        }
 
-            iter = _tracker.erase(iter);
+        if (chunk == nullptr) {
+            index->push_back(old);
         } else {
-            iter++;
+            replaced.push_back(old);
+            if (chunk->empty()) {
+                delete chunk;
+            } else {
+                index->push_back(chunk);
+            }
         }
     }
 
+    // unpublish the ranges before freeing them
+    publish(index, replaced);
+
+    for (void *ptr : amManaged) {
+        amReleaseBlock(ptr);
+    }
+
     return count;
 }
 
@@ -155,18 +494,191 @@ size_t AmPointerTracker::reset (const hc::accelerator &acc)
 // Returns count of ranges removed.
 void AmPointerTracker::update_peers (const hc::accelerator &acc, int peerCnt, hsa_agent_t *peerAgents) 
 {
-    std::lock_guard<std::mutex> l (_mutex);
+    std::lock_guard<std::mutex> l (_writerMutex);
+
+    for (const Chunk *c : *_index.load(std::memory_order_relaxed)) {
+        for (const Entry &e : *c) {
+            if (e.second._acc == acc) {
+                if (e.second._isInDeviceMem) {
+                    mprintf ("update peers\n");
+                    hsa_status_t status = hsa_amd_agents_allow_access(peerCnt, peerAgents, NULL, const_cast<void*> (e.first._basePointer));
+                    if (status == HSA_STATUS_SUCCESS) {
+                        std::vector<uint64_t> &agents = _peerAccess[e.first._basePointer];
+                        for (int i = 0; i < peerCnt; i++) {
+                            agents.push_back(peerAgents[i].handle);
+                        }
+                    }
+                }
+            } 
+        }
+    }
+}
+
+
+//---
+void AmPointerTracker::allow_access(const void *pointer, int agentCount, const hsa_agent_t *agents)
+{
+    std::lock_guard<std::mutex> l (_writerMutex);
+
+    const Index &current = *_index.load(std::memory_order_relaxed);
+    if (current.empty()) {
+        return;
+    }
+    const Chunk &chunk = *current[chunkOf(current, pointer)];
+    long i = lookup(chunk, pointer);
+    if (i < 0) {
+        return;
+    }
+    std::vector<uint64_t> &granted = _peerAccess[chunk[i].first._basePointer];
+    for (int a = 0; a < agentCount; a++) {
+        granted.push_back(agents[a].handle);
+    }
+}
+
+
+//---
+bool AmPointerTracker::has_access(const void *pointer, hsa_agent_t agent)
+{
+    std::lock_guard<std::mutex> l (_writerMutex);
+
+    const Index &current = *_index.load(std::memory_order_relaxed);
+    if (current.empty()) {
+        return false;
+    }
+    const Chunk &chunk = *current[chunkOf(current, pointer)];
+    long i = lookup(chunk, pointer);
+    if (i < 0) {
+        return false;
+    }
+    auto granted = _peerAccess.find(chunk[i].first._basePointer);
+    return (granted != _peerAccess.end()) &&
+           (std::find(granted->second.begin(), granted->second.end(), agent.handle) != granted->second.end());
+}
+
+//---
+void AmPointerTracker::usage(const hc::accelerator &acc, hc::AmMemoryUsage *usage)
+{
+    std::lock_guard<std::mutex> l (_writerMutex);
+    Usage u = {};
+    auto it = _usage.find(acc.get_dev_ptr());
+    if (it != _usage.end()) {
+        u = it->second;
+    }
+    usage->deviceBytes     = u.bytes[UsageDevice];
+    usage->deviceCount     = u.count[UsageDevice];
+    usage->devicePeakBytes = u.peakBytes[UsageDevice];
+    usage->hostBytes       = u.bytes[UsageHost];
+    usage->hostCount       = u.count[UsageHost];
+    usage->hostPeakBytes   = u.peakBytes[UsageHost];
+    usage->userBytes       = u.bytes[UsageUser];
+    usage->userCount       = u.count[UsageUser];
+    usage->userPeakBytes   = u.peakBytes[UsageUser];
+}
+
+
+//---
+void AmPointerTracker::app_usage(const hc::accelerator &acc, int appId, size_t *bytes, size_t *count)
+{
+    std::lock_guard<std::mutex> l (_writerMutex);
+    *bytes = *count = 0;
+    auto it = _usage.find(acc.get_dev_ptr());
+    if (it != _usage.end()) {
+        auto app = it->second.apps.find(appId);
+        if (app != it->second.apps.end()) {
+            *bytes = app->second.first;
+            *count = app->second.second;
+        }
+    }
+}
 
-    // relies on C++11 (erase returns iterator)
-    for (auto iter = _tracker.begin() ; iter != _tracker.end(); ) {
-        if (iter->second._acc == acc) {
-            if (iter->second._isInDeviceMem) {
-                mprintf ("update peers\n");
-                hsa_amd_agents_allow_access(peerCnt, peerAgents, NULL, const_cast<void*> (iter->first._basePointer));
+
+// JSON string of s, quotes and control characters escaped.
+static std::string jsonString(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if ((c == '"') || (c == '\\')) {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static std::string jsonDevice(Kalmar::KalmarDevice *dev)
+{
+    std::wstring path = dev ? dev->get_path() : L"";
+    return jsonString(std::string(path.begin(), path.end()));
+}
+
+
+//---
+// One JSON object per line, told apart by their "type":
+//   usage      totals of a device: bytes, count and peak bytes of each kind of memory
+//   app        totals of an appId on a device
+//   sample     a range of at least HCC_AM_PROFILE_THRESHOLD bytes still tracked, with its age and call stack
+//   range      a tracked range (allRanges only), to look at fragmentation
+void AmPointerTracker::dump(FILE *f, bool allRanges)
+{
+    std::lock_guard<std::mutex> l (_writerMutex);
+    const auto now = std::chrono::steady_clock::now();
+    static const char *kinds[UsageKinds] = { "device", "host", "user" };
+
+    for (auto &u : _usage) {
+        const std::string device = jsonDevice(u.first);
+        fprintf(f, "{\"type\":\"usage\",\"device\":%s", device.c_str());
+        for (int k = 0; k < UsageKinds; k++) {
+            fprintf(f, ",\"%sBytes\":%zu,\"%sCount\":%zu,\"%sPeakBytes\":%zu",
+                    kinds[k], u.second.bytes[k], kinds[k], u.second.count[k], kinds[k], u.second.peakBytes[k]);
+        }
+        fprintf(f, "}\n");
+
+        for (auto &app : u.second.apps) {
+            fprintf(f, "{\"type\":\"app\",\"device\":%s,\"appId\":%d,\"bytes\":%zu,\"count\":%zu}\n",
+                    device.c_str(), app.first, app.second.first, app.second.second);
+        }
+    }
+
+    for (const Chunk *c : *_index.load(std::memory_order_relaxed)) {
+        for (const Entry &e : *c) {
+            auto sample = _samples.find(e.first._basePointer);
+            const bool sampled = (sample != _samples.end());
+            if (!sampled && !allRanges) {
+                continue;
             }
-        } 
-        iter++;
+            const hc::AmPointerInfo &info = e.second;
+            fprintf(f, "{\"type\":\"%s\",\"device\":%s,\"pointer\":\"%p\",\"sizeBytes\":%zu,\"kind\":\"%s\",\"appId\":%d,\"appAllocationFlags\":%u",
+                    sampled ? "sample" : "range", jsonDevice(info._acc.get_dev_ptr()).c_str(), e.first._basePointer,
+                    info._sizeBytes, kinds[usageKind(info)], info._appId, info._appAllocationFlags);
+            if (sampled) {
+                const double ageSeconds = std::chrono::duration<double>(now - sample->second.time).count();
+                fprintf(f, ",\"ageSeconds\":%.3f,\"stack\":[", ageSeconds);
+                const std::vector<void*> &stack = sample->second.stack;
+                char **symbols = backtrace_symbols(stack.data(), static_cast<int> (stack.size()));
+                for (size_t i = 0; i < stack.size(); i++) {
+                    std::string frame;
+                    if (symbols) {
+                        frame = symbols[i];
+                    } else {
+                        char buf[32];
+                        snprintf(buf, sizeof(buf), "%p", stack[i]);
+                        frame = buf;
+                    }
+                    fprintf(f, "%s%s", i ? "," : "", jsonString(frame).c_str());
+                }
+                free(symbols);
+                fprintf(f, "]");
+            }
+            fprintf(f, "}\n");
+        }
     }
+    fflush(f);
 }
 
 
@@ -176,6 +688,97 @@ void AmPointerTracker::update_peers (const hc::accelerator &acc, int peerCnt, hs
 AmPointerTracker g_amPointerTracker;  // Track all am pointer allocations.
 
 
+//-------------------------------------------------------------------------------------------------
+// Memory of the allocation cache: a key is registered for each memory pool, and agent which
+// pinned host blocks are made accessible to.
+class HsaAllocBackend : public AmAllocCache::Backend {
+public:
+    uint64_t Key(hsa_amd_memory_pool_t pool, const hsa_agent_t *agent) {
+        std::lock_guard<std::mutex> l (_lock);
+        for (size_t i = 0; i < _pools.size(); i++) {
+            if ((_pools[i].pool.handle == pool.handle) && (_pools[i].allowAccess == (agent != NULL)) &&
+                (!agent || (_pools[i].agent.handle == agent->handle))) {
+                return i;
+            }
+        }
+        Pool p;
+        p.pool = pool;
+        p.allowAccess = (agent != NULL);
+        p.agent.handle = agent ? agent->handle : 0;
+        _pools.push_back(p);
+        return _pools.size() - 1;
+    }
+
+    void* Allocate(uint64_t key, size_t sizeBytes) override {
+        Pool p;
+        {
+            std::lock_guard<std::mutex> l (_lock);
+            p = _pools[key];
+        }
+        void *ptr = NULL;
+        if (hsa_amd_memory_pool_allocate(p.pool, sizeBytes, 0, &ptr) != HSA_STATUS_SUCCESS) {
+            return NULL;
+        }
+        if (p.allowAccess && (hsa_amd_agents_allow_access(1, &p.agent, NULL, ptr) != HSA_STATUS_SUCCESS)) {
+            hsa_amd_memory_pool_free(ptr);
+            return NULL;
+        }
+        return ptr;
+    }
+
+    void Free(uint64_t key, void *ptr) override {
+        hsa_amd_memory_pool_free(ptr);
+    }
+
+private:
+    struct Pool {
+        hsa_amd_memory_pool_t pool;
+        bool allowAccess;
+        hsa_agent_t agent;
+    };
+    std::vector<Pool> _pools;
+    std::mutex _lock;
+};
+
+static long amGetenv(const char *name, long defaultValue)
+{
+    const char *value = getenv(name);
+    return value ? atol(value) : defaultValue;
+}
+
+// Both are never destroyed: at exit the runtime may be gone before the static destructors run.
+static HsaAllocBackend &amAllocBackend()
+{
+    static HsaAllocBackend *backend = new HsaAllocBackend();
+    return *backend;
+}
+
+// HCC_AM_CACHE_SIZE: budget of the free blocks kept by the cache, in MB.
+static AmAllocCache &amAllocCache()
+{
+    static AmAllocCache *cache = new AmAllocCache(&amAllocBackend(), amGetenv("HCC_AM_CACHE_SIZE", 256) * 1024 * 1024);
+    return *cache;
+}
+
+// HCC_AM_CACHE: 0 (default) to cache the allocations with amCached only, 1 to cache all the
+// allocations except the ones with amNoCache.
+static bool amAllocCached(unsigned flags)
+{
+    static const bool cacheAll = (amGetenv("HCC_AM_CACHE", 0) != 0);
+    if (flags & amNoCache) {
+        return false;
+    }
+    return cacheAll || (flags & amCached);
+}
+
+static void amReleaseBlock(void *ptr)
+{
+    if (!amAllocCache().Discard(ptr)) {
+        hsa_amd_memory_pool_free(ptr);
+    }
+}
+
+
 //=========================================================================================================
 // API Definitions.
 //=========================================================================================================
@@ -204,25 +807,31 @@ auto_voidp am_alloc(size_t sizeBytes, hc::accelerator &acc, unsigned flags)
 
             if (alloc_region->handle != -1) {
 
-                hsa_status_t s1 = hsa_amd_memory_pool_allocate(*alloc_region, sizeBytes, 0, &ptr);
-
-                if (s1 != HSA_STATUS_SUCCESS) {
-                    ptr = NULL;
+                if (amAllocCached(flags)) {
+                    // the backend makes pinned host blocks accessible to the agent
+                    uint64_t key = amAllocBackend().Key(*alloc_region, (flags & amHostPinned) ? hsa_agent : NULL);
+                    ptr = amAllocCache().Allocate(key, sizeBytes);
                 } else {
-                    if (flags & amHostPinned) {
-                      s1 = hsa_amd_agents_allow_access(1, hsa_agent, NULL, ptr);
-                      if (s1 != HSA_STATUS_SUCCESS) {
-                        hsa_amd_memory_pool_free(ptr);
+                    hsa_status_t s1 = hsa_amd_memory_pool_allocate(*alloc_region, sizeBytes, 0, &ptr);
+
+                    if (s1 != HSA_STATUS_SUCCESS) {
                         ptr = NULL;
-                      }
-                      else {
+                    } else if (flags & amHostPinned) {
+                        s1 = hsa_amd_agents_allow_access(1, hsa_agent, NULL, ptr);
+                        if (s1 != HSA_STATUS_SUCCESS) {
+                            hsa_amd_memory_pool_free(ptr);
+                            ptr = NULL;
+                        }
+                    }
+                }
+
+                if (ptr != NULL) {
+                    if (flags & amHostPinned) {
                         g_amPointerTracker.insert(ptr,
                           hc::AmPointerInfo(ptr/*hostPointer*/, ptr /*devicePointer*/, sizeBytes, acc, false/*isDevice*/, true /*isAMManaged*/));
-                      }
-                    }
-                    else {
-                      g_amPointerTracker.insert(ptr,
-                        hc::AmPointerInfo(NULL/*hostPointer*/, ptr /*devicePointer*/, sizeBytes, acc, true/*isDevice*/, true /*isAMManaged*/));
+                    } else {
+                        g_amPointerTracker.insert(ptr,
+                          hc::AmPointerInfo(NULL/*hostPointer*/, ptr /*devicePointer*/, sizeBytes, acc, true/*isDevice*/, true /*isAMManaged*/));
                     }
                 }
             }
@@ -238,13 +847,24 @@ am_status_t am_free(void* ptr)
     am_status_t status = AM_SUCCESS;
 
     if (ptr != NULL) {
-        // See also tracker::reset which can free memory.
-        hsa_amd_memory_pool_free(ptr);
+        // the range may have been host memory pinned by unpinned copies
+        // before it was allocated here, and its addresses are about to be
+        // reused
+        hc::AmPointerInfo info;
+        if (g_amPointerTracker.find(ptr, &info)) {
+            Kalmar::getContext()->invalidateHostPinCache(ptr, info._sizeBytes);
+        }
 
+        // See also tracker::reset which can free memory.
+        // Untrack the range first: once freed, its address may be returned to another thread.
         int numRemoved = g_amPointerTracker.remove(ptr) ;
         if (numRemoved == 0) {
             status = AM_ERROR_MISC;
         }
+
+        if (!amAllocCache().Free(ptr)) {
+            hsa_amd_memory_pool_free(ptr);
+        }
     }
     return status;
 }
@@ -253,6 +873,7 @@ am_status_t am_free(void* ptr)
 am_status_t am_copy(void*  dst, const void*  src, size_t sizeBytes)
 {
     am_status_t am_status = AM_ERROR_MISC;
+    Kalmar::getContext()->invalidateMapShadows(dst, sizeBytes);
     hsa_status_t err = hsa_memory_copy(dst, src, sizeBytes);
 
     if (err == HSA_STATUS_SUCCESS) {
@@ -267,11 +888,7 @@ am_status_t am_copy(void*  dst, const void*  src, size_t sizeBytes)
 
 am_status_t am_memtracker_getinfo(hc::AmPointerInfo *info, const void *ptr)
 {
-    auto infoI = g_amPointerTracker.find(ptr);
-    if (infoI != g_amPointerTracker.end()) {
-        if (info) {
-            *info = infoI->second;
-        }
+    if (g_amPointerTracker.find(ptr, info)) {
         return AM_SUCCESS;
     } else {
         return AM_ERROR_MISC;
@@ -293,10 +910,7 @@ am_status_t am_memtracker_add(void* ptr, hc::AmPointerInfo &info)
 
 am_status_t am_memtracker_update(const void* ptr, int appId, unsigned allocationFlags)
 {
-    auto iter = g_amPointerTracker.find(ptr);
-    if (iter != g_amPointerTracker.end()) {
-        iter->second._appId              = appId;
-        iter->second._appAllocationFlags = allocationFlags;
+    if (g_amPointerTracker.update(ptr, appId, allocationFlags)) {
         return AM_SUCCESS;
     } else {
         return AM_ERROR_MISC;
@@ -308,6 +922,13 @@ am_status_t am_memtracker_remove(void* ptr)
 {
     am_status_t status = AM_SUCCESS;
 
+    // the memory is usually freed next: drop the pinned host ranges of the
+    // unpinned copies in it
+    hc::AmPointerInfo info;
+    if (g_amPointerTracker.find(ptr, &info)) {
+        Kalmar::getContext()->invalidateHostPinCache(ptr, info._sizeBytes);
+    }
+
     int numRemoved = g_amPointerTracker.remove(ptr) ;
     if (numRemoved == 0) {
         status = AM_ERROR_MISC;
@@ -321,43 +942,104 @@ void am_memtracker_print()
 {
     std::ostream &os = std::cerr;
 
-    //g_amPointerTracker.print(std::cerr);
-    for (auto iter = g_amPointerTracker.readerLockBegin() ; iter != g_amPointerTracker.end(); iter++) {
-        os << "  " << iter->first._basePointer << "..." << iter->first._endPointer << "::  ";
-        os << iter->second << std::endl;
-    }
-
-    g_amPointerTracker.readerUnlock();
+    g_amPointerTracker.forEach([&](const AmMemoryRange &range, const hc::AmPointerInfo &info) {
+        os << "  " << range._basePointer << "..." << range._endPointer << "::  ";
+        os << info << std::endl;
+    });
 }
 
 
 //---
 void am_memtracker_sizeinfo(const hc::accelerator &acc, size_t *deviceMemSize, size_t *hostMemSize, size_t *userMemSize)
 {
-    *deviceMemSize = *hostMemSize = *userMemSize = 0;
-    for (auto iter = g_amPointerTracker.readerLockBegin() ; iter != g_amPointerTracker.end(); iter++) {
-        if (iter->second._acc == acc) {
-            size_t sizeBytes = iter->second._sizeBytes;
-            if (iter->second._isAmManaged) {
-                if (iter->second._isInDeviceMem) {
-                    *deviceMemSize += sizeBytes;
-                } else {
-                    *hostMemSize += sizeBytes;
-                }
-            } else {
-                *userMemSize += sizeBytes;
-            }
-        }
+    AmMemoryUsage usage;
+    g_amPointerTracker.usage(acc, &usage);
+    *deviceMemSize = usage.deviceBytes;
+    *hostMemSize = usage.hostBytes;
+    *userMemSize = usage.userBytes;
+}
+
+
+//---
+void am_memtracker_usage(const hc::accelerator &acc, AmMemoryUsage *usage)
+{
+    g_amPointerTracker.usage(acc, usage);
+}
+
+
+//---
+void am_memtracker_app_usage(const hc::accelerator &acc, int appId, size_t *bytes, size_t *count)
+{
+    g_amPointerTracker.app_usage(acc, appId, bytes, count);
+}
+
+
+//---
+am_status_t am_memtracker_dump(const char *fileName, bool allRanges)
+{
+    FILE *f = fileName ? fopen(fileName, "a") : stderr;
+    if (f == NULL) {
+        return AM_ERROR_MISC;
+    }
+    g_amPointerTracker.dump(f, allRanges);
+    if (fileName) {
+        fclose(f);
+    }
+    return AM_SUCCESS;
+}
+
+
+am_status_t am_free_async(void* ptr, hc::accelerator_view &av)
+{
+    if (ptr == NULL) {
+        return AM_SUCCESS;
+    }
+
+    // as in am_free, the addresses of the range are about to be reused
+    hc::AmPointerInfo info;
+    if (g_amPointerTracker.find(ptr, &info)) {
+        Kalmar::getContext()->invalidateHostPinCache(ptr, info._sizeBytes);
+    }
+
+    int numRemoved = g_amPointerTracker.remove(ptr) ;
+    if (numRemoved == 0) {
+        return AM_ERROR_MISC;
     }
 
-    g_amPointerTracker.readerUnlock();
+    // the block may be used by the commands already enqueued to av
+    hc::completion_future marker = av.create_marker();
+    if (!amAllocCache().FreeAsync(ptr, [marker]() mutable { return marker.is_ready(); })) {
+        marker.wait();
+        hsa_amd_memory_pool_free(ptr);
+    }
+    return AM_SUCCESS;
+}
+
+
+void am_alloc_cache_stats(AmAllocCacheStats *stats)
+{
+    AmAllocCache::Stats s;
+    amAllocCache().GetStats(&s);
+    stats->hits = s.hits;
+    stats->misses = s.misses;
+    stats->inUseBytes = s.inUseBytes;
+    stats->cachedBytes = s.cachedBytes;
+    stats->pendingBytes = s.pendingBytes;
+}
+
+
+size_t am_alloc_cache_trim(size_t keepBytes)
+{
+    return amAllocCache().Trim(keepBytes);
 }
 
 
 //---
 size_t am_memtracker_reset(const hc::accelerator &acc)
 {
-    return g_amPointerTracker.reset(acc);
+    size_t count = g_amPointerTracker.reset(acc);
+    amAllocCache().Trim(0);
+    return count;
 }
 
 void am_memtracker_update_peers (const hc::accelerator &acc, int peerCnt, hsa_agent_t *peerAgents) 
@@ -365,6 +1047,11 @@ void am_memtracker_update_peers (const hc::accelerator &acc, int peerCnt, hsa_ag
     return g_amPointerTracker.update_peers(acc, peerCnt, peerAgents);
 }
 
+bool am_memtracker_peer_access(const void *ptr, const hsa_agent_t &agent)
+{
+    return g_amPointerTracker.has_access(ptr, agent);
+}
+
 am_status_t am_map_to_peers(void* ptr, size_t num_peer, const hc::accelerator* peers) 
 {
     // check input
@@ -414,7 +1101,7 @@ am_status_t am_map_to_peers(void* ptr, size_t num_peer, const hc::accelerator* p
                 continue;
         }
 
-        hsa_agent_t* agent = static_cast<hsa_agent_t*>(acc.get_hsa_agent());
+        hsa_agent_t* agent = static_cast<hsa_agent_t*>(a.get_hsa_agent());
 
         hsa_amd_memory_pool_access_t access;
         hsa_status_t  status = hsa_amd_agent_memory_pool_get_info(*agent, *pool, HSA_AMD_AGENT_MEMORY_POOL_INFO_ACCESS, &access);
@@ -444,7 +1131,11 @@ am_status_t am_map_to_peers(void* ptr, size_t num_peer, const hc::accelerator* p
     if(peer_count)
     {
         hsa_status_t status = hsa_amd_agents_allow_access(peer_count, agents, NULL, ptr);
-        return status == HSA_STATUS_SUCCESS ? AM_SUCCESS : AM_ERROR_MISC;
+        if (status != HSA_STATUS_SUCCESS) {
+            return AM_ERROR_MISC;
+        }
+        g_amPointerTracker.allow_access(ptr, peer_count, agents);
+        return AM_SUCCESS;
     }
    
     return AM_SUCCESS;
@@ -459,6 +1150,8 @@ am_status_t am_memory_host_lock(hc::accelerator &ac, void *hostPtr, size_t size,
     {
         agents.push_back(*static_cast<hsa_agent_t*>(visible_ac[i].get_hsa_agent()));
     }
+    // the range may be pinned already by unpinned copies
+    Kalmar::getContext()->invalidateHostPinCache(hostPtr, size);
     hsa_status_t hsa_status = hsa_amd_memory_lock(hostPtr, size, &agents[0], num_visible_ac, &devPtr);
     if(hsa_status == HSA_STATUS_SUCCESS)
     {
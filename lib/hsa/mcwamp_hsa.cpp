@@ -19,9 +19,11 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 
 #include <hsa/hsa.h>
 #include <hsa/hsa_ext_finalize.h>
@@ -35,8 +37,11 @@
 #include <hc_am.hpp>
 
 #include "unpinned_copy_engine.h"
+#include "peer_copy_scheduler.h"
+#include "streaming_memcpy.h"
 
 #include <time.h>
+#include <unistd.h>
 #include <iomanip>
 
 #ifndef KALMAR_DEBUG
@@ -72,14 +77,21 @@
 #define SIGNAL_POOL_SIZE (64) //
 
 // Maximum number of inflight commands sent to a single queue.
-// If limit is exceeded, HCC will force a queue wait to reclaim
+// This is the size of the HSAQueue.asyncOps ring. Completed commands are
+// retired from the ring as new ones are pushed; if it is still full of
+// incomplete commands, HCC will force a queue wait to reclaim
 // resources (signals, kernarg)
 // MUST be a power of 2.
 #define MAX_INFLIGHT_COMMANDS_PER_QUEUE  512
 
-// threshold to clean up finished kernel in HSAQueue.asyncOps
-// default set as 1024
-#define ASYNCOPS_VECTOR_GC_SIZE (1024)
+
+// maximum number of hardware queues behind one accelerator_view, see
+// HSAQueue.spreadQueues
+#define MAX_HARDWARE_QUEUES_PER_VIEW (4)
+
+// number of readers recorded for a buffer in HSAQueue.bufferDeps before
+// the ones which have completed are dropped
+#define BUFFER_READERS_GC_SIZE (16)
 
 
 // Copy thresholds, in KB.  These are used for "choose-best" copy mode.
@@ -87,6 +99,35 @@ long int HCC_H2D_STAGING_THRESHOLD    = 64;
 long int HCC_H2D_PININPLACE_THRESHOLD = 4096; 
 long int HCC_D2H_PININPLACE_THRESHOLD = 1024; 
 
+// Staging buffers of the unpinned copy engines: size of each buffer in KB (the largest chunk of a
+// staged copy), number of buffers per engine, and threads helping with the CPU side of the copies.
+long int HCC_STAGING_BUFFER_SIZE  = 1024;
+long int HCC_STAGING_BUFFER_COUNT = 4;
+long int HCC_STAGING_COPY_THREADS = 2;
+
+// Calibration of the copy thresholds above, done at the first unpinned copy of each device in
+// ChooseBest mode: 0=off, 1=read them from HCC_COPY_CALIBRATION_FILE or calibrate and save them,
+// 2=calibrate again.  Thresholds set in the environment are kept.
+long int HCC_COPY_CALIBRATION = 0;
+
+// Budget of the host ranges kept pinned for the pin-in-place copies, in MB.  0 disables the cache.
+// Off by default: the cache can not see host memory given back by free() or munmap(), so an
+// application enabling it has to call hc::invalidate_host_pin_cache before doing so.
+long int HCC_PINNED_CACHE_SIZE = 0;
+
+// Budget of the host shadow buffers kept by map() for the buffers of discrete devices, in MB.
+// 0 disables the cache: each mapping allocates and frees its own host buffer.
+long int HCC_MAP_CACHE_SIZE = 256;
+
+// Copies between the memory of two devices, see PeerCopyScheduler: size in KB of the chunks of the copies
+// staged through the host (and of each staging buffer), number of staging buffers, number of DMA engines
+// a direct copy may be spread over, and size in KB above which a direct copy is spread.  With 2 engines,
+// the source memory of a copy must also be mapped to the destination device (see am_map_to_peers).
+long int HCC_P2P_CHUNK_SIZE       = 4096;
+long int HCC_P2P_STAGING_COUNT    = 4;
+long int HCC_P2P_ENGINES          = 1;
+long int HCC_P2P_SPLIT_THRESHOLD  = 8192;
+
 int HCC_SERIALIZE_KERNEL = 0;
 int HCC_SERIALIZE_COPY = 0;
 
@@ -257,6 +298,9 @@ extern "C" void PushArgPtrImpl(void *ker, int idx, size_t sz, const void *v);
 namespace Kalmar {
 class HSAQueue;
 class HSADevice;
+
+// unpin host memory kept pinned by the unpinned copy engines, see PinnedHostCache
+static void invalidateHostPinCache(void* ptr, size_t size);
 } // namespace Kalmar
 
 ///
@@ -370,6 +414,74 @@ public:
     }
 }; // end of HSAKernel
 
+// Number of the async signal handlers registered by an op which have not run
+// yet. ROCr can not unregister a handler, so an op must not give its signal
+// back to the signal pool, where it is reset to 1 and handed to another op,
+// before its handlers have run: otherwise a late handler would wait for the
+// completion of the next user of the signal.
+class SignalHandlerCount {
+public:
+    SignalHandlerCount() : count(0) {}
+
+    void add() { count.fetch_add(1, std::memory_order_relaxed); }
+    void done() { count.fetch_sub(1, std::memory_order_release); }
+
+    // called before the signal is released. The signal has completed by
+    // then, so the handlers are about to run.
+    void wait() const {
+        while (count.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::atomic<int> count;
+};
+
+struct SignalCompletionCallback {
+    std::function<void()> callback;
+    SignalHandlerCount* handlers;
+};
+
+// Completion callbacks of signal-backed ops are delivered by the ROCr async
+// signal handler thread. The handler only forwards the callback to the shared
+// callback pool, so user continuations never run on (or stall) that thread.
+static bool signalCompletionHandler(hsa_signal_value_t value, void* arg) {
+    SignalCompletionCallback* cb = static_cast<SignalCompletionCallback*>(arg);
+    SignalHandlerCount* handlers = cb->handlers;
+    Kalmar::KalmarCallbackPool::getInstance().enqueue(std::move(cb->callback));
+    delete cb;
+
+    // last access to the op: it may release its signal from now on
+    handlers->done();
+
+    // one-shot: do not re-arm the handler
+    return false;
+}
+
+// Register callback to be run once signal drops below 1. handlers belongs to
+// the op owning signal, which must wait on it before releasing the signal.
+// Return false if the signal can not be monitored, in which case the caller
+// should fall back to a host wait.
+static bool addSignalCompletionCallback(hsa_signal_t signal, SignalHandlerCount& handlers,
+                                        std::function<void()>& callback) {
+    if (signal.handle == 0) {
+        return false;
+    }
+
+    SignalCompletionCallback* arg = new SignalCompletionCallback{ std::move(callback), &handlers };
+    handlers.add();
+    hsa_status_t status = hsa_amd_signal_async_handler(signal, HSA_SIGNAL_CONDITION_LT, 1,
+                                                       signalCompletionHandler, arg);
+    if (status != HSA_STATUS_SUCCESS) {
+        handlers.done();
+        callback = std::move(arg->callback);
+        delete arg;
+        return false;
+    }
+    return true;
+}
+
 class HSACopy : public Kalmar::KalmarAsyncOp {
 private:
     hsa_signal_t signal;
@@ -379,6 +491,9 @@ private:
 
     std::shared_future<void>* future;
 
+    // completion callbacks registered on the signal, see SignalHandlerCount
+    SignalHandlerCount signalHandlers;
+
 
     // If copy is dependent on another operation, record reference here.
     // keep a reference which prevents those ops from being deleted until this op is deleted.
@@ -397,10 +512,25 @@ private:
     // bytes to be copied
     size_t sizeBytes;
 
+    // Copies run by the AsyncCopyThread of copyDevice complete their signal from the host,
+    // they carry no profiling information: the thread records the timestamps instead.
+    bool isHostCopy;
+    uint64_t hostBeginTimestamp;
+    uint64_t hostEndTimestamp;
+
+    // why a copy run by the AsyncCopyThread failed, empty if it succeeded. Written by the
+    // thread before the signal is completed, rethrown by completion_future::get().
+    std::string hostCopyError;
+
+    // Copies between the memory of two devices are run by the PeerCopyScheduler, the signal
+    // is the completion event of the transfer.
+    std::shared_ptr<PeerCopyScheduler::Transfer> peerTransfer;
+
 
 public:
     std::shared_future<void>* getFuture() override { return future; }
     const Kalmar::HSADevice* getCopyDevice() { return copyDevice; } ;  // Which device did the copy.
+    bool isRunByHostThread() const { return isHostCopy; }
 
     void* getNativeHandle() override { return &signal; }
 
@@ -419,6 +549,12 @@ public:
         return (hsa_signal_load_acquire(signal) == 0);
     }
 
+    void addCompletionCallback(std::function<void()> callback) override {
+        if (!addSignalCompletionCallback(signal, signalHandlers, callback)) {
+            KalmarAsyncOp::addCompletionCallback(std::move(callback));
+        }
+    }
+
 
     // Copy mode will be set later on.
     // HSA signals would be waited in HSA_WAIT_STATE_ACTIVE by default for HSACopy instances
@@ -426,6 +562,7 @@ public:
         isSubmitted(false), future(nullptr), depAsyncOp(nullptr), hsaQueue(nullptr), copyDevice(nullptr), waitMode(HSA_WAIT_STATE_ACTIVE),
         src(src_), dst(dst_), 
         sizeBytes(sizeBytes_),
+        isHostCopy(false), hostBeginTimestamp(0), hostEndTimestamp(0),
         signalIndex(-1) {
 #if KALMAR_DEBUG
         std::cerr << "HSACopy::HSACopy(" << src_ << ", " << dst_ << ", " << sizeBytes_ << ")\n";
@@ -447,6 +584,9 @@ public:
 
     hsa_status_t enqueueAsyncCopyCommand(Kalmar::HSAQueue*, const Kalmar::HSADevice *copyDevice, const hc::AmPointerInfo &srcPtrInfo, const hc::AmPointerInfo &dstPtrInfo);
 
+    // enqueue a copy from or to memory which is not tracked, run by the AsyncCopyThread of copyDevice
+    hsa_status_t enqueueAsyncUnpinnedCopyCommand(Kalmar::HSAQueue*, const Kalmar::HSADevice *copyDevice, Kalmar::hcCommandKind copyDir);
+
     // wait for the async copy to complete
     hsa_status_t waitComplete();
 
@@ -471,6 +611,13 @@ public:
 
 
 private:
+  // body of an unpinned copy, run by the AsyncCopyThread
+  void runUnpinnedCopy(Kalmar::hcCommandKind copyDir);
+
+  // submit a copy between the memory of two devices to the PeerCopyScheduler
+  std::shared_ptr<PeerCopyScheduler::Transfer> submitPeerCopy(const hc::AmPointerInfo &srcPtrInfo, const hc::AmPointerInfo &dstPtrInfo,
+                                                              uint64_t waitFor, bool forceStaged);
+
   hsa_status_t hcc_memory_async_copy(const Kalmar::HSADevice *copyDevice, void *dst, const void *src, size_t sizeBytes, 
                                       int depSignalCnt, const hsa_signal_t *depSignals, 
                                       hsa_signal_t completion_signal);
@@ -486,6 +633,9 @@ private:
 
     std::shared_future<void>* future;
 
+    // completion callbacks registered on the signal, see SignalHandlerCount
+    SignalHandlerCount signalHandlers;
+
     Kalmar::HSAQueue* hsaQueue;
 
     // prior dependencies
@@ -497,11 +647,17 @@ private:
     // This array keeps a reference which prevents those ops from being deleted until this op is deleted.
     std::shared_ptr<KalmarAsyncOp> depAsyncOps [HSA_BARRIER_DEP_SIGNAL_CNT];
 
+    // if true the barrier packet also waits for all the packets before it
+    // in the queue, otherwise only for depAsyncOps
+    bool barrierBit;
+
 public:
     std::shared_future<void>* getFuture() override { return future; }
 
     void* getNativeHandle() override { return &signal; }
 
+    void setBarrierBit(bool b) { barrierBit = b; }
+
     void setWaitMode(Kalmar::hcWaitMode mode) override {
         switch (mode) {
             case Kalmar::hcWaitModeBlocked:
@@ -517,17 +673,23 @@ public:
         return (hsa_signal_load_acquire(signal) == 0);
     }
 
+    void addCompletionCallback(std::function<void()> callback) override {
+        if (!addSignalCompletionCallback(signal, signalHandlers, callback)) {
+            KalmarAsyncOp::addCompletionCallback(std::move(callback));
+        }
+    }
+
     // default constructor
     // 0 prior dependency
-    HSABarrier() : KalmarAsyncOp(Kalmar::hcCommandMarker), isDispatched(false), future(nullptr), hsaQueue(nullptr), waitMode(HSA_WAIT_STATE_BLOCKED), depCount(0) {}
+    HSABarrier() : KalmarAsyncOp(Kalmar::hcCommandMarker), isDispatched(false), future(nullptr), hsaQueue(nullptr), waitMode(HSA_WAIT_STATE_BLOCKED), depCount(0), barrierBit(true) {}
 
     // constructor with 1 prior depedency
-    HSABarrier(std::shared_ptr <Kalmar::KalmarAsyncOp> dependent_op) : KalmarAsyncOp(Kalmar::hcCommandMarker), isDispatched(false), future(nullptr), hsaQueue(nullptr), waitMode(HSA_WAIT_STATE_BLOCKED), depCount(1) {
+    HSABarrier(std::shared_ptr <Kalmar::KalmarAsyncOp> dependent_op) : KalmarAsyncOp(Kalmar::hcCommandMarker), isDispatched(false), future(nullptr), hsaQueue(nullptr), waitMode(HSA_WAIT_STATE_BLOCKED), depCount(1), barrierBit(true) {
         depAsyncOps[0] = dependent_op;
     }
 
     // constructor with at most 5 prior dependencies
-    HSABarrier(int count, std::shared_ptr <Kalmar::KalmarAsyncOp> *dependent_op_array) : KalmarAsyncOp(Kalmar::hcCommandMarker), isDispatched(false), future(nullptr), hsaQueue(nullptr), waitMode(HSA_WAIT_STATE_BLOCKED), depCount(count) {
+    HSABarrier(int count, std::shared_ptr <Kalmar::KalmarAsyncOp> *dependent_op_array) : KalmarAsyncOp(Kalmar::hcCommandMarker), isDispatched(false), future(nullptr), hsaQueue(nullptr), waitMode(HSA_WAIT_STATE_BLOCKED), depCount(count), barrierBit(true) {
         if ((count > 0) && (count <= 5)) {
             for (int i = 0; i < count; ++i) {
                 depAsyncOps[i] = dependent_op_array[i];
@@ -552,7 +714,9 @@ public:
 
     hsa_status_t enqueueBarrier(hsa_queue_t* queue);
 
-    hsa_status_t enqueueAsync(Kalmar::HSAQueue*);
+    // queue is the hardware queue to use, nullptr for the primary queue of
+    // the HSAQueue
+    hsa_status_t enqueueAsync(Kalmar::HSAQueue*, hsa_queue_t* queue = nullptr);
 
     // wait for the barrier to complete
     hsa_status_t waitComplete();
@@ -572,6 +736,19 @@ public:
 
 }; // end of HSABarrier
 
+// Completion signal shared by all the kernel dispatches published together by
+// one batch flush (see HSAQueue::flushBatch). Only the last packet of the
+// flush carries it, with the barrier bit set, so it drops once every packet
+// of the flush has completed. The signal returns to the pool when the last
+// dispatch referring to it is disposed.
+struct HSABatchSignal {
+    hsa_signal_t signal;
+    int signalIndex;
+
+    HSABatchSignal();
+    ~HSABatchSignal();
+};
+
 class HSADispatch : public Kalmar::KalmarAsyncOp {
 private:
     Kalmar::HSADevice* device;
@@ -580,10 +757,17 @@ private:
 
     std::vector<uint8_t> arg_vec;
     uint32_t arg_count;
+
+    // offsets in arg_vec of the pointer-sized arguments: the buffers, and the
+    // raw pointers and other 8 byte values pushed by PushArgImpl
+    std::vector<uint32_t> pointerOffsets;
     size_t prevArgVecCapacity;
     void* kernargMemory;
     int kernargMemoryIndex;
 
+    // kernarg buffer owned by a command graph, already holding the arguments
+    void* persistentKernarg;
+
 
     hsa_signal_t signal;
     int signalIndex;
@@ -591,15 +775,67 @@ private:
     bool isDispatched;
     hsa_wait_state_t waitMode;
 
+    // true if the packet was written while a batch was open on hsaQueue.
+    // Such a dispatch has no signal of its own and completes through
+    // batchSignal, which is attached when the batch is published.
+    bool isBatched;
+    std::shared_ptr<HSABatchSignal> batchSignal;
+
 
     std::shared_future<void>* future;
 
+    // completion callbacks registered on the signal, see SignalHandlerCount
+    SignalHandlerCount signalHandlers;
+
     Kalmar::HSAQueue* hsaQueue;
 
+    // hardware queue the packet is written to, nullptr for the primary
+    // queue of hsaQueue
+    hsa_queue_t* hwQueue;
+
+    // buffers used by the kernel, and whether the kernel may write them.
+    // Filled by HSAQueue::Push() while the arguments are prepared.
+    std::vector< std::pair<void*, bool> > bufferAccesses;
+
 public:
     std::shared_future<void>* getFuture() override { return future; }
 
-    void* getNativeHandle() override { return &signal; }
+    void* getNativeHandle() override;
+
+    void addBufferAccess(void* buffer, bool modify) { bufferAccesses.push_back(std::make_pair(buffer, modify)); }
+
+    void setHardwareQueue(hsa_queue_t* queue) { hwQueue = queue; }
+    hsa_queue_t* getHardwareQueue() const { return hwQueue; }
+    const std::vector< std::pair<void*, bool> >& getBufferAccesses() const { return bufferAccesses; }
+
+    // true if every pointer-sized argument is a buffer pushed by
+    // HSAQueue::Push(). Raw pointers can not be told from other 8 byte
+    // values, so any of those makes this false.
+    bool hasOnlyBufferPointers() const { return pointerOffsets.size() == bufferAccesses.size(); }
+
+    // called by HSAQueue::flushBatchLocked, with the batch lock held
+    void setBatchSignal(const std::shared_ptr<HSABatchSignal>& s) { batchSignal = s; }
+
+    // true while the batch of this dispatch has not been published
+    bool isBatchPending() const;
+
+    // Publish the batch holding this dispatch if it is still open, so that
+    // getNativeHandle returns a signal. Only the paths which wait on the
+    // dispatch, on the host or in a packet, call it.
+    void publishBatch();
+
+    const HSAKernel* getKernel() const { return kernel; }
+    const hsa_kernel_dispatch_packet_t& getPacket() const { return aql; }
+    const std::vector<uint8_t>& getKernargImage() const { return arg_vec; }
+    const std::vector<uint32_t>& getPointerOffsets() const { return pointerOffsets; }
+
+    // name of the kernel for traces. Packets given to dispatch_hsa_kernel
+    // have no HSAKernel.
+    const char* getKernelName() const { return kernel ? kernel->kernelName.c_str() : "<hsa_kernel_dispatch_packet>"; }
+
+    // use kernarg, owned by the caller, instead of copying the arguments into
+    // a kernarg buffer of the pool at dispatch time
+    void setPersistentKernarg(void* kernarg) { persistentKernarg = kernarg; }
 
     void setWaitMode(Kalmar::hcWaitMode mode) override {
         switch (mode) {
@@ -613,7 +849,15 @@ public:
     }
 
     bool isReady() override {
-        return (hsa_signal_load_acquire(signal) == 0);
+        publishBatch();
+        return (hsa_signal_load_acquire(*static_cast<hsa_signal_t*>(getNativeHandle())) == 0);
+    }
+
+    void addCompletionCallback(std::function<void()> callback) override {
+        publishBatch();
+        if (!addSignalCompletionCallback(*static_cast<hsa_signal_t*>(getNativeHandle()), signalHandlers, callback)) {
+            KalmarAsyncOp::addCompletionCallback(std::move(callback));
+        }
     }
 
     ~HSADispatch() {
@@ -629,7 +873,7 @@ public:
         dispose();
     }
 
-    HSADispatch(Kalmar::HSADevice* _device, HSAKernel* _kernel,
+    HSADispatch(Kalmar::HSADevice* _device, const HSAKernel* _kernel,
                 const hsa_kernel_dispatch_packet_t *aql=nullptr);
 
     hsa_status_t pushFloatArg(float f) { return pushArgPrivate(f); }
@@ -644,6 +888,7 @@ public:
     hsa_status_t clearArgs() {
         arg_count = 0;
         arg_vec.clear();
+        pointerOffsets.clear();
         return HSA_STATUS_SUCCESS;
     }
 
@@ -691,6 +936,9 @@ private:
             printf("%02X ", (uint8_t)0x00);
 #endif
         }
+        if (sizeof(T) == sizeof(void*)) {
+            pointerOffsets.push_back(static_cast<uint32_t>(arg_vec.size()));
+        }
         uint8_t* ptr = static_cast<uint8_t*>(static_cast<void*>(&val));
         for (size_t i = 0; i < sizeof(T); ++i) {
             arg_vec.push_back(ptr[i]);
@@ -717,6 +965,92 @@ private:
 
 }; // end of HSADispatch
 
+// Command graph captured on an HSAQueue (see HSAQueue::beginCapture).
+//
+// Kernel nodes keep the AQL packet prepared by setLaunchConfiguration and the
+// serialized kernel arguments. At the end of capture each kernarg image is
+// written once into a kernarg buffer owned by the graph, so a replay only has
+// to write the packets: no kernel lookup, argument serialization or kernarg
+// copy is done again.
+class HSAGraph final : public Kalmar::KalmarGraph {
+public:
+    enum NodeKind {
+        kernelNode,
+        copyNode,
+        markerNode
+    };
+
+    struct Node {
+        NodeKind kind;
+
+        // kernel node
+        const HSAKernel* kernel;
+        hsa_kernel_dispatch_packet_t aql;
+        std::vector<uint8_t> kernargImage;
+        void* kernargMemory;
+        int kernargMemoryIndex;
+        // offsets in kernargImage of the arguments patchPointer may update
+        std::vector<uint32_t> pointerOffsets;
+        // buffers used by the kernel and whether it may write them, for the
+        // data dependencies of a replay on a queue which does not execute in
+        // order. Empty if they are unknown.
+        std::vector< std::pair<void*, bool> > bufferAccesses;
+
+        // copy node
+        const void* src;
+        void* dst;
+        size_t sizeBytes;
+
+        // marker node: dependencies on ops issued before the capture
+        std::vector< std::shared_ptr<Kalmar::KalmarAsyncOp> > deps;
+    };
+
+    HSAGraph(Kalmar::HSADevice* device) : device(device) {}
+
+    ~HSAGraph();
+
+    // pointerOffsets are the offsets of the pointer arguments in args, or
+    // nullptr if the layout of args is unknown. bufferAccesses are the
+    // buffers used by the kernel, or nullptr if they are unknown.
+    std::shared_ptr<Kalmar::KalmarAsyncOp> addKernel(const HSAKernel* kernel, const hsa_kernel_dispatch_packet_t& aql,
+                                                     const void* args, size_t argSize,
+                                                     const std::vector<uint32_t>* pointerOffsets,
+                                                     const std::vector< std::pair<void*, bool> >* bufferAccesses);
+
+    std::shared_ptr<Kalmar::KalmarAsyncOp> addCopy(const void* src, void* dst, size_t sizeBytes);
+
+    std::shared_ptr<Kalmar::KalmarAsyncOp> addMarker(int count, std::shared_ptr<Kalmar::KalmarAsyncOp>* depOps);
+
+    // write the kernarg images into the kernarg buffers of the graph
+    void finalize();
+
+    const std::vector<Node>& getNodes() const { return nodes; }
+
+    size_t getNodeCount() const override { return nodes.size(); }
+
+    size_t patchPointer(const void* from, const void* to) override;
+
+    std::shared_ptr<Kalmar::KalmarAsyncOp> replay(Kalmar::KalmarQueue* queue) override;
+
+private:
+    // op handed out for a recorded command; it is already completed
+    std::shared_ptr<Kalmar::KalmarAsyncOp> recorded();
+
+    // wait for all the replays in flight, which may still read the kernarg
+    // buffers
+    void waitReplays();
+
+    Kalmar::HSADevice* device;
+    std::vector<Node> nodes;
+
+    // ops handed out during capture, used to tell dependencies inside the
+    // graph from dependencies on ops issued before the capture
+    std::vector< std::shared_ptr<Kalmar::KalmarAsyncOp> > recordedOps;
+
+    // completion of the replays which may still be in flight
+    std::vector< std::shared_ptr<Kalmar::KalmarAsyncOp> > replays;
+};
+
 //-----
 //Structure used to extract information from memory pool
 struct pool_iterator
@@ -773,14 +1107,23 @@ private:
     // kernel dispatches and barriers associated with this HSAQueue instance
     //
     // When a kernel k is dispatched, we'll get a KalmarAsyncOp f.
-    // This vector would hold f.  acccelerator_view::wait() would trigger
+    // This ring would hold f.  acccelerator_view::wait() would trigger
     // HSAQueue::wait(), and all future objects in the KalmarAsyncOp objects
     // will be waited on.
     //
+    // asyncOps has MAX_INFLIGHT_COMMANDS_PER_QUEUE slots. The op with
+    // sequence number n lives in slot (n & (MAX_INFLIGHT_COMMANDS_PER_QUEUE-1))
+    // while asyncOpsOldest <= n <= opSeqNums. The slot of an op which has
+    // been waited on (see removeAsyncOp) is nullptr.
+    //
     std::vector< std::shared_ptr<KalmarAsyncOp> > asyncOps;
 
+    // sequence number of the youngest op pushed to asyncOps
     uint64_t                                      opSeqNums;
 
+    // sequence number of the oldest op still held by asyncOps
+    uint64_t                                      asyncOpsOldest;
+
 
     // Kind of the youngest command in the queue.
     // Used to detect and enforce dependencies between commands.
@@ -788,41 +1131,103 @@ private:
 
 
     //
-    // kernelBufferMap and bufferKernelMap forms the dependency graph of
-    // kernel / kernel dispatches / buffers
+    // bufferDeps forms the dependency graph of kernel dispatches / buffers
     //
-    // For a particular kernel k, kernelBufferMap[k] holds a vector of
-    // host buffers used by k. The vector is filled at HSAQueue::Push(),
-    // when kernel arguments are prepared.
+    // For a particular kernel k, the buffers used by k, and whether k may
+    // write them, are recorded in its HSADispatch at HSAQueue::Push(), when
+    // kernel arguments are prepared.
     //
-    // When a kenrel k is to be dispatched, kernelBufferMap[k] will be traversed
-    // to figure out if there is any previous kernel dispatch associated for
-    // each buffer b used by k.  This is done by checking bufferKernelMap[b].
-    // If there are previous kernel dispatches which use b, then we wait on
-    // them before dispatch kernel k. bufferKernelMap[b] will be cleared then.
+    // When k is to be dispatched, bufferDeps[b] is checked for each buffer b
+    // used by k. k depends on the last writer of b, and if k may write b,
+    // also on the readers of b since then. On a queue which executes in
+    // order, the AQL barrier bit already orders k after them. Otherwise
+    // the ones still in flight are waited on by barrier-AND packets enqueued
+    // before k, so the host never blocks.
     //
-    // After kernel k is dispatched, we'll get a KalmarAsync object f, we then
-    // walk through each buffer b used by k and mark the association as:
-    // bufferKernelMap[b] = f
+    // After k is dispatched, we'll get a KalmarAsync object f, and for each
+    // buffer b used by k, f becomes the last writer of b or is added to its
+    // readers.
     //
-    // Finally kernelBufferMap[k] will be cleared.
+    // Host accesses to b (read / write / copy / map) wait on the same ops.
     //
+    struct BufferDeps {
+        std::weak_ptr<KalmarAsyncOp>                writer;
+        std::vector< std::weak_ptr<KalmarAsyncOp> > readers;
+    };
 
-    // association between buffers and kernel dispatches
     // key: buffer address
-    // value: a vector of kernel dispatches
-    std::map<void*, std::vector< std::weak_ptr<KalmarAsyncOp> > > bufferKernelMap;
-
-    // association between a kernel and buffers used by it
-    // key: kernel
-    // value: a vector of buffers used by the kernel
-    std::map<void*, std::vector<void*> > kernelBufferMap;
+    std::unordered_map<void*, BufferDeps> bufferDeps;
 
     // signal used by sync copy only
     hsa_signal_t  sync_copy_signal;
 
+    //
+    // kernel dispatch batching (see beginBatch / endBatch)
+    //
+    // While a batch is open, each kernel dispatch packet is written into the
+    // next reserved slot of commandQueue with an invalid header, and its real
+    // header is kept in batchPackets. flushBatch() then writes all the
+    // headers in order, attaches one shared completion signal to the last
+    // packet, and updates the write index and rings the doorbell only once.
+    //
+    struct BatchPacket {
+        uint64_t     index;     // slot in commandQueue
+        uint16_t     header;    // header to be written at publication
+        HSADispatch* dispatch;
+    };
+
+    // nesting depth of beginBatch() calls. Read by isBatchOpen() from the
+    // dispatch path without batchMutex.
+    std::atomic<int> batchDepth;
+
+    // slot following the last packet of the open batch
+    uint64_t batchNextIndex;
+
+    // packets written but not yet published
+    std::vector<BatchPacket> batchPackets;
+
+    // guards batchNextIndex, batchPackets and the packet slots of
+    // commandQueue, as a batch may be published from a thread waiting on one
+    // of its dispatches
+    std::mutex batchMutex;
+
+    //
+    // spreading of kernels over several hardware queues
+    //
+    // A view created with more than one hardware queue owns spreadQueues in
+    // addition to commandQueue. A kernel whose buffers are all known (see
+    // canSpread) is dispatched to one of spreadQueues or commandQueue, in
+    // turn, and waits through barrier-AND packets on the kernels of other
+    // hardware queues it depends on (bufferDeps) and, on an in-order view,
+    // on serialTail. All the other commands go to commandQueue as usual,
+    // after a barrier packet joining the kernels still in flight on the
+    // other hardware queues (see joinSpreadQueues).
+    //
+    struct SpreadQueue {
+        hsa_queue_t*                              queue;
+        // kernels dispatched to queue which may still be in flight. Without
+        // the barrier bit (views which are not in-order), a kernel may
+        // complete before the ones dispatched before it, so the last one
+        // does not stand for all of them.
+        std::vector< std::weak_ptr<KalmarAsyncOp> > inflight;
+    };
+
+    // index 0 is commandQueue
+    std::vector<SpreadQueue> spreadQueues;
+
+    // round-robin cursor over spreadQueues
+    unsigned int spreadCursor;
+
+    // youngest command which has not been spread. Used by detectStreamDeps.
+    std::weak_ptr<KalmarAsyncOp> serialTail;
+
+    // command graph being recorded between beginCapture() and endCapture().
+    // While it is set, kernels, async copies and markers are recorded into it
+    // instead of being executed.
+    std::shared_ptr<HSAGraph> captureGraph;
+
 public:
-    HSAQueue(KalmarDevice* pDev, hsa_agent_t agent, execute_order order) : KalmarQueue(pDev, queuing_mode_automatic, order), commandQueue(nullptr), asyncOps(), opSeqNums(0), bufferKernelMap(), kernelBufferMap() {
+    HSAQueue(KalmarDevice* pDev, hsa_agent_t agent, execute_order order, unsigned int hwQueueCount = 1) : KalmarQueue(pDev, queuing_mode_automatic, order), commandQueue(nullptr), asyncOps(MAX_INFLIGHT_COMMANDS_PER_QUEUE), opSeqNums(0), asyncOpsOldest(1), bufferDeps(), batchDepth(0), batchNextIndex(0), batchPackets(), spreadQueues(), spreadCursor(0), captureGraph(nullptr) {
         hsa_status_t status;
 
         /// Query the maximum size of the queue.
@@ -849,6 +1254,20 @@ public:
         /// Enable profiling support for the queue.
         status = hsa_amd_profiling_set_profiler_enabled(commandQueue, 1);
 
+        /// Create the additional hardware queues kernels are spread over.
+        hwQueueCount = std::max(1u, std::min<unsigned int>(hwQueueCount, MAX_HARDWARE_QUEUES_PER_VIEW));
+        if (hwQueueCount > 1) {
+            spreadQueues.push_back({ commandQueue, {} });
+            for (unsigned int i = 1; i < hwQueueCount; ++i) {
+                hsa_queue_t* queue = nullptr;
+                status = hsa_queue_create(agent, queue_size, HSA_QUEUE_TYPE_SINGLE, NULL, NULL,
+                                          UINT32_MAX, UINT32_MAX, &queue);
+                STATUS_CHECK_Q(status, queue, __LINE__);
+                status = hsa_amd_profiling_set_profiler_enabled(queue, 1);
+                spreadQueues.push_back({ queue, {} });
+            }
+        }
+
         youngestCommandKind = hcCommandInvalid;
 
         status = hsa_signal_create(1, 1, &agent, &sync_copy_signal);
@@ -865,21 +1284,18 @@ public:
         // wait on all existing kernel dispatches and barriers to complete
         wait();
 
-        // clear bufferKernelMap
-        for (auto iter = bufferKernelMap.begin(); iter != bufferKernelMap.end(); ++iter) {
-           iter->second.clear();
-        }
-        bufferKernelMap.clear();
-
-        // clear kernelBufferMap
-        for (auto iter = kernelBufferMap.begin(); iter != kernelBufferMap.end(); ++iter) {
-           iter->second.clear();
-        }
-        kernelBufferMap.clear();
+        // clear bufferDeps
+        bufferDeps.clear();
 
 #if KALMAR_DEBUG
         std::cerr << "HSAQueue::dispose(): destroy an HSA command queue: " << commandQueue << "\n";
 #endif
+        for (size_t i = 1; i < spreadQueues.size(); ++i) {
+            status = hsa_queue_destroy(spreadQueues[i].queue);
+            STATUS_CHECK(status, __LINE__);
+        }
+        spreadQueues.clear();
+
         status = hsa_queue_destroy(commandQueue);
         STATUS_CHECK(status, __LINE__);
         commandQueue = nullptr;
@@ -911,14 +1327,14 @@ public:
     void printAsyncOps(std::ostream &s = std::cerr)
     {
         hsa_signal_value_t oldv=0;
-        s << "Queue: " << this << "  : " << asyncOps.size() << " op entries\n";
-        for (int i=0; i<asyncOps.size(); i++) {
-            const std::shared_ptr<KalmarAsyncOp::KalmarAsyncOp> &op = asyncOps[i];
-            s << "index:" << std::setw(4) << i ;
+        s << "Queue: " << this << "  : " << asyncOpsCount() << " op entries\n";
+        for (uint64_t n = asyncOpsOldest; n <= opSeqNums; n++) {
+            const std::shared_ptr<KalmarAsyncOp::KalmarAsyncOp> &op = asyncOpSlot(n);
+            s << "index:" << std::setw(4) << (n & (MAX_INFLIGHT_COMMANDS_PER_QUEUE-1)) ;
             if (op != nullptr) {
                 s << " op#"<< op->getSeqNum() ;
                 hsa_signal_t signal = * (static_cast<hsa_signal_t*> (op->getNativeHandle()));
-                hsa_signal_value_t v = hsa_signal_load_acquire(signal);
+                hsa_signal_value_t v = signal.handle ? hsa_signal_load_acquire(signal) : 0;
                 s  << " " << getHcCommandKindString(op->getCommandKind());
                 s  << " signal=" << std::hex << signal.handle << std::dec <<" value=" << v;
 
@@ -934,9 +1350,70 @@ public:
         }
     }
 
+    std::shared_ptr<KalmarAsyncOp>& asyncOpSlot(uint64_t seqNum) {
+        return asyncOps[seqNum & (MAX_INFLIGHT_COMMANDS_PER_QUEUE-1)];
+    }
+
+    // number of ring slots in use, including the ones already waited on
+    uint64_t asyncOpsCount() const { return opSeqNums + 1 - asyncOpsOldest; }
+
+    // Non-blocking check used to retire ops from asyncOps.
+    // Kernels of a batch which is not published yet have no signal yet and
+    // are considered in flight.
+    // Other ops without a signal can not be tracked: as in
+    // HSADispatch::waitComplete they are considered complete once enqueued,
+    // so that they do not hold back the retirement of younger ops.
+    static bool isAsyncOpComplete(KalmarAsyncOp* op) {
+        if (op->getCommandKind() == hcCommandKernel &&
+            static_cast<HSADispatch*>(op)->isBatchPending()) {
+            return false;
+        }
+        hsa_signal_t signal = *(static_cast <hsa_signal_t*> (op->getNativeHandle()));
+        return (signal.handle == 0) || (hsa_signal_load_acquire(signal) == 0);
+    }
+
+    // Drop completed ops from the old end of asyncOps, stopping at the first
+    // one still in flight. Each op is retired once, so this is O(1)
+    // amortized per pushAsyncOp.
+    void retireAsyncOps() {
+        while (asyncOpsOldest <= opSeqNums) {
+            std::shared_ptr<KalmarAsyncOp>& slot = asyncOpSlot(asyncOpsOldest);
+            if (slot != nullptr) {
+                if (!isAsyncOpComplete(slot.get())) {
+                    break;
+                }
+                // move the op out of the ring first: if this was the last
+                // reference its destructor calls back into removeAsyncOp
+                std::shared_ptr<KalmarAsyncOp> retired = std::move(slot);
+                slot = nullptr;
+            }
+            ++asyncOpsOldest;
+        }
+    }
+
+    // youngest op in asyncOps, or nullptr if it has already been retired or
+    // waited on
+    std::shared_ptr<KalmarAsyncOp> youngestAsyncOp() {
+        return (asyncOpsCount() > 0) ? asyncOpSlot(opSeqNums) : nullptr;
+    }
+
     // Save the command and type
+    // spread is true for the kernels dispatched by dispatchSpread and their
+    // dependency barriers, which are not part of the stream of commands
+    // seen by detectStreamDeps.
     // TODO - can convert to reference?
-    void pushAsyncOp(std::shared_ptr<KalmarAsyncOp> op) {
+    void pushAsyncOp(std::shared_ptr<KalmarAsyncOp> op, bool spread = false) {
+        retireAsyncOps();
+
+        if (asyncOpsCount() >= MAX_INFLIGHT_COMMANDS_PER_QUEUE) {
+#if KALMAR_DEBUG_ASYNC_COPY
+            std::cerr << "Hit max inflight ops asyncOps count=" << asyncOpsCount() << ". op#" << opSeqNums + 1 << " force sync\n";
+#endif
+
+            // every slot holds incomplete work
+            wait();
+        }
+
         op->setSeqNum(++opSeqNums);
 
 #if KALMAR_DEBUG_ASYNC_COPY
@@ -944,19 +1421,154 @@ public:
                   << "  commandKind=" << getHcCommandKindString(op->getCommandKind()) << std::endl;
 #endif
 
+        if (!spread) {
+            youngestCommandKind = op->getCommandKind();
+            serialTail = op;
+        }
+        asyncOpSlot(opSeqNums) = std::move(op);
+    }
 
-        if (asyncOps.size() >= MAX_INFLIGHT_COMMANDS_PER_QUEUE) {
-#if KALMAR_DEBUG_ASYNC_COPY
-            std::cerr << "Hit max inflight ops asyncOps.size=" << asyncOps.size() << ". op#" << opSeqNums << " force sync\n";
-#endif
 
-            wait();
+    bool isBatchOpen() const { return batchDepth.load(std::memory_order_acquire) > 0; }
+
+    bool isOutOfOrder() const { return get_execute_order() == execute_out_of_order; }
+
+    unsigned int getHardwareQueueCount() override {
+        return spreadQueues.empty() ? 1 : spreadQueues.size();
+    }
+
+    void beginBatch() override {
+        batchDepth.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    void endBatch() override {
+        // decrement, but leave the depth at 0 on an unbalanced endBatch()
+        int depth = batchDepth.load(std::memory_order_acquire);
+        while (depth > 0 && !batchDepth.compare_exchange_weak(depth, depth - 1, std::memory_order_acq_rel)) {
+        }
+        if (depth == 1) {
+            flushBatch();
+        }
+    }
+
+    // publish the packets of the open batch, if any. The batch stays open.
+    void flush() override {
+        flushBatch();
+    }
+
+    void flushBatch() {
+        std::lock_guard<std::mutex> lock(batchMutex);
+        flushBatchLocked();
+    }
+
+    // guards the batch signals of the dispatches of this queue, see
+    // HSADispatch::getNativeHandle
+    std::mutex& getBatchMutex() { return batchMutex; }
+
+    // native handle of op for a wait on it, on the host or in a packet: the
+    // batch holding a kernel dispatch is published first
+    static void* waitHandle(KalmarAsyncOp* op) {
+        if (op->getCommandKind() == hcCommandKernel) {
+            static_cast<HSADispatch*>(op)->publishBatch();
+        }
+        return op->getNativeHandle();
+    }
+
+    // Write a kernel dispatch packet into the next free slot of queue, which
+    // is commandQueue or one of spreadQueues.
+    // If batched is false the packet is published immediately, otherwise it
+    // is held back until the batch is flushed. Batches only use commandQueue.
+    void submitDispatchPacket(HSADispatch* dispatch, const hsa_kernel_dispatch_packet_t& packet,
+                              uint16_t header, bool batched, hsa_queue_t* queue) {
+        std::lock_guard<std::mutex> lock(batchMutex);
+
+        if (!batched) {
+            // a packet published now must not land in a slot reserved by a batch
+            if (queue == commandQueue) {
+                flushBatchLocked();
+            }
+
+            const uint32_t mask = queue->size - 1;
+            hsa_kernel_dispatch_packet_t* queueSlots = static_cast<hsa_kernel_dispatch_packet_t*>(queue->base_address);
+
+            uint64_t index = reservePacketSlot(queue, hsa_queue_load_write_index_relaxed(queue));
+            hsa_kernel_dispatch_packet_t* q_aql = &queueSlots[index & mask];
+            *q_aql = packet;
+
+            // Lastly copy in the header:
+            q_aql->header = header;
+
+            hsa_queue_store_write_index_relaxed(queue, index + 1);
+
+            // Ring door bell
+            hsa_signal_store_relaxed(queue->doorbell_signal, index);
+            return;
+        }
+
+        assert(queue == commandQueue);
+        const uint32_t queueMask = commandQueue->size - 1;
+        hsa_kernel_dispatch_packet_t* slots = static_cast<hsa_kernel_dispatch_packet_t*>(commandQueue->base_address);
+
+        uint64_t index;
+        if (batchPackets.empty()) {
+            index = reservePacketSlot(commandQueue, hsa_queue_load_write_index_relaxed(commandQueue));
+        } else if (batchNextIndex + 1 - hsa_queue_load_read_index_acquire(commandQueue) >= commandQueue->size) {
+            // the packet processor can not drain packets which are not
+            // published yet: publish what we have and start over
+            flushBatchLocked();
+            index = reservePacketSlot(commandQueue, hsa_queue_load_write_index_relaxed(commandQueue));
+        } else {
+            index = batchNextIndex;
+        }
+
+        // keep the packet invalid until the batch is published
+        hsa_kernel_dispatch_packet_t* q_aql = &slots[index & queueMask];
+        *q_aql = packet;
+        q_aql->header = HSA_PACKET_TYPE_INVALID << HSA_PACKET_HEADER_TYPE;
+
+        batchPackets.push_back({ index, header, dispatch });
+        batchNextIndex = index + 1;
+    }
+
+private:
+    // check that the slot at index of queue is free and return index
+    uint64_t reservePacketSlot(hsa_queue_t* queue, uint64_t index) {
+        if (index + 1 - hsa_queue_load_read_index_acquire(queue) >= queue->size) {
+          checkHCCRuntimeStatus(Kalmar::HCCRuntimeStatus::HCCRT_STATUS_ERROR_COMMAND_QUEUE_OVERFLOW, __LINE__, queue);
+        }
+        return index;
+    }
+
+    void flushBatchLocked() {
+        if (batchPackets.empty()) {
+            return;
         }
-        asyncOps.push_back(op);
 
-        youngestCommandKind = op->getCommandKind();
+        const uint32_t queueMask = commandQueue->size - 1;
+        hsa_kernel_dispatch_packet_t* slots = static_cast<hsa_kernel_dispatch_packet_t*>(commandQueue->base_address);
+
+        // The last packet carries the shared signal. Its barrier bit makes it
+        // wait for all the packets before it, so the signal also covers them
+        // on a queue which executes in any order.
+        std::shared_ptr<HSABatchSignal> batchSignal = std::make_shared<HSABatchSignal>();
+        BatchPacket& tail = batchPackets.back();
+        slots[tail.index & queueMask].completion_signal = batchSignal->signal;
+        tail.header |= 1 << HSA_PACKET_HEADER_BARRIER;
+
+        for (auto& p : batchPackets) {
+            p.dispatch->setBatchSignal(batchSignal);
+            __atomic_store_n(&slots[p.index & queueMask].header, p.header, __ATOMIC_RELEASE);
+        }
+
+        DBOUT("publish batch of " << batchPackets.size() << " kernel dispatches, ring door bell\n");
+
+        hsa_queue_store_write_index_relaxed(commandQueue, batchNextIndex);
+        hsa_signal_store_relaxed(commandQueue->doorbell_signal, batchNextIndex - 1);
+
+        batchPackets.clear();
     }
 
+public:
 
     // Check the command kind for the upcoming command that will be sent to this queue
     // if it differs from the youngest async op sent to the queue, we may need to insert additional synchronization.
@@ -968,7 +1580,15 @@ public:
         hcCommandKind newCommandKind = newOp->getCommandKind();
         assert (newCommandKind != hcCommandInvalid);
 
-        if (!asyncOps.empty()) {
+        if (isOutOfOrder()) {
+            // commands are only ordered by the data dependencies found by
+            // enqueueDataDeps
+            return nullptr;
+        }
+
+        // nothing to depend on if the youngest op has already completed
+        std::shared_ptr<KalmarAsyncOp> youngestOp = serialTail.lock();
+        if (youngestOp != nullptr && !isAsyncOpComplete(youngestOp.get())) {
             assert (youngestCommandKind != hcCommandInvalid);
 
 
@@ -985,13 +1605,18 @@ public:
                 needDep = false;
             } else if (isCopyCommand(newCommandKind) && isCopyCommand(youngestCommandKind)) {
                 HSACopy *newCopyOp = static_cast<HSACopy*> (newOp);
-                HSACopy *youngestCopyOp = static_cast<HSACopy*> (asyncOps.back().get());
+                HSACopy *youngestCopyOp = static_cast<HSACopy*> (youngestOp.get());
                 if (newCopyOp->getCopyDevice() != youngestCopyOp->getCopyDevice()) {
                     // This covers cases where two copies are back-to-back in the queue but use different copy engines.
                     // In this case there is no implicit dependency between the ops so we need to add one 
                     // here.
                     needDep = true;
                 }
+                if (newCopyOp->isRunByHostThread() != youngestCopyOp->isRunByHostThread()) {
+                    // One copy is run by the AsyncCopyThread of the device, the other one by its DMA
+                    // engine: they are not ordered with each other either.
+                    needDep = true;
+                }
                 if (FORCE_SIGNAL_DEP_BETWEEN_COPIES) {
                     needDep = true;
                 }
@@ -1002,7 +1627,7 @@ public:
 #if KALMAR_DEBUG_ASYNC_COPY
                 std::cerr <<  "command type changed " << getHcCommandKindString(youngestCommandKind) << "  ->  " << getHcCommandKindString(newCommandKind) << "\n" ;
 #endif
-                return asyncOps.back();
+                return youngestOp;
             }
         }
 
@@ -1013,20 +1638,48 @@ public:
     void waitForStreamDeps (KalmarAsyncOp *newOp) {
         std::shared_ptr<KalmarAsyncOp> depOp = detectStreamDeps(newOp);
         if (depOp != nullptr) {
-            EnqueueMarkerWithDependency(1, &depOp);
+            enqueueBarrierOp(1, &depOp);
         }
     }
 
 
+    bool beginCapture() override {
+        captureGraph = std::make_shared<HSAGraph>(static_cast<HSADevice*>(getDev()));
+        return true;
+    }
+
+    std::shared_ptr<KalmarGraph> endCapture() override {
+        std::shared_ptr<HSAGraph> graph = captureGraph;
+        captureGraph = nullptr;
+        if (graph != nullptr) {
+            graph->finalize();
+        }
+        return graph;
+    }
+
+    bool isCapturing() override { return captureGraph != nullptr; }
+
+    // submit the commands recorded in graph. Runs of kernels are published
+    // as one batch.
+    std::shared_ptr<KalmarAsyncOp> replayGraph(const HSAGraph* graph);
+
+
     int getPendingAsyncOps() override {
+        retireAsyncOps();
+
         int count = 0;
-        for (int i = 0; i < asyncOps.size(); ++i) {
-            auto asyncOp = asyncOps[i];
+        for (uint64_t n = asyncOpsOldest; n <= opSeqNums; ++n) {
+            auto asyncOp = asyncOpSlot(n);
 
             if (asyncOp != nullptr) {
+                // a kernel of a batch which is not published is pending
+                if (asyncOp->getCommandKind() == hcCommandKernel &&
+                    static_cast<HSADispatch*>(asyncOp.get())->isBatchPending()) {
+                    ++count;
+                    continue;
+                }
                 hsa_signal_t signal = *(static_cast <hsa_signal_t*> (asyncOp->getNativeHandle()));
-                hsa_signal_value_t v = hsa_signal_load_relaxed(signal);
-                if (v != 0) {
+                if (signal.handle != 0 && hsa_signal_load_relaxed(signal) != 0) {
                     ++count;
                 }
             }
@@ -1043,26 +1696,29 @@ public:
 
         printAsyncOps(std::cerr);
 #endif
-    
+
+        // commands still held back in an open batch would never complete
+        flushBatch();
    
-        // If oldest OP doesn't have a signal, we need to enqueue 
+        // If youngest OP doesn't have a signal, we need to enqueue 
         // a barrier with a signal so host can tell when it finishes
-        for (int i = asyncOps.size()-1; i >= 0;  i--) {
-            auto asyncOp = asyncOps[i];
-            if (asyncOp != nullptr) {
-                hsa_signal_t signal =*(static_cast <hsa_signal_t*> (asyncOp->getNativeHandle()));
-                if (signal.handle==0) {
-                    // In the code below, this will be the first op waited on
-                    auto marker = EnqueueMarker();
-                    DBOUT("oldest AsyncOp has no signal - enqueue marker "<< marker<<"\n");
+        std::shared_ptr<KalmarAsyncOp> youngestOp = youngestAsyncOp();
+        if (youngestOp != nullptr) {
+            hsa_signal_t signal =*(static_cast <hsa_signal_t*> (youngestOp->getNativeHandle()));
+            if (signal.handle==0) {
+                // make room for the marker without draining the ring
+                if (asyncOpsCount() >= MAX_INFLIGHT_COMMANDS_PER_QUEUE) {
+                    waitOldestAsyncOp();
                 }
-                break;
+                // In the code below, this will be the first op waited on
+                auto marker = enqueueBarrierOp(0, nullptr);
+                DBOUT("youngest AsyncOp has no signal - enqueue marker "<< marker<<"\n");
             }
         }
 
-        for (int i = asyncOps.size()-1; i >= 0;  i--) {
-            if (asyncOps[i] != nullptr) {
-                auto asyncOp = asyncOps[i];
+        for (uint64_t n = opSeqNums; n >= asyncOpsOldest && n > 0; n--) {
+            if (asyncOpSlot(n) != nullptr) {
+                auto asyncOp = asyncOpSlot(n);
                 // wait on valid futures only
                 std::shared_future<void>* future = asyncOp->getFuture();
                 if (future->valid()) {
@@ -1071,9 +1727,25 @@ public:
             }
         }
         // clear async operations table
-        asyncOps.clear();
+        for (uint64_t n = asyncOpsOldest; n <= opSeqNums; n++) {
+            asyncOpSlot(n) = nullptr;
+        }
+        asyncOpsOldest = opSeqNums + 1;
    }
 
+    // wait on the oldest op of asyncOps and retire it
+    void waitOldestAsyncOp() {
+        std::shared_ptr<KalmarAsyncOp> oldest = std::move(asyncOpSlot(asyncOpsOldest));
+        asyncOpSlot(asyncOpsOldest) = nullptr;
+        ++asyncOpsOldest;
+        if (oldest != nullptr) {
+            std::shared_future<void>* future = oldest->getFuture();
+            if (future->valid()) {
+                future->wait();
+            }
+        }
+    }
+
     void LaunchKernel(void *ker, size_t nr_dim, size_t *global, size_t *local) override {
         LaunchKernelWithDynamicGroupMemory(ker, nr_dim, global, local, 0);
     }
@@ -1086,11 +1758,17 @@ public:
             local = tmp_local;
         dispatch->setLaunchConfiguration(nr_dim, global, local, dynamic_group_size);
 
-        // wait for previous kernel dispatches be completed
-        std::for_each(std::begin(kernelBufferMap[ker]), std::end(kernelBufferMap[ker]),
-                      [&] (void* buffer) {
-                        waitForDependentAsyncOps(buffer);
-                      });
+        if (captureGraph != nullptr) {
+            captureKernel(ker);
+            return;
+        }
+
+        invalidateRawPointerShadows(dispatch);
+
+        joinSpreadQueues();
+
+        // order the kernel after previous kernel dispatches using its buffers
+        enqueueBufferDeps(dispatch);
 
         waitForStreamDeps(dispatch);
 
@@ -1098,11 +1776,21 @@ public:
         // and wait for its completion
         dispatch->dispatchKernelWaitComplete(this);
 
-        // clear data in kernelBufferMap
-        kernelBufferMap[ker].clear();
-        kernelBufferMap.erase(ker);
+        delete(dispatch);
+    }
+
+    // record the kernel prepared in ker into the graph being captured
+    std::shared_ptr<KalmarAsyncOp> captureKernel(void *ker) {
+        HSADispatch *dispatch =
+            reinterpret_cast<HSADispatch*>(ker);
+
+        const std::vector<uint8_t>& args = dispatch->getKernargImage();
+        std::shared_ptr<KalmarAsyncOp> op =
+            captureGraph->addKernel(dispatch->getKernel(), dispatch->getPacket(), args.data(), args.size(),
+                                    &dispatch->getPointerOffsets(), &dispatch->getBufferAccesses());
 
         delete(dispatch);
+        return op;
     }
 
     std::shared_ptr<KalmarAsyncOp> LaunchKernelAsync(void *ker, size_t nr_dim, size_t *global, size_t *local) override {
@@ -1120,11 +1808,19 @@ public:
             local = tmp_local;
         dispatch->setLaunchConfiguration(nr_dim, global, local, dynamic_group_size);
 
-        // wait for previous kernel dispatches be completed
-        std::for_each(std::begin(kernelBufferMap[ker]), std::end(kernelBufferMap[ker]),
-                      [&] (void* buffer) {
-                        waitForDependentAsyncOps(buffer);
-                      });
+        if (captureGraph != nullptr) {
+            return captureKernel(ker);
+        }
+
+        invalidateRawPointerShadows(dispatch);
+
+        if (canSpread(dispatch)) {
+            return dispatchSpread(dispatch);
+        }
+        joinSpreadQueues();
+
+        // order the kernel after previous kernel dispatches using its buffers
+        enqueueBufferDeps(dispatch);
 
         waitForStreamDeps(dispatch);
 
@@ -1139,34 +1835,284 @@ public:
         pushAsyncOp(sp_dispatch);
 
         // associate all buffers used by the kernel with the kernel dispatch instance
-        std::for_each(std::begin(kernelBufferMap[ker]), std::end(kernelBufferMap[ker]),
-                      [&] (void* buffer) {
-                        bufferKernelMap[buffer].push_back(sp_dispatch);
-                      });
+        recordBufferAccesses(sp_dispatch, dispatch->getBufferAccesses());
+
+        return sp_dispatch;
+    }
+
 
-        // clear data in kernelBufferMap
-        kernelBufferMap[ker].clear();
-        kernelBufferMap.erase(ker);
+    // enqueue barrier-AND packets making dispatch wait for the kernel
+    // dispatches in flight it depends on through its buffers
+    //
+    // A kernel dispatch packet can not wait on a signal itself, so unlike
+    // enqueueDataDeps a single dependency also gets its barrier packet.
+    void enqueueBufferDeps(HSADispatch* dispatch) {
+        if (get_execute_order() == execute_in_order) {
+            // ordered by the barrier bit of the kernel dispatch packets
+            return;
+        }
+
+        std::vector< std::shared_ptr<KalmarAsyncOp> > deps = findDataDeps(dispatch->getBufferAccesses());
+        if (!deps.empty()) {
+            enqueueDepBarriers(deps, false, nullptr);
+        }
+    }
+
+    // the commands in flight which a command accessing the buffers in
+    // accesses depends on: the last writer of each buffer, plus its readers
+    // if the command may write it
+    std::vector< std::shared_ptr<KalmarAsyncOp> > findDataDeps(const std::vector< std::pair<void*, bool> >& accesses) {
+        std::vector< std::shared_ptr<KalmarAsyncOp> > deps;
+        auto addDep = [&] (const std::weak_ptr<KalmarAsyncOp>& dep) {
+            std::shared_ptr<KalmarAsyncOp> op = dep.lock();
+            if (op != nullptr && !isAsyncOpComplete(op.get()) &&
+                std::find(deps.begin(), deps.end(), op) == deps.end()) {
+                deps.push_back(op);
+            }
+        };
+
+        for (const auto& access : accesses) {
+            auto iter = bufferDeps.find(access.first);
+            if (iter != bufferDeps.end()) {
+                addDep(iter->second.writer);
+                if (access.second) {
+                    for (const auto& reader : iter->second.readers) {
+                        addDep(reader);
+                    }
+                }
+            }
+        }
+        return deps;
+    }
+
+    // Enqueue barrier-AND packets waiting on the data dependencies of a
+    // command accessing the buffers in accesses, and return the op which
+    // completes when all of them are satisfied (nullptr if there are none).
+    //
+    // On an out-of-order queue the packets have no barrier bit, so they do
+    // not wait for the independent commands enqueued before them, and a
+    // single dependency is returned as is: the caller must make its command
+    // wait on the op returned, as the copies do with their dependency signal.
+    std::shared_ptr<KalmarAsyncOp> enqueueDataDeps(const std::vector< std::pair<void*, bool> >& accesses) {
+        std::vector< std::shared_ptr<KalmarAsyncOp> > deps = findDataDeps(accesses);
+        if (deps.empty()) {
+            return nullptr;
+        }
+
+        const bool barrierBit = !isOutOfOrder();
+        if (deps.size() == 1 && !barrierBit) {
+            return deps[0];
+        }
+
+        return enqueueDepBarriers(deps, barrierBit, nullptr);
+    }
+
+    // Enqueue barrier-AND packets waiting on deps to hardware queue queue
+    // (nullptr for commandQueue) and return the last one.
+    // More dependencies than a packet can hold are chained: each packet also
+    // waits for the previous one.
+    std::shared_ptr<KalmarAsyncOp> enqueueDepBarriers(const std::vector< std::shared_ptr<KalmarAsyncOp> >& deps,
+                                                      bool barrierBit, hsa_queue_t* queue) {
+        std::shared_ptr<KalmarAsyncOp> merged;
+        size_t next = 0;
+        while (next < deps.size()) {
+            std::vector< std::shared_ptr<KalmarAsyncOp> > group;
+            if (merged != nullptr) {
+                group.push_back(merged);
+            }
+            while (group.size() < HSA_BARRIER_DEP_SIGNAL_CNT && next < deps.size()) {
+                group.push_back(deps[next++]);
+            }
+            merged = enqueueBarrierOp(group.size(), group.data(), barrierBit, queue);
+        }
+        return merged;
+    }
+
+    // true if dispatch may be sent to any of spreadQueues: all its
+    // dependencies can be found in bufferDeps. Kernels without any buffer,
+    // kernels also taking raw pointers (whose accesses are not tracked) and
+    // batched kernels stay on commandQueue.
+    bool canSpread(HSADispatch* dispatch) {
+        return !spreadQueues.empty() && !isBatchOpen() && !dispatch->getBufferAccesses().empty() &&
+               dispatch->hasOnlyBufferPointers();
+    }
+
+    // index in spreadQueues of the hardware queue a kernel was dispatched to
+    int spreadQueueIndex(KalmarAsyncOp* op) {
+        if (op->getCommandKind() != hcCommandKernel) {
+            return -1;
+        }
+        hsa_queue_t* queue = static_cast<HSADispatch*>(op)->getHardwareQueue();
+        if (queue == nullptr) {
+            queue = commandQueue;
+        }
+        for (size_t i = 0; i < spreadQueues.size(); ++i) {
+            if (spreadQueues[i].queue == queue) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // dispatch a kernel for which canSpread is true
+    std::shared_ptr<KalmarAsyncOp> dispatchSpread(HSADispatch* dispatch) {
+        hsa_status_t status = HSA_STATUS_SUCCESS;
+        const bool inOrder = (get_execute_order() == execute_in_order);
+
+        std::vector< std::shared_ptr<KalmarAsyncOp> > deps = findDataDeps(dispatch->getBufferAccesses());
+        if (inOrder) {
+            // the commands which have not been spread come first
+            std::shared_ptr<KalmarAsyncOp> tail = serialTail.lock();
+            if (tail != nullptr && !isAsyncOpComplete(tail.get()) &&
+                std::find(deps.begin(), deps.end(), tail) == deps.end()) {
+                deps.push_back(tail);
+            }
+        }
+
+        // run on the hardware queue of the youngest kernel it depends on,
+        // independent kernels take the hardware queues in turn
+        int target = -1;
+        uint64_t youngest = 0;
+        for (const auto& dep : deps) {
+            int index = spreadQueueIndex(dep.get());
+            if (index >= 0 && dep->getSeqNum() >= youngest) {
+                target = index;
+                youngest = dep->getSeqNum();
+            }
+        }
+        if (target < 0) {
+            target = spreadCursor;
+            spreadCursor = (spreadCursor + 1) % spreadQueues.size();
+        }
+        hsa_queue_t* queue = spreadQueues[target].queue;
+
+        // on an in-order view the barrier bit of the kernel already orders
+        // it after the packets of its own hardware queue
+        if (inOrder) {
+            deps.erase(std::remove_if(deps.begin(), deps.end(),
+                                      [&] (const std::shared_ptr<KalmarAsyncOp>& dep) {
+                                          return spreadQueueIndex(dep.get()) == target;
+                                      }),
+                       deps.end());
+        }
+        enqueueDepBarriers(deps, inOrder, queue);
+
+        dispatch->setHardwareQueue(queue);
+        status = dispatch->dispatchKernelAsyncFromOp(this);
+        STATUS_CHECK(status, __LINE__);
+
+        std::shared_ptr<KalmarAsyncOp> sp_dispatch(dispatch);
+        pushAsyncOp(sp_dispatch, true);
+
+        // on an in-order view the barrier bit makes the last kernel complete
+        // after the others of its hardware queue
+        std::vector< std::weak_ptr<KalmarAsyncOp> >& inflight = spreadQueues[target].inflight;
+        if (inOrder) {
+            inflight.clear();
+        } else {
+            inflight.erase(std::remove_if(inflight.begin(), inflight.end(),
+                                          [&] (const std::weak_ptr<KalmarAsyncOp>& op) {
+                                              std::shared_ptr<KalmarAsyncOp> o = op.lock();
+                                              return (o == nullptr) || isAsyncOpComplete(o.get());
+                                          }),
+                           inflight.end());
+        }
+        inflight.push_back(sp_dispatch);
+
+        recordBufferAccesses(sp_dispatch, dispatch->getBufferAccesses());
 
         return sp_dispatch;
     }
 
+    // make the next command on commandQueue wait for the kernels still in
+    // flight on spreadQueues
+    void joinSpreadQueues() {
+        // more kernels than a barrier packet holds are chained by
+        // enqueueDepBarriers
+        std::vector< std::shared_ptr<KalmarAsyncOp> > pending;
+        for (auto& spreadQueue : spreadQueues) {
+            for (const auto& op : spreadQueue.inflight) {
+                std::shared_ptr<KalmarAsyncOp> o = op.lock();
+                if (o != nullptr && !isAsyncOpComplete(o.get())) {
+                    pending.push_back(o);
+                }
+            }
+            spreadQueue.inflight.clear();
+        }
+        if (!pending.empty()) {
+            enqueueDepBarriers(pending, true, nullptr);
+        }
+    }
+
+    // read / write sets of an async copy
+    static std::vector< std::pair<void*, bool> > copyAccesses(const void* src, void* dst) {
+        return { std::make_pair(const_cast<void*>(src), false), std::make_pair(dst, true) };
+    }
+
+    // Async copies only take part in the data dependencies of an
+    // out-of-order queue; on other queues they are ordered by
+    // detectStreamDeps.
+    void recordCopyAccesses(const std::shared_ptr<KalmarAsyncOp>& op, const void* src, void* dst) {
+        if (isOutOfOrder()) {
+            recordBufferAccesses(op, copyAccesses(src, dst));
+        }
+    }
 
-    // wait for dependent async operations to complete
-    void waitForDependentAsyncOps(void* buffer) {
-        auto&& dependentAsyncOpVector = bufferKernelMap[buffer];
-        for (int i = 0; i < dependentAsyncOpVector.size(); ++i) {
-          auto dependentAsyncOp = dependentAsyncOpVector[i];
-          if (!dependentAsyncOp.expired()) {
-            auto dependentAsyncOpPointer = dependentAsyncOp.lock();
+    // make op the last writer or a reader of the buffers in accesses
+    void recordBufferAccesses(const std::shared_ptr<KalmarAsyncOp>& op,
+                              const std::vector< std::pair<void*, bool> >& accesses) {
+        for (const auto& access : accesses) {
+            BufferDeps& deps = bufferDeps[access.first];
+            if (access.second) {
+                deps.writer = op;
+                deps.readers.clear();
+            } else {
+                if (deps.readers.size() >= BUFFER_READERS_GC_SIZE) {
+                    deps.readers.erase(std::remove_if(deps.readers.begin(), deps.readers.end(),
+                                                      [&] (const std::weak_ptr<KalmarAsyncOp>& reader) {
+                                                          std::shared_ptr<KalmarAsyncOp> r = reader.lock();
+                                                          return (r == nullptr) || isAsyncOpComplete(r.get());
+                                                      }),
+                                       deps.readers.end());
+                }
+                deps.readers.push_back(op);
+            }
+        }
+    }
+
+    void waitAsyncOp(const std::weak_ptr<KalmarAsyncOp>& dep) {
+        std::shared_ptr<KalmarAsyncOp> op = dep.lock();
+        if (op != nullptr) {
             // wait on valid futures only
-            std::shared_future<void>* future = dependentAsyncOpPointer->getFuture();
+            std::shared_future<void>* future = op->getFuture();
             if (future->valid()) {
-              future->wait();
+                future->wait();
             }
-          }
         }
-        dependentAsyncOpVector.clear();
+    }
+
+    // wait for dependent async operations to complete before the host
+    // accesses buffer: the last writer, and the readers as well if the host
+    // is going to write buffer
+    void waitForDependentAsyncOps(void* buffer, bool modify = true) {
+        auto iter = bufferDeps.find(buffer);
+        if (iter == bufferDeps.end()) {
+            return;
+        }
+
+        BufferDeps& deps = iter->second;
+        waitAsyncOp(deps.writer);
+        deps.writer.reset();
+        if (modify) {
+            for (const auto& reader : deps.readers) {
+                waitAsyncOp(reader);
+            }
+            deps.readers.clear();
+        }
+
+        if (deps.readers.empty()) {
+            bufferDeps.erase(iter);
+        }
     }
 
 
@@ -1190,7 +2136,7 @@ public:
     }
 
     void read(void* device, void* dst, size_t count, size_t offset) override {
-        waitForDependentAsyncOps(device);
+        waitForDependentAsyncOps(device, false);
 
         // do read
         if (dst != device) {
@@ -1206,6 +2152,8 @@ public:
                 // allocator info. Same as write.
                 hsa_agent_t* agent = static_cast<hsa_agent_t*>(getHSAAgent());
                 void* va = nullptr;
+                // the pinned-host cache must not hold the range locked here
+                invalidateHostPinCache(dst, count);
                 status = hsa_amd_memory_lock(dst, count, agent, 1, &va);
                 // TODO: If host buffer is not allocated through OS allocator, so far, lock
                 // API will return nullptr to va, this is not specified in the spec, but will use it to
@@ -1232,6 +2180,7 @@ public:
 
     void write(void* device, const void* src, size_t count, size_t offset, bool blocking) override {
         waitForDependentAsyncOps(device);
+        invalidateMapShadow(device);
 
         // do write
         if (src != device) {
@@ -1244,6 +2193,8 @@ public:
                 // FIXME: host memory is allocated through OS allocator, if not, correct it.
                 hsa_agent_t* agent = static_cast<hsa_agent_t*>(getHSAAgent()); 
                 const void* va = nullptr;
+                // the pinned-host cache must not hold the range locked here
+                invalidateHostPinCache(const_cast<void*>(src), count);
                 status = hsa_amd_memory_lock(const_cast<void*>(src), count, agent, 1, (void**)&va);
                   
                 if(va == NULL || status != HSA_STATUS_SUCCESS)
@@ -1271,7 +2222,8 @@ public:
     //FIXME: this API doesn't work in the P2P world because we don't who the source agent is!!!
     void copy(void* src, void* dst, size_t count, size_t src_offset, size_t dst_offset, bool blocking) override {
         waitForDependentAsyncOps(dst);
-        waitForDependentAsyncOps(src);
+        waitForDependentAsyncOps(src, false);
+        invalidateMapShadow(dst);
 
         // do copy
         if (src != dst) {
@@ -1299,7 +2251,7 @@ public:
 #if KALMAR_DEBUG
         dumpHSAAgentInfo(*static_cast<hsa_agent_t*>(getHSAAgent()), "map(...)");
 #endif
-        waitForDependentAsyncOps(device);
+        waitForDependentAsyncOps(device, modify);
 
         // do map
         // as HSA runtime doesn't have map/unmap facility at this moment,
@@ -1310,6 +2262,32 @@ public:
             std::cerr << ": map( <device> " << device << ", <count> " << count << ", <offset> " << offset << ", <modify> " << modify << "): use HSA memory map\n";
 #endif
             hsa_status_t status = HSA_STATUS_SUCCESS;
+            hsa_agent_t* agent = static_cast<hsa_agent_t*>(getHSAAgent());
+            auto copyToHost = [&](void* dst, size_t bytes, size_t from) {
+                if (getDev()->has_cpu_accessible_am() && (bytes < HCC_H2D_STAGING_THRESHOLD)) {
+                    // large BAR: read the device memory directly, streaming loads are
+                    // much faster than regular loads on write-combined memory
+                    StreamingMemcpy(dst, ((char*)device) + from, bytes);
+                } else {
+                    sync_copy(dst, *static_cast<hsa_agent_t*>(getHostAgent()), ((char*)device) + from, *agent, bytes);
+                }
+            };
+
+            // reuse the shadow buffer of the device buffer, copying only the part which
+            // is not in sync with the device
+            size_t copyBegin = 0, copyEnd = 0;
+            char* shadow = acquireMapShadow(device, count, offset, &copyBegin, &copyEnd);
+            if (shadow != nullptr) {
+#if KALMAR_DEBUG
+                std::wcerr << getDev()->get_path();
+                std::cerr << ": map() use shadow buffer " << (void*)shadow << ", copy [" << copyBegin << ", " << copyEnd << ")\n";
+#endif
+                if (copyEnd > copyBegin) {
+                    copyToHost(shadow + copyBegin, copyEnd - copyBegin, copyBegin);
+                }
+                return shadow + offset;
+            }
+
             // allocate a host buffer
             // TODO: for safety, we copy to host, but we can map device memory to host through hsa_amd_agents_allow_access
             // withouth copying data.  (Note: CPU only has WC access to data, which has very poor read perf)
@@ -1323,14 +2301,13 @@ public:
             std::cerr << ": map() allow device access to mapped buffer\n";
 #endif
               // copy data from device buffer to host buffer
-              hsa_agent_t* agent = static_cast<hsa_agent_t*>(getHSAAgent());
               status = hsa_amd_agents_allow_access(1, agent, NULL, data);
               STATUS_CHECK(status, __LINE__);
 #if KALMAR_DEBUG
                 std::wcerr << getDev()->get_path();
                 std::cerr << ": map() copy device buffer to host buffer\n";
 #endif
-                sync_copy(data, *static_cast<hsa_agent_t*>(getHostAgent()), ((char*)device) + offset, *agent, count);
+                copyToHost(data, count, offset);
 #if KALMAR_DEBUG
                 std::wcerr << getDev()->get_path();
                 std::cerr << ": map() copy done\n";
@@ -1387,8 +2364,10 @@ public:
 #endif
             }
 
-            // deallocate the host buffer
-            hsa_amd_memory_pool_free(addr);
+            // deallocate the host buffer, shadow buffers are kept for the next mappings
+            if (!releaseMapShadow(device, addr)) {
+                hsa_amd_memory_pool_free(addr);
+            }
         } else {
 #if KALMAR_DEBUG
             std::wcerr << getDev()->get_path();
@@ -1401,12 +2380,13 @@ public:
     void Push(void *kernel, int idx, void *device, bool modify) override {
         PushArgImpl(kernel, idx, sizeof(void*), &device);
 
-        // register the buffer with the kernel
-        // when the buffer may be read/written by the kernel
-        // the buffer is not registered if it's only read by the kernel
         if (modify) {
-          kernelBufferMap[kernel].push_back(device);
+            invalidateMapShadow(device);
         }
+
+        // register the buffer with the kernel, along with whether the
+        // buffer may be written by the kernel
+        reinterpret_cast<HSADispatch*>(kernel)->addBufferAccess(device, modify);
     }
 
     void* getHSAQueue() override {
@@ -1418,6 +2398,22 @@ public:
     void* getHostAgent() override;
 
     void* getHSAAMRegion() override;
+
+    // shadow buffers of the device buffers mapped by map(), see HSADevice::acquireMapShadow
+    char* acquireMapShadow(void* device, size_t count, size_t offset, size_t* copyBegin, size_t* copyEnd);
+    bool releaseMapShadow(void* device, void* addr);
+    void invalidateMapShadow(void* device);
+
+    // A kernel may write device memory through the pointer-sized arguments at offsets of
+    // args (every pointer-aligned slot if offsets is nullptr): drop the map shadows of the
+    // buffers they point into. The buffers pushed by Push() are left out: Push() already
+    // invalidates them when the kernel may write them.
+    void invalidateRawPointerShadows(const void* args, size_t argSize, const std::vector<uint32_t>* offsets,
+                                     const std::vector< std::pair<void*, bool> >* buffers);
+    void invalidateRawPointerShadows(const HSADispatch* dispatch) {
+        invalidateRawPointerShadows(dispatch->getKernargImage().data(), dispatch->getKernargImage().size(),
+                                    &dispatch->getPointerOffsets(), &dispatch->getBufferAccesses());
+    }
     
     void* getHSACoherentHostRegion() override;
 
@@ -1470,44 +2466,54 @@ public:
 
     // enqueue a barrier packet
     std::shared_ptr<KalmarAsyncOp> EnqueueMarker() override {
-        hsa_status_t status = HSA_STATUS_SUCCESS;
-
-        // create shared_ptr instance
-        std::shared_ptr<HSABarrier> barrier = std::make_shared<HSABarrier>();
-
-        // enqueue the barrier
-        status = barrier.get()->enqueueAsync(this);
-        STATUS_CHECK(status, __LINE__);
-
-        // associate the barrier with this queue
-        pushAsyncOp(barrier);
+        if (captureGraph != nullptr) {
+            return captureGraph->addMarker(0, nullptr);
+        }
 
-        return barrier;
+        joinSpreadQueues();
+        return enqueueBarrierOp(0, nullptr);
     }
 
     // enqueue a barrier packet with multiple prior dependencies
     std::shared_ptr<KalmarAsyncOp> EnqueueMarkerWithDependency(int count, std::shared_ptr <KalmarAsyncOp> *depOps) override {
-        hsa_status_t status = HSA_STATUS_SUCCESS;
-
         if ((count > 0) && (count <= HSA_BARRIER_DEP_SIGNAL_CNT)) {
+            if (captureGraph != nullptr) {
+                return captureGraph->addMarker(count, depOps);
+            }
 
-            // create shared_ptr instance
-            std::shared_ptr<HSABarrier> barrier = std::make_shared<HSABarrier>(count, depOps);
-
-            // enqueue the barrier
-            status = barrier.get()->enqueueAsync(this);
-            STATUS_CHECK(status, __LINE__);
-
-            // associate the barrier with this queue
-            pushAsyncOp(barrier);
-
-            return barrier;
+            joinSpreadQueues();
+            return enqueueBarrierOp(count, depOps);
         } else {
             // throw an exception
             throw Kalmar::runtime_exception("Incorrect number of dependent signals passed to HSABarrier constructor", count);
         }
     }
 
+    // enqueue a barrier packet with count (0 to HSA_BARRIER_DEP_SIGNAL_CNT)
+    // prior dependencies. Used for the runtime's own synchronization, which is
+    // never recorded into a graph.
+    // If barrierBit is false the packet only waits for depOps.
+    // A barrier given a hardware queue belongs to a kernel being spread over
+    // spreadQueues.
+    std::shared_ptr<KalmarAsyncOp> enqueueBarrierOp(int count, std::shared_ptr <KalmarAsyncOp> *depOps, bool barrierBit = true,
+                                                    hsa_queue_t* queue = nullptr) {
+        hsa_status_t status = HSA_STATUS_SUCCESS;
+
+        // create shared_ptr instance
+        std::shared_ptr<HSABarrier> barrier = (count > 0) ? std::make_shared<HSABarrier>(count, depOps)
+                                                          : std::make_shared<HSABarrier>();
+        barrier->setBarrierBit(barrierBit);
+
+        // enqueue the barrier
+        status = barrier.get()->enqueueAsync(this, queue);
+        STATUS_CHECK(status, __LINE__);
+
+        // associate the barrier with this queue
+        pushAsyncOp(barrier, queue != nullptr);
+
+        return barrier;
+    }
+
     std::shared_ptr<KalmarAsyncOp> EnqueueAsyncCopyExt(const void* src, void* dst, size_t size_bytes, 
                                                        hcCommandKind copyDir, const hc::AmPointerInfo &srcPtrInfo, const hc::AmPointerInfo &dstPtrInfo, 
                                                        const Kalmar::KalmarDevice *copyDevice) override;
@@ -1544,18 +2550,12 @@ public:
 
 
     // remove finished async operation from waiting list
+    // The slot is found from the sequence number of the op; it may since
+    // have been retired and reused by a younger op.
     void removeAsyncOp(KalmarAsyncOp* asyncOp) {
-        for (int i = 0; i < asyncOps.size(); ++i) {
-            if (asyncOps[i].get() == asyncOp) {
-                asyncOps[i] = nullptr;
-            }
-        }
-
-        // GC for finished kernels
-        if (asyncOps.size() > ASYNCOPS_VECTOR_GC_SIZE) {
-            //printf ("GC\n");
-          asyncOps.erase(std::remove(asyncOps.begin(), asyncOps.end(), nullptr),
-                         asyncOps.end());
+        uint64_t n = asyncOp->getSeqNum();
+        if (n >= asyncOpsOldest && n <= opSeqNums && asyncOpSlot(n).get() == asyncOp) {
+            asyncOpSlot(n) = nullptr;
         }
     }
 };
@@ -1602,10 +2602,36 @@ private:
     uint16_t versionMajor;
     uint16_t versionMinor;
 
+    mutable std::once_flag copyThresholdsTuned;
+
+    // Host shadow buffers of the device buffers mapped with map(), kept until the buffer is
+    // released: mapping a buffer again skips the allocation and, for the range still in sync
+    // with the device buffer, the copy.  Only buffers allocated by create() are cached, the
+    // runtime sees all their writes: kernel arguments, write() and copy(), and through
+    // invalidateMapShadows the copies and kernels writing them through raw pointers.
+    struct MapShadow {
+        void* host;             // host copy of the whole device buffer
+        size_t size;
+        size_t validBegin;      // range of host in sync with the device buffer
+        size_t validEnd;
+        int mapCount;           // mappings not unmapped yet
+    };
+    std::map<void*, size_t> createdBuffers;     // buffers allocated by create(), and their size
+    std::map<void*, MapShadow> mapShadows;
+    size_t mapShadowBytes;
+    std::mutex mapShadowsMutex;
+
+    void freeMapShadow(std::map<void*, MapShadow>::iterator it) {
+        hsa_amd_memory_pool_free(it->second.host);
+        mapShadowBytes -= it->second.size;
+        mapShadows.erase(it);
+    }
+
 public:
     // Structures to manage unpinnned memory copies
     class UnpinnedCopyEngine      *copy_engine[2]; // one for each direction.
     UnpinnedCopyEngine::CopyMode  copy_mode;
+    AsyncCopyThread               *async_copy_thread; // runs the asynchronous unpinned copies
 
 public:
 
@@ -1772,7 +2798,111 @@ public:
 
 
 
-    HSADevice(hsa_agent_t a, hsa_agent_t host) : KalmarDevice(access_type_read_write),
+private:
+    // file the calibrated copy thresholds are kept in, one per host
+    static std::string copyCalibrationFile() {
+        const char* file = getenv("HCC_COPY_CALIBRATION_FILE");
+        if (file != nullptr) {
+            return file;
+        }
+        char hostname[256] {0};
+        gethostname(hostname, sizeof(hostname) - 1);
+        const char* home = getenv("HOME");
+        return std::string(home ? home : "/tmp") + "/.hcc_copy_thresholds." + hostname;
+    }
+
+    // lines of the file: <device path> <H2D direct/staging> <H2D staging/pin-in-place> <D2H>, in bytes
+    static bool readCopyThresholds(const std::string& file, const std::string& key, size_t thresholds[3]) {
+        std::ifstream in(file);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string device;
+            if ((fields >> device) && (device == key) &&
+                (fields >> thresholds[0] >> thresholds[1] >> thresholds[2])) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void writeCopyThresholds(const std::string& file, const std::string& key, const size_t thresholds[3]) {
+        // keep the lines of the other devices, and replace the file in one step so concurrent
+        // processes never read a partial file
+        std::vector<std::string> lines;
+        {
+            std::ifstream in(file);
+            std::string line;
+            while (std::getline(in, line)) {
+                std::istringstream fields(line);
+                std::string device;
+                if ((fields >> device) && (device != key)) {
+                    lines.push_back(line);
+                }
+            }
+        }
+        std::string tmp = file + "." + std::to_string(getpid());
+        {
+            std::ofstream out(tmp);
+            for (const auto& line : lines) {
+                out << line << "\n";
+            }
+            out << key << " " << thresholds[0] << " " << thresholds[1] << " " << thresholds[2] << "\n";
+            if (!out) {
+                return;
+            }
+        }
+        rename(tmp.c_str(), file.c_str());
+    }
+
+public:
+    // Pick the thresholds of the ChooseBest copy mode for this device, see HCC_COPY_CALIBRATION.
+    // Done once, at the first unpinned copy.
+    void tuneCopyThresholds() const {
+        if ((HCC_COPY_CALIBRATION == 0) || (copy_mode != UnpinnedCopyEngine::ChooseBest)) {
+            return;
+        }
+        std::call_once(copyThresholdsTuned, [this] {
+            const std::string file = copyCalibrationFile();
+            const std::string key(path.begin(), path.end());
+
+            size_t thresholds[3];
+            if ((HCC_COPY_CALIBRATION == 2) || !readCopyThresholds(file, key, thresholds)) {
+                static const size_t calibrationSize = 16*1024*1024;
+                void* deviceBuffer = nullptr;
+                hsa_status_t status = hsa_amd_memory_pool_allocate(ri._am_memory_pool, calibrationSize, 0, &deviceBuffer);
+                if (status != HSA_STATUS_SUCCESS) {
+                    return;
+                }
+                status = hsa_amd_agents_allow_access(1, &agent, NULL, deviceBuffer);
+                STATUS_CHECK(status, __LINE__);
+
+                copy_engine[0]->CalibrateThresholds(deviceBuffer, calibrationSize);
+                copy_engine[0]->GetThresholds(&thresholds[0], &thresholds[1], &thresholds[2]);
+
+                status = hsa_amd_memory_pool_free(deviceBuffer);
+                STATUS_CHECK(status, __LINE__);
+
+                writeCopyThresholds(file, key, thresholds);
+            }
+
+            // thresholds given in the environment win
+            if (getenv("HCC_H2D_STAGING_THRESHOLD")) {
+                thresholds[0] = HCC_H2D_STAGING_THRESHOLD;
+            }
+            if (getenv("HCC_H2D_PININPLACE_THRESHOLD")) {
+                thresholds[1] = HCC_H2D_PININPLACE_THRESHOLD;
+            }
+            if (getenv("HCC_D2H_PININPLACE_THRESHOLD")) {
+                thresholds[2] = HCC_D2H_PININPLACE_THRESHOLD;
+            }
+            for (int i = 0; i < 2; i++) {
+                copy_engine[i]->SetThresholds(thresholds[0], thresholds[1], thresholds[2]);
+            }
+        });
+    }
+
+    HSADevice(hsa_agent_t a, hsa_agent_t host, PinnedHostCache* pinCache) : KalmarDevice(access_type_read_write),
                                agent(a), programs(), max_tile_static_size(0),
                                queues(), queues_mutex(),
                                ri(),
@@ -1781,7 +2911,8 @@ public:
                                executables(),
                                profile(hcAgentProfileNone),
                                path(), description(), hostAgent(host),
-                               versionMajor(0), versionMinor(0) {
+                               versionMajor(0), versionMinor(0),
+                               mapShadowBytes(0) {
 #if KALMAR_DEBUG
         std::cerr << "HSADevice::HSADevice()\n";
 #endif
@@ -1933,26 +3064,37 @@ public:
             getenvlong("HCC_H2D_PININPLACE_THRESHOLD", HCC_H2D_PININPLACE_THRESHOLD);
         HCC_D2H_PININPLACE_THRESHOLD =  
             getenvlong("HCC_D2H_PININPLACE_THRESHOLD", HCC_D2H_PININPLACE_THRESHOLD);
+        HCC_COPY_CALIBRATION = getenvlong("HCC_COPY_CALIBRATION", HCC_COPY_CALIBRATION);
        
 
         HCC_H2D_STAGING_THRESHOLD    *= 1024;
         HCC_H2D_PININPLACE_THRESHOLD *= 1024;
         HCC_D2H_PININPLACE_THRESHOLD *= 1024;
 
-        static const size_t stagingSize = 64*1024;
+        HCC_STAGING_BUFFER_SIZE  = getenvlong("HCC_STAGING_BUFFER_SIZE",  HCC_STAGING_BUFFER_SIZE);
+        HCC_STAGING_BUFFER_COUNT = getenvlong("HCC_STAGING_BUFFER_COUNT", HCC_STAGING_BUFFER_COUNT);
+        HCC_STAGING_COPY_THREADS = getenvlong("HCC_STAGING_COPY_THREADS", HCC_STAGING_COPY_THREADS);
+
+        const size_t stagingSize = std::max(HCC_STAGING_BUFFER_SIZE, 64L) * 1024;
+        const int stagingCount = std::max(HCC_STAGING_BUFFER_COUNT, 2L);
+        const int copyThreads = std::max(HCC_STAGING_COPY_THREADS, 0L);
         this->cpu_accessible_am = hasAccess(hostAgent, ri._am_memory_pool);
         hsa_amd_memory_pool_t hostPool = (getHSAAMHostRegion());
-        copy_engine[0] = new UnpinnedCopyEngine(agent, hostAgent, stagingSize, 2/*staging buffers*/,
+        copy_engine[0] = new UnpinnedCopyEngine(agent, hostAgent, stagingSize, stagingCount,
                                                 this->cpu_accessible_am, 
                                                 HCC_H2D_STAGING_THRESHOLD,
                                                 HCC_H2D_PININPLACE_THRESHOLD,
-                                                HCC_D2H_PININPLACE_THRESHOLD);
+                                                HCC_D2H_PININPLACE_THRESHOLD,
+                                                pinCache, copyThreads);
 
-        copy_engine[1] = new UnpinnedCopyEngine(agent, hostAgent, stagingSize, 2/*staging Buffers*/,
+        copy_engine[1] = new UnpinnedCopyEngine(agent, hostAgent, stagingSize, stagingCount,
                                                 this->cpu_accessible_am, 
                                                 HCC_H2D_STAGING_THRESHOLD,
                                                 HCC_H2D_PININPLACE_THRESHOLD,
-                                                HCC_D2H_PININPLACE_THRESHOLD);
+                                                HCC_D2H_PININPLACE_THRESHOLD,
+                                                pinCache, copyThreads);
+
+        async_copy_thread = new AsyncCopyThread();
     }
 
     ~HSADevice() {
@@ -2001,6 +3143,14 @@ public:
         executables.clear();
 
 
+        while (!mapShadows.empty()) {
+            freeMapShadow(mapShadows.begin());
+        }
+
+        // finishes the pending copies, which use the copy engines
+        delete async_copy_thread;
+        async_copy_thread = NULL;
+
         for (int i=0; i<2; i++) {
             if (copy_engine[i]) {
                 delete copy_engine[i];
@@ -2030,6 +3180,131 @@ public:
 
     bool has_cpu_accessible_am() const override { return cpu_accessible_am; }
 
+    // Host shadow buffer to map [offset, offset+count) of device buffer device, or nullptr if
+    // the buffer is not cached.  [*copyBegin, *copyEnd) receives the range the caller has to
+    // copy from the device buffer to the shadow buffer: empty when the range is in sync.
+    char* acquireMapShadow(void* device, size_t count, size_t offset, size_t* copyBegin, size_t* copyEnd) {
+        std::lock_guard<std::mutex> l(mapShadowsMutex);
+        auto it = mapShadows.find(device);
+        if (it == mapShadows.end()) {
+            auto created = createdBuffers.find(device);
+            if (created == createdBuffers.end()) {
+                return nullptr;
+            }
+            const size_t size = created->second;
+            const size_t budget = HCC_MAP_CACHE_SIZE * 1024 * 1024;
+            if (size > budget) {
+                return nullptr;
+            }
+            // make room: drop the shadows not mapped at the moment
+            for (auto victim = mapShadows.begin(); (mapShadowBytes + size > budget) && (victim != mapShadows.end()); ) {
+                if (victim->second.mapCount == 0) {
+                    freeMapShadow(victim++);
+                } else {
+                    ++victim;
+                }
+            }
+            if (mapShadowBytes + size > budget) {
+                return nullptr;
+            }
+
+            void* host = nullptr;
+            hsa_status_t status = hsa_amd_memory_pool_allocate(getHSAAMHostRegion(), size, 0, &host);
+            if ((status != HSA_STATUS_SUCCESS) || (host == nullptr)) {
+                return nullptr;
+            }
+            status = hsa_amd_agents_allow_access(1, &agent, NULL, host);
+            STATUS_CHECK(status, __LINE__);
+
+            it = mapShadows.insert(std::make_pair(device, MapShadow{host, size, 0, 0, 0})).first;
+            mapShadowBytes += size;
+        }
+
+        MapShadow& shadow = it->second;
+        if (offset + count > shadow.size) {
+            return nullptr;
+        }
+
+        const size_t begin = offset;
+        const size_t end = offset + count;
+        if ((begin >= shadow.validBegin) && (end <= shadow.validEnd)) {
+            *copyBegin = *copyEnd = begin;
+        } else if (shadow.mapCount > 0) {
+            // the copy could overwrite data written through another mapping
+            return nullptr;
+        } else {
+            *copyBegin = begin;
+            *copyEnd = end;
+            if ((shadow.validBegin == shadow.validEnd) || (end < shadow.validBegin) || (begin > shadow.validEnd)) {
+                shadow.validBegin = begin;
+                shadow.validEnd = end;
+            } else {
+                // overlapping or adjacent: only the part outside of the valid range is copied
+                if ((begin >= shadow.validBegin) && (begin < shadow.validEnd)) {
+                    *copyBegin = shadow.validEnd;
+                } else if ((end > shadow.validBegin) && (end <= shadow.validEnd)) {
+                    *copyEnd = shadow.validBegin;
+                }
+                shadow.validBegin = std::min(shadow.validBegin, begin);
+                shadow.validEnd = std::max(shadow.validEnd, end);
+            }
+        }
+        shadow.mapCount++;
+        return static_cast<char*>(shadow.host);
+    }
+
+    // Done with a mapping of device buffer device at addr.  Returns false if addr is not
+    // in the shadow buffer of device: the mapping was not cached.
+    bool releaseMapShadow(void* device, void* addr) {
+        std::lock_guard<std::mutex> l(mapShadowsMutex);
+        auto it = mapShadows.find(device);
+        if (it == mapShadows.end()) {
+            return false;
+        }
+        MapShadow& shadow = it->second;
+        char* host = static_cast<char*>(shadow.host);
+        if ((static_cast<char*>(addr) < host) || (static_cast<char*>(addr) >= host + shadow.size)) {
+            return false;
+        }
+        shadow.mapCount--;
+        return true;
+    }
+
+    // The device buffer device is about to be written by the device: its shadow buffer is stale.
+    void invalidateMapShadow(void* device) {
+        std::lock_guard<std::mutex> l(mapShadowsMutex);
+        auto it = mapShadows.find(device);
+        if (it != mapShadows.end()) {
+            it->second.validBegin = it->second.validEnd = 0;
+        }
+    }
+
+    // [ptr, ptr+size) is about to be written by a copy or through a raw pointer (e.g. from
+    // accelerator_pointer()): the shadows of the created buffers it overlaps are stale.
+    void invalidateMapShadows(const void* ptr, size_t size) override {
+        if (HCC_MAP_CACHE_SIZE == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> l(mapShadowsMutex);
+        if (mapShadows.empty()) {
+            return;
+        }
+        const char* begin = static_cast<const char*>(ptr);
+        auto created = createdBuffers.upper_bound(const_cast<void*>(ptr));
+        if (created != createdBuffers.begin()) {
+            --created;
+        }
+        for (; (created != createdBuffers.end()) && (static_cast<const char*>(created->first) < begin + size); ++created) {
+            if (static_cast<const char*>(created->first) + created->second <= begin) {
+                continue;
+            }
+            auto it = mapShadows.find(created->first);
+            if (it != mapShadows.end()) {
+                it->second.validBegin = it->second.validEnd = 0;
+            }
+        }
+    }
+
     void* create(size_t count, struct rw_info* key) override {
         void *data = nullptr;
 
@@ -2060,12 +3335,26 @@ public:
         std::cerr << ": create -> <pointer> " << data << "\n";
 #endif
 
+        if (!is_unified() && (HCC_MAP_CACHE_SIZE != 0)) {
+            std::lock_guard<std::mutex> l(mapShadowsMutex);
+            createdBuffers[data] = count;
+        }
+
         return data;
     }
 
     void release(void *ptr, struct rw_info* key ) override {
         hsa_status_t status = HSA_STATUS_SUCCESS;
         if (!is_unified()) {
+            {
+                std::lock_guard<std::mutex> l(mapShadowsMutex);
+                createdBuffers.erase(ptr);
+                auto it = mapShadows.find(ptr);
+                if (it != mapShadows.end()) {
+                    freeMapShadow(it);
+                }
+            }
+
 #if KALMAR_DEBUG
             std::cerr << "release(" << ptr << "," << key << "): use HSA memory deallocator\n";
 #endif
@@ -2192,8 +3481,8 @@ public:
         return dispatch;
     }
 
-    std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order) override {
-        std::shared_ptr<KalmarQueue> q =  std::shared_ptr<KalmarQueue>(new HSAQueue(this, agent, order));
+    std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order, unsigned int hwQueueCount = 1) override {
+        std::shared_ptr<KalmarQueue> q =  std::shared_ptr<KalmarQueue>(new HSAQueue(this, agent, order, hwQueueCount));
         queues_mutex.lock();
         queues.push_back(q);
         queues_mutex.unlock();
@@ -2524,10 +3813,104 @@ private:
             status = hsa_executable_freeze(hsaExecutable, NULL);
             STATUS_CHECK(status, __LINE__);
 
-            // save everything as an HSAExecutable instance
-            executables[index] = new HSAExecutable(hsaExecutable, code_object);
-        }
+            // save everything as an HSAExecutable instance
+            executables[index] = new HSAExecutable(hsaExecutable, code_object);
+        }
+    }
+};
+
+// Runtime of the PeerCopyScheduler over HSA: agents are identified by their handles, and the events
+// are signals completed by hsa_amd_memory_async_copy.
+class HsaPeerCopyRuntime : public PeerCopyScheduler::Runtime {
+public:
+    HsaPeerCopyRuntime(const std::vector<KalmarDevice*>& devices, hsa_amd_memory_pool_t hostPool) : _hostPool(hostPool) {
+        for (auto dev : devices) {
+            HSADevice* hsaDevice = static_cast<HSADevice*>(dev);
+            _devices[hsaDevice->getAgent().handle] = hsaDevice;
+            _agents.push_back(hsaDevice->getAgent());
+        }
+    }
+
+    // A pool disallowed by default is accessible from another agent only in the allocations it was
+    // given access to.
+    bool CanAccess(AgentId agent, AgentId owner, const void* ptr) override {
+        if (agent == owner) {
+            return true;
+        }
+        auto a = _devices.find(agent);
+        auto o = _devices.find(owner);
+        if ((a == _devices.end()) || (o == _devices.end())) {
+            return false;
+        }
+        if (!o->second->is_peer(a->second)) {
+            return false;
+        }
+        hsa_amd_memory_pool_t pool = o->second->getHSAAMRegion();
+        hsa_amd_memory_pool_access_t access;
+        hsa_agent_t hsaAgent = a->second->getAgent();
+        hsa_status_t status = hsa_amd_agent_memory_pool_get_info(hsaAgent, pool, HSA_AMD_AGENT_MEMORY_POOL_INFO_ACCESS, &access);
+        if (status != HSA_STATUS_SUCCESS) {
+            return false;
+        }
+        return (access == HSA_AMD_MEMORY_POOL_ACCESS_ALLOWED_BY_DEFAULT) || hc::am_memtracker_peer_access(ptr, hsaAgent);
+    }
+
+    void* AllocStaging(size_t sizeBytes) override {
+        void* ptr = nullptr;
+        hsa_status_t status = hsa_amd_memory_pool_allocate(_hostPool, sizeBytes, 0, &ptr);
+        if (status != HSA_STATUS_SUCCESS) {
+            return nullptr;
+        }
+        status = hsa_amd_agents_allow_access(_agents.size(), _agents.data(), NULL, ptr);
+        if (status != HSA_STATUS_SUCCESS) {
+            hsa_amd_memory_pool_free(ptr);
+            return nullptr;
+        }
+        return ptr;
+    }
+
+    void FreeStaging(void* ptr) override {
+        hsa_amd_memory_pool_free(ptr);
+    }
+
+    EventId CopyAsync(void* dst, const void* src, size_t sizeBytes, AgentId copyAgent,
+                      int depCount, const EventId* deps) override {
+        hsa_signal_t signal;
+        hsa_status_t status = hsa_signal_create(1, 0, NULL, &signal);
+        STATUS_CHECK(status, __LINE__);
+
+        hsa_signal_t depSignals[3];
+        for (int i = 0; i < depCount; ++i) {
+            depSignals[i].handle = deps[i];
+        }
+
+        // same agent for source and destination, so the engine of copyAgent does the copy
+        hsa_agent_t agent;
+        agent.handle = copyAgent;
+        status = hsa_amd_memory_async_copy(dst, agent, src, agent, sizeBytes, depCount, depCount ? depSignals : NULL, signal);
+        if (status != HSA_STATUS_SUCCESS) {
+            hsa_signal_destroy(signal);
+            throw Kalmar::runtime_exception("hsa_amd_memory_async_copy error", status);
+        }
+        return signal.handle;
+    }
+
+    void Wait(EventId event) override {
+        hsa_signal_t signal;
+        signal.handle = event;
+        hsa_signal_wait_acquire(signal, HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, HSA_WAIT_STATE_BLOCKED);
+    }
+
+    void Release(EventId event) override {
+        hsa_signal_t signal;
+        signal.handle = event;
+        hsa_signal_destroy(signal);
     }
+
+private:
+    std::map<uint64_t, HSADevice*>  _devices;
+    std::vector<hsa_agent_t>        _agents;
+    hsa_amd_memory_pool_t           _hostPool;
 };
 
 class HSAContext final : public KalmarContext
@@ -2546,6 +3929,13 @@ class HSAContext final : public KalmarContext
     */
     hsa_agent_t host;
 
+    /// host ranges pinned by the unpinned copy engines of all devices
+    PinnedHostCache* pinCache;
+
+    /// copies between the memory of two devices
+    HsaPeerCopyRuntime* peerCopyRuntime;
+    PeerCopyScheduler* peerCopy;
+
     /// Determines if the given agent is of type HSA_DEVICE_TYPE_GPU
     /// If so, cache to input data
     static hsa_status_t find_gpu(hsa_agent_t agent, void *data) {
@@ -2607,7 +3997,8 @@ class HSAContext final : public KalmarContext
 
 
 public:
-    HSAContext() : KalmarContext(), signalPool(), signalPoolFlag(), signalCursor(0), signalPoolMutex() {
+    HSAContext() : KalmarContext(), signalPool(), signalPoolFlag(), signalCursor(0), signalPoolMutex(), pinCache(nullptr),
+                   peerCopyRuntime(nullptr), peerCopy(nullptr) {
         host.handle = (uint64_t)-1;
         // initialize HSA runtime
 #if KALMAR_DEBUG
@@ -2626,15 +4017,29 @@ public:
         status = hsa_iterate_agents(&HSAContext::find_host, &host);
         STATUS_CHECK(status, __LINE__);
 
+        HCC_PINNED_CACHE_SIZE = HSADevice::getenvlong("HCC_PINNED_CACHE_SIZE", HCC_PINNED_CACHE_SIZE);
+        HCC_MAP_CACHE_SIZE = HSADevice::getenvlong("HCC_MAP_CACHE_SIZE", HCC_MAP_CACHE_SIZE);
+        pinCache = new PinnedHostCache(agents, HCC_PINNED_CACHE_SIZE * 1024 * 1024);
+
         for (int i = 0; i < agents.size(); ++i) {
             hsa_agent_t agent = agents[i];
-            auto Dev = new HSADevice(agent, host);
+            auto Dev = new HSADevice(agent, host, pinCache);
             // choose the first GPU device as the default device
             if (i == 0)
                 def = Dev;
             Devices.push_back(Dev);
         }
 
+        HCC_P2P_CHUNK_SIZE      = HSADevice::getenvlong("HCC_P2P_CHUNK_SIZE", HCC_P2P_CHUNK_SIZE);
+        HCC_P2P_STAGING_COUNT   = HSADevice::getenvlong("HCC_P2P_STAGING_COUNT", HCC_P2P_STAGING_COUNT);
+        HCC_P2P_ENGINES         = HSADevice::getenvlong("HCC_P2P_ENGINES", HCC_P2P_ENGINES);
+        HCC_P2P_SPLIT_THRESHOLD = HSADevice::getenvlong("HCC_P2P_SPLIT_THRESHOLD", HCC_P2P_SPLIT_THRESHOLD);
+        if (!Devices.empty()) {
+            peerCopyRuntime = new HsaPeerCopyRuntime(Devices, static_cast<HSADevice*>(def)->getHSAAMHostRegion());
+            peerCopy = new PeerCopyScheduler(peerCopyRuntime, std::max(HCC_P2P_CHUNK_SIZE, 64L) * 1024,
+                                             HCC_P2P_STAGING_COUNT, HCC_P2P_ENGINES,
+                                             std::max(HCC_P2P_SPLIT_THRESHOLD, 0L) * 1024);
+        }
 
 #if SIGNAL_POOL_SIZE > 0
         signalPoolMutex.lock();
@@ -2784,12 +4189,22 @@ public:
         std::cerr << "HSAContext::~HSAContext() in\n";
 #endif
 
+        // the last copies through the staging buffers are done before the devices go away
+        delete peerCopy;
+        peerCopy = nullptr;
+        delete peerCopyRuntime;
+        peerCopyRuntime = nullptr;
+
         // destroy all KalmarDevices associated with this context
         for (auto dev : Devices)
             delete dev;
         Devices.clear();
         def = nullptr;
 
+        // unpin the cached host ranges
+        delete pinCache;
+        pinCache = nullptr;
+
 #if SIGNAL_POOL_SIZE > 0
         signalPoolMutex.lock();
 
@@ -2818,6 +4233,18 @@ public:
 #endif
     }
 
+    PeerCopyScheduler* getPeerCopyScheduler() {
+        return peerCopy;
+    }
+
+    void invalidateHostPinCache(void* ptr, size_t size) override {
+        pinCache->Invalidate(ptr, size);
+    }
+
+    void getHostPinCacheStats(uint64_t* hits, uint64_t* misses, uint64_t* evictions, size_t* pinnedBytes) override {
+        pinCache->GetStats(hits, misses, evictions, pinnedBytes);
+    }
+
     uint64_t getSystemTicks() override {
         // get system tick
         uint64_t timestamp = 0L;
@@ -2835,6 +4262,10 @@ public:
 
 static HSAContext ctx;
 
+static void invalidateHostPinCache(void* ptr, size_t size) {
+    ctx.invalidateHostPinCache(ptr, size);
+}
+
 } // namespace Kalmar
 
 // ----------------------------------------------------------------------
@@ -2862,7 +4293,54 @@ inline void*
 HSAQueue::getHostAgent() override {
     return static_cast<void*>(&(static_cast<HSADevice*>(getDev())->getHostAgent()));
 }
-inline void*
+inline char*
+HSAQueue::acquireMapShadow(void* device, size_t count, size_t offset, size_t* copyBegin, size_t* copyEnd) {
+    return static_cast<HSADevice*>(getDev())->acquireMapShadow(device, count, offset, copyBegin, copyEnd);
+}
+
+bool
+HSAQueue::releaseMapShadow(void* device, void* addr) {
+    return static_cast<HSADevice*>(getDev())->releaseMapShadow(device, addr);
+}
+
+void
+HSAQueue::invalidateMapShadow(void* device) {
+    static_cast<HSADevice*>(getDev())->invalidateMapShadow(device);
+}
+
+void
+HSAQueue::invalidateRawPointerShadows(const void* args, size_t argSize, const std::vector<uint32_t>* offsets,
+                                      const std::vector< std::pair<void*, bool> >* buffers) {
+    if (HCC_MAP_CACHE_SIZE == 0) {
+        return;
+    }
+    auto invalidate = [&](size_t offset) {
+        void* ptr;
+        memcpy(&ptr, static_cast<const char*>(args) + offset, sizeof(void*));
+        if (ptr == nullptr) {
+            return;
+        }
+        if (buffers != nullptr) {
+            for (const auto& buffer : *buffers) {
+                if (buffer.first == ptr) {
+                    return;
+                }
+            }
+        }
+        ctx.invalidateMapShadows(ptr, 1);
+    };
+    if (offsets != nullptr) {
+        for (uint32_t offset : *offsets) {
+            invalidate(offset);
+        }
+    } else {
+        for (size_t offset = 0; offset + sizeof(void*) <= argSize; offset += alignof(void*)) {
+            invalidate(offset);
+        }
+    }
+}
+
+void*
 HSAQueue::getHSAAMRegion() override {
     return static_cast<void*>(&(static_cast<HSADevice*>(getDev())->getHSAAMRegion()));
 }
@@ -2889,6 +4367,7 @@ void HSAQueue::copy_ext(const void *src, void *dst, size_t size_bytes, hc::hcCom
     // wait for all previous async commands in this queue to finish
     this->wait();
 
+    ctx.invalidateMapShadows(dst, size_bytes);
 
     const Kalmar::HSADevice *copyDeviceHsa = static_cast<const Kalmar::HSADevice*> (copyDevice);
 
@@ -2934,12 +4413,16 @@ std::shared_ptr<KalmarAsyncOp> HSAQueue::EnqueueAsyncCopyExt(const void* src, vo
     const Kalmar::HSADevice *copyDeviceHsa = static_cast<const Kalmar::HSADevice*> (copyDevice);
     std::shared_ptr<HSACopy> copyCommand = std::make_shared<HSACopy>(src, dst, size_bytes);
 
+    joinSpreadQueues();
+    ctx.invalidateMapShadows(dst, size_bytes);
+
     // euqueue the async copy command
     status = copyCommand.get()->enqueueAsyncCopyCommand(this, copyDeviceHsa, srcPtrInfo, dstPtrInfo);
     STATUS_CHECK(status, __LINE__);
 
     // associate the async copy command with this queue
     pushAsyncOp(copyCommand);
+    recordCopyAccesses(copyCommand, src, dst);
 
     return copyCommand;
 };
@@ -2949,6 +4432,12 @@ std::shared_ptr<KalmarAsyncOp> HSAQueue::EnqueueAsyncCopyExt(const void* src, vo
 std::shared_ptr<KalmarAsyncOp> HSAQueue::EnqueueAsyncCopy(const void *src, void *dst, size_t size_bytes) override {
     hsa_status_t status = HSA_STATUS_SUCCESS;
 
+    if (captureGraph != nullptr) {
+        return captureGraph->addCopy(src, dst, size_bytes);
+    }
+
+    ctx.invalidateMapShadows(dst, size_bytes);
+
     // create shared_ptr instance
     std::shared_ptr<HSACopy> copyCommand = std::make_shared<HSACopy>(src, dst, size_bytes);
 
@@ -2960,13 +4449,32 @@ std::shared_ptr<KalmarAsyncOp> HSAQueue::EnqueueAsyncCopy(const void *src, void
     bool srcInTracker = (hc::am_memtracker_getinfo(&srcPtrInfo, src) == AM_SUCCESS);
     bool dstInTracker = (hc::am_memtracker_getinfo(&dstPtrInfo, dst) == AM_SUCCESS);
 
-    if (!srcInTracker) {
-        // throw an exception
-        throw Kalmar::runtime_exception("trying to copy from unpinned src pointer", 0);
-    } else if (!dstInTracker) {
-        // throw an exception
-        throw Kalmar::runtime_exception("trying to copy from unpinned dst pointer", 0);
-    };
+    if (!srcInTracker || !dstInTracker) {
+        // Memory the DMA engines can not see: the copy is run by a CPU thread of the device
+        // owning the other pointer, through its staging buffers, or of this queue for H2H.
+        Kalmar::hcCommandKind copyDir;
+        const Kalmar::HSADevice *copyDevice;
+        if (srcInTracker && srcPtrInfo._isInDeviceMem) {
+            copyDir = Kalmar::hcMemcpyDeviceToHost;
+            copyDevice = static_cast<Kalmar::HSADevice*>(srcPtrInfo._acc.get_dev_ptr());
+        } else if (dstInTracker && dstPtrInfo._isInDeviceMem) {
+            copyDir = Kalmar::hcMemcpyHostToDevice;
+            copyDevice = static_cast<Kalmar::HSADevice*>(dstPtrInfo._acc.get_dev_ptr());
+        } else {
+            copyDir = Kalmar::hcMemcpyHostToHost;
+            copyDevice = static_cast<Kalmar::HSADevice*>(getDev());
+        }
+
+        joinSpreadQueues();
+
+        status = copyCommand.get()->enqueueAsyncUnpinnedCopyCommand(this, copyDevice, copyDir);
+        STATUS_CHECK(status, __LINE__);
+
+        pushAsyncOp(copyCommand);
+        recordCopyAccesses(copyCommand, src, dst);
+
+        return copyCommand;
+    }
 
 
     // Select optimal copy agent:
@@ -2985,12 +4493,15 @@ std::shared_ptr<KalmarAsyncOp> HSAQueue::EnqueueAsyncCopy(const void *src, void
         copyDevice = nullptr; // H2H
     }
 
+    joinSpreadQueues();
+
     // enqueue the async copy command
     status = copyCommand.get()->enqueueAsyncCopyCommand(this, copyDevice, srcPtrInfo, dstPtrInfo);
     STATUS_CHECK(status, __LINE__);
 
     // associate the async copy command with this queue
     pushAsyncOp(copyCommand);
+    recordCopyAccesses(copyCommand, src, dst);
 
     return copyCommand;
 }
@@ -3017,9 +4528,21 @@ HSAQueue::dispatch_hsa_kernel(const hsa_kernel_dispatch_packet_t *aql,
     }
 
 
+    if (captureGraph != nullptr) {
+        std::shared_ptr<KalmarAsyncOp> op = captureGraph->addKernel(nullptr, *aql, args, argSize, nullptr, nullptr);
+        if (cf) {
+            *cf = hc::completion_future(op);
+        }
+        return;
+    }
+
+    // the layout of args is unknown: any of its pointers may be written
+    invalidateRawPointerShadows(args, argSize, nullptr, nullptr);
+
     Kalmar::HSADevice* device = static_cast<Kalmar::HSADevice*>(this->getDev());
     HSADispatch *dispatch = new HSADispatch(device, nullptr, aql);
 
+    joinSpreadQueues();
     waitForStreamDeps(dispatch);
 
     // May be faster to create signals for each dispatch than to use markers.
@@ -3037,13 +4560,73 @@ HSAQueue::dispatch_hsa_kernel(const hsa_kernel_dispatch_packet_t *aql,
     }
 };
 
+std::shared_ptr<KalmarAsyncOp>
+HSAQueue::replayGraph(const HSAGraph* graph) {
+    hsa_status_t status = HSA_STATUS_SUCCESS;
+    Kalmar::HSADevice* device = static_cast<Kalmar::HSADevice*>(this->getDev());
+
+    std::shared_ptr<KalmarAsyncOp> last = nullptr;
+
+    joinSpreadQueues();
+    beginBatch();
+    for (const HSAGraph::Node& node : graph->getNodes()) {
+        switch (node.kind) {
+            case HSAGraph::kernelNode: {
+                HSADispatch *dispatch = new HSADispatch(device, node.kernel, &node.aql);
+                if (node.kernargMemory != nullptr) {
+                    dispatch->setPersistentKernarg(node.kernargMemory);
+                }
+                for (const auto& access : node.bufferAccesses) {
+                    dispatch->addBufferAccess(access.first, access.second);
+                }
+                // the buffers of the kernel were only invalidated at capture
+                invalidateRawPointerShadows(node.kernargImage.data(), node.kernargImage.size(),
+                                            &node.pointerOffsets, nullptr);
+
+                // order the kernel after the commands using its buffers, on
+                // a queue which does not execute in order
+                enqueueBufferDeps(dispatch);
+
+                waitForStreamDeps(dispatch);
+
+                status = dispatch->dispatchKernelAsync(this, nullptr, 0, true);
+                STATUS_CHECK(status, __LINE__);
+
+                std::shared_ptr<KalmarAsyncOp> sp_dispatch(dispatch);
+                pushAsyncOp(sp_dispatch);
+                recordBufferAccesses(sp_dispatch, dispatch->getBufferAccesses());
+                last = sp_dispatch;
+                break;
+            }
+            case HSAGraph::copyNode:
+                last = EnqueueAsyncCopy(node.src, node.dst, node.sizeBytes);
+                break;
+            case HSAGraph::markerNode: {
+                std::vector< std::shared_ptr<KalmarAsyncOp> > deps(node.deps);
+                last = enqueueBarrierOp(deps.size(), deps.data());
+                break;
+            }
+        }
+    }
+    endBatch();
+
+    if (last == nullptr) {
+        last = enqueueBarrierOp(0, nullptr);
+    } else if (get_execute_order() != execute_in_order) {
+        // the last command alone does not tell when the whole graph is done
+        last = enqueueBarrierOp(1, &last);
+    }
+
+    return last;
+}
+
 } // namespace Kalmar
 
 // ----------------------------------------------------------------------
 // member function implementation of HSADispatch
 // ----------------------------------------------------------------------
 
-HSADispatch::HSADispatch(Kalmar::HSADevice* _device, HSAKernel* _kernel,
+HSADispatch::HSADispatch(Kalmar::HSADevice* _device, const HSAKernel* _kernel,
                          const hsa_kernel_dispatch_packet_t *aql) :
     KalmarAsyncOp(Kalmar::hcCommandKernel),
     device(_device),
@@ -3051,9 +4634,13 @@ HSADispatch::HSADispatch(Kalmar::HSADevice* _device, HSAKernel* _kernel,
     kernel(_kernel),
     isDispatched(false),
     waitMode(HSA_WAIT_STATE_BLOCKED),
+    isBatched(false),
+    batchSignal(nullptr),
     future(nullptr),
     hsaQueue(nullptr),
-    kernargMemory(nullptr) 
+    hwQueue(nullptr),
+    kernargMemory(nullptr),
+    persistentKernarg(nullptr)
 {
     if (aql) {
         this->aql = *aql;
@@ -3096,7 +4683,9 @@ HSADispatch::dispatchKernel(hsa_queue_t* commandQueue, const void *hostKernarg,
     // bind kernel arguments
     //printf("hostKernargSize size: %d in bytesn", hostKernargSize);
 
-    if (hostKernargSize > 0) {
+    if (persistentKernarg != nullptr) {
+        aql.kernarg_address = persistentKernarg;
+    } else if (hostKernargSize > 0) {
         hsa_amd_memory_pool_t kernarg_region = device->getHSAKernargRegion();
         std::pair<void*, int> ret = device->getKernargBuffer(hostKernargSize);
         kernargMemory = ret.first;
@@ -3111,50 +4700,35 @@ HSADispatch::dispatchKernel(hsa_queue_t* commandQueue, const void *hostKernarg,
     }
 
 
-    // write packet
-    uint32_t queueMask = commandQueue->size - 1;
-    // TODO: Need to check if package write is correct.
-    uint64_t index = hsa_queue_load_write_index_relaxed(commandQueue);
-    uint64_t nextIndex = index + 1;
-    if (nextIndex - hsa_queue_load_read_index_acquire(commandQueue) >= commandQueue->size) {
-      checkHCCRuntimeStatus(Kalmar::HCCRuntimeStatus::HCCRT_STATUS_ERROR_COMMAND_QUEUE_OVERFLOW, __LINE__, commandQueue);
-    }
-
-
-    hsa_kernel_dispatch_packet_t* q_aql = 
-        &(((hsa_kernel_dispatch_packet_t*)(commandQueue->base_address))[index & queueMask]);
-
-    // Copy mostly-finished AQL packet into the queue
-    *q_aql = aql;
+    // Copy mostly-finished AQL packet
+    hsa_kernel_dispatch_packet_t packet = aql;
 
     // Set some specific fields:
-    if (allocSignal) {
+    // Inside an open batch the completion signal is shared by the whole batch
+    // and attached when the batch is published.
+    isBatched = hsaQueue->isBatchOpen();
+    if (allocSignal && !isBatched) {
         /*
          * Create a signal to wait for the dispatch to finish.
          */
         std::pair<hsa_signal_t, int> ret = Kalmar::ctx.getSignal();
         signal = ret.first;
         signalIndex = ret.second;
-        q_aql->completion_signal = signal;
+        packet.completion_signal = signal;
     } else {
         signal.handle = 0;
         signalIndex = -1;
     }
 
-    // Lastly copy in the header:
-    q_aql->header = header;
-
-    hsa_queue_store_write_index_relaxed(commandQueue, index + 1);
-
     if (HCC_DB & 0x1) {
-        std::cerr << "tid" << std::this_thread::get_id() <<  " ring door bell to dispatch kernel " << kernel->kernelName << "\n";
+        std::cerr << "tid" << std::this_thread::get_id() << (isBatched ? " batch" : " ring door bell to dispatch") << " kernel " << getKernelName() << "\n";
     }
 #if KALMAR_DEBUG
-    std::cerr << "ring door bell to dispatch kernel " << kernel->kernelName << "\n";
+    std::cerr << (isBatched ? "batch" : "ring door bell to dispatch") << " kernel " << getKernelName() << "\n";
 #endif
 
-    // Ring door bell
-    hsa_signal_store_relaxed(commandQueue->doorbell_signal, index);
+    // write packet, and ring door bell unless it is part of a batch
+    hsaQueue->submitDispatchPacket(this, packet, header, isBatched, commandQueue);
 
     isDispatched = true;
 
@@ -3171,7 +4745,8 @@ HSADispatch::waitComplete() {
         return HSA_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
-
+    publishBatch();
+    hsa_signal_t signal = *static_cast<hsa_signal_t*>(getNativeHandle());
 
     if (signal.handle) {
         DBOUT(" wait for kernel dispatch op#" << getSeqNum() << " completion with wait flag: " << waitMode << "  signal="<< std::hex  << signal.handle << std::dec << "\n");
@@ -3252,8 +4827,9 @@ HSADispatch::dispatchKernelAsync(Kalmar::HSAQueue* hsaQueue, const void *hostKer
 
     // record HSAQueue association
     this->hsaQueue = hsaQueue;
-    // extract hsa_queue_t from HSAQueue
-    hsa_queue_t* queue = static_cast<hsa_queue_t*>(hsaQueue->getHSAQueue());
+    // extract hsa_queue_t from HSAQueue, unless the kernel was assigned to
+    // another hardware queue of it
+    hsa_queue_t* queue = hwQueue ? hwQueue : static_cast<hsa_queue_t*>(hsaQueue->getHSAQueue());
 
     // dispatch kernel
     status = dispatchKernel(queue, hostKernarg, hostKernargSize, allocSignal);
@@ -3285,7 +4861,10 @@ HSADispatch::dispose() {
     clearArgs();
     std::vector<uint8_t>().swap(arg_vec);
 
+    // the callbacks may be registered on the signal of the batch as well
+    signalHandlers.wait();
     Kalmar::ctx.releaseSignal(signal, signalIndex);
+    batchSignal = nullptr;
 
     if (future != nullptr) {
       delete future;
@@ -3293,11 +4872,13 @@ HSADispatch::dispose() {
     }
 }
 
+// For a batched dispatch the timestamps are the ones of the last packet of
+// its batch, which carries the shared completion signal.
 inline uint64_t
 HSADispatch::getBeginTimestamp() override {
     Kalmar::HSADevice* device = static_cast<Kalmar::HSADevice*>(hsaQueue->getDev());
     hsa_amd_profiling_dispatch_time_t time;
-    hsa_amd_profiling_get_dispatch_time(device->getAgent(), signal, &time);
+    hsa_amd_profiling_get_dispatch_time(device->getAgent(), *static_cast<hsa_signal_t*>(getNativeHandle()), &time);
     return time.start;
 }
 
@@ -3305,10 +4886,205 @@ inline uint64_t
 HSADispatch::getEndTimestamp() override {
     Kalmar::HSADevice* device = static_cast<Kalmar::HSADevice*>(hsaQueue->getDev());
     hsa_amd_profiling_dispatch_time_t time;
-    hsa_amd_profiling_get_dispatch_time(device->getAgent(), signal, &time);
+    hsa_amd_profiling_get_dispatch_time(device->getAgent(), *static_cast<hsa_signal_t*>(getNativeHandle()), &time);
     return time.end;
 }
 
+// A dispatch of a batch which is not published yet has no signal: its own
+// one, with a null handle, is returned. The batch signal is never reset once
+// attached, so the pointer stays valid after the lock is released.
+inline void*
+HSADispatch::getNativeHandle() {
+    if (isBatched) {
+        std::lock_guard<std::mutex> lock(hsaQueue->getBatchMutex());
+        if (batchSignal != nullptr) {
+            return &batchSignal->signal;
+        }
+    }
+    return &signal;
+}
+
+inline bool
+HSADispatch::isBatchPending() const {
+    if (!isBatched) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(hsaQueue->getBatchMutex());
+    return batchSignal == nullptr;
+}
+
+inline void
+HSADispatch::publishBatch() {
+    if (isBatchPending()) {
+        hsaQueue->flushBatch();
+    }
+}
+
+// ----------------------------------------------------------------------
+// member function implementation of HSABatchSignal
+// ----------------------------------------------------------------------
+
+HSABatchSignal::HSABatchSignal() {
+    std::pair<hsa_signal_t, int> ret = Kalmar::ctx.getSignal();
+    signal = ret.first;
+    signalIndex = ret.second;
+}
+
+HSABatchSignal::~HSABatchSignal() {
+    Kalmar::ctx.releaseSignal(signal, signalIndex);
+}
+
+// ----------------------------------------------------------------------
+// member function implementation of HSAGraph
+// ----------------------------------------------------------------------
+
+HSAGraph::~HSAGraph() {
+    waitReplays();
+
+    for (auto& node : nodes) {
+        if (node.kind == kernelNode && node.kernargMemory != nullptr) {
+            device->releaseKernargBuffer(node.kernargMemory, node.kernargMemoryIndex);
+            node.kernargMemory = nullptr;
+        }
+    }
+}
+
+void
+HSAGraph::waitReplays() {
+    for (auto& op : replays) {
+        op->getFuture()->wait();
+    }
+    replays.clear();
+}
+
+std::shared_ptr<Kalmar::KalmarAsyncOp>
+HSAGraph::recorded() {
+    std::shared_ptr<Kalmar::KalmarAsyncOp> op = Kalmar::KalmarContinuationOp::createCompleted();
+    recordedOps.push_back(op);
+    return op;
+}
+
+std::shared_ptr<Kalmar::KalmarAsyncOp>
+HSAGraph::addKernel(const HSAKernel* kernel, const hsa_kernel_dispatch_packet_t& aql,
+                    const void* args, size_t argSize,
+                    const std::vector<uint32_t>* pointerOffsets,
+                    const std::vector< std::pair<void*, bool> >* bufferAccesses) {
+    Node node;
+    node.kind = kernelNode;
+    node.kernel = kernel;
+    node.aql = aql;
+    node.kernargImage.assign(static_cast<const uint8_t*>(args), static_cast<const uint8_t*>(args) + argSize);
+    node.kernargMemory = nullptr;
+    node.kernargMemoryIndex = -1;
+    node.pointerOffsets = pointerOffsets ? *pointerOffsets : pointerSlots(args, argSize);
+    if (bufferAccesses != nullptr) {
+        node.bufferAccesses = *bufferAccesses;
+    }
+    nodes.push_back(std::move(node));
+    return recorded();
+}
+
+std::shared_ptr<Kalmar::KalmarAsyncOp>
+HSAGraph::addCopy(const void* src, void* dst, size_t sizeBytes) {
+    Node node;
+    node.kind = copyNode;
+    node.src = src;
+    node.dst = dst;
+    node.sizeBytes = sizeBytes;
+    nodes.push_back(std::move(node));
+    return recorded();
+}
+
+std::shared_ptr<Kalmar::KalmarAsyncOp>
+HSAGraph::addMarker(int count, std::shared_ptr<Kalmar::KalmarAsyncOp>* depOps) {
+    Node node;
+    node.kind = markerNode;
+
+    // Markers wait for all the commands before them in the graph, so only
+    // dependencies on ops issued before the capture need to be kept.
+    for (int i = 0; i < count; ++i) {
+        if (depOps[i] != nullptr &&
+            std::find(recordedOps.begin(), recordedOps.end(), depOps[i]) == recordedOps.end()) {
+            node.deps.push_back(depOps[i]);
+        }
+    }
+    nodes.push_back(std::move(node));
+    return recorded();
+}
+
+void
+HSAGraph::finalize() {
+    recordedOps.clear();
+
+    // one kernarg buffer per kernel, as for a dispatch outside of a graph
+    for (auto& node : nodes) {
+        if (node.kind == kernelNode && !node.kernargImage.empty()) {
+            std::pair<void*, int> ret = device->getKernargBuffer(node.kernargImage.size());
+            node.kernargMemory = ret.first;
+            node.kernargMemoryIndex = ret.second;
+
+            // as kernarg buffers are fine-grained, we can directly use memcpy
+            memcpy(node.kernargMemory, node.kernargImage.data(), node.kernargImage.size());
+        }
+    }
+}
+
+size_t
+HSAGraph::patchPointer(const void* from, const void* to) {
+    // do not modify arguments a replay in flight may still read
+    waitReplays();
+
+    size_t count = 0;
+    for (auto& node : nodes) {
+        switch (node.kind) {
+            case kernelNode: {
+                size_t patched = patchPointerAt(node.kernargImage.data(), node.pointerOffsets, from, to);
+                if (patched > 0 && node.kernargMemory != nullptr) {
+                    memcpy(node.kernargMemory, node.kernargImage.data(), node.kernargImage.size());
+                }
+                for (auto& access : node.bufferAccesses) {
+                    if (access.first == from) {
+                        access.first = const_cast<void*>(to);
+                    }
+                }
+                count += patched;
+                break;
+            }
+            case copyNode:
+                if (node.src == from) {
+                    node.src = to;
+                    ++count;
+                }
+                if (node.dst == from) {
+                    node.dst = const_cast<void*>(to);
+                    ++count;
+                }
+                break;
+            case markerNode:
+                break;
+        }
+    }
+    return count;
+}
+
+std::shared_ptr<Kalmar::KalmarAsyncOp>
+HSAGraph::replay(Kalmar::KalmarQueue* queue) {
+    if (queue->getDev() != device) {
+        throw Kalmar::runtime_exception("command graph replayed on an accelerator_view of another accelerator", 0);
+    }
+
+    // forget the replays which have completed
+    replays.erase(std::remove_if(replays.begin(), replays.end(),
+                                 [] (const std::shared_ptr<Kalmar::KalmarAsyncOp>& op) {
+                                     return Kalmar::HSAQueue::isAsyncOpComplete(op.get());
+                                 }),
+                  replays.end());
+
+    std::shared_ptr<Kalmar::KalmarAsyncOp> op = static_cast<Kalmar::HSAQueue*>(queue)->replayGraph(this);
+    replays.push_back(op);
+    return op;
+}
+
 
 inline hsa_status_t
 HSADispatch::setLaunchConfiguration(int dims, size_t *globalDims, size_t *localDims,
@@ -3418,13 +5194,19 @@ HSABarrier::waitComplete() {
 }
 
 inline hsa_status_t
-HSABarrier::enqueueAsync(Kalmar::HSAQueue* hsaQueue) {
+HSABarrier::enqueueAsync(Kalmar::HSAQueue* hsaQueue, hsa_queue_t* queue) {
     hsa_status_t status = HSA_STATUS_SUCCESS;
 
     // record HSAQueue association
     this->hsaQueue = hsaQueue;
     // extract hsa_queue_t from HSAQueue
-    hsa_queue_t* queue = static_cast<hsa_queue_t*>(hsaQueue->getHSAQueue());
+    if (queue == nullptr) {
+        queue = static_cast<hsa_queue_t*>(hsaQueue->getHSAQueue());
+    }
+
+    // the barrier packet takes the next free slot: publish any open batch
+    // first so it does not land in a slot reserved by the batch
+    hsaQueue->flushBatch();
 
     // enqueue barrier packet
     status = enqueueBarrier(queue);
@@ -3445,6 +5227,16 @@ HSABarrier::enqueueBarrier(hsa_queue_t* queue) {
         return HSA_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
+    // Dependencies without a device signal (e.g. continuations created by
+    // completion_future::then) can not be expressed in the barrier packet;
+    // resolve them on the host before a queue slot is reserved.
+    for (int i = 0; i < depCount; ++i) {
+        if (depAsyncOps[i] != nullptr && depAsyncOps[i]->getNativeHandle() == nullptr &&
+            depAsyncOps[i]->getFuture() != nullptr) {
+            depAsyncOps[i]->getFuture()->wait();
+        }
+    }
+
     // Create a signal to wait for the barrier to finish.
     std::pair<hsa_signal_t, int> ret = Kalmar::ctx.getSignal();
     signal = ret.first;
@@ -3464,7 +5256,9 @@ HSABarrier::enqueueBarrier(hsa_queue_t* queue) {
 
     // setup header
     uint16_t header = HSA_PACKET_TYPE_BARRIER_AND << HSA_PACKET_HEADER_TYPE;
-    header |= 1 << HSA_PACKET_HEADER_BARRIER;
+    if (barrierBit) {
+        header |= 1 << HSA_PACKET_HEADER_BARRIER;
+    }
     header |= HSA_FENCE_SCOPE_SYSTEM << HSA_PACKET_HEADER_ACQUIRE_FENCE_SCOPE;
     header |= HSA_FENCE_SCOPE_SYSTEM << HSA_PACKET_HEADER_RELEASE_FENCE_SCOPE;
     barrier->header = header;
@@ -3476,7 +5270,11 @@ HSABarrier::enqueueBarrier(hsa_queue_t* queue) {
     // setup dependent signals
     if ((depCount > 0) && (depCount <= 5)) {
         for (int i = 0; i < depCount; ++i) {
-            barrier->dep_signal[i] = *(static_cast <hsa_signal_t*> (depAsyncOps[i]->getNativeHandle()));
+            hsa_signal_t* depSignal = depAsyncOps[i] ? static_cast <hsa_signal_t*> (Kalmar::HSAQueue::waitHandle(depAsyncOps[i].get())) : nullptr;
+            // a null dep_signal is ignored by the packet processor
+            if (depSignal != nullptr) {
+                barrier->dep_signal[i] = *depSignal;
+            }
         }
     }
 
@@ -3497,6 +5295,7 @@ HSABarrier::enqueueBarrier(hsa_queue_t* queue) {
 
 inline void
 HSABarrier::dispose() {
+    signalHandlers.wait();
     Kalmar::ctx.releaseSignal(signal, signalIndex);
 
     // Release referecne to our dependent ops:
@@ -3614,6 +5413,34 @@ static Kalmar::hcCommandKind resolveMemcpyDirection(bool srcInDeviceMem, bool ds
     }
 }
 
+// Copies between the memory of two devices go through the PeerCopyScheduler.
+static bool isPeerCopy(const hc::AmPointerInfo &srcPtrInfo, const hc::AmPointerInfo &dstPtrInfo, size_t sizeBytes)
+{
+    return srcPtrInfo._isInDeviceMem && dstPtrInfo._isInDeviceMem && (sizeBytes != 0) &&
+           (srcPtrInfo._acc.get_dev_ptr() != dstPtrInfo._acc.get_dev_ptr());
+}
+
+std::shared_ptr<PeerCopyScheduler::Transfer>
+HSACopy::submitPeerCopy(const hc::AmPointerInfo &srcPtrInfo, const hc::AmPointerInfo &dstPtrInfo, uint64_t waitFor, bool forceStaged)
+{
+    hsa_agent_t dstAgent = * (static_cast<hsa_agent_t*> (dstPtrInfo._acc.get_hsa_agent()));
+    hsa_agent_t srcAgent = * (static_cast<hsa_agent_t*> (srcPtrInfo._acc.get_hsa_agent()));
+
+    // the engine of the source device starts the transfer
+    this->copyDevice = static_cast<const Kalmar::HSADevice*>(srcPtrInfo._acc.get_dev_ptr());
+
+    std::shared_ptr<PeerCopyScheduler::Transfer> transfer =
+        Kalmar::ctx.getPeerCopyScheduler()->Submit(dst, dstAgent.handle, src, srcAgent.handle, sizeBytes, waitFor, forceStaged);
+    if (transfer == nullptr) {
+        throw Kalmar::runtime_exception("could not allocate the staging buffers of a peer copy", HSA_STATUS_ERROR_OUT_OF_RESOURCES);
+    }
+#if KALMAR_DEBUG
+    std::cerr << "HSACopy:: P2P copy, route=" << ((transfer->GetRoute() == PeerCopyScheduler::RouteDirect) ? "direct" : "staged")
+              << " steps=" << transfer->GetStepCount() << "\n";
+#endif
+    return transfer;
+}
+
 inline hsa_status_t
 HSACopy::enqueueAsyncCopyCommand(Kalmar::HSAQueue* hsaQueue, const Kalmar::HSADevice *copyDevice, const hc::AmPointerInfo &srcPtrInfo, const hc::AmPointerInfo &dstPtrInfo) {
 
@@ -3637,26 +5464,32 @@ HSACopy::enqueueAsyncCopyCommand(Kalmar::HSAQueue* hsaQueue, const Kalmar::HSADe
     }
 
     {
-        // Create a signal to wait for the async copy command to finish.
-        std::pair<hsa_signal_t, int> ret = Kalmar::ctx.getSignal();
-        signal = ret.first;
-        signalIndex = ret.second;
-
-
         int depSignalCnt = 0;
         hsa_signal_t depSignal;
         setCommandKind (resolveMemcpyDirection(srcPtrInfo._isInDeviceMem, dstPtrInfo._isInDeviceMem));
-        depAsyncOp = hsaQueue->detectStreamDeps(this);
+        depAsyncOp = hsaQueue->isOutOfOrder() ? hsaQueue->enqueueDataDeps(Kalmar::HSAQueue::copyAccesses(src, dst))
+                                              : hsaQueue->detectStreamDeps(this);
 
         if (depAsyncOp) {
             depSignalCnt = 1;
-            depSignal = * (static_cast <hsa_signal_t*> (depAsyncOp->getNativeHandle()));
+            depSignal = * (static_cast <hsa_signal_t*> (Kalmar::HSAQueue::waitHandle(depAsyncOp.get())));
 #if KALMAR_DEBUG_ASYNC_COPY
             std::cerr << "  asyncCopy sent with dependency on op#" << depAsyncOp->getSeqNum() << " depSignal="<< std::hex  << depSignal.handle << std::dec <<"\n";
 #endif
         }
 
 
+        if (isPeerCopy(srcPtrInfo, dstPtrInfo, sizeBytes)) {
+            // the transfer may be split and staged through the host, it completes with its last copy
+            peerTransfer = submitPeerCopy(srcPtrInfo, dstPtrInfo, depSignalCnt ? depSignal.handle : 0, false);
+            signal.handle = peerTransfer->GetCompletionEvent();
+            signalIndex = -1;
+        } else {
+            // Create a signal to wait for the async copy command to finish.
+            std::pair<hsa_signal_t, int> ret = Kalmar::ctx.getSignal();
+            signal = ret.first;
+            signalIndex = ret.second;
+
 #if KALMAR_DEBUG_ASYNC_COPY
             hsa_signal_value_t v = hsa_signal_load_acquire(signal);
             std::cerr << "  hsa_amd_memory_async_copy launched " << " completionSignal="<< std::hex  << signal.handle
@@ -3665,7 +5498,8 @@ HSACopy::enqueueAsyncCopyCommand(Kalmar::HSAQueue* hsaQueue, const Kalmar::HSADe
                       << "\n";
 #endif
 
-        hcc_memory_async_copy(copyDevice, dst, src, sizeBytes, depSignalCnt, depSignalCnt ? &depSignal:NULL, signal);
+            hcc_memory_async_copy(copyDevice, dst, src, sizeBytes, depSignalCnt, depSignalCnt ? &depSignal:NULL, signal);
+        }
     }
 
     isSubmitted = true;
@@ -3687,12 +5521,115 @@ HSACopy::enqueueAsyncCopyCommand(Kalmar::HSAQueue* hsaQueue, const Kalmar::HSADe
 
 
 
+inline hsa_status_t
+HSACopy::enqueueAsyncUnpinnedCopyCommand(Kalmar::HSAQueue* hsaQueue, const Kalmar::HSADevice *copyDevice, Kalmar::hcCommandKind copyDir) {
+
+    hsa_status_t status = HSA_STATUS_SUCCESS;
+
+    // record HSAQueue association
+    this->hsaQueue = hsaQueue;
+    this->copyDevice = copyDevice;
+    // extract hsa_queue_t from HSAQueue
+    hsa_queue_t* queue = static_cast<hsa_queue_t*>(hsaQueue->getHSAQueue());
+
+    if (HCC_SERIALIZE_COPY & 0x1) {
+        hsaQueue->wait();
+    }
+
+    if (isSubmitted) {
+        return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+    }
+
+    // The signal is completed by the AsyncCopyThread, so the copy is waited for and
+    // used as a dependency like any other copy.
+    std::pair<hsa_signal_t, int> ret = Kalmar::ctx.getSignal();
+    signal = ret.first;
+    signalIndex = ret.second;
+    isHostCopy = true;
+
+    setCommandKind(copyDir);
+    depAsyncOp = hsaQueue->isOutOfOrder() ? hsaQueue->enqueueDataDeps(Kalmar::HSAQueue::copyAccesses(src, dst))
+                                          : hsaQueue->detectStreamDeps(this);
+
+    AsyncCopyThread::Job job;
+    job.waitFor.handle = 0;
+    if (depAsyncOp) {
+        job.waitFor = * (static_cast <hsa_signal_t*> (Kalmar::HSAQueue::waitHandle(depAsyncOp.get())));
+#if KALMAR_DEBUG_ASYNC_COPY
+        std::cerr << "  unpinned asyncCopy sent with dependency on op#" << depAsyncOp->getSeqNum() << " depSignal="<< std::hex  << job.waitFor.handle << std::dec <<"\n";
+#endif
+    }
+    job.completion = signal;
+    job.copy = [this, copyDir] { runUnpinnedCopy(copyDir); };
+
+    isSubmitted = true;
+    copyDevice->async_copy_thread->Submit(job);
+
+    // dynamically allocate a std::shared_future<void> object
+    future = new std::shared_future<void>(std::async(std::launch::deferred, [&] {
+        waitComplete();
+        if (!hostCopyError.empty()) {
+            throw Kalmar::runtime_exception(hostCopyError.c_str(), HSA_STATUS_ERROR);
+        }
+    }).share());
+
+    if (HCC_SERIALIZE_COPY & 0x2) {
+        status = waitComplete();
+        STATUS_CHECK_Q(status, queue, __LINE__);
+    };
+
+    return status;
+}
+
+
+// Run by the AsyncCopyThread. A failure is recorded in hostCopyError: the signal is
+// completed anyway, so that the commands waiting on it do not hang.
+void
+HSACopy::runUnpinnedCopy(Kalmar::hcCommandKind copyDir) {
+    hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP, &hostBeginTimestamp);
+
+    try {
+        switch (copyDir) {
+            case Kalmar::hcMemcpyHostToDevice:
+                copyDevice->tuneCopyThresholds();
+                copyDevice->copy_engine[0]->CopyHostToDevice(copyDevice->copy_mode, dst, src, sizeBytes, NULL);
+                break;
+
+            case Kalmar::hcMemcpyDeviceToHost: {
+                UnpinnedCopyEngine::CopyMode d2hCopyMode = copyDevice->copy_mode;
+                if (d2hCopyMode == UnpinnedCopyEngine::UseMemcpy) {
+                    // override since D2H does not support Memcpy
+                    d2hCopyMode = UnpinnedCopyEngine::ChooseBest;
+                }
+                copyDevice->tuneCopyThresholds();
+                copyDevice->copy_engine[1]->CopyDeviceToHost(d2hCopyMode, dst, src, sizeBytes, NULL);
+                break;
+            }
+
+            default:
+                // host to host: dependencies are done, the CPU can copy
+                memcpy(dst, src, sizeBytes);
+                break;
+        }
+    } catch (const std::exception &e) {
+        hostCopyError = e.what();
+    }
+
+    hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP, &hostEndTimestamp);
+}
+
+
 inline void
 HSACopy::dispose() {
+    // the signal may also belong to peerTransfer
+    signalHandlers.wait();
 
     // clear reference counts for dependent ops.
     depAsyncOp = nullptr;
 
+    // the transfer is complete, its signals are released
+    peerTransfer = nullptr;
+
 
     // HSA signal may not necessarily be allocated by HSACopy instance
     // only release the signal if it was really allocated (signalIndex >= 0)
@@ -3708,6 +5645,9 @@ HSACopy::dispose() {
 
 inline uint64_t
 HSACopy::getBeginTimestamp() override {
+    if (isHostCopy) {
+        return hostBeginTimestamp;
+    }
     Kalmar::HSADevice* device = static_cast<Kalmar::HSADevice*>(hsaQueue->getDev());
     hsa_amd_profiling_dispatch_time_t time;
     hsa_amd_profiling_get_dispatch_time(device->getAgent(), signal, &time);
@@ -3716,6 +5656,9 @@ HSACopy::getBeginTimestamp() override {
 
 inline uint64_t
 HSACopy::getEndTimestamp() override {
+    if (isHostCopy) {
+        return hostEndTimestamp;
+    }
     Kalmar::HSADevice* device = static_cast<Kalmar::HSADevice*>(hsaQueue->getDev());
     hsa_amd_profiling_dispatch_time_t time;
     hsa_amd_profiling_get_dispatch_time(device->getAgent(), signal, &time);
@@ -3761,6 +5704,7 @@ HSACopy::syncCopyExt(Kalmar::HSAQueue *hsaQueue, hc::hcCommandKind copyDir, cons
                 std::cerr << "HSACopy::syncCopy(), invoke UnpinnedCopyEngine::CopyHostToDevice()\n";
 
 #endif
+                copyDevice->tuneCopyThresholds();
                 copyDevice->copy_engine[0]->CopyHostToDevice(copyDevice->copy_mode, dst, src, sizeBytes, depSignalCnt ? &depSignal : NULL);
                 useFastCopy = false;
             }
@@ -3777,6 +5721,7 @@ HSACopy::syncCopyExt(Kalmar::HSAQueue *hsaQueue, hc::hcCommandKind copyDir, cons
                     // override since D2H does not support Memcpy
                     d2hCopyMode = UnpinnedCopyEngine::ChooseBest;
                 }
+                copyDevice->tuneCopyThresholds();
                 copyDevice->copy_engine[1]->CopyDeviceToHost(d2hCopyMode, dst, src, sizeBytes, depSignalCnt ? &depSignal : NULL);
                 useFastCopy = false;
             };
@@ -3794,15 +5739,13 @@ HSACopy::syncCopyExt(Kalmar::HSAQueue *hsaQueue, hc::hcCommandKind copyDir, cons
             break;
 
         case Kalmar::hcMemcpyDeviceToDevice:
-            if (forceUnpinnedCopy) {
-                hsa_agent_t dstAgent = * (static_cast<hsa_agent_t*> (dstPtrInfo._acc.get_hsa_agent()));
-                hsa_agent_t srcAgent = * (static_cast<hsa_agent_t*> (srcPtrInfo._acc.get_hsa_agent()));
+            if (forceUnpinnedCopy || isPeerCopy(srcPtrInfo, dstPtrInfo, sizeBytes)) {
+                // Between two devices, or when staging is forced: the PeerCopyScheduler copies directly
+                // when one device can access the memory of the other, or else through host staging buffers.
 #if KALMAR_DEBUG
-                std::cerr << "HSACopy:: P2P copy by engine forcing use of staging buffers.  copyEngine=" << copyDevice << "\n";
+                std::cerr << "HSACopy:: P2P copy, forceUnpinnedCopy=" << forceUnpinnedCopy << "\n";
 #endif
-
-                // TODO, which staging buffer should we use for this to be optimal?
-                copyDevice->copy_engine[1]->CopyPeerToPeer(dst, dstAgent, src, srcAgent, sizeBytes, depSignalCnt ? &depSignal : NULL);
+                submitPeerCopy(srcPtrInfo, dstPtrInfo, 0, forceUnpinnedCopy)->Wait();
 
                 useFastCopy = false;
             }
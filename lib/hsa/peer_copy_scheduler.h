@@ -0,0 +1,296 @@
+/*
+Copyright (c) 2015-2016 Advanced Micro Devices, Inc. All rights reserved.
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANNTY OF ANY KIND, EXPRESS OR
+IMPLIED, INNCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANNY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER INN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR INN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef PEER_COPY_SCHEDULER_H
+#define PEER_COPY_SCHEDULER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+//-------------------------------------------------------------------------------------------------
+// Scheduler of the copies between the memory of two devices.  A copy takes one of two routes:
+//  - Direct: the DMA engine of a device which can access the memory of the other copies device to
+//    device.  The engine of the source device is preferred.  With _engines=2, a copy larger than
+//    _splitBytes is split in two parts, the second one copied by the engine of the destination device
+//    when it can access the source memory.
+//  - Staged: when neither device can access the memory of the other (or staging is forced), each chunk
+//    is copied by the engine of the source device to a host staging buffer, then by the engine of the
+//    destination device to the destination.  The staging buffers form a ring shared by all the
+//    transfers, so the copy of a chunk to the host overlaps with the copy of the previous chunks to
+//    the destination.
+//
+// The copies are chained with events, the host never waits between them: a Transfer completes with
+// the event of its last copy, which depends (directly or not) on all the others.
+//
+// The runtime operations are provided by a Runtime, so the scheduler does not depend on HSA.
+// PeerCopyScheduler provides thread-safe access via a mutex.  The ring is allocated by the first staged
+// transfer, and freed by the destructor once its last copies are done.
+class PeerCopyScheduler {
+public:
+    typedef uint64_t AgentId;   // a device and its DMA engine
+    typedef uint64_t EventId;   // completion of an asynchronous copy, 0 is none
+
+    struct Runtime {
+        virtual ~Runtime() {}
+        // true if the DMA engine of agent can access ptr, in the memory of owner
+        virtual bool CanAccess(AgentId agent, AgentId owner, const void* ptr) = 0;
+        // host memory the DMA engines of all the devices can access.  Returns NULL on failure.
+        virtual void* AllocStaging(size_t sizeBytes) = 0;
+        virtual void FreeStaging(void* ptr) = 0;
+        // copy with the engine of copyAgent once the deps have completed, returns the completion event
+        virtual EventId CopyAsync(void* dst, const void* src, size_t sizeBytes, AgentId copyAgent,
+                                  int depCount, const EventId* deps) = 0;
+        virtual void Wait(EventId event) = 0;
+        virtual void Release(EventId event) = 0;
+    };
+
+    enum Route {
+        RouteDirect,
+        RouteStaged
+    };
+
+    // One copy of a transfer, in issue order.
+    struct Step {
+        size_t      offset;     // in the source and the destination
+        size_t      sizeBytes;
+        AgentId     copyAgent;
+        int         chunk;      // index of the part (direct) or of the chunk (staged)
+        bool        toStaging;  // staged: copy from the source to the staging buffer of the chunk
+        bool        fromStaging;// staged: copy from the staging buffer of the chunk to the destination
+    };
+
+private:
+    // An event released once the transfers and the ring slots holding it are gone.
+    class Event {
+    public:
+        Event(Runtime *runtime, EventId id) : _runtime(runtime), _id(id) {}
+        ~Event() { _runtime->Release(_id); }
+        EventId Id() const { return _id; }
+    private:
+        Runtime *_runtime;
+        EventId  _id;
+    };
+
+public:
+    class Transfer {
+    public:
+        Transfer(Runtime *runtime, Route route) : _runtime(runtime), _route(route), _stepCount(0) {}
+
+        // a transfer is complete before its events are released
+        ~Transfer() { Wait(); }
+
+        Route GetRoute() const { return _route; }
+        size_t GetStepCount() const { return _stepCount; }
+
+        // event of the last copy, 0 for an empty transfer
+        EventId GetCompletionEvent() const { return _completion ? _completion->Id() : 0; }
+
+        void Wait() {
+            if (_completion) {
+                _runtime->Wait(_completion->Id());
+            }
+        }
+
+    private:
+        friend class PeerCopyScheduler;
+
+        Runtime                             *_runtime;
+        Route                               _route;
+        size_t                              _stepCount;
+        std::shared_ptr<Event>              _completion;
+        // the events of the copies, and the events of other transfers they depend on
+        std::vector<std::shared_ptr<Event>> _events;
+    };
+
+    PeerCopyScheduler(Runtime *runtime, size_t chunkBytes, int stagingCount, int engines, size_t splitBytes) :
+        _runtime(runtime), _chunkBytes(std::max(chunkBytes, size_t(4096))), _stagingCount(std::max(stagingCount, 2)),
+        _engines(engines), _splitBytes(splitBytes), _nextStaging(0) {}
+
+    ~PeerCopyScheduler() {
+        for (auto &lastUse : _stagingLastUse) {
+            if (lastUse) {
+                _runtime->Wait(lastUse->Id());
+            }
+        }
+        _stagingLastUse.clear();
+        for (auto ptr : _staging) {
+            _runtime->FreeStaging(ptr);
+        }
+    }
+
+    size_t GetChunkBytes() const { return _chunkBytes; }
+
+    // Choose the route of a copy of sizeBytes from src, in the memory of srcAgent, to dst, in the memory
+    // of dstAgent, and fill steps with its copies in issue order.
+    Route Plan(const void *dst, AgentId dstAgent, const void *src, AgentId srcAgent, size_t sizeBytes, bool forceStaged,
+               std::vector<Step> *steps) {
+        steps->clear();
+
+        std::vector<AgentId> engines;
+        if (!forceStaged) {
+            if (_runtime->CanAccess(srcAgent, dstAgent, dst)) {
+                engines.push_back(srcAgent);
+            }
+            if ((dstAgent != srcAgent) && _runtime->CanAccess(dstAgent, srcAgent, src) &&
+                (engines.empty() || ((_engines >= 2) && (sizeBytes > _splitBytes)))) {
+                engines.push_back(dstAgent);
+            }
+        }
+
+        if (!engines.empty()) {
+            // one part per engine, the parts but the last one are multiples of 4KB
+            const size_t parts = engines.size();
+            const size_t partBytes = (sizeBytes / parts) & ~size_t(4095);
+            size_t offset = 0;
+            for (size_t i = 0; (i < parts) && (offset < sizeBytes); ++i) {
+                const size_t bytes = (i + 1 == parts) ? (sizeBytes - offset) : partBytes;
+                if (bytes != 0) {
+                    steps->push_back(Step{offset, bytes, engines[i], int(i), false, false});
+                }
+                offset += bytes;
+            }
+            return RouteDirect;
+        }
+
+        // interleave the two halves of the chunks, so that both engines have work queued
+        int chunk = 0;
+        for (size_t offset = 0; offset < sizeBytes; offset += _chunkBytes, ++chunk) {
+            const size_t bytes = std::min(_chunkBytes, sizeBytes - offset);
+            steps->push_back(Step{offset, bytes, srcAgent, chunk, true, false});
+            steps->push_back(Step{offset, bytes, dstAgent, chunk, false, true});
+        }
+        return RouteStaged;
+    }
+
+    // Copy sizeBytes from src, in the memory of srcAgent, to dst, in the memory of dstAgent, once waitFor
+    // (if not 0) has completed.  Returns NULL if the staging buffers can not be allocated.
+    std::shared_ptr<Transfer> Submit(void *dst, AgentId dstAgent, const void *src, AgentId srcAgent, size_t sizeBytes,
+                                     EventId waitFor = 0, bool forceStaged = false) {
+        std::vector<Step> steps;
+        const Route route = Plan(dst, dstAgent, src, srcAgent, sizeBytes, forceStaged, &steps);
+
+        std::shared_ptr<Transfer> transfer = std::make_shared<Transfer>(_runtime, route);
+        transfer->_stepCount = steps.size();
+
+        std::lock_guard<std::mutex> l(_lock);
+        if ((route == RouteStaged) && !steps.empty() && !AllocRing()) {
+            return nullptr;
+        }
+
+        std::shared_ptr<Event> prevTo, prevFrom, last;
+        std::vector<std::shared_ptr<Event>> parts;
+        const int firstSlot = _nextStaging;
+        for (const Step &step : steps) {
+            EventId deps[3];
+            int depCount = 0;
+            void *stepDst;
+            const void *stepSrc;
+
+            if (route == RouteDirect) {
+                stepDst = static_cast<char*>(dst) + step.offset;
+                stepSrc = static_cast<const char*>(src) + step.offset;
+                if (waitFor) {
+                    deps[depCount++] = waitFor;
+                }
+                // the last part completes the transfer: it joins the others
+                if (&step == &steps.back()) {
+                    for (auto &part : parts) {
+                        deps[depCount++] = part->Id();
+                    }
+                }
+            } else {
+                const int slot = (firstSlot + step.chunk) % _stagingCount;
+                if (step.toStaging) {
+                    stepDst = _staging[slot];
+                    stepSrc = static_cast<const char*>(src) + step.offset;
+                    if (prevTo) {
+                        deps[depCount++] = prevTo->Id();
+                    } else if (waitFor) {
+                        deps[depCount++] = waitFor;
+                    }
+                    // the slot is free once the previous copy from it is done
+                    if (_stagingLastUse[slot]) {
+                        deps[depCount++] = _stagingLastUse[slot]->Id();
+                        transfer->_events.push_back(_stagingLastUse[slot]);
+                    }
+                } else {
+                    stepDst = static_cast<char*>(dst) + step.offset;
+                    stepSrc = _staging[slot];
+                    deps[depCount++] = prevTo->Id();
+                    if (prevFrom) {
+                        deps[depCount++] = prevFrom->Id();
+                    }
+                }
+            }
+
+            EventId id = _runtime->CopyAsync(stepDst, stepSrc, step.sizeBytes, step.copyAgent, depCount, depCount ? deps : NULL);
+            std::shared_ptr<Event> event = std::make_shared<Event>(_runtime, id);
+            transfer->_events.push_back(event);
+            last = event;
+
+            if (route == RouteDirect) {
+                parts.push_back(event);
+            } else if (step.toStaging) {
+                prevTo = event;
+            } else {
+                prevFrom = event;
+                _stagingLastUse[(firstSlot + step.chunk) % _stagingCount] = event;
+            }
+        }
+
+        if (route == RouteStaged) {
+            _nextStaging = (firstSlot + int(steps.size() / 2)) % _stagingCount;
+        }
+        transfer->_completion = last;
+        return transfer;
+    }
+
+private:
+    // Allocate the staging buffers.  Called with _lock held.
+    bool AllocRing() {
+        while (int(_staging.size()) < _stagingCount) {
+            void *ptr = _runtime->AllocStaging(_chunkBytes);
+            if (ptr == NULL) {
+                return false;
+            }
+            _staging.push_back(ptr);
+            _stagingLastUse.push_back(nullptr);
+        }
+        return true;
+    }
+
+    Runtime                             *_runtime;
+    const size_t                        _chunkBytes;    // size of the staged chunks and of the staging buffers
+    const int                           _stagingCount;
+    const int                           _engines;       // engines a direct copy may be spread over
+    const size_t                        _splitBytes;    // direct copies larger than this are split
+
+    std::vector<void*>                  _staging;
+    std::vector<std::shared_ptr<Event>> _stagingLastUse;// last copy from each staging buffer
+    int                                 _nextStaging;   // staging buffer of the next chunk
+
+    std::mutex                          _lock;
+};
+
+#endif
@@ -0,0 +1,214 @@
+/*
+Copyright (c) 2015-2016 Advanced Micro Devices, Inc. All rights reserved.
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANNTY OF ANY KIND, EXPRESS OR
+IMPLIED, INNCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANNY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER INN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR INN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STREAMING_MEMCPY_X86 1
+#else
+#define STREAMING_MEMCPY_X86 0
+#endif
+
+#include "streaming_memcpy.h"
+
+// Copies smaller than this use the libc memcpy: the alignment prologue and the fence do not pay off,
+// and the destination likely stays in the caches anyway.
+#define STREAMING_MEMCPY_MIN_SIZE (16*1024)
+
+
+namespace {
+
+typedef void (*CopyFunc)(char* dst, const char* src, size_t sizeBytes);
+
+void LibcCopy(char* dst, const char* src, size_t sizeBytes)
+{
+    memcpy(dst, src, sizeBytes);
+}
+
+#if STREAMING_MEMCPY_X86
+
+// Copy the bytes before the first align-aligned byte of dst, and return their number.
+inline size_t CopyHead(char* dst, const char* src, size_t sizeBytes, size_t align)
+{
+    size_t head = (align - (reinterpret_cast<uintptr_t>(dst) & (align - 1))) & (align - 1);
+    if (head > sizeBytes) {
+        head = sizeBytes;
+    }
+    memcpy(dst, src, head);
+    return head;
+}
+
+inline bool IsAligned(const char* p, size_t align)
+{
+    return (reinterpret_cast<uintptr_t>(p) & (align - 1)) == 0;
+}
+
+
+// Streaming loads need SSE4.1, so this path only uses non-temporal stores.
+__attribute__((target("sse2")))
+void Sse2Copy(char* dst, const char* src, size_t sizeBytes)
+{
+    size_t head = CopyHead(dst, src, sizeBytes, 16);
+    dst += head;
+    src += head;
+    sizeBytes -= head;
+
+    for (; sizeBytes >= 64; sizeBytes -= 64, src += 64, dst += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+    }
+    _mm_sfence();
+
+    memcpy(dst, src, sizeBytes);
+}
+
+
+__attribute__((target("avx2")))
+void Avx2Copy(char* dst, const char* src, size_t sizeBytes)
+{
+    size_t head = CopyHead(dst, src, sizeBytes, 32);
+    dst += head;
+    src += head;
+    sizeBytes -= head;
+
+    if (IsAligned(src, 32)) {
+        for (; sizeBytes >= 128; sizeBytes -= 128, src += 128, dst += 128) {
+            __m256i a = _mm256_stream_load_si256(reinterpret_cast<__m256i*>(const_cast<char*>(src)));
+            __m256i b = _mm256_stream_load_si256(reinterpret_cast<__m256i*>(const_cast<char*>(src + 32)));
+            __m256i c = _mm256_stream_load_si256(reinterpret_cast<__m256i*>(const_cast<char*>(src + 64)));
+            __m256i d = _mm256_stream_load_si256(reinterpret_cast<__m256i*>(const_cast<char*>(src + 96)));
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), a);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 32), b);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 64), c);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 96), d);
+        }
+    } else {
+        for (; sizeBytes >= 128; sizeBytes -= 128, src += 128, dst += 128) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 64));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 96));
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), a);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 32), b);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 64), c);
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 96), d);
+        }
+    }
+    _mm_sfence();
+
+    memcpy(dst, src, sizeBytes);
+}
+
+
+__attribute__((target("avx512f")))
+void Avx512Copy(char* dst, const char* src, size_t sizeBytes)
+{
+    size_t head = CopyHead(dst, src, sizeBytes, 64);
+    dst += head;
+    src += head;
+    sizeBytes -= head;
+
+    if (IsAligned(src, 64)) {
+        for (; sizeBytes >= 256; sizeBytes -= 256, src += 256, dst += 256) {
+            __m512i a = _mm512_stream_load_si512(const_cast<char*>(src));
+            __m512i b = _mm512_stream_load_si512(const_cast<char*>(src + 64));
+            __m512i c = _mm512_stream_load_si512(const_cast<char*>(src + 128));
+            __m512i d = _mm512_stream_load_si512(const_cast<char*>(src + 192));
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst), a);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 64), b);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 128), c);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 192), d);
+        }
+    } else {
+        for (; sizeBytes >= 256; sizeBytes -= 256, src += 256, dst += 256) {
+            __m512i a = _mm512_loadu_si512(src);
+            __m512i b = _mm512_loadu_si512(src + 64);
+            __m512i c = _mm512_loadu_si512(src + 128);
+            __m512i d = _mm512_loadu_si512(src + 192);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst), a);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 64), b);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 128), c);
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + 192), d);
+        }
+    }
+    _mm_sfence();
+
+    memcpy(dst, src, sizeBytes);
+}
+
+#endif // STREAMING_MEMCPY_X86
+
+
+struct SelectedCopy {
+    CopyFunc    func;
+    const char  *isa;
+
+    SelectedCopy() : func(LibcCopy), isa("libc") {
+        const char *env = getenv("HCC_STREAMING_MEMCPY");
+        if (env && (strtol(env, NULL, 0) == 0)) {
+            return;
+        }
+#if STREAMING_MEMCPY_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            func = Avx512Copy;
+            isa = "avx512";
+        } else if (__builtin_cpu_supports("avx2")) {
+            func = Avx2Copy;
+            isa = "avx2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            func = Sse2Copy;
+            isa = "sse2";
+        }
+#endif
+    }
+};
+
+const SelectedCopy& GetSelectedCopy()
+{
+    static SelectedCopy selected;
+    return selected;
+}
+
+} // namespace
+
+
+void StreamingMemcpy(void* dst, const void* src, size_t sizeBytes)
+{
+    if (sizeBytes < STREAMING_MEMCPY_MIN_SIZE) {
+        memcpy(dst, src, sizeBytes);
+        return;
+    }
+    GetSelectedCopy().func(static_cast<char*>(dst), static_cast<const char*>(src), sizeBytes);
+}
+
+
+const char* StreamingMemcpyIsa()
+{
+    return GetSelectedCopy().isa;
+}
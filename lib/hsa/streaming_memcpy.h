@@ -0,0 +1,41 @@
+/*
+Copyright (c) 2015-2016 Advanced Micro Devices, Inc. All rights reserved.
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANNTY OF ANY KIND, EXPRESS OR
+IMPLIED, INNCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANNY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER INN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR INN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef STREAMING_MEMCPY_H
+#define STREAMING_MEMCPY_H
+
+#include <cstddef>
+
+
+//-------------------------------------------------------------------------------------------------
+// memcpy with non-temporal stores, for destinations the CPU does not read back soon: the staging
+// buffers of the unpinned copies and device memory written through a large BAR.  The stores bypass
+// the caches, so a large copy neither evicts the working set of the application nor reads the
+// destination lines first.  When the source is suitably aligned it is read with streaming loads,
+// which makes reads from write-combined memory (device memory seen through a large BAR) much faster.
+//
+// The widest vector ISA supported by the CPU (AVX-512, AVX2 or SSE2) is selected at the first call.
+// HCC_STREAMING_MEMCPY=0 selects the libc memcpy instead.  Small copies always use the libc memcpy.
+// The stores are fenced before returning.
+void StreamingMemcpy(void* dst, const void* src, size_t sizeBytes);
+
+// Name of the implementation selected by StreamingMemcpy: "avx512", "avx2", "sse2" or "libc".
+const char* StreamingMemcpyIsa();
+
+#endif
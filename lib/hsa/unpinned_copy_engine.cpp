@@ -21,7 +21,16 @@ THE SOFTWARE.
 
 #include <hsa/hsa_ext_amd.h>
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+
 #include "unpinned_copy_engine.h"
+#include "streaming_memcpy.h"
 
 #define THROW_ERROR(err, hsaErr) throw (Kalmar::runtime_exception("HCC unpinned copy engine error", hsaErr))
 #ifdef KALMAR_DEBUG_COPY
@@ -83,18 +92,372 @@ static hsa_status_t find_gpu(hsa_agent_t agent, void *data) {
     return HSA_STATUS_SUCCESS;
 }
 
+//-------------------------------------------------------------------------------------------------
+MemcpyWorkers::MemcpyWorkers(int numThreads) :
+    _dst(NULL),
+    _src(NULL),
+    _sizeBytes(0),
+    _sliceBytes(0),
+    _streaming(false),
+    _generation(0),
+    _pending(0),
+    _exit(false)
+{
+    // slice 0 is copied by the calling thread
+    for (int i=0; i<numThreads; i++) {
+        _threads.push_back(std::thread(&MemcpyWorkers::Run, this, i+1));
+    }
+}
+
+
+MemcpyWorkers::~MemcpyWorkers()
+{
+    {
+        std::lock_guard<std::mutex> l (_lock);
+        _exit = true;
+    }
+    _start.notify_all();
+    for (auto &t : _threads) {
+        t.join();
+    }
+}
+
+
+void MemcpyWorkers::Run(int sliceIndex)
+{
+    uint64_t generation = 0;
+    std::unique_lock<std::mutex> l (_lock);
+    while (true) {
+        _start.wait(l, [&] { return _exit || (_generation != generation); });
+        if (_exit) {
+            return;
+        }
+        generation = _generation;
+
+        const size_t offset = sliceIndex * _sliceBytes;
+        if (offset < _sizeBytes) {
+            const size_t theseBytes = std::min(_sliceBytes, _sizeBytes - offset);
+            char *dst = _dst + offset;
+            const char *src = _src + offset;
+            const bool streaming = _streaming;
+
+            l.unlock();
+            if (streaming) {
+                StreamingMemcpy(dst, src, theseBytes);
+            } else {
+                memcpy(dst, src, theseBytes);
+            }
+            l.lock();
+        }
+
+        if (--_pending == 0) {
+            _done.notify_one();
+        }
+    }
+}
+
+
+void MemcpyWorkers::Copy(void* dst, const void* src, size_t sizeBytes, bool streaming)
+{
+    if (_threads.empty() || (sizeBytes < _minParallelBytes)) {
+        if (streaming) {
+            StreamingMemcpy(dst, src, sizeBytes);
+        } else {
+            memcpy(dst, src, sizeBytes);
+        }
+        return;
+    }
+
+    // cache-line aligned slices, one per thread
+    const size_t slices = _threads.size() + 1;
+    const size_t sliceBytes = ((sizeBytes + slices - 1) / slices + 63) & ~static_cast<size_t> (63);
+    {
+        std::lock_guard<std::mutex> l (_lock);
+        _dst = static_cast<char*> (dst);
+        _src = static_cast<const char*> (src);
+        _sizeBytes = sizeBytes;
+        _sliceBytes = sliceBytes;
+        _streaming = streaming;
+        _pending = _threads.size();
+        ++_generation;
+    }
+    _start.notify_all();
+
+    if (streaming) {
+        StreamingMemcpy(dst, src, std::min(sliceBytes, sizeBytes));
+    } else {
+        memcpy(dst, src, std::min(sliceBytes, sizeBytes));
+    }
+
+    std::unique_lock<std::mutex> l (_lock);
+    _done.wait(l, [&] { return _pending == 0; });
+}
+
+
+//-------------------------------------------------------------------------------------------------
+AsyncCopyThread::AsyncCopyThread() :
+    _exit(false)
+{
+}
+
+
+AsyncCopyThread::~AsyncCopyThread()
+{
+    {
+        std::lock_guard<std::mutex> l (_lock);
+        _exit = true;
+    }
+    _wake.notify_one();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+
+void AsyncCopyThread::Submit(const Job &job)
+{
+    {
+        std::lock_guard<std::mutex> l (_lock);
+        if (!_thread.joinable()) {
+            _thread = std::thread(&AsyncCopyThread::Run, this);
+        }
+        _jobs.push_back(job);
+    }
+    _wake.notify_one();
+}
+
+
+void AsyncCopyThread::Run()
+{
+    std::unique_lock<std::mutex> l (_lock);
+    while (true) {
+        // drain the pending copies before exiting, their completion signals are waited for
+        _wake.wait(l, [&] { return _exit || !_jobs.empty(); });
+        if (_jobs.empty()) {
+            return;
+        }
+        Job job = _jobs.front();
+        _jobs.pop_front();
+        l.unlock();
+
+        if (job.waitFor.handle != 0) {
+            hsa_signal_wait_acquire(job.waitFor, HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, HSA_WAIT_STATE_BLOCKED);
+        }
+
+        job.copy();
+
+        // the copy may be destroyed as soon as its signal is stored: do not touch it after
+        hsa_signal_store_screlease(job.completion, 0);
+        l.lock();
+    }
+}
+
+
+//-------------------------------------------------------------------------------------------------
+struct PinnedHostCache::Entry {
+    uintptr_t   base;       // page-aligned start of the pinned range
+    size_t      size;       // whole pages
+    char        *devBase;   // device address of base
+    int         users;      // copies using the range right now
+    bool        cached;     // false once removed from the cache; unpinned by the last Release
+    std::list<Entry*>::iterator lruPos;
+};
+
+
+PinnedHostCache::PinnedHostCache(const std::vector<hsa_agent_t> &agents, size_t budgetBytes) :
+    _agents(agents),
+    _budgetBytes(budgetBytes),
+    _pageSize(sysconf(_SC_PAGESIZE)),
+    _pinnedBytes(0),
+    _hits(0),
+    _misses(0),
+    _evictions(0)
+{
+}
+
+
+PinnedHostCache::~PinnedHostCache()
+{
+    std::lock_guard<std::mutex> l (_cacheLock);
+
+    tprintf (DB_COPY2, "PinnedHostCache: hits=%lu misses=%lu evictions=%lu pinnedBytes=%zu\n", _hits, _misses, _evictions, _pinnedBytes);
+    while (!_entries.empty()) {
+        Entry *entry = _entries.begin()->second;
+        Remove(entry);
+        Unpin(entry);
+    }
+}
+
+
+//---
+// Take entry out of the lookup structures.  The range stays pinned.
+void PinnedHostCache::Remove(Entry *entry)
+{
+    _entries.erase(entry->base);
+    _lru.erase(entry->lruPos);
+    _pinnedBytes -= entry->size;
+    entry->cached = false;
+}
+
+
+void PinnedHostCache::Unpin(Entry *entry)
+{
+    hsa_amd_memory_unlock(reinterpret_cast<void*> (entry->base));
+    delete entry;
+}
+
+
+PinnedHostCache::Entry *PinnedHostCache::Acquire(const void *ptr, size_t sizeBytes, void **devPtr)
+{
+    if ((_budgetBytes == 0) || (sizeBytes == 0)) {
+        return NULL;
+    }
+
+    const uintptr_t pageMask = ~static_cast<uintptr_t> (_pageSize - 1);
+    const uintptr_t p = reinterpret_cast<uintptr_t> (ptr);
+    const uintptr_t base = p & pageMask;
+    const uintptr_t end = (p + sizeBytes + _pageSize - 1) & pageMask;
+    const size_t size = end - base;
+
+    std::lock_guard<std::mutex> l (_cacheLock);
+
+    // Hit: a cached range holds the whole copy.
+    auto it = _entries.upper_bound(base);
+    if (it != _entries.begin()) {
+        Entry *entry = std::prev(it)->second;
+        if (end <= entry->base + entry->size) {
+            ++_hits;
+            ++entry->users;
+            _lru.splice(_lru.begin(), _lru, entry->lruPos);
+            *devPtr = entry->devBase + (p - entry->base);
+            return entry;
+        }
+        if (entry->base + entry->size > base) {
+            --it;
+        }
+    }
+    ++_misses;
+
+    // Memory can not be pinned twice: the cached ranges overlapping this one are dropped.
+    std::vector<Entry*> overlapping;
+    for (; (it != _entries.end()) && (it->first < end); ++it) {
+        if (it->second->users) {
+            return NULL;
+        }
+        overlapping.push_back(it->second);
+    }
+    for (auto entry : overlapping) {
+        Remove(entry);
+        Unpin(entry);
+    }
+
+    if (size > _budgetBytes) {
+        return NULL;
+    }
+
+    // Make room by unpinning the least recently used ranges.
+    std::vector<Entry*> victims;
+    size_t freedBytes = 0;
+    for (auto lit = _lru.rbegin(); (lit != _lru.rend()) && (_pinnedBytes - freedBytes + size > _budgetBytes); ++lit) {
+        if ((*lit)->users == 0) {
+            victims.push_back(*lit);
+            freedBytes += (*lit)->size;
+        }
+    }
+    if (_pinnedBytes - freedBytes + size > _budgetBytes) {
+        return NULL;
+    }
+    for (auto entry : victims) {
+        Remove(entry);
+        Unpin(entry);
+        ++_evictions;
+    }
+
+    void *devBase = NULL;
+    hsa_status_t hsa_status = hsa_amd_memory_lock(reinterpret_cast<void*> (base), size, _agents.data(), _agents.size(), &devBase);
+    tprintf (DB_COPY2, "PinnedHostCache: pin %p+%zu status=%x\n", reinterpret_cast<void*> (base), size, hsa_status);
+    if (hsa_status != HSA_STATUS_SUCCESS) {
+        // Let the caller pin the exact range and report the error.
+        return NULL;
+    }
+
+    Entry *entry = new Entry;
+    entry->base = base;
+    entry->size = size;
+    entry->devBase = static_cast<char*> (devBase);
+    entry->users = 1;
+    entry->cached = true;
+    _lru.push_front(entry);
+    entry->lruPos = _lru.begin();
+    _entries[base] = entry;
+    _pinnedBytes += size;
+
+    *devPtr = entry->devBase + (p - base);
+    return entry;
+}
+
+
+void PinnedHostCache::Release(Entry *entry)
+{
+    std::lock_guard<std::mutex> l (_cacheLock);
+
+    if ((--entry->users == 0) && !entry->cached) {
+        Unpin(entry);
+    }
+}
+
+
+void PinnedHostCache::Invalidate(const void *ptr, size_t sizeBytes)
+{
+    const uintptr_t p = reinterpret_cast<uintptr_t> (ptr);
+    const uintptr_t end = p + sizeBytes;
+
+    std::lock_guard<std::mutex> l (_cacheLock);
+
+    std::vector<Entry*> overlapping;
+    auto it = _entries.upper_bound(p);
+    if ((it != _entries.begin()) && (std::prev(it)->second->base + std::prev(it)->second->size > p)) {
+        --it;
+    }
+    for (; (it != _entries.end()) && (it->first < end); ++it) {
+        overlapping.push_back(it->second);
+    }
+    for (auto entry : overlapping) {
+        Remove(entry);
+        // A range still in use is unpinned when its copy is done.
+        if (entry->users == 0) {
+            Unpin(entry);
+        }
+    }
+}
+
+
+void PinnedHostCache::GetStats(uint64_t *hits, uint64_t *misses, uint64_t *evictions, size_t *pinnedBytes)
+{
+    std::lock_guard<std::mutex> l (_cacheLock);
+
+    *hits = _hits;
+    *misses = _misses;
+    *evictions = _evictions;
+    *pinnedBytes = _pinnedBytes;
+}
+
+
 //-------------------------------------------------------------------------------------------------
 UnpinnedCopyEngine::UnpinnedCopyEngine(hsa_agent_t hsaAgent, hsa_agent_t cpuAgent, size_t bufferSize, int numBuffers, 
                                        bool isLargeBar, int thresholdH2DDirectStaging, 
-                                       int thresholdH2DStagingPinInPlace, int thresholdD2H) :
+                                       int thresholdH2DStagingPinInPlace, int thresholdD2H,
+                                       PinnedHostCache *pinCache, int numCopyThreads) :
     _hsaAgent(hsaAgent),
     _cpuAgent(cpuAgent),
     _bufferSize(bufferSize),
     _numBuffers(numBuffers > _max_buffers ? _max_buffers : numBuffers),
     _isLargeBar(isLargeBar),
+    _memcpyWorkers(numCopyThreads),
     _hipH2DTransferThresholdDirectOrStaging(thresholdH2DDirectStaging),
     _hipH2DTransferThresholdStagingOrPininplace(thresholdH2DStagingPinInPlace),
-    _hipD2HTransferThreshold(thresholdD2H)
+    _hipD2HTransferThreshold(thresholdD2H),
+    _pinCache(pinCache)
 {
     hsa_amd_memory_pool_t sys_pool;
     hsa_status_t err = hsa_amd_agent_iterate_memory_pools(_cpuAgent, findGlobalPool, &sys_pool);
@@ -176,8 +539,12 @@ void UnpinnedCopyEngine::CopyHostToDevicePinInPlace(void* dst, const void* src,
 
     //void * masked_srcp = (void*) ((uintptr_t)srcp & (uintptr_t)(~0x3f)) ; // TODO
     void *locked_srcp;
-    //hsa_status_t hsa_status = hsa_amd_memory_lock(masked_srcp, theseBytes, &_hsaAgent, 1, &locked_srcp);
-    hsa_status_t hsa_status = hsa_amd_memory_lock(const_cast<char*> (srcp), theseBytes, &_hsaAgent, 1, &locked_srcp);
+    hsa_status_t hsa_status = HSA_STATUS_SUCCESS;
+    PinnedHostCache::Entry *pinned = _pinCache ? _pinCache->Acquire(srcp, theseBytes, &locked_srcp) : NULL;
+    if (pinned == NULL) {
+        //hsa_status_t hsa_status = hsa_amd_memory_lock(masked_srcp, theseBytes, &_hsaAgent, 1, &locked_srcp);
+        hsa_status = hsa_amd_memory_lock(const_cast<char*> (srcp), theseBytes, &_hsaAgent, 1, &locked_srcp);
+    }
     //tprintf (DB_COPY2, "H2D: bytesRemaining=%zu: pin-in-place:%p+%zu bufferIndex[%d]\n", bytesRemaining, srcp, theseBytes, bufferIndex);
     //printf ("status=%x srcp=%p, masked_srcp=%p, locked_srcp=%p\n", hsa_status, srcp, masked_srcp, locked_srcp);
 
@@ -195,12 +562,133 @@ void UnpinnedCopyEngine::CopyHostToDevicePinInPlace(void* dst, const void* src,
     }
     tprintf (DB_COPY2, "H2D: waiting... on completion signal handle=%lu\n", _completionSignal[bufferIndex].handle);
     hsa_signal_wait_acquire(_completionSignal[bufferIndex], HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, HSA_WAIT_STATE_ACTIVE);
-    hsa_amd_memory_unlock(const_cast<char*> (srcp));
+    if (pinned) {
+        _pinCache->Release(pinned);
+    } else {
+        hsa_amd_memory_unlock(const_cast<char*> (srcp));
+    }
     // Assume subsequent commands are dependent on previous and don't need dependency after first copy submitted, HIP_ONESHOT_COPY_DEP=1
     waitFor = NULL;
 }
 
 
+//---
+size_t UnpinnedCopyEngine::StagingChunkSize(size_t sizeBytes) const
+{
+    // Spread the copy over all the staging buffers, in whole pages.
+    size_t chunk = (sizeBytes + _numBuffers - 1) / _numBuffers;
+    chunk = (chunk + 4095) & ~static_cast<size_t> (4095);
+    if (chunk < _minChunkSize) {
+        chunk = _minChunkSize;
+    }
+    return std::min(chunk, _bufferSize);
+}
+
+
+//---
+// Best time of a few runs of copy, in seconds.
+static double timeCopy(const std::function<void()> &copy)
+{
+    double best = std::numeric_limits<double>::max();
+    for (int i=0; i<3; i++) {
+        auto start = std::chrono::steady_clock::now();
+        copy();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+
+// Size from which copies with timeB are faster than copies with timeA, at every measured size
+// from there on.  Lies between two measured sizes, half-way on a log scale.
+static size_t crossover(const std::vector<size_t> &sizes, const std::vector<double> &timeA, const std::vector<double> &timeB)
+{
+    size_t i = sizes.size();
+    while ((i > 0) && (timeB[i-1] <= timeA[i-1])) {
+        i--;
+    }
+
+    if (i == 0) {
+        return sizes[0] / 2;
+    } else if (i == sizes.size()) {
+        // B never wins
+        return std::numeric_limits<size_t>::max() / 2;
+    } else {
+        return static_cast<size_t> (sqrt(static_cast<double> (sizes[i-1]) * sizes[i]));
+    }
+}
+
+
+void UnpinnedCopyEngine::CalibrateThresholds(void* deviceBuffer, size_t maxBytes)
+{
+    char *host = static_cast<char*> (malloc(maxBytes));
+    if (host == NULL) {
+        return;
+    }
+    memset(host, 0, maxBytes);
+
+    std::vector<size_t> sizes;
+    std::vector<double> h2dMemcpy, h2dStaging, h2dPinInPlace, d2hStaging, d2hPinInPlace;
+    for (size_t sizeBytes = 16*1024; sizeBytes <= maxBytes; sizeBytes *= 4) {
+        sizes.push_back(sizeBytes);
+
+        // Pin-in-place is measured without the pinned-host cache: the cost of pinning is what
+        // the thresholds have to account for.
+        auto unpin = [&] {
+            if (_pinCache) {
+                _pinCache->Invalidate(host, maxBytes);
+            }
+        };
+
+        if (_isLargeBar) {
+            h2dMemcpy.push_back(timeCopy([&] { CopyHostToDeviceMemcpy(deviceBuffer, host, sizeBytes, NULL); }));
+        }
+        h2dStaging.push_back(timeCopy([&] { CopyHostToDeviceStaging(deviceBuffer, host, sizeBytes, NULL); }));
+        h2dPinInPlace.push_back(timeCopy([&] { unpin(); CopyHostToDevicePinInPlace(deviceBuffer, host, sizeBytes, NULL); }));
+        d2hStaging.push_back(timeCopy([&] { CopyDeviceToHostStaging(host, deviceBuffer, sizeBytes, NULL); }));
+        d2hPinInPlace.push_back(timeCopy([&] { unpin(); CopyDeviceToHostPinInPlace(host, deviceBuffer, sizeBytes, NULL); }));
+        unpin();
+    }
+    free(host);
+
+    if (sizes.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> l (_copyLock);
+    if (_isLargeBar) {
+        // memcpy is used below the threshold
+        _hipH2DTransferThresholdDirectOrStaging = crossover(sizes, h2dMemcpy, h2dStaging);
+    }
+    _hipH2DTransferThresholdStagingOrPininplace = crossover(sizes, h2dStaging, h2dPinInPlace);
+    _hipD2HTransferThreshold = crossover(sizes, d2hStaging, d2hPinInPlace);
+
+    tprintf (DB_COPY2, "Calibrated thresholds: H2D direct/staging=%zu H2D staging/pin-in-place=%zu D2H=%zu\n",
+             _hipH2DTransferThresholdDirectOrStaging, _hipH2DTransferThresholdStagingOrPininplace, _hipD2HTransferThreshold);
+}
+
+
+void UnpinnedCopyEngine::GetThresholds(size_t *thresholdH2DDirectStaging, size_t *thresholdH2DStagingPinInPlace, size_t *thresholdD2H)
+{
+    std::lock_guard<std::mutex> l (_copyLock);
+
+    *thresholdH2DDirectStaging = _hipH2DTransferThresholdDirectOrStaging;
+    *thresholdH2DStagingPinInPlace = _hipH2DTransferThresholdStagingOrPininplace;
+    *thresholdD2H = _hipD2HTransferThreshold;
+}
+
+
+void UnpinnedCopyEngine::SetThresholds(size_t thresholdH2DDirectStaging, size_t thresholdH2DStagingPinInPlace, size_t thresholdD2H)
+{
+    std::lock_guard<std::mutex> l (_copyLock);
+
+    _hipH2DTransferThresholdDirectOrStaging = thresholdH2DDirectStaging;
+    _hipH2DTransferThresholdStagingOrPininplace = thresholdH2DStagingPinInPlace;
+    _hipD2HTransferThreshold = thresholdD2H;
+}
+
+
 // Copy using simple memcpy.  Only works on large-bar systems.
 void UnpinnedCopyEngine::CopyHostToDeviceMemcpy(void* dst, const void* src, size_t sizeBytes, hsa_signal_t *waitFor)
 {
@@ -208,7 +696,8 @@ void UnpinnedCopyEngine::CopyHostToDeviceMemcpy(void* dst, const void* src, size
         THROW_ERROR (hipErrorInvalidValue, HSA_STATUS_ERROR_INVALID_ARGUMENT);
     }
 
-    memcpy(dst,src,sizeBytes);
+    // Device memory is write-combined through the BAR: non-temporal stores fill whole lines.
+    StreamingMemcpy(dst,src,sizeBytes);
     std::atomic_thread_fence(std::memory_order_release);
 };
 
@@ -262,17 +751,20 @@ void UnpinnedCopyEngine::CopyHostToDeviceStaging(void* dst, const void* src, siz
         if (sizeBytes >= UINT64_MAX/2) {
             THROW_ERROR (hipErrorInvalidValue, HSA_STATUS_ERROR_INVALID_ARGUMENT);
         }
+        const size_t chunkSize = StagingChunkSize(sizeBytes);
+        const hsa_wait_state_t waitState = StagingWaitState(chunkSize);
+
         int bufferIndex = 0;
-        for (int64_t bytesRemaining=sizeBytes; bytesRemaining>0 ;  bytesRemaining -= _bufferSize) {
+        for (int64_t bytesRemaining=sizeBytes; bytesRemaining>0 ;  bytesRemaining -= chunkSize) {
 
-            size_t theseBytes = (bytesRemaining > _bufferSize) ? _bufferSize : bytesRemaining;
+            size_t theseBytes = (bytesRemaining > chunkSize) ? chunkSize : bytesRemaining;
 
             tprintf (DB_COPY2, "H2D: waiting... on completion signal handle=%lu\n", _completionSignal[bufferIndex].handle);
-            hsa_signal_wait_acquire(_completionSignal[bufferIndex], HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, HSA_WAIT_STATE_ACTIVE);
+            hsa_signal_wait_acquire(_completionSignal[bufferIndex], HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, waitState);
 
             tprintf (DB_COPY2, "H2D: bytesRemaining=%zu: copy %zu bytes %p to stagingBuf[%d]:%p\n", bytesRemaining, theseBytes, srcp, bufferIndex, _pinnedStagingBuffer[bufferIndex]);
-            // TODO - use uncached memcpy, someday.
-            memcpy(_pinnedStagingBuffer[bufferIndex], srcp, theseBytes);
+            // The staging buffer is only read by the DMA engine: bypass the caches.
+            _memcpyWorkers.Copy(_pinnedStagingBuffer[bufferIndex], srcp, theseBytes, true);
 
 
             hsa_signal_store_relaxed(_completionSignal[bufferIndex], 1);
@@ -294,7 +786,7 @@ void UnpinnedCopyEngine::CopyHostToDeviceStaging(void* dst, const void* src, siz
 
 
         for (int i=0; i<_numBuffers; i++) {
-            hsa_signal_wait_acquire(_completionSignal[i], HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, HSA_WAIT_STATE_ACTIVE);
+            hsa_signal_wait_acquire(_completionSignal[i], HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, waitState);
         }
 	}
 }
@@ -318,7 +810,11 @@ void UnpinnedCopyEngine::CopyDeviceToHostPinInPlace(void* dst, const void* src,
     size_t theseBytes= sizeBytes;
     void *locked_destp;
 
-    hsa_status_t hsa_status = hsa_amd_memory_lock(const_cast<char*> (dstp), theseBytes, &_hsaAgent, 1, &locked_destp);
+    hsa_status_t hsa_status = HSA_STATUS_SUCCESS;
+    PinnedHostCache::Entry *pinned = _pinCache ? _pinCache->Acquire(dstp, theseBytes, &locked_destp) : NULL;
+    if (pinned == NULL) {
+        hsa_status = hsa_amd_memory_lock(const_cast<char*> (dstp), theseBytes, &_hsaAgent, 1, &locked_destp);
+    }
 
 
     if (hsa_status != HSA_STATUS_SUCCESS) {
@@ -334,7 +830,11 @@ void UnpinnedCopyEngine::CopyDeviceToHostPinInPlace(void* dst, const void* src,
     }
     tprintf (DB_COPY2, "D2H: waiting... on completion signal handle=%lu\n", _completionSignal[bufferIndex].handle);
     hsa_signal_wait_acquire(_completionSignal[bufferIndex], HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, HSA_WAIT_STATE_ACTIVE);
-    hsa_amd_memory_unlock(const_cast<char*> (dstp));
+    if (pinned) {
+        _pinCache->Release(pinned);
+    } else {
+        hsa_amd_memory_unlock(const_cast<char*> (dstp));
+    }
 
     // Assume subsequent commands are dependent on previous and don't need dependency after first copy submitted, HIP_ONESHOT_COPY_DEP=1
     waitFor = NULL;
@@ -383,15 +883,18 @@ void UnpinnedCopyEngine::CopyDeviceToHostStaging(void* dst, const void* src, siz
             THROW_ERROR (hipErrorInvalidValue, HSA_STATUS_ERROR_INVALID_ARGUMENT);
         }
 
+        const size_t chunkSize = StagingChunkSize(sizeBytes);
+        const hsa_wait_state_t waitState = StagingWaitState(chunkSize);
+
         int64_t bytesRemaining0 = sizeBytes; // bytes to copy from dest into staging buffer.
         int64_t bytesRemaining1 = sizeBytes; // bytes to copy from staging buffer into final dest
 
         while (bytesRemaining1 > 0)
         {
             // First launch the async copies to copy from dest to host
-            for (int bufferIndex = 0; (bytesRemaining0>0) && (bufferIndex < _numBuffers);  bytesRemaining0 -= _bufferSize, bufferIndex++) {
+            for (int bufferIndex = 0; (bytesRemaining0>0) && (bufferIndex < _numBuffers);  bytesRemaining0 -= chunkSize, bufferIndex++) {
 
-                size_t theseBytes = (bytesRemaining0 > _bufferSize) ? _bufferSize : bytesRemaining0;
+                size_t theseBytes = (bytesRemaining0 > chunkSize) ? chunkSize : bytesRemaining0;
 
                 tprintf (DB_COPY2, "D2H: bytesRemaining0=%zu  async_copy %zu bytes src:%p to staging:%p\n", bytesRemaining0, theseBytes, srcp0, _pinnedStagingBuffer[bufferIndex]);
                 hsa_signal_store_relaxed(_completionSignal[bufferIndex], 1);
@@ -408,15 +911,15 @@ void UnpinnedCopyEngine::CopyDeviceToHostStaging(void* dst, const void* src, siz
             }
 
             // Now unload the staging buffers:
-            for (int bufferIndex=0; (bytesRemaining1>0) && (bufferIndex < _numBuffers);  bytesRemaining1 -= _bufferSize, bufferIndex++) {
+            for (int bufferIndex=0; (bytesRemaining1>0) && (bufferIndex < _numBuffers);  bytesRemaining1 -= chunkSize, bufferIndex++) {
 
-                size_t theseBytes = (bytesRemaining1 > _bufferSize) ? _bufferSize : bytesRemaining1;
+                size_t theseBytes = (bytesRemaining1 > chunkSize) ? chunkSize : bytesRemaining1;
 
                 tprintf (DB_COPY2, "D2H: wait_completion[%d] bytesRemaining=%zu\n", bufferIndex, bytesRemaining1);
-                hsa_signal_wait_acquire(_completionSignal[bufferIndex], HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, HSA_WAIT_STATE_ACTIVE);
+                hsa_signal_wait_acquire(_completionSignal[bufferIndex], HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX, waitState);
 
                 tprintf (DB_COPY2, "D2H: bytesRemaining1=%zu copy %zu bytes stagingBuf[%d]:%p to dst:%p\n", bytesRemaining1, theseBytes, bufferIndex, _pinnedStagingBuffer[bufferIndex], dstp1);
-                memcpy(dstp1, _pinnedStagingBuffer[bufferIndex], theseBytes);
+                _memcpyWorkers.Copy(dstp1, _pinnedStagingBuffer[bufferIndex], theseBytes);
 
                 dstp1 += theseBytes;
             }
@@ -23,28 +23,168 @@ THE SOFTWARE.
 
 #include "hsa/hsa.h"
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//-------------------------------------------------------------------------------------------------
+// Pool of threads splitting a large memcpy into slices copied in parallel, used to fill and drain
+// the staging buffers faster than a single CPU core can.  The calling thread copies one slice too.
+// Not thread-safe: used under the lock of its UnpinnedCopyEngine.
+class MemcpyWorkers {
+public:
+    // Copies smaller than this are done by the calling thread alone.
+    static const size_t _minParallelBytes = 256*1024;
+
+    MemcpyWorkers(int numThreads);
+    ~MemcpyWorkers();
+
+    // streaming: copy with StreamingMemcpy, for destinations the CPU does not read back
+    void Copy(void* dst, const void* src, size_t sizeBytes, bool streaming = false);
+
+private:
+    void Run(int sliceIndex);
+
+    std::vector<std::thread>    _threads;
+    std::mutex                  _lock;
+    std::condition_variable     _start;
+    std::condition_variable     _done;
+
+    // current copy
+    char                        *_dst;
+    const char                  *_src;
+    size_t                      _sizeBytes;
+    size_t                      _sliceBytes;
+    bool                        _streaming;
+    uint64_t                    _generation;
+    int                         _pending;   // slices not copied yet by the threads
+    bool                        _exit;
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// Thread running unpinned copies in the background, so that an asynchronous copy from or to
+// memory which is not tracked does not block the thread submitting it.  Copies run one at a
+// time in submission order.  Each copy starts once its dependency signal (if any) drops
+// below 1, and stores 0 to its completion signal when done, like the DMA engines do for
+// the copies of pinned memory.  The thread is started by the first copy.
+//
+// AsyncCopyThread provides thread-safe access via a mutex.
+class AsyncCopyThread {
+public:
+    struct Job {
+        std::function<void()>   copy;        // must not throw: errors are reported through the op
+        hsa_signal_t            waitFor;     // handle 0 for none
+        hsa_signal_t            completion;
+    };
+
+    AsyncCopyThread();
+    ~AsyncCopyThread();
+
+    void Submit(const Job &job);
+
+private:
+    void Run();
+
+    std::thread                 _thread;
+    std::mutex                  _lock;
+    std::condition_variable     _wake;
+    std::deque<Job>             _jobs;
+    bool                        _exit;
+};
+
+
+//-------------------------------------------------------------------------------------------------
+// LRU cache of the host ranges pinned by the pin-in-place copies.
+// Pinning (hsa_amd_memory_lock) and unpinning host memory is expensive, and applications
+// commonly copy from and to the same host buffers over and over. Ranges are rounded to
+// whole pages and pinned for every GPU agent, so one entry serves the copy engines of all
+// the devices.  The total size of the pinned ranges is limited to a budget: the least
+// recently used ranges are unpinned to make room, except the ones still used by a copy.
+//
+// The cache can not see host memory being freed: Invalidate must be called before a range
+// which has been copied is unmapped or given back to the OS.
+//
+// PinnedHostCache provides thread-safe access via a mutex.
+class PinnedHostCache {
+public:
+    struct Entry;
+
+    PinnedHostCache(const std::vector<hsa_agent_t> &agents, size_t budgetBytes);
+    ~PinnedHostCache();
+
+    // Pin host range [ptr, ptr+sizeBytes) or find it in the cache, and return the entry
+    // holding it.  *devPtr receives the device address of ptr.
+    // Returns NULL if the range can not be cached (cache disabled, larger than the budget,
+    // or overlapping with a range in use): the caller pins it by itself.
+    Entry *Acquire(const void *ptr, size_t sizeBytes, void **devPtr);
+
+    // Done with an entry returned by Acquire.
+    void Release(Entry *entry);
+
+    // Unpin the cached ranges overlapping [ptr, ptr+sizeBytes).
+    void Invalidate(const void *ptr, size_t sizeBytes);
+
+    void GetStats(uint64_t *hits, uint64_t *misses, uint64_t *evictions, size_t *pinnedBytes);
+
+private:
+    void Unpin(Entry *entry);
+    void Remove(Entry *entry);
+
+    std::vector<hsa_agent_t>        _agents;
+    size_t                          _budgetBytes;
+    size_t                          _pageSize;
+
+    std::map<uintptr_t, Entry*>     _entries;   // by start address of the range
+    std::list<Entry*>               _lru;       // most recently used first
+    size_t                          _pinnedBytes;
+
+    uint64_t                        _hits;
+    uint64_t                        _misses;
+    uint64_t                        _evictions;
+
+    std::mutex                      _cacheLock;
+};
+
 
 //-------------------------------------------------------------------------------------------------
 // An optimized "staging buffer" used to implement Host-To-Device and Device-To-Host copies.
 // Some GPUs may not be able to directly access host memory, and in these cases we need to
 // stage the copy through a pinned staging buffer.  For example, the CopyHostToDevice
 // uses the CPU to copy to a pinned "staging buffer", and then use the GPU DMA engine to copy
-// from the staging buffer to the final destination.  The copy is broken into buffer-sized chunks
+// from the staging buffer to the final destination.  The copy is broken into chunks
 // to limit the size of the buffer and also to provide better performance by overlapping the CPU copies
-// with the DMA copies.
+// with the DMA copies.  The chunk size adapts to the size of the copy: small copies use small chunks so
+// the first DMA starts early, large copies use whole staging buffers to amortize the cost of each chunk.
+// The CPU copies of large chunks are split over several threads (MemcpyWorkers).
 //
 // PinInPlace is another algorithm which pins the host memory "in-place", and copies it with the DMA
-// engine.  This routine is under development.
+// engine.  The pinned ranges are kept in a PinnedHostCache so repeated copies of the same host
+// buffers skip the pinning.
 //
 // Staging buffer provides thread-safe access via a mutex.
 struct UnpinnedCopyEngine {
 
     enum CopyMode {ChooseBest=0, UsePinInPlace=1, UseStaging=2, UseMemcpy=3} ; 
 
-    static const int _max_buffers = 4;
+    static const int _max_buffers = 8;
+
+    // Smallest chunk of a staged copy.
+    static const size_t _minChunkSize = 64*1024;
+
+    // Chunks from this size on are waited for with a blocking wait rather than a spin.
+    static const size_t _blockedWaitChunkSize = 1024*1024;
 
     UnpinnedCopyEngine(hsa_agent_t hsaAgent,hsa_agent_t cpuAgent, size_t bufferSize, int numBuffers, 
-                       bool isLargeBar, int thresholdH2D_directStaging, int thresholdH2D_stagingPinInPlace, int thresholdD2H) ;
+                       bool isLargeBar, int thresholdH2D_directStaging, int thresholdH2D_stagingPinInPlace, int thresholdD2H,
+                       PinnedHostCache *pinCache = NULL, int numCopyThreads = 0) ;
     ~UnpinnedCopyEngine();
 
     // Use hueristic to choose best copy algorithm 
@@ -63,11 +203,26 @@ struct UnpinnedCopyEngine {
     void CopyDeviceToHostPinInPlace(void* dst, const void* src, size_t sizeBytes, hsa_signal_t *waitFor);
 
 
+    // Measure the copy modes at several sizes up to maxBytes, between deviceBuffer and a host
+    // buffer, and set the ChooseBest thresholds to the sizes where the faster mode changes.
+    void CalibrateThresholds(void* deviceBuffer, size_t maxBytes);
+
+    void GetThresholds(size_t *thresholdH2DDirectStaging, size_t *thresholdH2DStagingPinInPlace, size_t *thresholdD2H);
+    void SetThresholds(size_t thresholdH2DDirectStaging, size_t thresholdH2DStagingPinInPlace, size_t thresholdD2H);
+
+
     // P2P Copy implementation:
     void CopyPeerToPeer( void* dst, hsa_agent_t dstAgent, const void* src, hsa_agent_t srcAgent, size_t sizeBytes, hsa_signal_t *waitFor);
 
 
 private:
+    // Chunk size of a staged copy of sizeBytes.
+    size_t StagingChunkSize(size_t sizeBytes) const;
+
+    hsa_wait_state_t StagingWaitState(size_t chunkBytes) const {
+        return (chunkBytes >= _blockedWaitChunkSize) ? HSA_WAIT_STATE_BLOCKED : HSA_WAIT_STATE_ACTIVE;
+    }
+
     hsa_agent_t     _hsaAgent;
     hsa_agent_t     _cpuAgent;
     size_t          _bufferSize;  // Size of the buffers.
@@ -80,9 +235,13 @@ private:
     hsa_signal_t     _completionSignal[_max_buffers];
     hsa_signal_t     _completionSignal2[_max_buffers]; // P2P needs another set of signals.
     std::mutex       _copyLock;    // provide thread-safe access
+    MemcpyWorkers    _memcpyWorkers;
     size_t              _hipH2DTransferThresholdDirectOrStaging;
     size_t              _hipH2DTransferThresholdStagingOrPininplace;
     size_t              _hipD2HTransferThreshold;
+
+    // Ranges pinned by the pin-in-place copies, shared by all the engines.  May be NULL.
+    PinnedHostCache     *_pinCache;
 };
 
 #endif
@@ -0,0 +1,71 @@
+// RUN: %hc %s -o %t.out -lhc_am && %t.out
+// RUN: env HCC_UNPINNED_COPY_MODE=2 %t.out
+//
+// Test asynchronous copies from and to host memory which is not pinned: they are run
+// in the background, ordered with the other commands of the accelerator_view.
+//
+#include <stdlib.h>
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+bool test(hc::accelerator &acc)
+{
+    bool ret = true;
+
+    const size_t N = 4 * 1024 * 1024 + 17;
+    const size_t Nbytes = N * sizeof(int);
+
+    hc::accelerator_view av = acc.create_view(hc::execute_in_order);
+
+    int *hostA = static_cast<int*> (malloc(Nbytes));
+    int *hostB = static_cast<int*> (malloc(Nbytes));
+    int *hostC = static_cast<int*> (malloc(Nbytes));
+    int *devA = hc::am_alloc(Nbytes, acc, 0);
+    int *devB = hc::am_alloc(Nbytes, acc, 0);
+
+    for (size_t i = 0; i < N; i++) {
+        hostA[i] = i;
+        hostB[i] = -1;
+        hostC[i] = -1;
+    }
+
+    // H2D, kernel, D2H and H2H chained on the accelerator_view
+    hc::completion_future h2d = av.copy_async(hostA, devA, Nbytes);
+    hc::completion_future pfe = hc::parallel_for_each(av, hc::extent<1>(N), [=](hc::index<1> idx) [[hc]] {
+        devB[idx[0]] = devA[idx[0]] * 2;
+    });
+    hc::completion_future d2h = av.copy_async(devB, hostB, Nbytes);
+    hc::completion_future h2h = av.copy_async(hostB, hostC, Nbytes);
+
+    h2h.wait();
+    ret &= h2d.is_ready() && pfe.is_ready() && d2h.is_ready();
+    ret &= (h2d.get_begin_tick() <= h2d.get_end_tick());
+
+    for (size_t i = 0; i < N; i++) {
+        if ((hostB[i] != static_cast<int> (i * 2)) || (hostC[i] != hostB[i])) {
+            ret = false;
+            break;
+        }
+    }
+
+    hc::am_free(devA);
+    hc::am_free(devB);
+    free(hostA);
+    free(hostB);
+    free(hostC);
+
+    return ret;
+}
+
+int main()
+{
+    bool ret = true;
+
+    hc::accelerator acc;
+    if (acc.is_hsa_accelerator()) {
+        ret &= test(acc);
+    }
+
+    return !(ret == true);
+}
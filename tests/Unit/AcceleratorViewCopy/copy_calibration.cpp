@@ -0,0 +1,78 @@
+// RUN: %hc %s -o %t.out -lhc_am
+// RUN: rm -f %t.thresholds
+// RUN: env HCC_COPY_CALIBRATION=2 HCC_COPY_CALIBRATION_FILE=%t.thresholds %t.out %t.thresholds
+// RUN: env HCC_COPY_CALIBRATION=1 HCC_COPY_CALIBRATION_FILE=%t.thresholds %t.out %t.thresholds
+//
+// Test the calibration of the thresholds of the unpinned copy modes: the first unpinned copy
+// measures the copy modes and saves the thresholds, copies of all sizes are still correct.
+//
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+bool test(hc::accelerator &acc, const char *thresholdFile)
+{
+    bool ret = true;
+
+    hc::accelerator_view av = acc.get_default_view();
+
+    const size_t maxBytes = 8 * 1024 * 1024;
+    std::vector<char> host(maxBytes);
+    std::vector<char> result(maxBytes);
+    char *dev = hc::am_alloc(maxBytes, acc, 0);
+
+    for (size_t sizeBytes = 1024; sizeBytes <= maxBytes; sizeBytes *= 8) {
+        for (size_t i = 0; i < sizeBytes; i++) {
+            host[i] = static_cast<char>(i + sizeBytes);
+        }
+        av.copy(host.data(), dev, sizeBytes);
+        av.copy(dev, result.data(), sizeBytes);
+        for (size_t i = 0; i < sizeBytes; i++) {
+            if (result[i] != host[i]) {
+                ret = false;
+                break;
+            }
+        }
+    }
+
+    hc::invalidate_host_pin_cache(host.data(), maxBytes);
+    hc::invalidate_host_pin_cache(result.data(), maxBytes);
+    hc::am_free(dev);
+
+    // one line for the device: <device> <3 thresholds>
+    std::wstring path = acc.get_device_path();
+    std::string key(path.begin(), path.end());
+    std::ifstream in(thresholdFile);
+    std::string line;
+    bool found = false;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string device;
+        size_t thresholds[3];
+        if ((fields >> device >> thresholds[0] >> thresholds[1] >> thresholds[2]) && (device == key)) {
+            found = true;
+        }
+    }
+    ret &= found;
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    bool ret = true;
+
+    // calibration only applies when the copy mode is chosen by the runtime
+    hc::accelerator acc;
+    if (acc.is_hsa_accelerator() && (argc > 1) && getenv("HCC_UNPINNED_COPY_MODE") == nullptr) {
+        ret &= test(acc, argv[1]);
+    }
+
+    return !(ret == true);
+}
@@ -0,0 +1,89 @@
+// RUN: %hc %s -o %t.out -lhc_am && env HCC_PINNED_CACHE_SIZE=256 %t.out
+//
+// Test the cache of host memory pinned by the pin-in-place copies: repeated copies
+// from and to the same unpinned host buffer only pin it once.
+//
+#include <stdlib.h>
+
+#include <vector>
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+bool test(hc::accelerator &acc)
+{
+    bool ret = true;
+
+    // large enough to be copied in-place by the default copy mode
+    const size_t N = 4 * 1024 * 1024;
+    const size_t Nbytes = N * sizeof(int);
+
+    hc::accelerator_view av = acc.get_default_view();
+
+    int *host = static_cast<int*> (malloc(Nbytes));
+    int *dev = hc::am_alloc(Nbytes, acc, 0);
+
+    uint64_t hits0, misses0, evictions0;
+    size_t pinnedBytes0;
+    hc::get_host_pin_cache_stats(&hits0, &misses0, &evictions0, &pinnedBytes0);
+
+    const int iterations = 4;
+    for (int i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < N; j++) {
+            host[j] = i + j;
+        }
+        av.copy(host, dev, Nbytes);
+
+        for (size_t j = 0; j < N; j++) {
+            host[j] = -1;
+        }
+        av.copy(dev, host, Nbytes);
+
+        for (size_t j = 0; j < N; j++) {
+            if (host[j] != i + j) {
+                ret = false;
+                break;
+            }
+        }
+    }
+
+    uint64_t hits, misses, evictions;
+    size_t pinnedBytes;
+    hc::get_host_pin_cache_stats(&hits, &misses, &evictions, &pinnedBytes);
+
+    // the host buffer has been pinned by the first copy only
+    ret &= (misses - misses0 == 1);
+    ret &= (hits - hits0 == 2 * iterations - 1);
+    ret &= (pinnedBytes >= Nbytes);
+
+    // once invalidated the buffer has to be pinned again
+    hc::invalidate_host_pin_cache(host, Nbytes);
+    hc::get_host_pin_cache_stats(&hits, &misses, &evictions, &pinnedBytes);
+    ret &= (pinnedBytes == pinnedBytes0);
+
+    av.copy(host, dev, Nbytes);
+    hc::get_host_pin_cache_stats(&hits, &misses, &evictions, &pinnedBytes);
+    ret &= (misses - misses0 == 2);
+
+    hc::invalidate_host_pin_cache(host, Nbytes);
+    hc::am_free(dev);
+    free(host);
+
+    return ret;
+}
+
+int main()
+{
+    bool ret = true;
+
+    // the cache is only used when the copy mode is chosen by the runtime,
+    // and is disabled by default
+    hc::accelerator acc;
+    const char* cacheSize = getenv("HCC_PINNED_CACHE_SIZE");
+    if (acc.is_hsa_accelerator() && getenv("HCC_UNPINNED_COPY_MODE") == nullptr &&
+        cacheSize != nullptr && atoi(cacheSize) > 0) {
+        ret &= test(acc);
+    }
+
+    return !(ret == true);
+}
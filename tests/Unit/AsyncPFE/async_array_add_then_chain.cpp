@@ -0,0 +1,96 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <iostream>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+#include <hc.hpp>
+
+// test chaining of completion_future::then()
+// each continuation returns a completion_future which can be chained again,
+// waited on, or used as the dependency of a marker
+bool test() {
+  const int vecSize = 1024;
+  const int chainLength = 64;
+
+  hc::array_view<int, 1> av(vecSize);
+  hc::completion_future fut = hc::parallel_for_each(
+    av.get_extent(),
+    [=](hc::index<1> idx) restrict(amp) {
+      av[idx] = idx[0];
+  });
+
+  // build a long chain of continuations; each one must observe all the
+  // previous ones
+  std::atomic<int> counter(0);
+  bool ordered = true;
+  hc::completion_future last = fut;
+  for (int i = 0; i < chainLength; ++i) {
+    last = last.then([=, &counter, &ordered] {
+      if (counter.fetch_add(1) != i) {
+        ordered = false;
+      }
+    });
+  }
+
+  // several continuations on the same future
+  std::atomic<int> fanout(0);
+  std::vector<hc::completion_future> branches;
+  for (int i = 0; i < 8; ++i) {
+    branches.push_back(fut.then([&fanout] { fanout++; }));
+  }
+
+  last.wait();
+  for (auto& b : branches) {
+    b.wait();
+  }
+
+  bool ret = ordered && (counter == chainLength) && (fanout == 8);
+
+  // exceptions thrown by a continuation are rethrown by get()
+  hc::completion_future failed = fut.then([] {
+    throw std::runtime_error("continuation failed");
+  });
+  bool caught = false;
+  try {
+    failed.get();
+  } catch (const std::runtime_error&) {
+    caught = true;
+  }
+  ret &= caught;
+
+  // a continuation can be used as the dependency of a marker
+  hc::accelerator_view accView = hc::accelerator().get_default_view();
+  std::atomic<bool> flag(false);
+  hc::completion_future cont = fut.then([&flag] { flag = true; });
+  hc::completion_future marker = accView.create_blocking_marker(cont);
+  marker.wait();
+  ret &= flag.load();
+
+  // then() on an invalid completion_future never calls the functor
+  hc::completion_future empty;
+  bool called = false;
+  hc::completion_future none = empty.then([&called] { called = true; });
+  ret &= !none.valid() && !called;
+
+  // verify the kernel result
+  for (int i = 0; i < vecSize; ++i) {
+    if (av[i] != i) {
+      ret = false;
+      break;
+    }
+  }
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (acc.is_hsa_accelerator()) {
+    ret &= test();
+  }
+
+  return !(ret == true);
+}
@@ -16,8 +16,10 @@
 ///
 /// The test case only works on HSA because it directly uses HSA runtime API
 /// It would use completion_future::get_native_handle() to retrieve the
-/// underlying hsa_signal_t data structure to query if dependent kernels have
-/// really finished execution before the new kernel is executed.
+/// underlying hsa_signal_t data structure to query if kernels have finished
+/// execution, and the profiling ticks of the kernels to check that dependent
+/// kernels have really finished execution before the new kernel is executed.
+/// The host does not block on the dependencies.
 ///
 template<size_t grid_size, size_t tile_size>
 bool test1D() {
@@ -89,8 +91,6 @@ bool test1D() {
   std::cout << "signal value #1: " << signal_value1 << "\n";
   std::cout << "signal value #2: " << signal_value2 << "\n";
 #endif
-  // signal_value1 MUST be 0 because the new kernel must wait on the previous one be completed
-  ret &= (signal_value1 == 0);
 
 #if TEST_DEBUG
   std::cout << "launch pfe3\n";
@@ -118,8 +118,6 @@ bool test1D() {
   std::cout << "signal value #2: " << signal_value2 << "\n";
   std::cout << "signal value #3: " << signal_value3 << "\n";
 #endif
-  // signal_value2 MUST be 0 because the new kernel must wait on the previous one be completed
-  ret &= (signal_value2 == 0);
 
   // wait on all kernels to be finished
   hc::accelerator().get_default_view().wait();
@@ -139,6 +137,10 @@ bool test1D() {
   // signal_value3 MUST be 0 because all kernels are finished at this point
   ret &= (signal_value3 == 0);
 
+  // the device must have executed the kernels in dependency order
+  ret &= (fut1.get_end_tick() <= fut2.get_begin_tick());
+  ret &= (fut2.get_end_tick() <= fut3.get_begin_tick());
+
 #define SHOW_CONTENT_1D(str,av,table) \
   { \
     std::cout << str << "\n"; \
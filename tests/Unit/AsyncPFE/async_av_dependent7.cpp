@@ -83,9 +83,9 @@ bool test1D() {
   std::cout << "after pfe3\n";
 #endif
 
-  // now there must be 1 pending async operations for the accelerator_view
-  // pfe1 and pfe2 must be completed by now
-  ret &= (hc::accelerator().get_default_view().get_pending_async_ops() == 1);
+  // the host does not wait for pfe1 and pfe2 before dispatching pfe3, the
+  // device orders pfe3 after them. So up to 3 async operations may be pending
+  ret &= (hc::accelerator().get_default_view().get_pending_async_ops() <= 3);
 
   // for this test case we deliberately NOT wait on kernels
   // we want to check when array_view instances go to destruction
@@ -0,0 +1,92 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+
+#include <vector>
+
+// loop to deliberately slow down kernel execution
+#define LOOP_COUNT (1024)
+
+/// test implicit synchronization of array_view and kernel dispatches on an
+/// accelerator_view which executes commands in any order
+///
+/// kernel dispatch packets carry no barrier bit there, so the dependencies
+/// through array_view instances are enforced by barrier packets enqueued by
+/// the runtime. The profiling ticks of the kernels are used to check that
+/// dependent kernels have really finished execution before the new kernel is
+/// executed.
+template<size_t grid_size>
+bool test1D() {
+
+  bool ret = true;
+
+  // dependency graph
+  // pfe1: av1 + av2 -> av3
+  // pfe2: av3 + av2 -> av1
+  // pfe3: av1 * 2   -> av3
+  // pfe2 depends on pfe1 (reads av3 written by pfe1)
+  // pfe3 depends on pfe2 (reads av1 written by pfe2, writes av3 read by pfe2)
+
+  std::vector<int> table1(grid_size);
+  std::vector<int> table2(grid_size);
+  std::vector<int> table3(grid_size);
+
+  for (int i = 0; i < grid_size; ++i) {
+    table1[i] = i;
+    table2[i] = i;
+  }
+
+  hc::accelerator_view accView = hc::accelerator().create_view(hc::execute_any_order);
+
+  hc::array_view<int, 1> av1(grid_size, table1);
+  hc::array_view<const int, 1> av2(grid_size, table2);
+  hc::array_view<int, 1> av3(grid_size, table3);
+
+  hc::completion_future fut1 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) restrict(amp) {
+    // av3 = i * 2
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av3(idx) = av1(idx) + av2(idx);
+  });
+
+  hc::completion_future fut2 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) restrict(amp) {
+    // av1 = i * 3
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av1(idx) = av3(idx) + av2(idx);
+  });
+
+  hc::completion_future fut3 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) restrict(amp) {
+    // av3 = i * 6
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av3(idx) = av1(idx) * 2;
+  });
+
+  accView.wait();
+
+  // the device must have executed the kernels in dependency order
+  ret &= (fut1.get_end_tick() <= fut2.get_begin_tick());
+  ret &= (fut2.get_end_tick() <= fut3.get_begin_tick());
+
+  av1.synchronize();
+  av3.synchronize();
+  for (int i = 0; i < grid_size; ++i) {
+    if (av1[i] != i * 3 || av3[i] != i * 6) {
+      ret = false;
+      break;
+    }
+  }
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (acc.is_hsa_accelerator()) {
+    ret &= test1D<32>();
+    ret &= test1D<256>();
+    ret &= test1D<1024>();
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,68 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+#include <vector>
+
+/// test a long stream of asynchronous kernel dispatches on one queue
+///
+/// many more kernels are dispatched than commands can be in flight on a
+/// queue, so completed ones have to be retired while new ones are pushed.
+/// Some of the completion_future objects are kept, some are dropped.
+bool test() {
+  const int vecSize = 256;
+  const int kernelCount = 4096;
+
+  hc::accelerator acc;
+  hc::accelerator_view av = acc.create_view();
+
+  int* data = hc::am_alloc(sizeof(int) * vecSize, acc, 0);
+  std::vector<int> host(vecSize, 0);
+  av.copy(host.data(), data, sizeof(int) * vecSize);
+
+  std::vector<hc::completion_future> kept;
+  for (int i = 0; i < kernelCount; ++i) {
+    hc::completion_future fut = hc::parallel_for_each(av, hc::extent<1>(vecSize), [=](hc::index<1> idx) [[hc]] {
+      data[idx[0]] += 1;
+    });
+    if (i % 97 == 0) {
+      kept.push_back(fut);
+    }
+    // waiting on a future in the middle of the stream must not disturb the
+    // bookkeeping of the younger ones
+    if (i % 1000 == 500) {
+      fut.wait();
+    }
+  }
+
+  bool ret = true;
+
+  // futures of kernels which have been retired are still usable
+  for (auto& f : kept) {
+    f.wait();
+    ret &= f.is_ready();
+  }
+
+  av.wait();
+  ret &= (av.get_pending_async_ops() == 0);
+
+  av.copy(data, host.data(), sizeof(int) * vecSize);
+  for (int i = 0; i < vecSize; ++i) {
+    ret &= (host[i] == kernelCount);
+  }
+
+  hc::am_free(data);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (acc.is_hsa_accelerator()) {
+    ret &= test();
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,87 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+#include <vector>
+
+/// test a long stream of asynchronous kernel dispatches on one queue, mixing
+/// kernels with a completion signal and batched kernels which have none until
+/// their batch is published
+///
+/// many more kernels are dispatched than commands can be in flight on a
+/// queue. Ops without a signal must neither block the retirement of the
+/// younger ones nor be waited on before they are published.
+bool test() {
+  const int vecSize = 256;
+  const int roundCount = 512;
+
+  hc::accelerator acc;
+  hc::accelerator_view av = acc.create_view();
+
+  int* data = hc::am_alloc(sizeof(int) * vecSize, acc, 0);
+  std::vector<int> host(vecSize, 0);
+  av.copy(host.data(), data, sizeof(int) * vecSize);
+
+  auto increment = [&]() {
+    return hc::parallel_for_each(av, hc::extent<1>(vecSize), [=](hc::index<1> idx) [[hc]] {
+      data[idx[0]] += 1;
+    });
+  };
+
+  std::vector<hc::completion_future> kept;
+  int kernelCount = 0;
+  for (int i = 0; i < roundCount; ++i) {
+    // a kernel with its own signal
+    hc::completion_future fut = increment();
+    ++kernelCount;
+
+    // a batch of kernels, which stays open while the queue is asked about
+    // its pending ops, then is published
+    av.begin_batch();
+    for (int j = 0; j < i % 5; ++j) {
+      hc::completion_future batched = increment();
+      ++kernelCount;
+      if (j == 0 && i % 61 == 0) {
+        kept.push_back(batched);
+      }
+    }
+    if (i % 3 == 0) {
+      av.get_pending_async_ops();
+    }
+    av.end_batch();
+
+    if (i % 97 == 0) {
+      kept.push_back(fut);
+    }
+  }
+
+  bool ret = true;
+
+  for (auto& f : kept) {
+    f.wait();
+    ret &= f.is_ready();
+  }
+
+  av.wait();
+  ret &= (av.get_pending_async_ops() == 0);
+
+  av.copy(data, host.data(), sizeof(int) * vecSize);
+  for (int i = 0; i < vecSize; ++i) {
+    ret &= (host[i] == kernelCount);
+  }
+
+  hc::am_free(data);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (acc.is_hsa_accelerator()) {
+    ret &= test();
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,190 @@
+// RUN: %hc %s -I%S/../../../lib/hsa -o %t.out && %t.out
+
+#include "am_alloc_cache.h"
+
+#include <stdlib.h>
+
+#include <map>
+#include <set>
+
+// test the caching sub-allocator of am_alloc against a stub backend,
+// no accelerator is used
+class StubBackend : public AmAllocCache::Backend {
+public:
+  void* Allocate(uint64_t key, size_t sizeBytes) override {
+    if (failNext) {
+      failNext = false;
+      return NULL;
+    }
+    void* ptr = malloc(sizeBytes);
+    live[ptr] = key;
+    allocations++;
+    return ptr;
+  }
+  void Free(uint64_t key, void* ptr) override {
+    if (live.count(ptr) == 0 || live[ptr] != key) {
+      errors++;
+    }
+    live.erase(ptr);
+    free(ptr);
+  }
+
+  std::map<void*, uint64_t> live;
+  int allocations = 0;
+  int errors = 0;
+  bool failNext = false;
+};
+
+bool test_size_classes() {
+  bool ret = true;
+  ret &= (AmAllocCache::SizeClass(1) == 256);
+  ret &= (AmAllocCache::SizeClass(256) == 256);
+  ret &= (AmAllocCache::SizeClass(257) == 320);
+  ret &= (AmAllocCache::SizeClass(1000) == 1024);
+  ret &= (AmAllocCache::SizeClass(1025) == 1280);
+  for (size_t size = 1; size < 64 * 1024 * 1024; size = size * 3 + 1) {
+    size_t c = AmAllocCache::SizeClass(size);
+    ret &= (c >= size) && (c <= size + size / 4 + 256);
+  }
+  return ret;
+}
+
+bool test_reuse() {
+  bool ret = true;
+  StubBackend backend;
+  {
+    AmAllocCache cache(&backend, 1024 * 1024);
+    AmAllocCache::Stats stats;
+
+    // same size class and key: the block is reused
+    bool fresh;
+    void* p1 = cache.Allocate(0, 1000, &fresh);
+    ret &= fresh;
+    ret &= cache.Free(p1);
+    void* p2 = cache.Allocate(0, 900, &fresh);
+    ret &= !fresh && (p2 == p1);
+
+    // another key (device or memory pool) never shares blocks
+    void* p3 = cache.Allocate(1, 1000);
+    ret &= (p3 != p1);
+
+    cache.GetStats(&stats);
+    ret &= (stats.hits == 1) && (stats.misses == 2);
+    ret &= (stats.inUseBytes == 2048) && (stats.cachedBytes == 0);
+
+    // pointers not allocated by the cache are refused
+    int local;
+    ret &= !cache.Free(&local);
+
+    ret &= cache.Free(p2) && cache.Free(p3);
+    cache.GetStats(&stats);
+    ret &= (stats.cachedBytes == 2048) && (stats.inUseBytes == 0);
+
+    // trim gives the blocks back
+    ret &= (cache.Trim(0) == 2048);
+    ret &= backend.live.empty();
+  }
+  ret &= (backend.errors == 0);
+  return ret;
+}
+
+bool test_budget_and_large() {
+  bool ret = true;
+  StubBackend backend;
+  {
+    AmAllocCache cache(&backend, 4096);
+    void* p[4];
+    for (int i = 0; i < 4; ++i) {
+      p[i] = cache.Allocate(0, 2048);
+    }
+    for (int i = 0; i < 4; ++i) {
+      cache.Free(p[i]);
+    }
+    // two blocks fit in the budget, the others went back to the backend
+    AmAllocCache::Stats stats;
+    cache.GetStats(&stats);
+    ret &= (stats.cachedBytes == 4096) && (backend.live.size() == 2);
+
+    // blocks too large to be cached are freed right away
+    void* large = cache.Allocate(0, AmAllocCache::_maxCachedBytes + 1);
+    ret &= (large != NULL) && cache.Free(large);
+    ret &= (backend.live.size() == 2);
+
+    // a failed allocation trims the cache and retries
+    backend.failNext = true;
+    void* retry = cache.Allocate(0, 100000);
+    ret &= (retry != NULL);
+    cache.GetStats(&stats);
+    ret &= (stats.cachedBytes == 0);
+    cache.Discard(retry);
+  }
+  // the destructor releases the cached blocks
+  ret &= backend.live.empty() && (backend.errors == 0);
+  return ret;
+}
+
+bool test_async_free() {
+  bool ret = true;
+  StubBackend backend;
+  {
+    AmAllocCache cache(&backend, 1024 * 1024);
+    bool done = false;
+    void* p1 = cache.Allocate(0, 4096);
+    ret &= cache.FreeAsync(p1, [&done]() { return done; });
+
+    // the block is not reused while its work is pending
+    AmAllocCache::Stats stats;
+    cache.GetStats(&stats);
+    ret &= (stats.pendingBytes == 4096) && (stats.cachedBytes == 0);
+    void* p2 = cache.Allocate(0, 4096);
+    ret &= (p2 != p1);
+
+    done = true;
+    void* p3 = cache.Allocate(0, 4096);
+    ret &= (p3 == p1);
+    cache.GetStats(&stats);
+    ret &= (stats.pendingBytes == 0);
+
+    cache.Free(p2);
+    cache.Free(p3);
+  }
+  ret &= backend.live.empty() && (backend.errors == 0);
+  return ret;
+}
+
+bool test_async_free_budget() {
+  bool ret = true;
+  StubBackend backend;
+  {
+    AmAllocCache cache(&backend, 4096);
+    bool done = false;
+    void* p[4];
+    for (int i = 0; i < 4; ++i) {
+      p[i] = cache.Allocate(0, 2048);
+    }
+    for (int i = 0; i < 4; ++i) {
+      ret &= cache.FreeAsync(p[i], [&done]() { return done; });
+    }
+
+    // once ready, two blocks fit in the budget, the others go back to the backend
+    done = true;
+    AmAllocCache::Stats stats;
+    cache.GetStats(&stats);
+    ret &= (stats.pendingBytes == 0) && (stats.cachedBytes == 4096);
+    ret &= (backend.live.size() == 2);
+  }
+  ret &= backend.live.empty() && (backend.errors == 0);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test_size_classes();
+  ret &= test_reuse();
+  ret &= test_budget_and_large();
+  ret &= test_async_free();
+  ret &= test_async_free_budget();
+
+  return !(ret == true);
+}
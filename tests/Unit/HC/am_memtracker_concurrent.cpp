@@ -0,0 +1,85 @@
+// RUN: %hc %s -o %t.out -lhc_am -pthread && %t.out
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// test lookups of the memory tracker from several threads while other
+// threads allocate and free memory: tracked pointers must always be found
+// with their own size, interior pointers included
+#define NUM_READERS (8)
+#define NUM_WRITERS (2)
+#define ITERATIONS (2000)
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+
+  // ranges which stay tracked during the whole test, more than the tracker
+  // keeps in one chunk
+  const int numStable = 1024;
+  auto stableSize = [](int i) { return size_t(i % 64 + 1) * 4096; };
+  std::vector<char*> stable;
+  for (int i = 0; i < numStable; ++i) {
+    stable.push_back(hc::am_alloc(stableSize(i), acc, 0));
+    if (stable.back() == nullptr) {
+      return 1;
+    }
+  }
+
+  std::atomic<bool> failed(false);
+  std::atomic<bool> done(false);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_READERS; ++t) {
+    threads.push_back(std::thread([&, t] {
+      hc::AmPointerInfo info(nullptr, nullptr, 0, acc, false, false);
+      for (int it = 0; !done.load(); ++it) {
+        int i = (it + t) % numStable;
+        char* ptr = stable[i] + (it % stableSize(i));
+        if (hc::am_memtracker_getinfo(&info, ptr) != AM_SUCCESS ||
+            info._devicePointer != stable[i] || info._sizeBytes != stableSize(i)) {
+          failed = true;
+        }
+      }
+    }));
+  }
+
+  std::vector<std::thread> writers;
+  for (int t = 0; t < NUM_WRITERS; ++t) {
+    writers.push_back(std::thread([&] {
+      hc::AmPointerInfo info(nullptr, nullptr, 0, acc, false, false);
+      for (int it = 0; it < ITERATIONS; ++it) {
+        char* ptr = hc::am_alloc(256, acc, 0);
+        if (hc::am_memtracker_getinfo(&info, ptr + 255) != AM_SUCCESS || info._sizeBytes != 256) {
+          failed = true;
+        }
+        if (hc::am_memtracker_update(ptr, it, 0) != AM_SUCCESS ||
+            hc::am_memtracker_getinfo(&info, ptr) != AM_SUCCESS || info._appId != it) {
+          failed = true;
+        }
+        hc::am_free(ptr);
+      }
+    }));
+  }
+
+  for (auto& w : writers) {
+    w.join();
+  }
+  done = true;
+  for (auto& r : threads) {
+    r.join();
+  }
+
+  ret &= !failed.load();
+
+  for (auto ptr : stable) {
+    ret &= (hc::am_free(ptr) == AM_SUCCESS);
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,77 @@
+// RUN: %hc %s -o %t.out -lhc_am && rm -f %t.json && env HCC_AM_PROFILE_THRESHOLD=1048576 %t.out %t.json
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+#include <fstream>
+#include <string>
+
+// test the memory usage totals of the tracker, and the JSON lines dump of
+// the ranges sampled by the allocation profiler
+int main(int argc, char *argv[]) {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (!acc.is_hsa_accelerator() || argc < 2) {
+    return 0;
+  }
+
+  hc::AmMemoryUsage before, usage;
+  hc::am_memtracker_usage(acc, &before);
+
+  const size_t small = 4096;
+  const size_t large = 4 * 1024 * 1024;
+  char* d1 = hc::am_alloc(small, acc, 0);
+  char* d2 = hc::am_alloc(large, acc, 0);
+  char* h1 = hc::am_alloc(small, acc, amHostPinned);
+
+  hc::am_memtracker_usage(acc, &usage);
+  ret &= (usage.deviceBytes - before.deviceBytes == small + large);
+  ret &= (usage.deviceCount - before.deviceCount == 2);
+  ret &= (usage.hostBytes - before.hostBytes == small);
+  ret &= (usage.devicePeakBytes >= usage.deviceBytes);
+
+  // totals by appId follow am_memtracker_update
+  size_t bytes, count;
+  hc::am_memtracker_update(d1, 1234, 0);
+  hc::am_memtracker_update(d2, 1234, 0);
+  hc::am_memtracker_app_usage(acc, 1234, &bytes, &count);
+  ret &= (bytes == small + large) && (count == 2);
+
+  // am_memtracker_sizeinfo reports the same totals
+  size_t deviceMemSize, hostMemSize, userMemSize;
+  hc::am_memtracker_sizeinfo(acc, &deviceMemSize, &hostMemSize, &userMemSize);
+  ret &= (deviceMemSize == usage.deviceBytes) && (hostMemSize == usage.hostBytes);
+
+  // only the large allocation is sampled
+  ret &= (hc::am_memtracker_dump(argv[1]) == AM_SUCCESS);
+  std::ifstream in(argv[1]);
+  std::string line;
+  int samples = 0, usages = 0, apps = 0;
+  while (std::getline(in, line)) {
+    if (line.find("\"type\":\"sample\"") != std::string::npos) {
+      samples++;
+      ret &= (line.find("\"sizeBytes\":4194304") != std::string::npos);
+      ret &= (line.find("\"stack\":[\"") != std::string::npos);
+    } else if (line.find("\"type\":\"usage\"") != std::string::npos) {
+      usages++;
+    } else if (line.find("\"type\":\"app\"") != std::string::npos &&
+               line.find("\"appId\":1234") != std::string::npos) {
+      apps++;
+    }
+  }
+  ret &= (samples == 1) && (usages >= 1) && (apps == 1);
+
+  hc::am_free(d1);
+  hc::am_free(d2);
+  hc::am_free(h1);
+
+  // the peak is kept after the frees
+  hc::am_memtracker_usage(acc, &usage);
+  ret &= (usage.deviceBytes == before.deviceBytes) && (usage.hostBytes == before.hostBytes);
+  ret &= (usage.devicePeakBytes >= before.deviceBytes + small + large);
+  hc::am_memtracker_app_usage(acc, 1234, &bytes, &count);
+  ret &= (bytes == 0) && (count == 0);
+
+  return !(ret == true);
+}
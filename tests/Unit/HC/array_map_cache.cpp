@@ -0,0 +1,87 @@
+// RUN: %hc %s -o %t.out && %t.out
+// RUN: env HCC_MAP_CACHE_SIZE=0 %t.out
+
+#include <hc.hpp>
+
+#include <vector>
+
+// test copies between host containers and an array, which map the array:
+// mappings reuse a host shadow buffer, which must follow the writes of the
+// kernels, of copies and of other mappings, also through the raw pointer of
+// the array
+template<size_t grid_size>
+bool test() {
+  bool ret = true;
+
+  hc::array<int, 1> array(grid_size);
+  std::vector<int> input(grid_size);
+  std::vector<int> output(grid_size);
+
+  for (int iteration = 0; iteration < 4; ++iteration) {
+    for (int i = 0; i < grid_size; ++i) {
+      input[i] = i + iteration;
+    }
+    hc::copy(input.begin(), input.end(), array);
+
+    // read twice: the second mapping is in sync with the device
+    for (int read = 0; read < 2; ++read) {
+      hc::copy(array, output.begin());
+      for (int i = 0; i < grid_size; ++i) {
+        if (output[i] != i + iteration) {
+          ret = false;
+          break;
+        }
+      }
+    }
+
+    // a kernel writing the array makes the shadow buffer stale
+    hc::parallel_for_each(hc::extent<1>(grid_size), [&array](hc::index<1> idx) [[hc]] {
+      array[idx] *= 2;
+    }).wait();
+    hc::copy(array, output.begin());
+    for (int i = 0; i < grid_size; ++i) {
+      if (output[i] != (i + iteration) * 2) {
+        ret = false;
+        break;
+      }
+    }
+
+    // a part of the array written through a mapping of a section
+    std::vector<int> half(grid_size / 2, -iteration);
+    hc::array_view<int, 1> section = array.section(hc::index<1>(grid_size / 2), hc::extent<1>(grid_size / 2));
+    hc::copy(half.begin(), half.end(), section);
+    hc::copy(array, output.begin());
+    for (int i = 0; i < grid_size; ++i) {
+      int expected = (i < grid_size / 2) ? (i + iteration) * 2 : -iteration;
+      if (output[i] != expected) {
+        ret = false;
+        break;
+      }
+    }
+
+    // a kernel writing the array through its raw pointer
+    hc::copy(array, output.begin());
+    int* data = array.accelerator_pointer();
+    hc::parallel_for_each(hc::extent<1>(grid_size), [=](hc::index<1> idx) [[hc]] {
+      data[idx[0]] = idx[0] * 3 + iteration;
+    }).wait();
+    hc::copy(array, output.begin());
+    for (int i = 0; i < grid_size; ++i) {
+      if (output[i] != i * 3 + iteration) {
+        ret = false;
+        break;
+      }
+    }
+  }
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test<64>();
+  ret &= test<1024 * 1024>();
+
+  return !(ret == true);
+}
@@ -0,0 +1,74 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+#include <vector>
+
+// test accelerator_view::begin_batch() / end_batch()
+// kernels dispatched within a batch are published to the device together
+template<hc::execute_order order>
+bool test() {
+  const int vecSize = 64;
+  const int kernelCount = 300;
+
+  hc::accelerator acc;
+  hc::accelerator_view av = acc.create_view(order);
+
+  int* data = hc::am_alloc(sizeof(int) * vecSize, acc, 0);
+  std::vector<int> host(vecSize, 0);
+  av.copy(host.data(), data, sizeof(int) * vecSize);
+
+  // every kernel touches a different element so the result does not depend
+  // on the execution order of the queue
+  std::vector<hc::completion_future> futures;
+  av.begin_batch();
+  for (int i = 0; i < kernelCount; ++i) {
+    const int slot = i % vecSize;
+    futures.push_back(hc::parallel_for_each(av, hc::extent<1>(1), [=](hc::index<1>) [[hc]] {
+      atomic_fetch_add(&data[slot], 1);
+    }));
+  }
+
+  // waiting on a kernel of the open batch publishes it
+  futures[kernelCount / 2].wait();
+
+  // nested batches only publish at the outermost end_batch()
+  av.begin_batch();
+  for (int i = 0; i < vecSize; ++i) {
+    futures.push_back(hc::parallel_for_each(av, hc::extent<1>(1), [=](hc::index<1>) [[hc]] {
+      atomic_fetch_add(&data[i], 1);
+    }));
+  }
+  av.end_batch();
+  av.end_batch();
+
+  futures.back().wait();
+  av.wait();
+
+  bool ret = true;
+  for (auto& f : futures) {
+    ret &= f.is_ready();
+  }
+
+  av.copy(data, host.data(), sizeof(int) * vecSize);
+  for (int i = 0; i < vecSize; ++i) {
+    int expected = kernelCount / vecSize + (i < kernelCount % vecSize ? 1 : 0) + 1;
+    ret &= (host[i] == expected);
+  }
+
+  hc::am_free(data);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (acc.is_hsa_accelerator()) {
+    ret &= test<hc::execute_in_order>();
+    ret &= test<hc::execute_any_order>();
+  }
+
+  return !(ret == true);
+}
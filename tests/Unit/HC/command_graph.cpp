@@ -0,0 +1,152 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+#include <hc_am.hpp>
+
+#include <vector>
+
+// test accelerator_view::begin_capture() / end_capture() / replay()
+// commands recorded into a command_graph are only executed when replayed
+const int vecSize = 256;
+
+// loop to deliberately slow down kernel execution
+#define LOOP_COUNT (1024)
+
+bool test(hc::accelerator& acc, bool deviceMemory) {
+  hc::accelerator_view av = acc.create_view();
+
+  int* a;
+  int* b;
+  int* c;
+  if (deviceMemory) {
+    a = hc::am_alloc(sizeof(int) * vecSize, acc, 0);
+    b = hc::am_alloc(sizeof(int) * vecSize, acc, 0);
+    c = hc::am_alloc(sizeof(int) * vecSize, acc, 0);
+  } else {
+    a = new int[vecSize];
+    b = new int[vecSize];
+    c = new int[vecSize];
+  }
+
+  std::vector<int> host(vecSize, 0);
+  auto upload = [&](int* dst, int value) {
+    std::fill(host.begin(), host.end(), value);
+    if (deviceMemory) {
+      av.copy(host.data(), dst, sizeof(int) * vecSize);
+    } else {
+      std::copy(host.begin(), host.end(), dst);
+    }
+  };
+  auto download = [&](int* src) {
+    if (deviceMemory) {
+      av.copy(src, host.data(), sizeof(int) * vecSize);
+    } else {
+      std::copy(src, src + vecSize, host.begin());
+    }
+  };
+  auto check = [&](int* src, int expected) {
+    download(src);
+    bool ok = true;
+    for (int i = 0; i < vecSize; ++i) {
+      ok &= (host[i] == expected);
+    }
+    return ok;
+  };
+
+  upload(a, 0);
+  upload(b, 0);
+  upload(c, 100);
+
+  // record: a[i] += 1, a[i] *= 2, then copy a to b
+  av.begin_capture();
+  bool ret = av.is_capturing();
+  hc::completion_future recorded = hc::parallel_for_each(av, hc::extent<1>(vecSize), [=](hc::index<1> idx) [[hc]] {
+    a[idx[0]] += 1;
+  });
+  // recorded commands are not executed: their futures are ready at once
+  ret &= recorded.is_ready();
+  hc::parallel_for_each(av, hc::extent<1>(vecSize), [=](hc::index<1> idx) [[hc]] {
+    a[idx[0]] *= 2;
+  });
+  av.create_marker();
+  av.copy_async(a, b, sizeof(int) * vecSize);
+  hc::command_graph graph = av.end_capture();
+  ret &= !av.is_capturing();
+  ret &= graph.valid() && (graph.get_node_count() == 4);
+
+  // nothing has been executed by the capture
+  ret &= check(a, 0);
+
+  // ((0 + 1) * 2 + 1) * 2 = 6
+  av.replay(graph).wait();
+  av.replay(graph).wait();
+  ret &= check(a, 6);
+  ret &= check(b, 6);
+
+  // run the same graph on c instead of a: (100 + 1) * 2 = 202
+  ret &= (graph.patch_pointer(a, c) >= 3);
+  av.replay(graph).wait();
+  ret &= check(c, 202);
+  ret &= check(b, 202);
+  ret &= check(a, 6);
+
+  if (deviceMemory) {
+    hc::am_free(a);
+    hc::am_free(b);
+    hc::am_free(c);
+  } else {
+    delete [] a;
+    delete [] b;
+    delete [] c;
+  }
+  return ret;
+}
+
+// a chain of kernels ordered only by the arrays they read and write, with
+// enough nodes for the kernel arguments not to fit in one kernarg buffer
+template<hc::execute_order order>
+bool test_chain(hc::accelerator& acc) {
+  const int chainLength = 40;
+
+  hc::accelerator_view av = acc.create_view(order);
+
+  std::vector<int> host(vecSize, 0);
+  hc::array<int, 1> a(vecSize, host.begin(), av);
+  hc::array<int, 1> b(vecSize, host.begin(), av);
+
+  // each kernel writes the array read by the next one
+  av.begin_capture();
+  for (int k = 0; k < chainLength; ++k) {
+    hc::array<int, 1>& src = (k % 2 == 0) ? a : b;
+    hc::array<int, 1>& dst = (k % 2 == 0) ? b : a;
+    hc::parallel_for_each(av, hc::extent<1>(vecSize), [&src, &dst](hc::index<1> idx) [[hc]] {
+      for (int i = 0; i < LOOP_COUNT; ++i)
+        dst(idx) = src(idx) + 1;
+    });
+  }
+  hc::command_graph graph = av.end_capture();
+  bool ret = (graph.get_node_count() == chainLength);
+
+  av.replay(graph);
+  av.replay(graph).wait();
+
+  hc::copy(a, host.begin());
+  for (int i = 0; i < vecSize; ++i) {
+    ret &= (host[i] == 2 * chainLength);
+  }
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  ret &= test(acc, acc.is_hsa_accelerator());
+  if (acc.is_hsa_accelerator()) {
+    ret &= test_chain<hc::execute_in_order>(acc);
+    ret &= test_chain<hc::execute_any_order>(acc);
+    ret &= test_chain<hc::execute_out_of_order>(acc);
+  }
+
+  return !(ret == true);
+}
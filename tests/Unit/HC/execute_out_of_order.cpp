@@ -0,0 +1,88 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+
+#include <vector>
+
+// loop to deliberately slow down kernel execution
+#define LOOP_COUNT (1024)
+
+// test accelerator_view created with execute_out_of_order
+// kernels are ordered by the array_view instances they read and write only
+template<size_t grid_size>
+bool test() {
+  bool ret = true;
+
+  // dependency graph
+  // pfe1: av1 * 2   -> av2
+  // pfe2: av1 * 3   -> av3
+  // pfe3: av2 + av3 -> av4
+  // pfe4: av1 + 1   -> av2
+  // pfe1 and pfe2 are independent
+  // pfe3 depends on pfe1 and pfe2
+  // pfe4 depends on pfe3 (overwrites av2 read by pfe3)
+
+  std::vector<int> table1(grid_size);
+  std::vector<int> table2(grid_size);
+  std::vector<int> table3(grid_size);
+  std::vector<int> table4(grid_size);
+  for (int i = 0; i < grid_size; ++i) {
+    table1[i] = i;
+  }
+
+  hc::accelerator_view accView = hc::accelerator().create_view(hc::execute_out_of_order);
+  ret &= (accView.get_execute_order() == hc::execute_out_of_order);
+
+  hc::array_view<const int, 1> av1(grid_size, table1);
+  hc::array_view<int, 1> av2(grid_size, table2);
+  hc::array_view<int, 1> av3(grid_size, table3);
+  hc::array_view<int, 1> av4(grid_size, table4);
+
+  hc::completion_future fut1 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av2(idx) = av1(idx) * 2;
+  });
+  hc::completion_future fut2 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av3(idx) = av1(idx) * 3;
+  });
+  hc::completion_future fut3 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av4(idx) = av2(idx) + av3(idx);
+  });
+  hc::completion_future fut4 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av2(idx) = av1(idx) + 1;
+  });
+
+  accView.wait();
+
+  // the device must have executed dependent kernels in order
+  ret &= (fut1.get_end_tick() <= fut3.get_begin_tick());
+  ret &= (fut2.get_end_tick() <= fut3.get_begin_tick());
+  ret &= (fut3.get_end_tick() <= fut4.get_begin_tick());
+
+  av2.synchronize();
+  av3.synchronize();
+  av4.synchronize();
+  for (int i = 0; i < grid_size; ++i) {
+    if (av2[i] != i + 1 || av3[i] != i * 3 || av4[i] != i * 5) {
+      ret = false;
+      break;
+    }
+  }
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (acc.is_hsa_accelerator()) {
+    ret &= test<64>();
+    ret &= test<1024>();
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,67 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+
+#include <vector>
+
+// loop to deliberately slow down kernel execution
+#define LOOP_COUNT (1024 * 64)
+
+// test accelerator_view created with execute_out_of_order
+// a kernel with exactly one data dependency, launched while the producer is
+// still running, must wait for it
+template<size_t grid_size>
+bool test() {
+  bool ret = true;
+
+  // pfe1: av1 * 2 -> av2, slow
+  // pfe2: av2 + 1 -> av3, depends on pfe1 only
+
+  std::vector<int> table1(grid_size);
+  std::vector<int> table2(grid_size);
+  std::vector<int> table3(grid_size);
+  for (int i = 0; i < grid_size; ++i) {
+    table1[i] = i;
+  }
+
+  hc::accelerator_view accView = hc::accelerator().create_view(hc::execute_out_of_order);
+
+  hc::array_view<const int, 1> av1(grid_size, table1);
+  hc::array_view<int, 1> av2(grid_size, table2);
+  hc::array_view<int, 1> av3(grid_size, table3);
+
+  hc::completion_future fut1 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av2(idx) = av1(idx) * 2;
+  });
+  // launched while pfe1 is still running
+  hc::completion_future fut2 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    av3(idx) = av2(idx) + 1;
+  });
+
+  accView.wait();
+
+  ret &= (fut1.get_end_tick() <= fut2.get_begin_tick());
+
+  av3.synchronize();
+  for (int i = 0; i < grid_size; ++i) {
+    if (av3[i] != i * 2 + 1) {
+      ret = false;
+      break;
+    }
+  }
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (acc.is_hsa_accelerator()) {
+    ret &= test<64>();
+    ret &= test<1024>();
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,151 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+
+#include <vector>
+
+// loop to deliberately slow down kernel execution
+#define LOOP_COUNT (1024)
+
+// test accelerator_view created with several hardware queues
+// independent kernels may run on different hardware queues, kernels which
+// depend on each other through array_view instances must still be ordered
+template<size_t grid_size>
+bool test(hc::execute_order order) {
+  bool ret = true;
+
+  // dependency graph
+  // pfe1: av1 * 2   -> av2
+  // pfe2: av1 * 3   -> av3
+  // pfe3: av1 * 4   -> av4
+  // pfe4: av2 + av3 -> av5
+  // pfe5: av5 + av4 -> av2
+  // pfe1, pfe2 and pfe3 are independent
+  // pfe4 depends on pfe1 and pfe2
+  // pfe5 depends on pfe3 and pfe4 (and overwrites av2 read by pfe4)
+
+  std::vector<int> table1(grid_size);
+  std::vector<int> table2(grid_size);
+  std::vector<int> table3(grid_size);
+  std::vector<int> table4(grid_size);
+  std::vector<int> table5(grid_size);
+  for (int i = 0; i < grid_size; ++i) {
+    table1[i] = i;
+  }
+
+  hc::accelerator_view accView = hc::accelerator().create_view(order, hc::queuing_mode_automatic, 4);
+  ret &= (accView.get_hardware_queue_count() == 4);
+
+  hc::array_view<const int, 1> av1(grid_size, table1);
+  hc::array_view<int, 1> av2(grid_size, table2);
+  hc::array_view<int, 1> av3(grid_size, table3);
+  hc::array_view<int, 1> av4(grid_size, table4);
+  hc::array_view<int, 1> av5(grid_size, table5);
+
+  hc::completion_future fut1 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av2(idx) = av1(idx) * 2;
+  });
+  hc::completion_future fut2 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av3(idx) = av1(idx) * 3;
+  });
+  hc::completion_future fut3 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av4(idx) = av1(idx) * 4;
+  });
+  hc::completion_future fut4 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av5(idx) = av2(idx) + av3(idx);
+  });
+  hc::completion_future fut5 = hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+    for (int i = 0; i < LOOP_COUNT; ++i)
+      av2(idx) = av5(idx) + av4(idx);
+  });
+
+  // a marker waits for the kernels of all the hardware queues
+  hc::completion_future marker = accView.create_marker();
+  marker.wait();
+  ret &= fut1.is_ready() && fut2.is_ready() && fut3.is_ready() && fut4.is_ready() && fut5.is_ready();
+
+  // the device must have executed dependent kernels in order
+  ret &= (fut1.get_end_tick() <= fut4.get_begin_tick());
+  ret &= (fut2.get_end_tick() <= fut4.get_begin_tick());
+  ret &= (fut3.get_end_tick() <= fut5.get_begin_tick());
+  ret &= (fut4.get_end_tick() <= fut5.get_begin_tick());
+
+  av2.synchronize();
+  av5.synchronize();
+  for (int i = 0; i < grid_size; ++i) {
+    if (av5[i] != i * 5 || av2[i] != i * 9) {
+      ret = false;
+      break;
+    }
+  }
+
+  return ret;
+}
+
+// more independent kernels than hardware queues: several kernels share a
+// hardware queue and, without the barrier bit, may complete out of order. The
+// first ones are the slowest, so they are still running when the last ones
+// are done: a marker must wait for all of them.
+template<size_t grid_size>
+bool test_many(hc::execute_order order) {
+  bool ret = true;
+  const int kernelCount = 11;
+
+  hc::accelerator_view accView = hc::accelerator().create_view(order, hc::queuing_mode_automatic, 4);
+
+  std::vector<std::vector<int>> tables(kernelCount, std::vector<int>(grid_size, 0));
+  std::vector<hc::array_view<int, 1>> avs;
+  for (int k = 0; k < kernelCount; ++k) {
+    avs.push_back(hc::array_view<int, 1>(grid_size, tables[k]));
+  }
+
+  std::vector<hc::completion_future> futs;
+  for (int k = 0; k < kernelCount; ++k) {
+    hc::array_view<int, 1> av = avs[k];
+    const int loops = (k < 4) ? LOOP_COUNT * 16 : 1;
+    futs.push_back(hc::parallel_for_each(accView, hc::extent<1>(grid_size), [=](hc::index<1>& idx) [[hc]] {
+      for (int i = 0; i < loops; ++i)
+        av(idx) = idx[0] + k;
+    }));
+  }
+
+  accView.create_marker().wait();
+  for (int k = 0; k < kernelCount; ++k) {
+    ret &= futs[k].is_ready();
+  }
+
+  for (int k = 0; k < kernelCount; ++k) {
+    avs[k].synchronize();
+    for (int i = 0; i < grid_size; ++i) {
+      if (avs[k][i] != i + k) {
+        ret = false;
+        break;
+      }
+    }
+  }
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  hc::accelerator acc;
+  if (acc.is_hsa_accelerator()) {
+    ret &= test<64>(hc::execute_in_order);
+    ret &= test<1024>(hc::execute_in_order);
+    ret &= test<1024>(hc::execute_any_order);
+    ret &= test<1024>(hc::execute_out_of_order);
+    ret &= test_many<1024>(hc::execute_any_order);
+    ret &= test_many<1024>(hc::execute_out_of_order);
+
+    // the default view still uses a single hardware queue
+    ret &= (acc.get_default_view().get_hardware_queue_count() == 1);
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,323 @@
+// RUN: %hc %s -I%S/../../../lib/hsa -o %t.out && %t.out
+
+#include "peer_copy_scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+// test the routes and the pipelining of the peer to peer copy scheduler
+// against a stub runtime simulating agents, no accelerator is used.
+//
+// The stub runs the copies only when an event is waited for, the newest
+// copy ready first: a copy missing a dependency runs too early and the
+// data copied is wrong.
+class StubRuntime : public PeerCopyScheduler::Runtime {
+public:
+  typedef PeerCopyScheduler::AgentId AgentId;
+  typedef PeerCopyScheduler::EventId EventId;
+
+  // agent 0 is the host, all the agents access the host memory.  Peers
+  // access all the memory of each other, other agents only the buffers they
+  // were granted.
+  bool CanAccess(AgentId agent, AgentId owner, const void* ptr) override {
+    return (agent == owner) || (owner == 0) || (peers.count(std::make_pair(agent, owner)) != 0) ||
+           (granted.count(std::make_pair(agent, ptr)) != 0);
+  }
+
+  void* AllocStaging(size_t sizeBytes) override {
+    if (failStaging) {
+      return NULL;
+    }
+    char* ptr = new char[sizeBytes];
+    memory[ptr] = Buffer{0, sizeBytes};
+    stagingCount++;
+    return ptr;
+  }
+  void FreeStaging(void* ptr) override {
+    memory.erase(static_cast<char*>(ptr));
+    delete[] static_cast<char*>(ptr);
+    stagingCount--;
+  }
+
+  EventId CopyAsync(void* dst, const void* src, size_t sizeBytes, AgentId copyAgent,
+                    int depCount, const EventId* deps) override {
+    // the engine must access both sides of the copy
+    if (!CanAccess(copyAgent, Owner(dst), dst) || !CanAccess(copyAgent, Owner(src), src)) {
+      errors++;
+    }
+    Copy copy{static_cast<char*>(dst), static_cast<const char*>(src), sizeBytes, copyAgent, {}, false};
+    for (int i = 0; i < depCount; ++i) {
+      if (events.count(deps[i]) == 0) {
+        errors++;   // released or unknown event
+      }
+      copy.deps.push_back(deps[i]);
+    }
+    copies.push_back(copy);
+    EventId id = nextEvent++;
+    events[id] = copies.size() - 1;
+    return id;
+  }
+
+  void Wait(EventId event) override {
+    while (!Done(event)) {
+      if (!RunOne()) {
+        errors++;   // deadlock
+        return;
+      }
+    }
+  }
+
+  void Release(EventId event) override {
+    if (events.count(event) == 0 || !Done(event)) {
+      errors++;
+    }
+    events.erase(event);
+  }
+
+  // events not completed by a copy
+  EventId UserEvent() {
+    EventId id = nextEvent++;
+    events[id] = -1;
+    userEvents[id] = false;
+    return id;
+  }
+
+  bool Done(EventId event) {
+    if (userEvents.count(event)) {
+      return userEvents[event];
+    }
+    return copies[events[event]].done;
+  }
+
+  // run the newest copy whose dependencies are done
+  bool RunOne() {
+    for (int i = int(copies.size()) - 1; i >= 0; --i) {
+      Copy& c = copies[i];
+      if (c.done) {
+        continue;
+      }
+      bool ready = true;
+      for (EventId d : c.deps) {
+        ready &= (events.count(d) != 0) && Done(d);
+      }
+      if (ready) {
+        memcpy(c.dst, c.src, c.sizeBytes);
+        c.done = true;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // device memory owned by an agent
+  char* Alloc(AgentId owner, size_t sizeBytes) {
+    char* ptr = new char[sizeBytes];
+    memory[ptr] = Buffer{owner, sizeBytes};
+    return ptr;
+  }
+  void Free(char* ptr) {
+    memory.erase(ptr);
+    delete[] ptr;
+  }
+
+  AgentId Owner(const void* ptr) {
+    const char* p = static_cast<const char*>(ptr);
+    auto it = memory.upper_bound(const_cast<char*>(p));
+    if (it == memory.begin()) {
+      errors++;
+      return ~AgentId(0);
+    }
+    --it;
+    if (p >= it->first + it->second.sizeBytes) {
+      errors++;
+      return ~AgentId(0);
+    }
+    return it->second.owner;
+  }
+
+  struct Buffer {
+    AgentId owner;
+    size_t sizeBytes;
+  };
+  struct Copy {
+    char* dst;
+    const char* src;
+    size_t sizeBytes;
+    AgentId copyAgent;
+    std::vector<EventId> deps;
+    bool done;
+  };
+
+  std::set<std::pair<AgentId, AgentId>> peers;
+  std::set<std::pair<AgentId, const void*>> granted;
+  std::map<char*, Buffer> memory;
+  std::vector<Copy> copies;
+  std::map<EventId, int> events;
+  std::map<EventId, bool> userEvents;
+  EventId nextEvent = 1;
+  int stagingCount = 0;
+  int errors = 0;
+  bool failStaging = false;
+};
+
+const size_t chunkBytes = 64 * 1024;
+
+void fill(char* p, size_t size, int seed) {
+  for (size_t i = 0; i < size; ++i) {
+    p[i] = char(i * 7 + i / 4096 + seed);
+  }
+}
+
+bool check(const char* p, size_t size, int seed) {
+  for (size_t i = 0; i < size; ++i) {
+    if (p[i] != char(i * 7 + i / 4096 + seed)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool test_routes() {
+  bool ret = true;
+  StubRuntime runtime;
+  // agents 1 and 2 are peers, agent 3 only accesses the memory of agent 1
+  runtime.peers.insert(std::make_pair(1, 2));
+  runtime.peers.insert(std::make_pair(2, 1));
+  runtime.peers.insert(std::make_pair(3, 1));
+
+  std::vector<PeerCopyScheduler::Step> steps;
+  {
+    PeerCopyScheduler one(&runtime, chunkBytes, 4, 1, 1024 * 1024);
+    ret &= (one.Plan(nullptr, 2, nullptr, 1, 8 * 1024 * 1024, false, &steps) == PeerCopyScheduler::RouteDirect);
+    ret &= (steps.size() == 1) && (steps[0].copyAgent == 1);
+  }
+
+  PeerCopyScheduler sched(&runtime, chunkBytes, 4, 2, 1024 * 1024);
+
+  // peers: large copies are spread over both engines, small ones use the source engine
+  ret &= (sched.Plan(nullptr, 2, nullptr, 1, 8 * 1024 * 1024, false, &steps) == PeerCopyScheduler::RouteDirect);
+  ret &= (steps.size() == 2) && (steps[0].copyAgent == 1) && (steps[1].copyAgent == 2);
+  ret &= (steps[0].sizeBytes + steps[1].sizeBytes == 8 * 1024 * 1024);
+  ret &= (sched.Plan(nullptr, 2, nullptr, 1, 4096, false, &steps) == PeerCopyScheduler::RouteDirect);
+  ret &= (steps.size() == 1) && (steps[0].copyAgent == 1);
+
+  // only the destination engine accesses the source memory
+  ret &= (sched.Plan(nullptr, 3, nullptr, 1, 8 * 1024 * 1024, false, &steps) == PeerCopyScheduler::RouteDirect);
+  ret &= (steps.size() == 1) && (steps[0].copyAgent == 3);
+
+  // no peer access: staged through the host, chunk by chunk
+  const size_t size = 5 * chunkBytes + 100;
+  ret &= (sched.Plan(nullptr, 3, nullptr, 2, size, false, &steps) == PeerCopyScheduler::RouteStaged);
+  ret &= (steps.size() == 12);
+  for (size_t i = 0; i < steps.size(); ++i) {
+    ret &= (steps[i].toStaging == (i % 2 == 0)) && (steps[i].fromStaging == (i % 2 == 1));
+    ret &= (steps[i].copyAgent == ((i % 2 == 0) ? 2u : 3u));
+    ret &= (steps[i].chunk == int(i / 2));
+  }
+  ret &= (steps.back().sizeBytes == 100);
+
+  // staging may be forced between peers
+  ret &= (sched.Plan(nullptr, 2, nullptr, 1, chunkBytes, true, &steps) == PeerCopyScheduler::RouteStaged);
+  ret &= (steps.size() == 2);
+
+  // access granted to one buffer only
+  char src2[16], other2[16];
+  runtime.granted.insert(std::make_pair(3, static_cast<const void*>(src2)));
+  ret &= (sched.Plan(nullptr, 3, src2, 2, size, false, &steps) == PeerCopyScheduler::RouteDirect);
+  ret &= (steps.size() == 1) && (steps[0].copyAgent == 3);
+  ret &= (sched.Plan(nullptr, 3, other2, 2, size, false, &steps) == PeerCopyScheduler::RouteStaged);
+
+  ret &= (runtime.errors == 0);
+  return ret;
+}
+
+bool test_copies() {
+  bool ret = true;
+  StubRuntime runtime;
+  runtime.peers.insert(std::make_pair(1, 2));
+  runtime.peers.insert(std::make_pair(2, 1));
+  {
+    PeerCopyScheduler sched(&runtime, chunkBytes, 3, 2, 1024 * 1024);
+    const size_t size = 4 * 1024 * 1024 + 12345;
+
+    char* src1 = runtime.Alloc(1, size);
+    char* dst2 = runtime.Alloc(2, size);
+    char* src3 = runtime.Alloc(3, size);
+    char* dst3 = runtime.Alloc(3, size);
+    fill(src1, size, 1);
+    fill(src3, size, 3);
+
+    // direct, over two engines
+    auto t1 = sched.Submit(dst2, 2, src1, 1, size);
+    ret &= (t1 != nullptr) && (t1->GetRoute() == PeerCopyScheduler::RouteDirect) && (t1->GetStepCount() == 2);
+    t1->Wait();
+    ret &= check(dst2, size, 1);
+
+    // two staged transfers in flight sharing the ring of 3 buffers
+    auto t2 = sched.Submit(dst3, 3, src1, 1, size);
+    auto t3 = sched.Submit(dst2, 2, src3, 3, size);
+    ret &= (t2->GetRoute() == PeerCopyScheduler::RouteStaged) && (t3->GetRoute() == PeerCopyScheduler::RouteStaged);
+    ret &= (runtime.stagingCount == 3);
+    t3->Wait();
+    ret &= check(dst2, size, 3);
+    t2->Wait();
+    ret &= check(dst3, size, 1);
+
+    // nothing runs before the event the transfer waits for
+    fill(src3, size, 5);
+    PeerCopyScheduler::EventId user = runtime.UserEvent();
+    auto t4 = sched.Submit(dst2, 2, src3, 3, size, user);
+    while (runtime.RunOne()) {
+    }
+    ret &= check(dst2, size, 3);
+    runtime.userEvents[user] = true;
+    t4->Wait();
+    ret &= check(dst2, size, 5);
+    t4 = nullptr;
+    runtime.events.erase(user);
+
+    // empty transfer
+    auto t5 = sched.Submit(dst2, 2, src1, 1, 0);
+    ret &= (t5->GetCompletionEvent() == 0) && (t5->GetStepCount() == 0);
+
+    t1 = t2 = t3 = t5 = nullptr;
+    runtime.Free(src1);
+    runtime.Free(dst2);
+    runtime.Free(src3);
+    runtime.Free(dst3);
+  }
+  // every event and staging buffer is released
+  ret &= runtime.events.empty() && (runtime.stagingCount == 0);
+  ret &= (runtime.errors == 0);
+  return ret;
+}
+
+bool test_staging_failure() {
+  bool ret = true;
+  StubRuntime runtime;
+  runtime.failStaging = true;
+  {
+    PeerCopyScheduler sched(&runtime, chunkBytes, 2, 1, 1024 * 1024);
+    char* src = runtime.Alloc(1, chunkBytes);
+    char* dst = runtime.Alloc(2, chunkBytes);
+    ret &= (sched.Submit(dst, 2, src, 1, chunkBytes) == nullptr);
+    runtime.Free(src);
+    runtime.Free(dst);
+  }
+  ret &= (runtime.errors == 0);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test_routes();
+  ret &= test_copies();
+  ret &= test_staging_failure();
+
+  return !(ret == true);
+}
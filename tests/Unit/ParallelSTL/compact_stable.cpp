@@ -0,0 +1,121 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "test_random.h"
+
+// copy_if, remove_if, remove_copy_if, remove, remove_copy, unique,
+// unique_copy, partition, stable_partition and partition_copy: the kept
+// elements must come out in order, whatever the counts of the ranges before
+// them, so the results are exactly those of the stable sequential
+// algorithms.  unique must compare the first element of a range with the
+// last one of the range before it, and a single key keeps all the elements
+// or none.
+
+struct KeyIsEven {
+  bool operator()(const Record& a) const __CPU__ __HC__ {
+    return a.key % 2 == 0;
+  }
+};
+
+struct SameKey {
+  bool operator()(const Record& a, const Record& b) const __CPU__ __HC__ {
+    return a.key == b.key;
+  }
+};
+
+template<typename Seq, typename Par>
+bool test_copy(const std::vector<Record>& input, Seq seq, Par par) {
+  std::vector<Record> expected(input.size(), Record{-1, -1});
+  std::vector<Record> output(expected);
+  auto e = seq(input.begin(), input.end(), expected.begin());
+  auto o = par(input.begin(), input.end(), output.begin());
+  return (e - expected.begin() == o - output.begin()) && (output == expected);
+}
+
+template<typename Seq, typename Par>
+bool test_in_place(const std::vector<Record>& input, Seq seq, Par par) {
+  std::vector<Record> expected(input), output(input);
+  auto e = seq(expected.begin(), expected.end());
+  auto o = par(output.begin(), output.end());
+  const size_t count = e - expected.begin();
+  return (count == size_t(o - output.begin())) &&
+         std::equal(expected.begin(), expected.begin() + count, output.begin());
+}
+
+bool test(size_t size, int range) {
+  using std::experimental::parallel::par;
+  namespace parallel = std::experimental::parallel;
+  typedef std::vector<Record>::const_iterator In;
+  typedef std::vector<Record>::iterator It;
+
+  std::vector<Record> input = random_records(size, range, unsigned(size + range));
+  const Record removed = input[size / 2];
+  bool ret = true;
+
+  ret &= test_copy(input,
+    [](In f, In l, It d) { return std::copy_if(f, l, d, KeyIsEven()); },
+    [](In f, In l, It d) { return parallel::copy_if(par, f, l, d, KeyIsEven()); });
+  ret &= test_copy(input,
+    [](In f, In l, It d) { return std::remove_copy_if(f, l, d, KeyIsEven()); },
+    [](In f, In l, It d) { return parallel::remove_copy_if(par, f, l, d, KeyIsEven()); });
+  ret &= test_copy(input,
+    [=](In f, In l, It d) { return std::remove_copy(f, l, d, removed); },
+    [=](In f, In l, It d) { return parallel::remove_copy(par, f, l, d, removed); });
+  ret &= test_copy(input,
+    [](In f, In l, It d) { return std::unique_copy(f, l, d, SameKey()); },
+    [](In f, In l, It d) { return parallel::unique_copy(par, f, l, d, SameKey()); });
+
+  ret &= test_in_place(input,
+    [](It f, It l) { return std::remove_if(f, l, KeyIsEven()); },
+    [](It f, It l) { return parallel::remove_if(par, f, l, KeyIsEven()); });
+  ret &= test_in_place(input,
+    [=](It f, It l) { return std::remove(f, l, removed); },
+    [=](It f, It l) { return parallel::remove(par, f, l, removed); });
+  ret &= test_in_place(input,
+    [](It f, It l) { return std::unique(f, l, SameKey()); },
+    [](It f, It l) { return parallel::unique(par, f, l, SameKey()); });
+
+  // the whole range is rearranged
+  for (bool stable : {false, true}) {
+    std::vector<Record> expected(input), output(input);
+    auto e = std::stable_partition(expected.begin(), expected.end(), KeyIsEven());
+    auto o = stable ? parallel::stable_partition(par, output.begin(), output.end(), KeyIsEven())
+                    : parallel::partition(par, output.begin(), output.end(), KeyIsEven());
+    ret &= (e - expected.begin() == o - output.begin()) && (output == expected);
+  }
+
+  std::vector<Record> expectedTrue(size), expectedFalse(size);
+  std::vector<Record> outputTrue(size), outputFalse(size);
+  auto e = std::partition_copy(input.begin(), input.end(),
+                               expectedTrue.begin(), expectedFalse.begin(), KeyIsEven());
+  auto o = parallel::partition_copy(par, input.begin(), input.end(),
+                                    outputTrue.begin(), outputFalse.begin(), KeyIsEven());
+  const size_t count = e.first - expectedTrue.begin();
+  ret &= (count == size_t(o.first - outputTrue.begin()));
+  ret &= (size - count == size_t(o.second - outputFalse.begin()));
+  ret &= std::equal(expectedTrue.begin(), expectedTrue.begin() + count, outputTrue.begin());
+  ret &= std::equal(expectedFalse.begin(), expectedFalse.begin() + (size - count),
+                    outputFalse.begin());
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  for (size_t size : {7, 1000, 65537, 300001}) {
+    ret &= test(size, 3);       // long runs of equal keys
+    ret &= test(size, 1000);
+    ret &= test(size, 0);       // one key: all kept or none
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,122 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <vector>
+
+#include "test_random.h"
+
+// merge, inplace_merge, includes and the set operations against the
+// sequential algorithms: the equal elements must come from the same range,
+// in the same order.  With a handful of keys the runs of equal elements are
+// much longer than a slice, so set_split must move the start of a slice back
+// to the start of the run it falls in; one range can also be much longer
+// than the other, or empty.
+
+template<typename Seq, typename Par>
+bool test_set(const std::vector<Record>& a, const std::vector<Record>& b, Seq seq, Par par) {
+  std::vector<Record> expected(a.size() + b.size(), Record{-1, -1});
+  std::vector<Record> output(expected);
+  auto e = seq(a.begin(), a.end(), b.begin(), b.end(), expected.begin());
+  auto o = par(a.begin(), a.end(), b.begin(), b.end(), output.begin());
+  return (e - expected.begin() == o - output.begin()) && (output == expected);
+}
+
+bool test(size_t n1, size_t n2, int range) {
+  using std::experimental::parallel::par;
+  namespace parallel = std::experimental::parallel;
+  typedef std::vector<Record>::const_iterator In;
+  typedef std::vector<Record>::iterator Out;
+
+  const std::vector<Record> a = sorted_records(n1, range, 0, unsigned(n1 + range));
+  const std::vector<Record> b = sorted_records(n2, range, 1 << 30, unsigned(n2 + 2 * range));
+  bool ret = true;
+
+  ret &= test_set(a, b,
+    [](In f1, In l1, In f2, In l2, Out d) { return std::merge(f1, l1, f2, l2, d, RecordLess()); },
+    [](In f1, In l1, In f2, In l2, Out d) {
+      return parallel::merge(par, f1, l1, f2, l2, d, RecordLess());
+    });
+  ret &= test_set(a, b,
+    [](In f1, In l1, In f2, In l2, Out d) { return std::set_union(f1, l1, f2, l2, d, RecordLess()); },
+    [](In f1, In l1, In f2, In l2, Out d) {
+      return parallel::set_union(par, f1, l1, f2, l2, d, RecordLess());
+    });
+  ret &= test_set(a, b,
+    [](In f1, In l1, In f2, In l2, Out d) {
+      return std::set_intersection(f1, l1, f2, l2, d, RecordLess());
+    },
+    [](In f1, In l1, In f2, In l2, Out d) {
+      return parallel::set_intersection(par, f1, l1, f2, l2, d, RecordLess());
+    });
+  ret &= test_set(a, b,
+    [](In f1, In l1, In f2, In l2, Out d) {
+      return std::set_difference(f1, l1, f2, l2, d, RecordLess());
+    },
+    [](In f1, In l1, In f2, In l2, Out d) {
+      return parallel::set_difference(par, f1, l1, f2, l2, d, RecordLess());
+    });
+  ret &= test_set(a, b,
+    [](In f1, In l1, In f2, In l2, Out d) {
+      return std::set_symmetric_difference(f1, l1, f2, l2, d, RecordLess());
+    },
+    [](In f1, In l1, In f2, In l2, Out d) {
+      return parallel::set_symmetric_difference(par, f1, l1, f2, l2, d, RecordLess());
+    });
+
+  // a then b in one range
+  std::vector<Record> expected(a);
+  expected.insert(expected.end(), b.begin(), b.end());
+  std::vector<Record> output(expected);
+  std::inplace_merge(expected.begin(), expected.begin() + n1, expected.end(), RecordLess());
+  parallel::inplace_merge(par, output.begin(), output.begin() + n1, output.end(), RecordLess());
+  ret &= (output == expected);
+
+  ret &= (parallel::includes(par, a.begin(), a.end(), b.begin(), b.end(), RecordLess()) ==
+          std::includes(a.begin(), a.end(), b.begin(), b.end(), RecordLess()));
+  // every other element of a is included in a
+  std::vector<Record> half;
+  for (size_t i = 0; i < n1; i += 2) {
+    half.push_back(a[i]);
+  }
+  ret &= parallel::includes(par, a.begin(), a.end(), half.begin(), half.end(), RecordLess());
+  if (n1 > 0) {
+    half.push_back(Record{range + 1, 0});
+    ret &= !parallel::includes(par, a.begin(), a.end(), half.begin(), half.end(), RecordLess());
+  }
+
+  // the default comparator
+  std::vector<int> ka(n1), kb(n2), ke(n1 + n2), ko(n1 + n2);
+  for (size_t i = 0; i < n1; ++i) {
+    ka[i] = a[i].key;
+  }
+  for (size_t i = 0; i < n2; ++i) {
+    kb[i] = b[i].key;
+  }
+  auto e = std::set_union(ka.begin(), ka.end(), kb.begin(), kb.end(), ke.begin());
+  auto o = parallel::set_union(par, ka.begin(), ka.end(), kb.begin(), kb.end(), ko.begin());
+  ret &= (e - ke.begin() == o - ko.begin()) && (ke == ko);
+  std::merge(ka.begin(), ka.end(), kb.begin(), kb.end(), ke.begin());
+  parallel::merge(par, ka.begin(), ka.end(), kb.begin(), kb.end(), ko.begin());
+  ret &= (ke == ko);
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  for (size_t size : {7, 1000, 65537, 300001}) {
+    ret &= test(size, size, 5);         // long runs of equal keys
+    ret &= test(size, size + 33, 1000);
+    ret &= test(size, size / 10, 1 << 20);
+    ret &= test(size / 10, size, 100);
+    ret &= test(size, 0, 100);
+  }
+
+  return !(ret == true);
+}
@@ -32,7 +32,8 @@ bool test(void) {
   typedef T cArray[SIZE];
   ret &= run_and_compare<T, SIZE>([&eq, pred]
                                   (cArray &input1, cArray &input2) {
-    std::partition(std::begin(input1), std::end(input1), pred);
+    // the parallel partition is stable
+    std::stable_partition(std::begin(input1), std::end(input1), pred);
     std::experimental::parallel::
     partition(par, std::begin(input2), std::end(input2), pred);
   });
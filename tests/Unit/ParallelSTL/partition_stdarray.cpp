@@ -32,7 +32,8 @@ bool test(void) {
   typedef std::array<T, SIZE> stdArray;
   ret &= run_and_compare<T, SIZE, stdArray>([&eq, pred]
                                             (stdArray &input1, stdArray &input2) {
-    std::partition(std::begin(input1), std::end(input1), pred);
+    // the parallel partition is stable
+    std::stable_partition(std::begin(input1), std::end(input1), pred);
     std::experimental::parallel::
     partition(par, std::begin(input2), std::end(input2), pred);
   });
@@ -0,0 +1,114 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/numeric>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <numeric>
+#include <vector>
+
+#include "test_random.h"
+
+// reduce, transform_reduce, count_if and lexicographical_compare: every tile
+// writes its partial result, and the tile taking the last ticket combines
+// them with init, so it must see the partial results of all the others.
+// The sizes go from the sequential path and a single tile to many tiles with
+// a partial last one.
+
+struct Point {
+  int x;
+  int y;
+};
+
+struct PointSum {
+  Point operator()(const Point& a, const Point& b) const __CPU__ __HC__ {
+    return Point{a.x + b.x, a.y + b.y};
+  }
+};
+
+struct Square {
+  long operator()(const int& a) const __CPU__ __HC__ {
+    return long(a) * a;
+  }
+};
+
+// orders on the tens only
+struct TensLess {
+  bool operator()(const int& a, const int& b) const __CPU__ __HC__ {
+    return a / 10 < b / 10;
+  }
+};
+
+bool test(size_t size) {
+  using std::experimental::parallel::par;
+  namespace parallel = std::experimental::parallel;
+
+  const std::vector<int> data = random_ints(size, -1000, 1000, unsigned(size));
+  std::vector<Point> points(size);
+  for (size_t i = 0; i < size; ++i) {
+    points[i] = Point{int(i % 7), 1};
+  }
+  bool ret = true;
+
+  ret &= (parallel::reduce(par, data.begin(), data.end(), 5) ==
+          std::accumulate(data.begin(), data.end(), 5));
+  ret &= (parallel::reduce(par, data.begin(), data.end(), -2000,
+                           [](const int& a, const int& b) { return std::max(a, b); }) ==
+          *std::max_element(data.begin(), data.end()));
+  ret &= (parallel::reduce(par, data.begin(), data.end(), 3000,
+                           [](const int& a, const int& b) { return std::min(a, b); }) ==
+          *std::min_element(data.begin(), data.end()));
+
+  const Point sum = parallel::reduce(par, points.begin(), points.end(), Point{1, 1}, PointSum());
+  const Point expected = std::accumulate(points.begin(), points.end(), Point{1, 1}, PointSum());
+  ret &= (sum.x == expected.x) && (sum.y == expected.y) && (sum.y == int(size) + 1);
+
+  long squares = 0;
+  for (int a : data) {
+    squares += long(a) * a;
+  }
+  ret &= (parallel::transform_reduce(par, data.begin(), data.end(), Square(), 7L,
+                                     std::plus<long>()) == squares + 7);
+  ret &= (parallel::count_if(par, data.begin(), data.end(), [](const int& a) { return a < 0; }) ==
+          std::count_if(data.begin(), data.end(), [](const int& a) { return a < 0; }));
+
+  // equivalent but not equal elements, then a difference at the end or none.
+  // Non-negative, so that the elements of a stay in the tens of b.
+  std::vector<int> a(size), b(size);
+  for (size_t i = 0; i < size; ++i) {
+    b[i] = std::abs(data[i]);
+    a[i] = 10 * (b[i] / 10) + 3;
+  }
+  ret &= (parallel::lexicographical_compare(par, a.begin(), a.end(), b.begin(), b.end(),
+                                            TensLess()) ==
+          std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), TensLess()));
+  b.back() += 10;
+  ret &= (parallel::lexicographical_compare(par, a.begin(), a.end(), b.begin(), b.end(),
+                                            TensLess()) ==
+          std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), TensLess()));
+  ret &= (parallel::lexicographical_compare(par, b.begin(), b.end(), a.begin(), a.end(),
+                                            TensLess()) ==
+          std::lexicographical_compare(b.begin(), b.end(), a.begin(), a.end(), TensLess()));
+  // a prefix is less
+  ret &= parallel::lexicographical_compare(par, data.begin(), data.end() - 1,
+                                           data.begin(), data.end());
+  ret &= !parallel::lexicographical_compare(par, data.begin(), data.end(),
+                                            data.begin(), data.end() - 1);
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  for (size_t size : {12, 257, 1000, 65537, 300001, 4000037}) {
+    ret &= test(size);
+  }
+
+  return !(ret == true);
+}
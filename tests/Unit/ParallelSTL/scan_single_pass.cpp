@@ -0,0 +1,98 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/numeric>
+#include <experimental/execution_policy>
+
+#include <numeric>
+#include <vector>
+
+#include "test_random.h"
+
+// inclusive_scan, exclusive_scan, transform_inclusive_scan and
+// transform_exclusive_scan with an associative but not commutative
+// operation, out of place and in place.  A tile looks back across the tiles
+// before it, combining their aggregates until it finds an inclusive prefix,
+// so the sums must be combined in order; sizes of exactly one tile and one
+// more exercise the first tile and a last tile of one element.
+
+// x -> a * x + b, in 32 bit arithmetic
+struct Affine {
+  unsigned a;
+  unsigned b;
+};
+
+bool operator==(const Affine& x, const Affine& y) {
+  return x.a == y.a && x.b == y.b;
+}
+
+// x then y
+struct Compose {
+  Affine operator()(const Affine& x, const Affine& y) const __CPU__ __HC__ {
+    return Affine{x.a * y.a, x.b * y.a + y.b};
+  }
+};
+
+struct FromInt {
+  Affine operator()(const int& v) const __CPU__ __HC__ {
+    return Affine{unsigned(v) | 1u, unsigned(v) * 7u};
+  }
+};
+
+bool test(size_t size) {
+  using std::experimental::parallel::par;
+  namespace parallel = std::experimental::parallel;
+
+  const std::vector<int> values = random_ints(size, 0, 1 << 20, unsigned(size));
+  std::vector<Affine> input(size);
+  for (size_t i = 0; i < size; ++i) {
+    input[i] = FromInt()(values[i]);
+  }
+  const Affine identity{1, 0};
+  const Affine init{3, 5};
+  bool ret = true;
+
+  std::vector<Affine> inclusive(size), exclusive(size);
+  std::partial_sum(input.begin(), input.end(), inclusive.begin(), Compose());
+  Affine sum = init;
+  for (size_t i = 0; i < size; ++i) {
+    exclusive[i] = sum;
+    sum = Compose()(sum, input[i]);
+  }
+
+  std::vector<Affine> output(size, Affine{0, 0});
+  parallel::inclusive_scan(par, input.begin(), input.end(), output.begin(), Compose(), identity);
+  ret &= (output == inclusive);
+  parallel::exclusive_scan(par, input.begin(), input.end(), output.begin(), init, Compose());
+  ret &= (output == exclusive);
+
+  std::fill(output.begin(), output.end(), Affine{0, 0});
+  parallel::transform_inclusive_scan(par, values.begin(), values.end(), output.begin(),
+                                     FromInt(), Compose(), identity);
+  ret &= (output == inclusive);
+  parallel::transform_exclusive_scan(par, values.begin(), values.end(), output.begin(),
+                                     FromInt(), init, Compose());
+  ret &= (output == exclusive);
+
+  // in place
+  std::vector<Affine> data(input);
+  parallel::inclusive_scan(par, data.begin(), data.end(), data.begin(), Compose(), identity);
+  ret &= (data == inclusive);
+  data = input;
+  parallel::exclusive_scan(par, data.begin(), data.end(), data.begin(), init, Compose());
+  ret &= (data == exclusive);
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  for (size_t size : {11, 1000, 1024, 1025, 65537, 300001, 2000003}) {
+    ret &= test(size);
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,125 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// find, find_if, find_if_not, find_first_of, adjacent_find, mismatch,
+// search, search_n, equal and any_of/all_of/none_of with no match, one
+// match, and several matches in different blocks.  A block searched after a
+// later match has been published must still lower the result, so the first
+// match is returned; a match at the first element is found before anything
+// is launched, and one at the last element ends the last, partial block.
+
+struct IsMarked {
+  bool operator()(const int& a) const __CPU__ __HC__ {
+    return a < 0;
+  }
+};
+
+// 0, 1, ..., size - 1, with -1 at the marks
+std::vector<int> marked(size_t size, const std::vector<size_t>& marks) {
+  std::vector<int> data(size);
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = int(i);
+  }
+  for (size_t m : marks) {
+    if (m < size) {
+      data[m] = -1;
+    }
+  }
+  return data;
+}
+
+bool test(size_t size, const std::vector<size_t>& marks) {
+  using std::experimental::parallel::par;
+  namespace parallel = std::experimental::parallel;
+
+  const std::vector<int> plain = marked(size, {});
+  const std::vector<int> data = marked(size, marks);
+  bool ret = true;
+
+  ret &= (parallel::find(par, data.begin(), data.end(), -1) ==
+          std::find(data.begin(), data.end(), -1));
+  ret &= (parallel::find_if(par, data.begin(), data.end(), IsMarked()) ==
+          std::find_if(data.begin(), data.end(), IsMarked()));
+  ret &= (parallel::find_if_not(par, plain.begin(), plain.end(), [](int a) { return a != -1; }) ==
+          std::find_if_not(plain.begin(), plain.end(), [](int a) { return a != -1; }));
+
+  ret &= (parallel::any_of(par, data.begin(), data.end(), IsMarked()) ==
+          std::any_of(data.begin(), data.end(), IsMarked()));
+  ret &= (parallel::none_of(par, data.begin(), data.end(), IsMarked()) ==
+          std::none_of(data.begin(), data.end(), IsMarked()));
+  ret &= (parallel::all_of(par, data.begin(), data.end(), [](int a) { return a >= 0; }) ==
+          std::all_of(data.begin(), data.end(), [](int a) { return a >= 0; }));
+
+  const std::vector<int> set = {-5, -1, -7};
+  ret &= (parallel::find_first_of(par, data.begin(), data.end(), set.begin(), set.end()) ==
+          std::find_first_of(data.begin(), data.end(), set.begin(), set.end()));
+
+  // the marks and the elements before them are equal
+  std::vector<int> pairs(data);
+  for (size_t i = 1; i < size; ++i) {
+    if (pairs[i] == -1) {
+      pairs[i - 1] = -1;
+    }
+  }
+  ret &= (parallel::adjacent_find(par, pairs.begin(), pairs.end()) ==
+          std::adjacent_find(pairs.begin(), pairs.end()));
+
+  auto m = parallel::mismatch(par, plain.begin(), plain.end(), data.begin());
+  auto e = std::mismatch(plain.begin(), plain.end(), data.begin());
+  ret &= (m.first == e.first) && (m.second == e.second);
+  ret &= (parallel::equal(par, plain.begin(), plain.end(), data.begin()) ==
+          std::equal(plain.begin(), plain.end(), data.begin()));
+
+  // the pattern is found at each mark
+  const std::vector<int> pattern = {-1, 5, 6};
+  std::vector<int> text(plain);
+  for (size_t mk : marks) {
+    if (mk + pattern.size() <= size) {
+      std::copy(pattern.begin(), pattern.end(), text.begin() + mk);
+    }
+  }
+  ret &= (parallel::search(par, text.begin(), text.end(), pattern.begin(), pattern.end()) ==
+          std::search(text.begin(), text.end(), pattern.begin(), pattern.end()));
+
+  // runs of -1 of lengths 1, 3, 5, ... at the marks
+  std::vector<int> runs(plain);
+  size_t length = 1;
+  for (size_t mk : marks) {
+    for (size_t i = mk; (i < mk + length) && (i < size); ++i) {
+      runs[i] = -1;
+    }
+    length += 2;
+  }
+  const size_t longest = std::min(size, marks.empty() ? 1 : length - 2);
+  for (size_t count : {size_t(1), size_t(3), longest, longest + 1}) {
+    ret &= (parallel::search_n(par, runs.begin(), runs.end(), count, -1) ==
+            std::search_n(runs.begin(), runs.end(), count, -1));
+  }
+
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  for (size_t size : {7, 1000, 65537, 300001}) {
+    ret &= test(size, {});
+    ret &= test(size, {0});
+    ret &= test(size, {size - 1});
+    ret &= test(size, {size / 2});
+    // the first of several
+    ret &= test(size, {size / 3, size / 2, size - 5});
+    ret &= test(size, {size - 300, size / 7, size / 2});
+    ret &= test(size, {size / 2 + 1, size / 2});
+  }
+
+  return !(ret == true);
+}
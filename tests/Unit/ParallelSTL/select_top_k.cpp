@@ -0,0 +1,94 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "test_random.h"
+
+// nth_element, partial_sort, partial_sort_copy and top_k for k from 0 to past
+// the end.  With few distinct values or constant data, many elements are
+// equal to the splitters picked from the sample, which must then neither
+// lose nor duplicate elements; sorted data is sampled in order.  The elements
+// selected are compared with those of a sorted copy, and the range must
+// still be a permutation of the input.
+
+template<typename Compare>
+bool test(const std::vector<int>& input, size_t k, Compare comp) {
+  using std::experimental::parallel::par;
+  namespace parallel = std::experimental::parallel;
+
+  const size_t size = input.size();
+  std::vector<int> sorted(input);
+  std::sort(sorted.begin(), sorted.end(), comp);
+  bool ret = true;
+
+  if (k < size) {
+    std::vector<int> data(input);
+    parallel::nth_element(par, data.begin(), data.begin() + k, data.end(), comp);
+    const int nth = data[k];
+    ret &= (nth == sorted[k]);
+    ret &= std::none_of(data.begin(), data.begin() + k, [&](int a) { return comp(nth, a); });
+    ret &= std::none_of(data.begin() + k, data.end(), [&](int a) { return comp(a, nth); });
+    std::sort(data.begin(), data.end(), comp);
+    ret &= (data == sorted);
+  }
+
+  {
+    std::vector<int> data(input);
+    parallel::partial_sort(par, data.begin(), data.begin() + std::min(k, size), data.end(), comp);
+    ret &= std::equal(sorted.begin(), sorted.begin() + std::min(k, size), data.begin());
+    std::sort(data.begin(), data.end(), comp);
+    ret &= (data == sorted);
+  }
+
+  std::vector<int> output(k + 1, -1);
+  auto o = parallel::partial_sort_copy(par, input.begin(), input.end(),
+                                       output.begin(), output.begin() + k, comp);
+  ret &= (size_t(o - output.begin()) == std::min(k, size));
+  ret &= std::equal(output.begin(), o, sorted.begin());
+  ret &= (output[k] == -1);
+
+  std::fill(output.begin(), output.end(), -1);
+  o = parallel::top_k(par, input.begin(), input.end(), output.begin(), k, comp);
+  ret &= (size_t(o - output.begin()) == std::min(k, size));
+  ret &= std::equal(output.begin(), o, sorted.begin());
+  ret &= (output[k] == -1);
+
+  return ret;
+}
+
+template<typename Compare>
+bool test_all_k(const std::vector<int>& input, Compare comp) {
+  const size_t size = input.size();
+  bool ret = true;
+  for (size_t k : {size_t(0), size_t(1), size_t(10), size / 1000, size / 100, size / 3,
+                   size / 2, size - 1, size, size + 5}) {
+    ret &= test(input, k, comp);
+  }
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  for (size_t size : {7, 1000, 65537, 300001}) {
+    const std::vector<int> data = random_ints(size, 0, 1 << 20, unsigned(size));
+    ret &= test_all_k(data, std::less<int>());
+    ret &= test_all_k(data, std::greater<int>());         // the largest elements
+    ret &= test_all_k(random_ints(size, 0, 5, unsigned(size + 1)), std::less<int>());
+    ret &= test_all_k(random_ints(size, 0, 0, 0), std::less<int>());
+
+    std::vector<int> sorted(data);
+    std::sort(sorted.begin(), sorted.end());
+    ret &= test_all_k(sorted, std::less<int>());
+    ret &= test_all_k(sorted, std::greater<int>());
+  }
+
+  return !(ret == true);
+}
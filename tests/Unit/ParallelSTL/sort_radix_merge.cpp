@@ -0,0 +1,90 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "test_random.h"
+
+// sort: radix sort for the arithmetic types with std::less and std::greater,
+// merge sort for the other comparators.  The radix keys must order the
+// negative values of the signed and floating point types before the others,
+// descending orders must use the complement of the digits, and the passes
+// where all the digits are equal (small values in a wide type) are skipped.
+
+// not std::greater, so the merge sort is used
+struct IntGreater {
+  bool operator()(const int& a, const int& b) const __CPU__ __HC__ {
+    return a > b;
+  }
+};
+
+template<typename T, typename Compare>
+bool test(const std::vector<T>& input, Compare comp) {
+  using std::experimental::parallel::par;
+
+  std::vector<T> expected(input), output(input);
+  std::sort(std::begin(expected), std::end(expected), comp);
+  std::experimental::parallel::sort(par, std::begin(output), std::end(output), comp);
+  return output == expected;
+}
+
+template<typename T>
+bool test_radix(double low, double high) {
+  bool ret = true;
+  for (size_t size : {1000, 65537, 300001}) {
+    std::vector<T> data = random_values<T>(size, low, high, size);
+    ret &= test(data, std::less<T>());
+    ret &= test(data, std::greater<T>());
+  }
+  return ret;
+}
+
+bool test_merge() {
+  bool ret = true;
+  for (size_t size : {1000, 65537, 300001}) {
+    // few distinct keys, the equal keys end up in any order
+    const std::vector<Record> input = random_records(size, 100, size);
+    std::vector<Record> data(input);
+    using std::experimental::parallel::par;
+    std::experimental::parallel::sort(par, std::begin(data), std::end(data), RecordLess());
+    bool sorted = true;
+    std::vector<int> values(size);
+    for (size_t i = 0; i < size; ++i) {
+      sorted &= (i == 0) || (data[i - 1].key <= data[i].key);
+      values[i] = data[i].value;
+      sorted &= (input[data[i].value].key == data[i].key);
+    }
+    std::sort(std::begin(values), std::end(values));
+    for (size_t i = 0; i < size; ++i) {
+      sorted &= (values[i] == int(i));
+    }
+    ret &= sorted;
+
+    // radix types with another comparator
+    std::vector<int> ints = random_values<int>(size, -1e6, 1e6, size + 1);
+    ret &= test(ints, IntGreater());
+  }
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test_radix<int>(-2e9, 2e9);
+  ret &= test_radix<unsigned>(0, 4e9);
+  ret &= test_radix<int64_t>(-9e18, 9e18);
+  ret &= test_radix<uint16_t>(0, 65535);
+  ret &= test_radix<int>(0, 1000);       // passes skipped
+  ret &= test_radix<float>(-1e6, 1e6);
+  ret &= test_radix<double>(-1e12, 1e12);
+  ret &= test_merge();
+
+  return !(ret == true);
+}
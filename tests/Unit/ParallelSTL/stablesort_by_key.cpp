@@ -0,0 +1,98 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "test_random.h"
+
+// stable_sort, sort_by_key and stable_sort_by_key with a few hundred distinct
+// keys: the values must follow their keys through every pass, and the equal
+// keys keep their order, including -0 and +0, which compare equal but differ
+// in their bits.
+
+// not std::less, so the merge sort is used
+struct IntLess {
+  bool operator()(const int& a, const int& b) const __CPU__ __HC__ {
+    return a < b;
+  }
+};
+
+bool test_stable_sort(size_t size) {
+  using std::experimental::parallel::par;
+
+  std::vector<int> keys = random_ints(size, -50, 50, size);
+  std::vector<Record> expected(size);
+  for (size_t i = 0; i < size; ++i) {
+    expected[i] = Record{keys[i], int(i)};
+  }
+  std::vector<Record> output(expected);
+  std::stable_sort(std::begin(expected), std::end(expected), RecordLess());
+  std::experimental::parallel::stable_sort(par, std::begin(output), std::end(output), RecordLess());
+  return output == expected;
+}
+
+// the values are the original positions: the stable order is unique
+template<typename K, typename Compare>
+bool test_by_key(const std::vector<K>& keys, Compare comp, bool stable) {
+  using std::experimental::parallel::par;
+
+  const size_t size = keys.size();
+  std::vector<K> sortedKeys(keys);
+  std::vector<unsigned> values(size);
+  for (size_t i = 0; i < size; ++i) {
+    values[i] = unsigned(i);
+  }
+  if (stable) {
+    std::experimental::parallel::stable_sort_by_key(par, std::begin(sortedKeys), std::end(sortedKeys),
+                                                    std::begin(values), comp);
+  } else {
+    std::experimental::parallel::sort_by_key(par, std::begin(sortedKeys), std::end(sortedKeys),
+                                             std::begin(values), comp);
+  }
+
+  std::vector<unsigned> expected(values);
+  for (size_t i = 0; i < size; ++i) {
+    expected[i] = unsigned(i);
+  }
+  std::stable_sort(std::begin(expected), std::end(expected), [&](unsigned a, unsigned b) {
+    return comp(keys[a], keys[b]);
+  });
+  bool ret = (values == expected);
+  for (size_t i = 0; i < size; ++i) {
+    ret &= (sortedKeys[i] == keys[expected[i]]);
+  }
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  for (size_t size : {7, 1000, 65537, 300001}) {
+    std::vector<int> keys = random_ints(size, -100, 100, size + 1);
+    std::vector<float> floats(keys.begin(), keys.end());
+    // -0 and +0 are equal keys
+    std::vector<float> zeros(size);
+    for (size_t i = 0; i < size; ++i) {
+      zeros[i] = (keys[i] % 4 != 0) ? float(keys[i]) : ((i % 2) ? -0.0f : 0.0f);
+    }
+    std::vector<double> doubleZeros(zeros.begin(), zeros.end());
+
+    ret &= test_stable_sort(size);
+    ret &= test_by_key(keys, std::less<int>(), false);
+    ret &= test_by_key(keys, std::greater<int>(), true);
+    ret &= test_by_key(floats, std::less<float>(), true);
+    ret &= test_by_key(zeros, std::less<float>(), true);
+    ret &= test_by_key(doubleZeros, std::greater<double>(), true);
+    ret &= test_by_key(keys, IntLess(), false);
+    ret &= test_by_key(keys, IntLess(), true);
+  }
+
+  return !(ret == true);
+}
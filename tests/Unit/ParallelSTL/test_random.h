@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+
+// Random inputs shared by the Parallel STL tests.  The same seed always gives
+// the same data, so a failure can be reproduced.
+
+// A key compared by RecordLess, and a value telling the equal keys apart.
+struct Record {
+  int key;
+  int value;
+};
+
+inline bool operator==(const Record& a, const Record& b) {
+  return a.key == b.key && a.value == b.value;
+}
+
+// orders on the key only
+struct RecordLess {
+  bool operator()(const Record& a, const Record& b) const __CPU__ __HC__ {
+    return a.key < b.key;
+  }
+};
+
+
+// size integers in [low, high]
+inline std::vector<int> random_ints(size_t size, int low, int high, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> dis(low, high);
+  std::vector<int> data(size);
+  for (auto& v : data) {
+    v = dis(gen);
+  }
+  return data;
+}
+
+// size values of T drawn in [low, high), for the types with a range wider
+// than int
+template<typename T>
+std::vector<T> random_values(size_t size, double low, double high, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> dis(low, high);
+  std::vector<T> data(size);
+  for (auto& v : data) {
+    v = static_cast<T>(dis(gen));
+  }
+  return data;
+}
+
+// size records with keys in [0, range] and their positions as values
+inline std::vector<Record> random_records(size_t size, int range, unsigned seed) {
+  std::vector<int> keys = random_ints(size, 0, range, seed);
+  std::vector<Record> data(size);
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = Record{keys[i], int(i)};
+  }
+  return data;
+}
+
+// random_records sorted on the keys, with values tag, tag + 1, ... in the
+// sorted order
+inline std::vector<Record> sorted_records(size_t size, int range, int tag, unsigned seed) {
+  std::vector<Record> data = random_records(size, range, seed);
+  std::sort(data.begin(), data.end(), RecordLess());
+  for (size_t i = 0; i < size; ++i) {
+    data[i].value = tag + int(i);
+  }
+  return data;
+}
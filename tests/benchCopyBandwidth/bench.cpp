@@ -0,0 +1,97 @@
+// RUN: %hc %s -O3 -o %t.out -lhc_am
+// RUN: env HCC_UNPINNED_COPY_MODE=0 %t.out 64
+// RUN: env HCC_UNPINNED_COPY_MODE=1 %t.out 64
+// RUN: env HCC_UNPINNED_COPY_MODE=1 HCC_PINNED_CACHE_SIZE=256 %t.out 64
+// RUN: env HCC_UNPINNED_COPY_MODE=2 %t.out 64
+// RUN: env HCC_UNPINNED_COPY_MODE=2 HCC_STAGING_COPY_THREADS=0 HCC_STAGING_BUFFER_SIZE=64 HCC_STAGING_BUFFER_COUNT=2 %t.out 64
+
+// benchmark for host-to-device and device-to-host copies of unpinned host memory
+//
+// The copy mode and the staging pipeline are selected with environment variables,
+// read once when the runtime starts:
+//   HCC_UNPINNED_COPY_MODE   0=choose best, 1=pin in place, 2=staging, 3=memcpy (large-bar only)
+//   HCC_STAGING_BUFFER_SIZE  size of each staging buffer in KB
+//   HCC_STAGING_BUFFER_COUNT number of staging buffers
+//   HCC_STAGING_COPY_THREADS threads helping the CPU side of staged copies
+//   HCC_PINNED_CACHE_SIZE    budget in MB of the host ranges kept pinned by pin in place copies
+//
+// Copies of unpinned memory are timed cold, with the pinned-host cache emptied before every
+// copy, and warm, with the cache kept between the copies (the same as cold when it is off).
+//
+// hcc `hcc-config --cxxflags --ldflags` bench.cpp -lhc_am -o bench
+// ./bench [max size in MB]
+
+#include "hc.hpp"
+#include "hc_am.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#define ITERATIONS 5
+
+// best bandwidth in GB/s of ITERATIONS copies of sizeBytes
+// If unpin is not null, [unpin, unpin + sizeBytes) is dropped from the pinned-host cache
+// before each copy, outside of the timed region.
+double time_copy(hc::accelerator_view &av, const void *src, void *dst, size_t sizeBytes,
+                 void *unpin = nullptr)
+{
+  double best = 0.0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    if (unpin)
+      hc::invalidate_host_pin_cache(unpin, sizeBytes);
+    auto start = std::chrono::high_resolution_clock::now();
+    av.copy(src, dst, sizeBytes);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> dur = end - start;
+    best = std::max(best, sizeBytes / dur.count() / 1e9);
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  size_t maxSizeMB = 256;
+  if (argc > 1)
+    maxSizeMB = std::stoul(argv[1]);
+
+  hc::accelerator acc;
+  hc::accelerator_view av = acc.get_default_view();
+
+  const size_t maxBytes = maxSizeMB * 1024 * 1024;
+  char *host = static_cast<char*>(malloc(maxBytes));
+  char *pinned = hc::am_alloc(maxBytes, acc, amHostPinned);
+  char *dev = hc::am_alloc(maxBytes, acc, 0);
+  memset(host, 1, maxBytes);
+  memset(pinned, 1, maxBytes);
+
+  const char *mode = getenv("HCC_UNPINNED_COPY_MODE");
+  std::cout << "HCC_UNPINNED_COPY_MODE=" << (mode ? mode : "0") << "\n";
+  std::cout << std::setw(12) << std::left << "size(KB)"
+            << std::setw(16) << "H2D cold(GB/s)" << std::setw(16) << "H2D warm(GB/s)"
+            << std::setw(16) << "D2H cold(GB/s)" << std::setw(16) << "D2H warm(GB/s)"
+            << std::setw(20) << "H2D pinned(GB/s)" << std::setw(20) << "D2H pinned(GB/s)" << "\n";
+
+  for (size_t sizeBytes = 64 * 1024; sizeBytes <= maxBytes; sizeBytes *= 4) {
+    double h2dCold = time_copy(av, host, dev, sizeBytes, host);
+    double h2dWarm = time_copy(av, host, dev, sizeBytes);
+    double d2hCold = time_copy(av, dev, host, sizeBytes, host);
+    double d2hWarm = time_copy(av, dev, host, sizeBytes);
+    double h2dPinned = time_copy(av, pinned, dev, sizeBytes);
+    double d2hPinned = time_copy(av, dev, pinned, sizeBytes);
+
+    std::cout << std::setw(12) << std::left << sizeBytes / 1024 << std::setprecision(4)
+              << std::setw(16) << h2dCold << std::setw(16) << h2dWarm
+              << std::setw(16) << d2hCold << std::setw(16) << d2hWarm
+              << std::setw(20) << h2dPinned << std::setw(20) << d2hPinned << "\n";
+  }
+
+  hc::invalidate_host_pin_cache(host, maxBytes);
+  hc::am_free(dev);
+  hc::am_free(pinned);
+  free(host);
+
+  return 0;
+}
@@ -0,0 +1,201 @@
+// RUN: %hc %s -O3 -o %t.out
+// RUN: %t.out 16
+// RUN: %t.out 16 cpu
+
+// benchmark of std::experimental::parallel::merge, inplace_merge, includes
+// and the set operations against the std:: ones, on two sorted ranges of
+// uint32 of half the size each
+//
+// Sizes go from 16M elements (both ranges) to the max size, by powers of 4.
+// With "cpu", the default accelerator is the CPU and the algorithms run on
+// host threads.
+//
+// hcc `hcc-config --cxxflags --ldflags` bench.cpp -o bench
+// ./bench [max size in M elements] [cpu]
+
+#include "hc.hpp"
+
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define ITERATIONS 3
+
+typedef std::vector<uint32_t>::const_iterator In;
+typedef std::vector<uint32_t>::iterator Out;
+
+// sorted values in [0, range]: a small range makes many matches
+std::vector<uint32_t> sorted_values(size_t size, uint32_t range, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<uint32_t> dis(0, range);
+  std::vector<uint32_t> data(size);
+  for (auto& v : data) {
+    v = dis(gen);
+  }
+  std::sort(data.begin(), data.end());
+  return data;
+}
+
+// best rate in M elements/s (of both inputs) of ITERATIONS runs of f,
+// which returns the end of its output
+template<typename F>
+double time_op(size_t size, std::vector<uint32_t>& output, Out& end, F f) {
+  double best = 0.0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+    end = f(output.begin());
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> dur = stop - start;
+    best = std::max(best, size / dur.count() / 1e6);
+  }
+  return best;
+}
+
+void print(const std::string& name, size_t size, double seq, double parallel, bool ok) {
+  std::cout << std::setw(26) << name << std::setw(8) << size / (1024 * 1024) << "M"
+            << std::fixed << std::setprecision(1)
+            << std::setw(14) << seq << std::setw(14) << parallel
+            << std::setw(10) << parallel / seq << "x"
+            << (ok ? "" : "  MISMATCH") << "\n";
+}
+
+template<typename Seq, typename Par>
+bool bench(const std::string& name, const std::vector<uint32_t>& a,
+           const std::vector<uint32_t>& b, Seq seq, Par par) {
+  const size_t size = a.size() + b.size();
+  std::vector<uint32_t> expected(size), output(size);
+  Out expectedEnd, outputEnd;
+  const double s = time_op(size, expected, expectedEnd, [&](Out d) {
+    return seq(a.begin(), a.end(), b.begin(), b.end(), d);
+  });
+  const double p = time_op(size, output, outputEnd, [&](Out d) {
+    return par(a.begin(), a.end(), b.begin(), b.end(), d);
+  });
+  const bool ok = (expectedEnd - expected.begin() == outputEnd - output.begin()) &&
+                  std::equal(expected.begin(), expectedEnd, output.begin());
+  print(name, size, s, p, ok);
+  return ok;
+}
+
+bool bench_inplace_merge(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+  using std::experimental::parallel::par;
+
+  const size_t size = a.size() + b.size();
+  std::vector<uint32_t> input(a);
+  input.insert(input.end(), b.begin(), b.end());
+  std::vector<uint32_t> expected, output;
+  double seq = 0.0, parallel = 0.0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    expected = input;
+    auto start = std::chrono::high_resolution_clock::now();
+    std::inplace_merge(expected.begin(), expected.begin() + a.size(), expected.end());
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> dur = stop - start;
+    seq = std::max(seq, size / dur.count() / 1e6);
+
+    output = input;
+    start = std::chrono::high_resolution_clock::now();
+    std::experimental::parallel::inplace_merge(par, output.begin(), output.begin() + a.size(),
+                                               output.end());
+    stop = std::chrono::high_resolution_clock::now();
+    dur = stop - start;
+    parallel = std::max(parallel, size / dur.count() / 1e6);
+  }
+  const bool ok = (output == expected);
+  print("inplace_merge", size, seq, parallel, ok);
+  return ok;
+}
+
+bool bench_includes(const std::vector<uint32_t>& a) {
+  using std::experimental::parallel::par;
+
+  // every other element: included, so the whole ranges are walked
+  std::vector<uint32_t> half;
+  for (size_t i = 0; i < a.size(); i += 2) {
+    half.push_back(a[i]);
+  }
+  const size_t size = a.size() + half.size();
+  bool expected = false, output = false;
+  double seq = 0.0, parallel = 0.0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+    expected = std::includes(a.begin(), a.end(), half.begin(), half.end());
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> dur = stop - start;
+    seq = std::max(seq, size / dur.count() / 1e6);
+
+    start = std::chrono::high_resolution_clock::now();
+    output = std::experimental::parallel::includes(par, a.begin(), a.end(),
+                                                   half.begin(), half.end());
+    stop = std::chrono::high_resolution_clock::now();
+    dur = stop - start;
+    parallel = std::max(parallel, size / dur.count() / 1e6);
+  }
+  const bool ok = expected && output;
+  print("includes", size, seq, parallel, ok);
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  using std::experimental::parallel::par;
+  namespace parallel = std::experimental::parallel;
+
+  size_t maxSizeM = 64;
+  if (argc > 1)
+    maxSizeM = std::stoul(argv[1]);
+  if (argc > 2 && std::string(argv[2]) == "cpu")
+    hc::accelerator::set_default(L"cpu");
+
+  const std::wstring description = hc::accelerator().get_description();
+  std::cout << "accelerator: " << std::string(description.begin(), description.end()) << "\n";
+  std::cout << std::setw(26) << "algorithm" << std::setw(9) << "size"
+            << std::setw(14) << "std Melem/s" << std::setw(14) << "par Melem/s"
+            << std::setw(11) << "speedup" << "\n";
+
+  bool ret = true;
+  for (size_t size = 16 * 1024 * 1024; size <= maxSizeM * 1024 * 1024; size *= 4) {
+    // about one element in two of a matches one of b
+    const uint32_t range = static_cast<uint32_t>(size);
+    const std::vector<uint32_t> a = sorted_values(size / 2, range, unsigned(size));
+    const std::vector<uint32_t> b = sorted_values(size - size / 2, range, unsigned(size + 1));
+
+    ret &= bench("merge", a, b,
+      [](In f1, In l1, In f2, In l2, Out d) { return std::merge(f1, l1, f2, l2, d); },
+      [](In f1, In l1, In f2, In l2, Out d) { return parallel::merge(par, f1, l1, f2, l2, d); });
+    ret &= bench_inplace_merge(a, b);
+    ret &= bench_includes(a);
+    ret &= bench("set_union", a, b,
+      [](In f1, In l1, In f2, In l2, Out d) { return std::set_union(f1, l1, f2, l2, d); },
+      [](In f1, In l1, In f2, In l2, Out d) {
+        return parallel::set_union(par, f1, l1, f2, l2, d);
+      });
+    ret &= bench("set_intersection", a, b,
+      [](In f1, In l1, In f2, In l2, Out d) { return std::set_intersection(f1, l1, f2, l2, d); },
+      [](In f1, In l1, In f2, In l2, Out d) {
+        return parallel::set_intersection(par, f1, l1, f2, l2, d);
+      });
+    ret &= bench("set_difference", a, b,
+      [](In f1, In l1, In f2, In l2, Out d) { return std::set_difference(f1, l1, f2, l2, d); },
+      [](In f1, In l1, In f2, In l2, Out d) {
+        return parallel::set_difference(par, f1, l1, f2, l2, d);
+      });
+    ret &= bench("set_symmetric_difference", a, b,
+      [](In f1, In l1, In f2, In l2, Out d) {
+        return std::set_symmetric_difference(f1, l1, f2, l2, d);
+      },
+      [](In f1, In l1, In f2, In l2, Out d) {
+        return parallel::set_symmetric_difference(par, f1, l1, f2, l2, d);
+      });
+  }
+
+  return !(ret == true);
+}
@@ -0,0 +1,179 @@
+// RUN: %hc %s -O3 -o %t.out
+// RUN: %t.out 4
+// RUN: %t.out 4 cpu
+
+// benchmark of std::experimental::parallel::sort against std::sort, and of
+// sort_by_key against std::stable_sort of (key, value) records
+//
+// The keys compared with std::less or std::greater are radix sorted, the
+// others are merge sorted.  Sizes go from 1M elements to the max size, by
+// powers of 4.  With "cpu", the default accelerator is the CPU and the sorts
+// run on host threads.
+//
+// hcc `hcc-config --cxxflags --ldflags` bench.cpp -o bench
+// ./bench [max size in M elements] [cpu]
+
+#include "hc.hpp"
+
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/execution_policy>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define ITERATIONS 3
+
+struct Record {
+  uint32_t key;
+  uint32_t value;
+};
+
+// not a radix order: merge sort
+struct RecordLess {
+  bool operator()(const Record& a, const Record& b) const __CPU__ __HC__ {
+    return a.key < b.key;
+  }
+};
+
+template<typename T>
+T make_value(std::mt19937_64& gen) {
+  uint64_t bits = gen();
+  T v;
+  // keep the floating point values finite
+  if (std::is_floating_point<T>::value) {
+    return static_cast<T>(static_cast<int64_t>(bits) / 1024.0);
+  }
+  std::memcpy(&v, &bits, sizeof(T));
+  return v;
+}
+
+template<>
+Record make_value<Record>(std::mt19937_64& gen) {
+  uint64_t bits = gen();
+  return Record{static_cast<uint32_t>(bits), static_cast<uint32_t>(bits >> 32)};
+}
+
+bool same(const Record& a, const Record& b) { return a.key == b.key; }
+template<typename T>
+bool same(const T& a, const T& b) { return a == b; }
+
+// best rate in M elements/s of ITERATIONS sorts of a copy of input
+template<typename T, typename Sort>
+double time_sort(const std::vector<T>& input, std::vector<T>& output, Sort sort) {
+  double best = 0.0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    output = input;
+    auto start = std::chrono::high_resolution_clock::now();
+    sort(output);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> dur = end - start;
+    best = std::max(best, output.size() / dur.count() / 1e6);
+  }
+  return best;
+}
+
+template<typename T, typename Compare>
+bool bench(const std::string& name, size_t size, Compare comp) {
+  using std::experimental::parallel::par;
+
+  std::mt19937_64 gen(size);
+  std::vector<T> input(size), expected, output;
+  for (auto& v : input) {
+    v = make_value<T>(gen);
+  }
+
+  const double seq = time_sort(input, expected, [comp](std::vector<T>& v) {
+    std::sort(std::begin(v), std::end(v), comp);
+  });
+  const double parallel = time_sort(input, output, [comp](std::vector<T>& v) {
+    std::experimental::parallel::sort(par, std::begin(v), std::end(v), comp);
+  });
+
+  bool ok = true;
+  for (size_t i = 0; i < size; ++i) {
+    ok &= same(output[i], expected[i]);
+  }
+
+  std::cout << std::setw(16) << name << std::setw(8) << size / (1024 * 1024) << "M"
+            << std::fixed << std::setprecision(1)
+            << std::setw(14) << seq << std::setw(14) << parallel
+            << std::setw(10) << parallel / seq << "x"
+            << (ok ? "" : "  MISMATCH") << "\n";
+  return ok;
+}
+
+// sort_by_key of uint32 keys and values against std::stable_sort of records
+bool bench_by_key(size_t size) {
+  using std::experimental::parallel::par;
+
+  std::mt19937_64 gen(size);
+  std::vector<Record> records(size), expected;
+  std::vector<uint32_t> keys(size), values(size), sortedKeys, sortedValues;
+  for (size_t i = 0; i < size; ++i) {
+    records[i] = make_value<Record>(gen);
+    keys[i] = records[i].key;
+    values[i] = records[i].value;
+  }
+
+  const double seq = time_sort(records, expected, [](std::vector<Record>& v) {
+    std::stable_sort(std::begin(v), std::end(v), RecordLess());
+  });
+  double parallel = 0.0;
+  for (int i = 0; i < ITERATIONS; ++i) {
+    sortedKeys = keys;
+    sortedValues = values;
+    auto start = std::chrono::high_resolution_clock::now();
+    std::experimental::parallel::sort_by_key(par, std::begin(sortedKeys), std::end(sortedKeys),
+                                             std::begin(sortedValues));
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> dur = end - start;
+    parallel = std::max(parallel, size / dur.count() / 1e6);
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < size; ++i) {
+    ok &= (sortedKeys[i] == expected[i].key) && (sortedValues[i] == expected[i].value);
+  }
+
+  std::cout << std::setw(16) << "uint32 by key" << std::setw(8) << size / (1024 * 1024) << "M"
+            << std::fixed << std::setprecision(1)
+            << std::setw(14) << seq << std::setw(14) << parallel
+            << std::setw(10) << parallel / seq << "x"
+            << (ok ? "" : "  MISMATCH") << "\n";
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  size_t maxSizeM = 64;
+  if (argc > 1)
+    maxSizeM = std::stoul(argv[1]);
+  if (argc > 2 && std::string(argv[2]) == "cpu")
+    hc::accelerator::set_default(L"cpu");
+
+  const std::wstring description = hc::accelerator().get_description();
+  std::cout << "accelerator: " << std::string(description.begin(), description.end()) << "\n";
+  std::cout << std::setw(16) << "type" << std::setw(9) << "size"
+            << std::setw(14) << "std Melem/s" << std::setw(14) << "par Melem/s"
+            << std::setw(11) << "speedup" << "\n";
+
+  bool ret = true;
+  for (size_t size = 1024 * 1024; size <= maxSizeM * 1024 * 1024; size *= 4) {
+    ret &= bench<uint32_t>("uint32", size, std::less<uint32_t>());
+    ret &= bench<int64_t>("int64", size, std::less<int64_t>());
+    ret &= bench<float>("float", size, std::less<float>());
+    ret &= bench<double>("double >", size, std::greater<double>());
+    ret &= bench<Record>("record (merge)", size, RecordLess());
+    ret &= bench_by_key(size);
+  }
+
+  return !(ret == true);
+}